@@ -7,25 +7,28 @@
 
 // currently 21 registers are used
 
+// the context is 32 bit on every host, the generated code only ever
+// accesses dwords of it
+typedef unsigned int u32; // unsigned long is 64 bit on x64 *nix
 
 /*! Defines ARM System control context */
 struct syscontrol_context
 {
 	enum { CONTROL_DEFAULT = 0x0 };
-	unsigned long control_register;
+	u32 control_register;
 };
 
 /*! Defines an ARM CPU context */
 struct emulation_context
 {
 	enum { THUMB_BIT = (1 << 5) };
-	unsigned long regs[16]; /*! GPRs */
-	unsigned long cpsr;     /*! cpsr */
-	unsigned long spsr;     /*! spsr */
+	u32 regs[16]; /*! GPRs */
+	u32 cpsr;     /*! cpsr */
+	u32 spsr;     /*! spsr */
 
 	/*! backup of the x86 flags register the last S operation produced */
-	unsigned long x86_flags; 
-	unsigned long bpre; /* branch prefix addend for thumb mode */
+	u32 x86_flags; 
+	u32 bpre; /* branch prefix addend for thumb mode */
 	syscontrol_context syscontrol; /* system control context */
 };
 
@@ -10,6 +10,7 @@
 #include "MemMap.h"
 #include "SourceDebug.h"
 #include "jitcode.h"
+#include "CodeArena.h"
 
 // when memory fragmentation ever gets a problem use pool allocators
 // for break_data and all the maps! 
@@ -137,7 +138,7 @@ private:
 			boost::mutex::scoped_lock g(breakpoints_base<T>::dt_lock);
 			breakpoints_base<T>::dt[bi.pos] = &bi;
 		}
-		*bi.pos = DEBUG_BREAK;
+		*code_arena::writable(bi.pos) = DEBUG_BREAK;
 		bi.patched = true;
 	}
 
@@ -148,7 +149,7 @@ private:
 			return;
 		
 		// need to unpatch
-		*bi.pos = bi.original_byte;
+		*code_arena::writable(bi.pos) = bi.original_byte;
 		bi.patched = false;
 		{
 			boost::mutex::scoped_lock g(breakpoints_base<T>::dt_lock);
@@ -188,7 +189,9 @@ private:
 		if (subcode >= breakpoint_defs::MAX_SUBINSTRUCTIONS)
 			return;
 
-		char *physical = &memory_map<T>::addr2page( addr )->mem[addr & PAGING::ADDRESS_MASK];
+		memory_block *b = memory_map<T>::addr2page( addr );
+		b->executed = memory_block::HOT_STEPS; // the interpreter ignores breakpoints
+		char *physical = &b->mem[addr & PAGING::ADDRESS_MASK];
 		break_data* &bd = breaks[physical];
 		if (!bd)
 		{
@@ -384,16 +387,25 @@ public:
 			return;
 
 		unsigned long inst = (bd->addr & PAGING::ADDRESS_MASK) >> U::INSTRUCTION_SIZE_LG2;
-		char *start = code->remap[inst];
-		inst++;
-		if (inst >= compiled_block<U>::REMAPS)
-			sz = code->code_size - (start - code->code);
-		else sz = code->remap[inst] - start;
+		char *start = code->target(inst);
+		if (!start)
+		{
+			// not compiled yet, gets patched once the piece is compiled
+			bd->jit_instructions = 0;
+			for (unsigned int i = 0; i < breakpoint_defs::MAX_SUBINSTRUCTIONS; i++)
+				bd->jit_line[i].pos = 0;
+			return;
+		}
+		sz = code->slot_size(inst);
 				
 		// should lower those if possible ...
 		_DecodedInst instructions[breakpoint_defs::MAX_SUBINSTRUCTIONS_DISTORM];
 		unsigned int decoded = 0;
+#ifdef JIT_X64
+		if (distorm_decode( 0, (unsigned char*)start, (int)sz, Decode64Bits, 
+#else
 		if (distorm_decode( 0, (unsigned char*)start, (int)sz, Decode32Bits, 
+#endif
 			instructions, breakpoint_defs::MAX_SUBINSTRUCTIONS_DISTORM, &decoded ) == DECRES_SUCCESS)
 		{
 			if (decoded  > breakpoint_defs::MAX_SUBINSTRUCTIONS)
@@ -464,7 +476,9 @@ public:
 	{
 		memory_block *b = memory_map<T>::addr2page(addr);
 		compiled_block<U> *j = b->get_jit<T,U>();
-		if (!j)
+		unsigned long saddr = addr & PAGING::ADDRESS_MASK;
+		unsigned long entry = saddr >> U::INSTRUCTION_SIZE_LG2;
+		if (!j || !j->compiled(entry))
 		{
 			jit.data = 0;
 			jit.original = 0;
@@ -472,15 +486,10 @@ public:
 			return;
 		} else
 		{
-			unsigned long saddr = addr & PAGING::ADDRESS_MASK;
-			unsigned long entry = saddr >> U::INSTRUCTION_SIZE_LG2;
-			char *code = j->remap[entry];
+			char *code = j->target(entry);
 			jit.original = code;
 
-			size_t code_size;
-			if (entry < compiled_block<U>::REMAPS - 1)
-				code_size = j->remap[entry+1] - code;
-			else code_size = (j->code_size - 0) - (code - j->code);
+			size_t code_size = j->slot_size(entry);
 			jit.len  = (unsigned long)code_size;
 
 			// final step: check if theres a break on the address
@@ -0,0 +1,124 @@
+#include <assert.h>
+#include "CodeArena.h"
+#include "Namespaces.h"
+#include "Logging.h"
+#include "osdep.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+boost::mutex code_arena::lock;
+code_arena::region code_arena::regions[code_arena::MAX_REGIONS];
+volatile int code_arena::num_regions = 0;
+code_arena::free_node* code_arena::free_lists[code_arena::NUM_CLASSES];
+
+#ifdef WIN32
+
+bool code_arena::map_region(region &r)
+{
+#ifdef JIT_DUAL_MAPPING
+	HANDLE h = CreateFileMapping( INVALID_HANDLE_VALUE, 0, PAGE_EXECUTE_READWRITE,
+		0, REGION_SIZE, 0 );
+	if (h)
+	{
+		r.write = (char*)MapViewOfFile( h, FILE_MAP_WRITE, 0, 0, REGION_SIZE );
+		r.exec  = (char*)MapViewOfFile( h, FILE_MAP_READ | FILE_MAP_EXECUTE, 0, 0, REGION_SIZE );
+		CloseHandle( h ); // the views keep the mapping alive
+		if (r.write && r.exec)
+			return true;
+		if (r.write)
+			UnmapViewOfFile( r.write );
+		if (r.exec)
+			UnmapViewOfFile( r.exec );
+	}
+	logging<_DEFAULT>::log("Dual mapping JIT memory failed, falling back to RWX");
+#endif
+	r.exec = (char*)VirtualAlloc( 0, REGION_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE );
+	r.write = r.exec;
+	return r.exec != 0;
+}
+
+#else
+
+bool code_arena::map_region(region &r)
+{
+#if defined(JIT_DUAL_MAPPING) && defined(SYS_memfd_create)
+	int fd = (int)syscall( SYS_memfd_create, "ndse-jit", 0 );
+	if (fd >= 0)
+	{
+		if (ftruncate( fd, REGION_SIZE ) == 0)
+		{
+			r.write = (char*)mmap( 0, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+			r.exec  = (char*)mmap( 0, REGION_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0 );
+			close( fd ); // the mappings keep the file alive
+			if ((r.write != MAP_FAILED) && (r.exec != MAP_FAILED))
+				return true;
+			if (r.write != MAP_FAILED)
+				munmap( r.write, REGION_SIZE );
+			if (r.exec != MAP_FAILED)
+				munmap( r.exec, REGION_SIZE );
+		} else close( fd );
+	}
+	logging<_DEFAULT>::log("Dual mapping JIT memory failed, falling back to RWX");
+#endif
+	r.exec = (char*)mmap( 0, REGION_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if (r.exec == MAP_FAILED)
+		return false;
+	r.write = r.exec;
+	return true;
+}
+
+#endif
+
+char* code_arena::allocate(size_t size)
+{
+	size_t c = size_class( size );
+	if (c >= NUM_CLASSES)
+		return 0; // the compiler splits the piece
+
+	boost::mutex::scoped_lock g(lock);
+
+	// reuse a freed block of the same class
+	free_node *n = free_lists[c];
+	if (n)
+	{
+		free_lists[c] = ((free_node*)writable((char*)n))->next;
+		return (char*)n;
+	}
+
+	// bump allocate from the newest region
+	size = c << GRANULARITY_BITS;
+	if ((num_regions == 0) || (regions[num_regions-1].used + size > REGION_SIZE))
+	{
+		if (num_regions == MAX_REGIONS)
+		{
+			logging<_DEFAULT>::log("Out of JIT memory");
+			return 0;
+		}
+		region &r = regions[num_regions];
+		if (!map_region( r ))
+		{
+			logging<_DEFAULT>::log("Failed to allocate JIT memory");
+			return 0;
+		}
+		r.used = 0;
+		num_regions = num_regions + 1; // publish after the region is valid
+	}
+	region &r = regions[num_regions-1];
+	char *code = r.exec + r.used;
+	r.used += size;
+	return code;
+}
+
+void code_arena::release(char *code, size_t size)
+{
+	if (!code)
+		return;
+	size_t c = size_class( size );
+	boost::mutex::scoped_lock g(lock);
+	((free_node*)writable(code))->next = free_lists[c];
+	free_lists[c] = (free_node*)code;
+}
@@ -0,0 +1,75 @@
+#ifndef _CODEARENA_H_
+#define _CODEARENA_H_
+
+// executable memory for compiled blocks
+// code is carved out of large regions, so allocating a block neither
+// touches the heap nor needs a mprotect call per block and blocks stay
+// close together. regions are never unmapped, freed blocks go back to
+// the free list of their size class
+//
+// with JIT_DUAL_MAPPING each region is mapped twice, once RX for
+// execution and once RW for writing (W^X)
+// everything that patches compiled code has to go through writable()
+//#define JIT_DUAL_MAPPING
+
+#include <cstring>
+#include <boost/thread.hpp>
+
+class code_arena
+{
+public:
+	enum { REGION_SIZE      = 16 * 1024 * 1024 };
+	enum { MAX_REGIONS      = 64 };
+	enum { GRANULARITY_BITS = 6 };
+	enum { GRANULARITY      = 1 << GRANULARITY_BITS };
+	enum { MAX_CLASS_SIZE   = 64 * 1024 }; // largest block the emitter can produce
+	enum { NUM_CLASSES      = (MAX_CLASS_SIZE >> GRANULARITY_BITS) + 1 };
+
+private:
+	struct region
+	{
+		char *exec;  // mapping the code runs from
+		char *write; // mapping the code gets written to (same as exec if not dual mapped)
+		size_t used;
+	};
+	struct free_node
+	{
+		free_node *next;
+	};
+
+	static boost::mutex lock;
+	static region regions[MAX_REGIONS];
+	static volatile int num_regions;
+	static free_node* free_lists[NUM_CLASSES]; // freed blocks per size class
+
+	static bool map_region(region &r);
+
+	static size_t size_class(size_t size)
+	{
+		return (size + GRANULARITY - 1) >> GRANULARITY_BITS;
+	}
+
+public:
+	// returns executable memory for size bytes of code
+	// or 0 if size exceeds the largest class or no memory is left
+	static char* allocate(size_t size);
+	// gives a block back to its size class
+	static void release(char *code, size_t size);
+
+	// translates an executable address to the address code can be written to
+	static char* writable(char *code)
+	{
+#ifdef JIT_DUAL_MAPPING
+		int n = num_regions;
+		for (int i = 0; i < n; i++)
+		{
+			size_t off = code - regions[i].exec;
+			if (off < REGION_SIZE)
+				return regions[i].write + off;
+		}
+#endif
+		return code;
+	}
+};
+
+#endif
@@ -1,20 +1,243 @@
 #ifndef _COMPILEDBLOCK_H_
 #define _COMPILEDBLOCK_H_
 
-// instances of compiled_block could be pool allocated
-// if vmem fragmentation should stay lower
+// instances of compiled_block are allocated from block_pool
 
 #include <cstring>
+#include <list>
+#include <vector>
 #include "Mem.h"
+#include "CodeArena.h"
+
+// a direct jump from one compiled block into another one
+// see compiler::link_branch for the layout of the patched site
+struct block_link
+{
+	typedef std::list<block_link*> list;
+	char *site;                 // start of the jump site in the source code
+	compiled_block_links *from; // block containing the site
+	compiled_block_links *to;   // block the site is linked to (0 = unlinked)
+	list::iterator pos;         // entry inside to->incoming
+};
+
+// keeps track of the direct jumps leading into and out of a block
+// so they can be unlinked when a block is recompiled or deleted
+struct compiled_block_links
+{
+	block_link::list incoming;        // sites jumping into this block
+	std::vector<block_link*> outgoing; // sites owned by this block
+
+	// increased each time a block is deleted, used to detect
+	// that a site vanished while its destination got resolved
+	// (interlocked, prefetch workers delete blocks they could not publish)
+	static volatile unsigned long generation;
+
+	void unlink_incoming();
+	~compiled_block_links();
+};
+
+// shadow return stack kept by the compiled code
+// calls push the return address along with the landing pad emitted behind
+// them, returns matching the top entry jump to that pad rather than
+// resolving the address (see compiler::push_return and jmp_return).
+// the pad is a jump site to the return address, so it checks the
+// destination just like any other linked branch
+struct return_stack
+{
+	enum { DEPTH = 16 };
+	enum { MAX_STACKS = 2 }; // one per cpu
+	struct entry
+	{
+		char *pad;          // landing pad inside the calling block
+		unsigned long addr; // ARM return address (thumb bit included)
+	};
+	enum { MASK = DEPTH * sizeof(entry) - 1 };
+
+	entry entries[DEPTH];
+	unsigned long top; // byte offset of the top entry
+	char *miss;        // pad of dropped entries, resolves the address
+
+	void init(char *lookup);
+
+	// points the entries with their pad inside code about to be released
+	// to the lookup instead
+	static void drop(const char *code, size_t size);
+
+private:
+	static return_stack *stacks[MAX_STACKS];
+	static int num_stacks;
+};
+
+// fixed size allocations for the compiled blocks
+// carved out of chunks of CHUNK_BLOCKS blocks, freed blocks are kept on a
+// list per size rather than going back to the heap. the chunks are never
+// released (prefetch workers allocate as well, hence the lock)
+class block_pool
+{
+public:
+	enum { CHUNK_BLOCKS = 64 };
+	enum { MAX_SIZES = 4 }; // compiled_block<IS_ARM> and <IS_THUMB> so far
+
+	static void* allocate(size_t size);
+	static void release(void *p, size_t size);
+
+private:
+	struct free_node
+	{
+		free_node *next;
+	};
+	struct size_class
+	{
+		size_t size;
+		free_node *free;
+	};
+	static boost::mutex lock;
+	static size_class classes[MAX_SIZES];
+	static int num_classes;
+	static size_class& get(size_t size);
+};
+
+// further code of a block compiled for a later entry point
+struct code_piece
+{
+	char *code;
+	size_t size;
+	code_piece(char *c, size_t s): code(c), size(s) {}
+};
 
 template <typename T>
-struct compiled_block_base
+struct compiled_block_base: public compiled_block_links
 {
 	enum { REMAPS = PAGING::INST<T>::NUM };
-	char *code;             // compiled code
+	// blocks start compiled by the quick baseline tier and get compiled
+	// again by the optimizing one after HOT_BRANCHES branches through
+	// their link sites (see compiler::count_branch)
+	enum { HOT_BRANCHES = 2048 };
+	// remap holds offsets into the piece the code of an instruction is in,
+	// pieces never exceed emitter::CAPACITY (0xFFFF bytes), so every
+	// instruction starts below UNMAPPED
+	enum { UNMAPPED = 0xFFFF };
+	char *code;             // compiled code (first piece)
 	size_t code_size;       // size of compiled code
+	std::vector<code_piece> pieces; // pieces compiled after the first one
+	std::vector<unsigned long> exits; // page relative targets of the pieces outside the page
 	memory_block *block;
-	char *remap[REMAPS]; // remapping from ARM address to compiled code
+	int cached_reg;         // ARM register kept in edi by the code (-1 = none)
+	bool optimized;         // compiled by the optimizing tier
+	int heat;               // branches the baseline code takes until it is hot (32 bit, see count_branch)
+	block_link *page_exit;  // site falling through to the next page (0 = none)
+	memory_block *trace_page; // next page the code continues into (0 = none, see compiler::emit_trace)
+	unsigned long trace_addr; // ARM address of trace_page
+	bool breaks_pending;    // published by a prefetch worker, breakpoints not adjusted yet
+	unsigned short remap[REMAPS];      // code offset of each instruction (UNMAPPED = not compiled yet)
+	unsigned char remap_piece[REMAPS]; // piece the offset is into (0 = code, n = pieces[n - 1])
+
+	static void* operator new(size_t size)
+	{
+		return block_pool::allocate( size );
+	}
+
+	static void operator delete(void *p, size_t size)
+	{
+		block_pool::release( p, size );
+	}
+
+	// returns the number of the piece for remap_piece
+	// every piece holds at least one instruction, so they fit a byte
+	unsigned int add_piece(char *c, size_t size)
+	{
+		if (!code)
+		{
+			code = c;
+			code_size = size;
+			return 0;
+		}
+		pieces.push_back( code_piece( c, size ) );
+		return (unsigned int)pieces.size();
+	}
+
+	char* piece_code(unsigned int n) const
+	{
+		return n ? pieces[n - 1].code : code;
+	}
+
+	size_t piece_size(unsigned int n) const
+	{
+		return n ? pieces[n - 1].size : code_size;
+	}
+
+	bool compiled(unsigned int i) const
+	{
+		return remap[i] != UNMAPPED;
+	}
+
+	// code of instruction i (0 = not compiled yet)
+	char* target(unsigned int i) const
+	{
+		if (remap[i] == UNMAPPED)
+			return 0;
+		return piece_code( remap_piece[i] ) + remap[i];
+	}
+
+	// number of the piece of code containing ip (-1 if none)
+	int piece_of(const char *ip) const
+	{
+		if (!code)
+			return -1;
+		for (unsigned int n = 0; n <= pieces.size(); n++)
+		{
+			const char *c = piece_code( n );
+			if ((ip >= c) && (ip < c + piece_size( n )))
+				return (int)n;
+		}
+		return -1;
+	}
+
+	// finds the piece of code containing ip
+	bool find_piece(const char *ip, const char* &start, const char* &end) const
+	{
+		int n = piece_of( ip );
+		if (n < 0)
+			return false;
+		start = piece_code( n );
+		end = start + piece_size( n );
+		return true;
+	}
+
+	bool contains(const char *ip) const
+	{
+		const char *s, *e;
+		return find_piece( ip, s, e );
+	}
+
+	// instruction whose code contains ip (-1 if none)
+	int slot_of(const char *ip) const
+	{
+		int n = piece_of( ip );
+		if (n < 0)
+			return -1;
+		size_t off = ip - piece_code( n );
+		int slot = -1;
+		for (int i = 0; i < REMAPS; i++)
+			if (compiled( i ) && (remap_piece[i] == n) && (remap[i] <= off) && 
+				((slot < 0) || (remap[i] >= remap[slot])))
+				slot = i;
+		return slot;
+	}
+
+	// bytes of code emitted for instruction i
+	// the last instruction of a piece includes its epilogue
+	size_t slot_size(int i) const
+	{
+		if (!compiled( i ))
+			return 0;
+		unsigned int n = remap_piece[i];
+		size_t e = piece_size( n );
+		for (int j = 0; j < REMAPS; j++)
+			if (compiled( j ) && (remap_piece[j] == n) && (remap[j] > remap[i]) && (remap[j] < e))
+				e = remap[j];
+		return e - remap[i];
+	}
 };
 
 #endif
@@ -10,10 +10,8 @@
 #include "HLE.h"
 
 #include "osdep.h"
+#include "CodeArena.h"
 
-#ifdef HLE_CORE
-#include "HLCore.h"
-#endif
 
 
 
@@ -24,13 +22,15 @@
 ////////////////////////////////////////////////////////////////////////////////
 // IMPORTANT BUGS
 // flag prediction:
-// the lookahead optimizer will remove flag updates if the follow up instruction
-// would overwrite the flag.
+// the liveness pass in compile() removes flag updates if the flags get
+// overwritten before any instruction of the piece reads them.
 // in a similiar fashion it removes restores when a consuming instruction
 // follows straight after a producing instruction.
 //
 // A problem that can arise with that is when some branch goes to a consuming 
-// instruction (this should be handled within the branch HLE for performance!)
+// instruction. Static branches within the page are known and reload the
+// flags, computed ones are not (this should be handled within the branch 
+// HLE for performance!)
 //
 // A second problem is 2 instruction branches in thumb mode beeing on different
 // pages .
@@ -48,44 +48,385 @@
 */
 
 ////////////////////////////////////////////////////////////////////////////////
-// TODO: sometime in the future
+// Block linking
 //
-// some more performant way would be using immediate calls
-// and jumps between codeblocks.
-// however this would require that each block holds information
-// about all all jump/call instructions to it, so they can be
-// relocated.
-// recompiling a page would relocate all those jumps
+// Branches with a destination known at compile time (B, BL, BLX_I and the
+// fallthrough at the end of a page) emit a jump site (see link_branch)
+// rather than an unconditional jump to compile_and_link_branch_a.
+// The first time a site is taken it is resolved through
+// compile_and_link_branch_l which patches it to jump directly into the
+// remap entry of the destination block.
+// Each block holds a list of all sites jumping into it, recompiling or
+// deleting a block unlinks those again.
 //
-// Advantages => no more page / destination lookups
-//            => no more indirect jumps
-// Disadv     => could break emulation in such a scenario:
-//               code gets executed at an address and a mirrored address
-//               however the relative jump out could go to different
-//               locations
-//               => this needs extra work
+// A linked site still checks
+//   => pending interrupts (so polling is not skipped)
+//   => the ARM destination, since a page can be executed at mirrored
+//      addresses that lead to different relative destinations
+//   => the dirty flag of the destination code (cpu and instruction set)
+// and falls back to the lookup if any of those fail.
 //
 // Memory accesses could be optimized the same way
+//
+// Returns (BX LR, MOV PC,LR and LDM with PC) cannot be linked, as their
+// destination is only known at runtime. Calls therefore push the return
+// address and the code right behind them onto a small shadow return stack
+// (see return_stack), which is a jump site to the return address again.
+// A return checks the top entry and jumps to that pad if the address
+// matches, so a correctly predicted return costs a compare and the checks
+// of the site. Entries with their pad in released code are pointed back to
+// compile_and_link_branch_a.
+//
+// Other indirect branches (BX/BLX Rm, writes to PC) emit an inline cache of
+// IC_WAYS sites in a row instead (see jmp_indirect). All but the last one
+// resolve through compile_and_link_branch_c, which chains the address check
+// of a linked way to the next one. So the first ways keep the targets they
+// got linked to first, and the last one is relinked on every miss.
+// Unlinking a way restores its check, the ways are invalidated like any
+// other site.
+//
+// Code falling through the end of its page always passes the site of the
+// epilogue. When a baseline block turns hot and that site got linked, the
+// optimizing tier continues the piece with the code of the linked page
+// (see emit_trace), guarded by the address and its dirty flag. The next
+// page records the block, any recompile of it dirties the block as well.
+
+////////////////////////////////////////////////////////////////////////////////
+// Host register caching
+//
+// edi is not used otherwise, so the ARM register referenced most often
+// within a page is kept in it (compiled_block::cached_reg).
+// All register accesses go through reg_op which addresses edi instead of
+// the context for that register.
+// Every entry into a block loads edi (see link_branch and the HLE branch
+// stubs), and it is written back before leaving the block or calling out.
+// Calls that can touch the register set (loadcpsr, swi, ...) reload edi.
+//
+// The dirty state is only tracked linearly, so once the cached register got
+// written all later exits of the page spill it. Jumps inside an instruction
+// could otherwise skip a spill the compiler already accounted for.
 
 char NOT_SUPPORTED_YET_BUT_SKIP = '\x90';
 
-#define WRITE_P(p) { void *x = p; s.write((char*)&x, sizeof(x)); }
+#define WRITE_P(p) { s.ptr(p); }
 #define OFFSET(z) ((char*)&__context_helper.z - (char*)&__context_helper)
 // need to find a better way to do calls ...
-#define CALL(f) { s << '\xE8'; reloc_table.push_back(s.tellp());\
-	char *x = (char*)&f; x -= 4; s.write((char*)&x, sizeof(x)); }
-#define CALLP(f) { s << '\xE8'; reloc_table.push_back(s.tellp());\
-	char *x = (char*)f; x -= 4; s.write((char*)&x, sizeof(x)); }
-#define JMP(f) { s << '\xE9'; reloc_table.push_back(s.tellp());\
-	char *x = (char*)&f; x -= 4; s.write((char*)&x, sizeof(x)); }
-#define JMPP(f) { s << '\xE9'; reloc_table.push_back(s.tellp());\
-	char *x = (char*)f; x -= 4; s.write((char*)&x, sizeof(x)); }
+#define CALL(f)  { call( (void*)&f ); }
+#define CALLP(f) { call( (void*)f ); }
+#define JMP(f)   { jmp( (void*)&f ); }
+#define JMPP(f)  { jmp( (void*)f ); }
 static emulation_context __context_helper; // temporary for OFFSET calculation
+static memory_block __block_helper;         // temporary for BLOCK_OFFSET calculation
+#define BLOCK_OFFSET(z) ((char*)&__block_helper.z - (char*)&__block_helper)
 #define RECORD_CALLSTACK CALL
 
-template <typename T> void write(std::ostream &s, const T &t)
+// a linked site tests this when unlinked, so it always takes the slow path
+unsigned long compiler::unlinked_flags = 0xFFFFFFFF;
+volatile unsigned long compiled_block_links::generation = 0;
+return_stack *return_stack::stacks[return_stack::MAX_STACKS];
+int return_stack::num_stacks = 0;
+
+template <typename T> void write(emitter &s, const T &t)
+{
+	s.put(t);
+}
+
+// immediates stay 32 bit on LP64 hosts
+void write(emitter &s, unsigned long t)
+{
+	s.imm32(t);
+}
+
+void write(emitter &s, long t)
+{
+	s.imm32(t);
+}
+
+// counts the ARM registers an instruction references
+// walks the disassembly string just like the HLE core does
+void compiler::count_reg_uses(const disassembler::context &c, unsigned long *uses)
+{
+	const char *p = INST::strings[c.instruction];
+	while (*p)
+	{
+		if (*p++ != '%')
+			continue;
+		char f = *p;
+		if (!f)
+			break;
+		p++;
+		if ((f == 'C') && (*p == 'R')) // coprocessor transfer register
+			f = *p++;
+		if (f != 'R')
+			continue;
+		switch (*p)
+		{
+		case 'd': uses[c.rd & 0xF]++; break;
+		case 'n': uses[c.rn & 0xF]++; break;
+		case 'm': uses[c.rm & 0xF]++; break;
+		case 's': uses[c.rs & 0xF]++; break;
+		case 'L':
+			for (int i = 0; i < 16; i++)
+				if (c.imm & (1 << i))
+					uses[i]++;
+			break;
+		default:
+			continue;
+		}
+		p++;
+	}
+}
+
+int compiler::choose_cached_reg(const unsigned long *uses)
+{
+	// R15 is never cached, it gets updated by the branch code
+	int best = -1;
+	unsigned long most = MIN_CACHED_USES - 1;
+	for (int i = 0; i < 15; i++)
+	{
+		if (uses[i] > most)
+		{
+			most = uses[i];
+			best = i;
+		}
+	}
+	return best;
+}
+
+// whether an op/r (as passed to reg_op) writes to its r/m operand
+bool compiler::writes_rm(const char *op, int r)
+{
+	switch ((unsigned char)op[0])
+	{
+	case 0x03: case 0x0B: case 0x13: case 0x1B: // add/or/adc/sbb reg, r/m
+	case 0x23: case 0x2B: case 0x33: case 0x3B: // and/sub/xor/cmp reg, r/m
+	case 0x39: case 0x85: case 0x8B: case 0x0F: // cmp r/m, reg / test / mov reg, r/m
+		return false;
+	case 0x81:
+	case 0x83:
+		return r != 7; // cmp r/m, imm
+	case 0xF7:
+		return (r == 2) || (r == 3); // not/neg, the others are test/mul/div
+	case 0xFF:
+		return r != 6; // push r/m
+	}
+	return true;
+}
+
+// emits op with register r (or an opcode extension) and ARM register n
+// as r/m operand
+void compiler::reg_op(const char *op, int r, int n)
+{
+	if (n == cached_reg)
+	{
+		s.rex( false, r, emitter::CACHE );
+		s << op;
+		s.modrm( 3, r, emitter::CACHE );
+		if (writes_rm(op, r))
+			cache_dirty = true;
+	} else
+	{
+		s << op;
+		s.mem( r, emitter::EBP, OFFSET(regs[n]) );
+	}
+}
+
+// push/pop an ARM register through the stack
+// x86-64 only pushes qwords, these go through r11 there so the upper half
+// is zero and the context field following the register stays intact
+void compiler::push_reg(int n)
+{
+#ifdef JIT_X64
+	if (n != cached_reg)
+	{
+		s.mov_r_m( emitter::R11, emitter::EBP, OFFSET(regs[n]) ); // mov r11d, [rbp+Rn]
+		s << "\x41\x53";                                         // push r11
+		return;
+	}
+#endif
+	reg_op( "\xFF", 6, n ); // push dword ptr[ebp+Rn]
+}
+
+void compiler::pop_reg(int n)
+{
+#ifdef JIT_X64
+	s << "\x41\x5B"; // pop r11
+	if (n == cached_reg)
+	{
+		s.mov_r_r( (emitter::reg)emitter::CACHE, emitter::R11 );  // mov r12d, r11d
+		cache_dirty = true;
+	} else s.mov_m_r( emitter::EBP, OFFSET(regs[n]), emitter::R11 ); // mov [rbp+Rn], r11d
+#else
+	reg_op( "\x8F", 0, n ); // pop dword ptr[ebp+Rn]
+#endif
+}
+
+void compiler::spill()
+{
+	if (cache_dirty)
+		s.mov_m_r( emitter::EBP, OFFSET(regs[cached_reg]), (emitter::reg)emitter::CACHE ); // mov [ebp+Rc], edi
+}
+
+void compiler::reload()
+{
+	if (cached_reg >= 0)
+		s.mov_r_m( (emitter::reg)emitter::CACHE, emitter::EBP, OFFSET(regs[cached_reg]) ); // mov edi, [ebp+Rc]
+}
+
+// calls f with the fastcall arguments in ecx, edx (and r8 for a third one)
+//
+// x86-64 passes them in edi, esi, rdx instead and does not preserve esi,
+// the stack also has to be 16 byte aligned there. r13 and r14 are callee
+// saved and not used otherwise by the generated code
+void compiler::host_call(void *f, bool arg3)
+{
+#ifdef JIT_X64
+	s << "\x49\x89\xF6";     // mov r14, rsi
+	s << "\x89\xCF";         // mov edi, ecx
+	s << "\x89\xD6";         // mov esi, edx
+	if (arg3)
+		s << "\x4C\x89\xC2"; // mov rdx, r8
+	s << "\x49\x89\xE5";     // mov r13, rsp
+	s << "\x48\x83\xE4\xF0"; // and rsp, -16
+	s.call( f );
+	s << "\x4C\x89\xEC";     // mov rsp, r13
+	s << "\x4C\x89\xF6";     // mov rsi, r14
+#else
+	s.call( f );
+#endif
+}
+
+// ebp = eax, for calls returning a (possibly swapped) register set
+void compiler::load_context_eax()
+{
+#ifdef JIT_X64
+	s << "\x48\x8B\xE8";                            // mov rbp, rax
+#else
+	s << "\x8B\xE8";                                // mov ebp, eax
+#endif
+}
+
+void compiler::call(void *f)
 {
-	s.write((char*)&t, sizeof(t));
+	if (inline_access( f ))
+		return;
+	call_stack( f, 0 );
+}
+
+// emits the memory accessor f (address in ecx, value in edx) inline
+// pages without access handler or protection are accessed directly,
+// anything else still goes through the HLE function
+// returns false if f is no accessor handled here
+bool compiler::inline_access(void *f)
+{
+	unsigned long mask = memory_block::PAGE_INVALID | memory_block::PAGE_ACCESSHANDLER;
+	unsigned long align;
+	bool store = (f == store32) || (f == store16) || (f == store8);
+	if ((f == load32) || (f == store32))
+		align = ~3;
+	else if ((f == load16u) || (f == load16s) || (f == store16))
+		align = ~1;
+	else if ((f == load8u) || (f == store8))
+		align = ~0;
+	else return false;
+#ifdef DEBUGGING
+	if (store)
+		return false; // keep DEBUG_STORE working
+#endif
+	// stores into pages holding compiled code take the slow path, which
+	// checks the code maps to see if any code has to be recompiled
+	if (store)
+		mask |= memory_block::PAGE_WRITEPROT | memory_block::PAGE_CODE;
+	else mask |= memory_block::PAGE_READPROT;
+	if (f == store8)
+		mask |= memory_block::PAGE_WRITEPROT8;
+
+	// eax = page of the address
+	s.mov_r_r( emitter::EAX, emitter::ECX );                       // mov eax, ecx
+	s << "\xC1\xE8" << (char)PAGING::SIZE_BITS;                   // shr eax, SIZE_BITS
+#ifdef JIT_X64
+	s.mov_r_p( emitter::R11, mem_pages );                          // mov r11, pages
+	s << "\x49\x8B\x04\xC3";                                       // mov rax, [r11+rax*8]
+#else
+	s << "\x8B\x04\x85"; WRITE_P(mem_pages);                       // mov eax, [eax*4+pages]
+#endif
+	s << '\xF7'; s.mem( 0, emitter::EAX, BLOCK_OFFSET(flags) );
+	write( s, mask );                                              // test [eax+flags], mask
+	size_t fast = s.jcc8( 4 );                                     // jz fast
+	call_stack( f, 0 );
+	s << '\xEB';                                                   // jmp done
+	size_t done = s.tellp();
+	s << '\0';
+	bool ok = s.patch8( fast );
+
+	// fast:
+	const long mem = BLOCK_OFFSET(mem);
+	if (f == load32)
+	{
+		// misaligned loads rotate the word, cl only uses the low 5 bits
+		s.mov_r_r( emitter::EDX, emitter::ECX );                   // mov edx, ecx
+		s << "\x81\xE2"; write( s, PAGING::ADDRESS_MASK & align ); // and edx, offset mask
+		s << '\x8B'; s.mem( emitter::EAX, emitter::EAX, emitter::EDX, mem ); // mov eax, [eax+edx+mem]
+		s << "\xC1\xE1\x03";                                       // shl ecx, 3
+		s << "\xD3\xC8";                                           // ror eax, cl
+	} else
+	{
+		s << "\x81\xE1"; write( s, PAGING::ADDRESS_MASK & align ); // and ecx, offset mask
+		if (f == load16u)
+		{
+			s << "\x0F\xB7"; s.mem( emitter::EAX, emitter::EAX, emitter::ECX, mem ); // movzx eax, word [eax+ecx+mem]
+		} else if (f == load16s)
+		{
+			s << "\x0F\xBF"; s.mem( emitter::EAX, emitter::EAX, emitter::ECX, mem ); // movsx eax, word [eax+ecx+mem]
+		} else if (f == load8u)
+		{
+			s << "\x0F\xB6"; s.mem( emitter::EAX, emitter::EAX, emitter::ECX, mem ); // movzx eax, byte [eax+ecx+mem]
+		} else
+		{
+			if (f == store16)
+				s << '\x66';
+			s << ((f == store8) ? '\x88' : '\x89');
+			s.mem( emitter::EDX, emitter::EAX, emitter::ECX, mem ); // mov [eax+ecx+mem], edx/dx/dl
+			s << "\xF0\x81"; s.mem( 1, emitter::EAX, BLOCK_OFFSET(flags) );
+			write( s, (unsigned long)(memory_block::PAGE_DIRTY & ~memory_block::PAGE_DIRTY_CODE) ); // lock or [eax+flags], data dirty
+		}
+	}
+	ok = s.patch8( done ) && ok;
+	assert(ok);
+	return true;
+}
+
+// calls a cdecl function with args arguments pushed to the stack
+// the first one pushed last, as in push data / push num / push addr
+void compiler::call_stack(void *f, int args)
+{
+#ifdef JIT_X64
+	// x86-64 takes them in registers
+	assert(args <= 3);
+	if (args > 0) s << '\x59';     // pop rcx
+	if (args > 1) s << '\x5A';     // pop rdx
+	if (args > 2) s << "\x41\x58"; // pop r8
+#endif
+	spill();
+	host_call( f, args > 2 );
+#ifndef JIT_X64
+	s.add_sp( args );              // add esp, args*4
+#endif
+	// memory accessors preserve edi and leave the register set alone
+	if ((f == load32) || (f == load16u) || (f == load16s) || (f == load8u) ||
+		(f == store32) || (f == store16) || (f == store8) || (f == store32_array) ||
+		(f == pushcallstack) || (f == popcallstack) || (f == storecpsr) ||
+		(f == remap_tcm) || (f == idle_hook))
+		return;
+	reload();
+}
+
+// the branch stubs take ecx/edx on both hosts and translate the
+// arguments themselves (see HLE<T>::init)
+void compiler::jmp(void *f)
+{
+	spill();
+	s.jmp( f );
 }
 
 void compiler::store_carry()
@@ -163,18 +504,40 @@ void compiler::load_shifter_imm()
 }
 
 
+// the store is deferred while the following instructions only consume
+// the flags from EFLAGS (see keeps_flags), the last of them stores them
+// if they are still read afterwards
 void compiler::store_flags()
 {
 	flags_updated = 1;
-	if (lookahead_s) // next instruction would overwrite
+	if (flags_dead) // overwritten before being read
 		return;
+	if (next_keeps_flags && (ctx.rd != 15))
+	{
+		flags_pending = true;
+		return;
+	}
+	save_flags();
+
+	//s << '\x9C';                                // pushfd
+	//s << "\x8F\x45" << (char)OFFSET(x86_flags); // pop [ebp+x86_flags]
+}
+
+// stores the flags held in EFLAGS behind an instruction that kept them
+void compiler::flush_flags()
+{
+	if (!flags_pending || next_keeps_flags)
+		return;
+	flags_pending = false;
+	if (flags_live_out)
+		save_flags();
+}
 
+void compiler::save_flags()
+{
 	s << "\x0F\x90\xC0";                        // seto al
 	s << '\x9F';                                // lahf
 	s << "\x89\x45" << (char)OFFSET(x86_flags); // mov [ebp+x86_flags], eax
-
-	//s << '\x9C';                                // pushfd
-	//s << "\x8F\x45" << (char)OFFSET(x86_flags); // pop [ebp+x86_flags]
 }
 
 void compiler::load_flags()
@@ -195,12 +558,12 @@ void compiler::update_dest(int size)
 	{
 	case ADDRESSING_MODE::DA:
 	case ADDRESSING_MODE::DB:
-		s << "\x83\x6D" << (char)OFFSET(regs[ctx.rn]); // sub dword ptr[ebp+Rn],
+		reg_op( "\x83", 5, ctx.rn ); // sub dword ptr[ebp+Rn],
 		s << (char)(size << 2);                        // size*4
 		break;
 	case ADDRESSING_MODE::IA:
 	case ADDRESSING_MODE::IB:
-		s << "\x83\x45" << (char)OFFSET(regs[ctx.rn]); // add dword ptr[ebp+Rn],
+		reg_op( "\x83", 0, ctx.rn ); // add dword ptr[ebp+Rn],
 		s << (char)(size << 2);                        // size*4
 		break;
 	}
@@ -244,7 +607,7 @@ void compiler::count(unsigned long imm,
 // one register to be stored/loaded
 void compiler::load_ecx_single()
 {
-	s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]);  // mov ecx, dword ptr [ebp+Rn] 
+	reg_op( "\x8B", emitter::ECX, ctx.rn );  // mov ecx, dword ptr [ebp+Rn] 
 	switch (ctx.addressing_mode)
 	{
 	case ADDRESSING_MODE::DA: break; // start at Rn - 1*4 + 4 = Rn
@@ -264,20 +627,20 @@ void compiler::push_multiple(int num)
 	switch (ctx.addressing_mode)
 	{
 	case ADDRESSING_MODE::IA: // start at Rn
-		s << "\xFF\x75" << (char)OFFSET(regs[ctx.rn]); // push dword ptr[ebp+Rn]
+		push_reg( ctx.rn ); // push dword ptr[ebp+Rn]
 		break;
 	case ADDRESSING_MODE::IB: // start at Rn+4
-		s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]); // mov ecx, dword ptr[ebp+Rn]
+		reg_op( "\x8B", emitter::ECX, ctx.rn ); // mov ecx, dword ptr[ebp+Rn]
 		s << "\x83\xC1\x04";                           // add ecx, 4
 		s << "\x51";                                   // push ecx
 		break;
 	case ADDRESSING_MODE::DA: // start at Rn - num*4 + 4, num >= 1
-		s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]); // mov ecx, dword ptr[ebp+Rn]
+		reg_op( "\x8B", emitter::ECX, ctx.rn ); // mov ecx, dword ptr[ebp+Rn]
 		s << "\x83\xE9" << (char)((num-1) << 2);       // sub ecx, (num-1)*4
 		s << "\x51";                                   // push ecx
 		break;
 	case ADDRESSING_MODE::DB: // start at Rn - num * 4, mum >= 1
-		s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]); // mov ecx, dword ptr[ebp+Rn]
+		reg_op( "\x8B", emitter::ECX, ctx.rn ); // mov ecx, dword ptr[ebp+Rn]
 		s << "\x83\xE9" << (char)(num << 2);           // sub ecx, num*4
 		s << "\x51";                                   // push ecx
 		break;
@@ -292,11 +655,11 @@ void compiler::load_ecx_reg_or_pc(int reg, unsigned long offset)
 {
 	if (reg != 0xF)
 	{
-		s << "\x8B\x4D" << (char)OFFSET(regs[reg]);      // mov ecx, [ebp+rn]
+		reg_op( "\x8B", emitter::ECX, reg ); // mov ecx, [ebp+rn]
 	} else
 	{
 		// ip relative
-		s << "\x8B\x4D" << (char)OFFSET(regs[15]);    // mov ecx, [ebp+rn]
+		s.mov_r_m( emitter::ECX, emitter::EBP, OFFSET(regs[15]) );  // mov ecx, [ebp+rn]
 		s << "\x81\xE1"; write( s, (unsigned long)(~PAGING::ADDRESS_MASK) ); // and ecx, ~PAGING::ADDR_MASK
 		offset += ((inst+2) << INST_BITS) & ~3;
 	}
@@ -310,11 +673,11 @@ void compiler::load_eax_reg_or_pc(int reg, unsigned long offset)
 {
 	if (reg != 0xF)
 	{
-		s << "\x8B\x45" << (char)OFFSET(regs[reg]);      // mov eax, [ebp+rn]
+		reg_op( "\x8B", emitter::EAX, reg ); // mov eax, [ebp+rn]
 	} else
 	{
 		// ip relative
-		s << "\x8B\x45" << (char)OFFSET(regs[15]);    // mov eax, [ebp+rn]
+		s.mov_r_m( emitter::EAX, emitter::EBP, OFFSET(regs[15]) );  // mov eax, [ebp+rn]
 		s << "\x25"; write( s, (unsigned long)(~PAGING::ADDRESS_MASK) ); // and eax, ~PAGING::ADDR_MASK
 		offset += ((inst+2) << INST_BITS) & ~3;
 	}
@@ -338,7 +701,7 @@ void compiler::load_edx_ecx_or_reg(int r1, int r2)
 {
 	if (r1 == r2)                                   // reuse same reg?
 		s << "\x8B\xD1";                            // mov edx, ecx
-	else s << "\x8B\x55" << (char)OFFSET(regs[r1]); // mov edx, [ebp+rn]
+	else reg_op( "\x8B", emitter::EDX, r1 ); // mov edx, [ebp+rn]
 }
 
 void compiler::load_eax_ecx_or_reg(int r1, int r2)
@@ -380,7 +743,7 @@ unsigned long _31 = 31;
 void compiler::shiftop_eax_ecx()
 {
 	// clamp ecx at 31
-	std::ostringstream::pos_type jmpbyte;
+	size_t jmpbyte = 0;
 
 	// shift amount 0  => bypass shifter and keep carry
 	// shift amount 32 => LSL: load 0, carry = lowest in bit
@@ -436,16 +799,11 @@ void compiler::shiftop_eax_ecx()
 	//s << "\xEB\x06"; // jmp $+6
 
 
-	std::ostringstream::pos_type cur = s.tellp();
-	size_t off = cur - jmpbyte - 1;
-	if(off >= 128)
+	if (!s.patch8( jmpbyte ))
 	{
-		std::cerr << "Generated code too large: " << off << "\n";			
+		std::cerr << "Generated code too large: " << (s.tellp() - jmpbyte - 1) << "\n";
 		assert(0);
 	}
-	s.seekp( jmpbyte );
-	s << (char)off;
-	s.seekp( cur );
 
 
 	//s << "\x8B\x75" << (char)OFFSET(x86_flags); // mov esi, [ebp+x86_flags]
@@ -457,18 +815,12 @@ void compiler::shiftop_eax_ecx()
 
 void compiler::add_ecx(unsigned long imm)
 {
-	if (imm)
-	{
-		s << "\x81\xC1"; write( s, imm ); // add ecx, imm
-	}
+	s.add_r_i( emitter::ECX, imm ); // add ecx, imm
 }
 
 void compiler::add_eax(unsigned long imm)
 {
-	if (imm)
-	{
-		s << "\x05"; write( s, imm ); // add eax, imm
-	}
+	s.add_r_i( emitter::EAX, imm ); // add eax, imm
 }
 
 void compiler::generic_store()
@@ -480,16 +832,21 @@ void compiler::generic_store()
 
 void compiler::generic_loadstore_postupdate_imm()
 {
-	if (ctx.imm)
+	long imm = (long)ctx.imm;
+	if (imm == 0)
+		return;
+	if ((imm >= -128) && (imm <= 127))
+	{
+		reg_op( "\x83", 0, ctx.rn ); s << (char)imm; // add [ebp+Rn], imm8
+	} else
 	{
-		s << "\x81\x45" << (char)OFFSET(regs[ctx.rn]); // add [ebp+Rn],
-		write( s, ctx.imm );                           //  imm
+		reg_op( "\x81", 0, ctx.rn ); write( s, ctx.imm ); // add [ebp+Rn], imm
 	}
 }
 
 void compiler::generic_loadstore_postupdate_ecx()
 {
-	s << "\x89\x4D" << (char)OFFSET(regs[ctx.rn]); // mov [ebp+rn], ecx
+	reg_op( "\x89", emitter::ECX, ctx.rn ); // mov [ebp+rn], ecx
 }
 
 
@@ -511,11 +868,11 @@ void compiler::generic_loadstore_shift()
 	if ((ctx.shift == SHIFT::LSL) && (ctx.imm == 0))
 	{
 		// simply add Rm to ecx
-		s << "\x03\x4D" << (char)OFFSET(regs[ctx.rm]); // add ecx, [ebp+rm]
+		reg_op( "\x03", emitter::ECX, ctx.rm ); // add ecx, [ebp+rm]
 		return;
 	} 
 	
-	s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax,[ebp+rm]
+	reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax,[ebp+rm]
 	shift_eax_imm();
 	store_carry();
 	s << "\x03\xC8";                               // add ecx, eax
@@ -526,6 +883,22 @@ void compiler::generic_load()
 	load_ecx_reg_or_pc(ctx.rn, ctx.imm);
 }
 
+// LDR Rd,[PC,#imm] reading a literal of the page being compiled gets
+// the constant moved in directly. The literal gets added to the code map,
+// so writing it recompiles the page before it gets entered again
+bool compiler::fold_literal()
+{
+	if ((ctx.rn != 15) || (ctx.rd == 15) || !literals)
+		return false;
+	unsigned long addr = ((((inst+2) << INST_BITS) & ~3) + ctx.imm) & 0xFFFFFFFF;
+	if ((addr >= PAGING::SIZE) || (addr & 3))
+		return false;
+	reg_op( "\xC7", 0, ctx.rd );                          // mov [ebp+rd], imm32
+	write( s, (unsigned long)*(const unsigned int*)&literals[addr] );
+	used.set( addr, 4 );
+	return true;
+}
+
 void compiler::generic_load_post()
 {
 	break_if_pc(ctx.rd);            // todo handle rd = PC
@@ -552,15 +925,15 @@ void compiler::generic_load_rs(bool post, bool wb)
 
 	if (post)
 	{
-		s << "\x03\x45" << (char)OFFSET(regs[ctx.rn]); // add eax, [ebp+rn]	
+		reg_op( "\x03", emitter::EAX, ctx.rn ); // add eax, [ebp+rn]	
 		s << "\x8B\xC8";                               // mov ecx, eax
 		if (wb)
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rn]); // mov [ebp+rn], eax
+			reg_op( "\x89", emitter::EAX, ctx.rn ); // mov [ebp+rn], eax
 	} else
 	{
-		s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]); // mov ecx, [ebp+rn]
+		reg_op( "\x8B", emitter::ECX, ctx.rn ); // mov ecx, [ebp+rn]
 		if (wb)
-			s << "\x01\x45" << (char)OFFSET(regs[ctx.rn]); // add [ebp+rn], eax
+			reg_op( "\x01", emitter::EAX, ctx.rn ); // add [ebp+rn], eax
 	}
 }
 
@@ -569,11 +942,11 @@ void compiler::generic_postload_shift()
 	/*
 	if (ctx.rn != ctx.rd) // unpredictable load wins according to armwrestler
 	{
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd );  // mov [ebp+rd], eax
 		load_shifter_imm();                            // eax = rm SHIFT imm
 		if (!(ctx.flags & disassembler::U_BIT))
 			s << "\xF7\xD8";                           // neg eax
-		s << "\x01\x45" << (char)OFFSET(regs[ctx.rn]); // add [ebp+rn], eax
+		reg_op( "\x01", emitter::EAX, ctx.rn ); // add [ebp+rn], eax
 	}
 	*/
 
@@ -581,8 +954,8 @@ void compiler::generic_postload_shift()
 	load_shifter_imm();
 	if (!(ctx.flags & disassembler::U_BIT))
 			s << "\xF7\xD8";                       // neg eax
-	s << "\x01\x45" << (char)OFFSET(regs[ctx.rn]); // add [ebp+rn], eax
-	s << "\x8F\x45" << (char)OFFSET(regs[ctx.rd]); // pop [ebp+rd] 
+	reg_op( "\x01", emitter::EAX, ctx.rn ); // add [ebp+rn], eax
+	pop_reg( ctx.rd ); // pop [ebp+rd]
 }
 
 void compiler::generic_load_x()
@@ -612,9 +985,89 @@ void compiler::generic_store_x()
 }
 
 
+// classifies an instruction for find_idle_loop
+// returns false for anything a loop that just polls might not contain,
+// otherwise the register masks it reads/writes and the access size for loads
+bool compiler::idle_instruction(const disassembler::context &c, 
+	unsigned long &reads, unsigned long &writes, unsigned long &size)
+{
+	reads = writes = size = 0;
+	if ((c.cond != CONDITION::AL) || (c.shift == SHIFT::RRX))
+		return false; // would depend on the flags of the previous iteration
+	switch (c.instruction)
+	{
+	case INST::LDR_IP:  size = 4; break;
+	case INST::LDRB_IP: size = 1; break;
+	case INST::LDRX_IP:
+		switch (c.extend_mode)
+		{
+		case EXTEND_MODE::H: case EXTEND_MODE::SH: size = 2; break;
+		case EXTEND_MODE::SB: size = 1; break;
+		default: return false;
+		}
+		break;
+
+	case INST::TST_I: case INST::TEQ_I: case INST::CMP_I: case INST::CMN_I:
+		reads = 1 << c.rn;
+		return true;
+	case INST::TST_R: case INST::TEQ_R: case INST::CMP_R: case INST::CMN_R:
+		reads = (1 << c.rn) | (1 << c.rm);
+		return true;
+
+	case INST::AND_I: case INST::EOR_I: case INST::ORR_I: case INST::BIC_I:
+	case INST::ADD_I: case INST::SUB_I:
+		reads = 1 << c.rn;
+		break;
+	case INST::AND_R: case INST::EOR_R: case INST::ORR_R: case INST::BIC_R:
+	case INST::ADD_R: case INST::SUB_R:
+		reads = (1 << c.rn) | (1 << c.rm);
+		break;
+	case INST::MOV_I: case INST::MVN_I:
+		break;
+	case INST::MOV_R: case INST::MVN_R:
+		if ((c.rd == c.rm) && (c.rd == 12) && (c.imm == 0))
+			return false; // debug magic
+		reads = 1 << c.rm;
+		break;
+	default:
+		return false;
+	}
+	if (size)
+		reads = 1 << c.rn;
+	if (c.rd == 15)
+		return false;
+	writes = 1 << c.rd;
+	return true;
+}
+
+// calls the idle hook before taking the branch of a detected idle loop
+// with ecx = address and edx = size of the watched load (0 if none)
+void compiler::idle_wait()
+{
+	if (!idle_size)
+	{
+		s << "\x33\xC9"; // xor ecx, ecx
+		s << "\x33\xD2"; // xor edx, edx
+		CALLP(idle_hook)
+		return;
+	}
+	if (idle_load.rn == 15)
+	{
+		s.mov_r_m( emitter::ECX, emitter::EBP, OFFSET(regs[15]) );              // mov ecx, [ebp+R15]
+		s << "\x81\xE1"; write( s, (unsigned long)~PAGING::ADDRESS_MASK );    // and ecx, ~PAGING::ADDR_MASK 
+		add_ecx( (((idle_load_inst + 2) << INST_BITS) & ~3) + idle_load.imm );
+	} else
+	{
+		reg_op( "\x8B", emitter::ECX, idle_load.rn ); // mov ecx, [ebp+rn]
+		add_ecx( idle_load.imm );
+	}
+	s << '\xBA'; write( s, idle_size ); // mov edx, size
+	CALLP(idle_hook)
+}
+
 void compiler::load_r15_ecx()
 {
-	s << "\x8B\x4D" << (char)OFFSET(regs[15]);                               // mov ecx, [ebp+R15]
+	s.mov_r_m( emitter::ECX, emitter::EBP, OFFSET(regs[15]) );                // mov ecx, [ebp+R15]
 	s << "\x81\xE1"; write( s, (unsigned long)(~PAGING::ADDRESS_MASK | 1) ); // and ecx, ~PAGING::ADDR_MASK 
 }
 
@@ -641,9 +1094,25 @@ const unsigned long cpsr_masks[16] =
 
 // EVERYTHING HERE IS ONLY VALID FOR THE ARM9 SO FAR!!!
 
-compiler::compiler() : s(std::ostringstream::binary | std::ostringstream::out)
+compiler::compiler()
 {
 	flags_updated = false;
+	cached_reg = -1;
+	cache_dirty = false;
+	literals = 0;
+	run_member = false;
+	run_next = false;
+	run_left = 1;
+	run_open = false;
+	optimize = true;
+	heat = 0;
+	hot_flags = 0;
+	hot_flag = 0;
+	page_exit = -1;
+	trace_page = 0;
+	trace_addr = 0;
+	trace_dirty = 0;
+	trace_jump = 0;
 	//preoff = 0;
 }
 
@@ -664,6 +1133,14 @@ void compiler::update_callstack()
 
 void compiler::add_ecx_bpre()
 {
+	if (bpre_fused)
+	{
+		// the prefix right before got folded in at compile time
+		bpre_fused = false;
+		s << "\x81\xC1"; write( s, ctx.imm - 4 + bpre_imm ); // add ecx, imm
+		return;
+	}
+
 	// originally was
 	// s << "\x81\xC1"; write( s, bpre + ctx.imm - 4 );   // add ecx, imm
 	// but this causes trouble with bpre beeing in the previous page
@@ -678,152 +1155,389 @@ void compiler::add_ecx_bpre()
 // branch when rd = R15
 void compiler::store_rd_eax()
 {
-	s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+	reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 	if (ctx.rd == 15)
 	{
-		s << "\x8B\xC8"; // mov ecx, eax
-		JMPP(compile_and_link_branch_a)
+		s.mov_r_r( emitter::ECX, emitter::EAX ); // mov ecx, eax
+		jmp_indirect();
 	}
 }
 
-void compiler::push(unsigned long imm)
+// jump to the ARM address in ecx (R15 has to be updated already)
+// the site starts out unlinked and always falls through to the slow path
+// a chained site is a way of an inline cache, see jmp_indirect
+void compiler::link_branch(bool chained)
+{
+	spill();
+	count_branch();
+	block_link *l = new block_link;
+	l->site = (char*)0 + tellp();
+	l->from = 0;
+	l->to = 0;
+	links.push_back(l);
+
+#ifdef JIT_X64
+	s.mov_r_p( emitter::EAX, irq_signaled );                              // mov rax, &signaled
+	s << "\x83\x38" << '\0';                                              // cmp dword ptr [rax], 0
+	s << '\x75' << (char)(LINK_SLOW - 15);                                // jnz slow
+	s << "\x81\xF9"; write( s, (unsigned long)0 );                        // cmp ecx, addr
+	s << '\x75' << (char)(LINK_SLOW - LINK_MISS - 1);                     // jnz slow
+	s.mov_r_p( emitter::EAX, &unlinked_flags );                           // mov rax, flags
+	s << "\xF7\x00"; write( s, (unsigned long)0 );                        // test dword ptr [rax], dirty
+	s << '\x75' << (char)(LINK_SLOW - 41);                                // jnz slow
+	s.mov_r_p( emitter::EAX, 0 );                                         // mov rax, page
+	s << "\x48\xA3"; WRITE_P(last_page);                                  // mov [last_page], rax
+	s << "\x0F\x1F\x40" << '\0';                                          // nop / mov r12d, [rbp+Rc] of dest
+#else
+	s << "\x83\x3D"; WRITE_P(irq_signaled); s << '\0';                   // cmp dword ptr [signaled], 0
+	s << '\x75' << (char)(LINK_SLOW - 9);                                 // jnz slow
+	s << "\x81\xF9"; write( s, (unsigned long)0 );                        // cmp ecx, addr
+	s << '\x75' << (char)(LINK_SLOW - LINK_MISS - 1);                     // jnz slow
+	s << "\xF7\x05"; WRITE_P(&unlinked_flags); write( s, (unsigned long)0 ); // test dword ptr [flags], dirty
+	s << '\x75' << (char)(LINK_SLOW - 29);                                // jnz slow
+	s << "\xC7\x05"; WRITE_P(last_page); write( s, (unsigned long)0 );    // mov dword ptr [last_page], page
+	s << "\x0F\x1F" << '\0';                                              // nop / mov edi, [ebp+Rc] of dest
+#endif
+	s << '\xE9'; write( s, (unsigned long)0 );                            // jmp dest (+0 = slow)
+	// slow:
+	assert(tellp() - (size_t)l->site == LINK_SLOW);
+	s.mov_r_p( emitter::EDX, l );                                         // mov edx, link
+	s.jmp( chained ? compile_and_link_branch_c : compile_and_link_branch_l ); // already spilled
+}
+
+// jump to the ARM address in ecx (R15 has to be updated already)
+// through an inline cache of IC_WAYS jump sites
+void compiler::jmp_indirect()
 {
-	//__asm push 1
-	//__asm push 0xbadc0de
+	spill();
+	count_branch();
+	bool dirty = cache_dirty;
+	int *counter = heat;
+	cache_dirty = false; // the ways have to follow each other directly
+	heat = 0;
+	for (int i = 0; i < IC_WAYS; i++)
+		link_branch( i < IC_WAYS - 1 );
+	cache_dirty = dirty;
+	heat = counter;
+}
+
+// baseline code counts down the branches it takes, once hot the page gets
+// marked dirty so the next branch into it has memory_block::recompile
+// compile it again by the optimizing tier. the dirty flag is tested by
+// every linked site, so loops within the page get there as well
+// trashes eax (and EFLAGS)
+void compiler::count_branch()
+{
+	if (!heat)
+		return;
+#ifdef JIT_X64
+	s.mov_r_p( emitter::EAX, heat );                                      // mov rax, &heat
+	s << "\x83\x28\x01";                                                  // sub dword ptr [rax], 1
+	size_t warm = s.jcc8( 5 );                                            // jnz warm
+	s.mov_r_p( emitter::EAX, hot_flags );                                 // mov rax, &flags
+	s << "\xF0\x81\x08"; write( s, hot_flag );                            // lock or dword ptr [rax], dirty
+#else
+	s << "\x83\x2D"; WRITE_P(heat); s << '\x01';                          // sub dword ptr [heat], 1
+	size_t warm = s.jcc8( 5 );                                            // jnz warm
+	s << "\xF0\x81\x0D"; WRITE_P(hot_flags); write( s, hot_flag );        // lock or dword ptr [flags], dirty
+#endif
+	s.patch8( warm );
+}
 
-	//01841233 6A 01            push        1    
-	//01841235 68 DE C0 AD 0B   push        0BADC0DEh 
-	if ((signed long)imm == (signed char)imm)
-		s << '\x6A' << (signed char)imm;
-	else 
+// pushes the return address in ecx along with the pad emitted by
+// return_pad onto the shadow return stack, trashes eax and edx
+// returns the position of the pad distance to patch
+size_t compiler::push_return()
+{
+	size_t at;
+#ifdef JIT_X64
+	long top = (long)((char*)&returns->top - (char*)returns);
+	s << "\x48\x8D\x15"; at = tellp(); write( s, (unsigned long)0 );     // lea rdx, [rip+pad]
+	s.mov_r_p( emitter::R11, returns );                                  // mov r11, &returns
+	s.mov_r_m( emitter::EAX, emitter::R11, top );                        // mov eax, [r11+top]
+	s << "\x83\xC0" << (char)sizeof(return_stack::entry);                // add eax, entry
+	s << '\x25'; write( s, (unsigned long)return_stack::MASK );          // and eax, mask
+	s.mov_m_r( emitter::R11, top, emitter::EAX );                        // mov [r11+top], eax
+	s.rex( true, emitter::EDX, emitter::R11 ); s << '\x89';
+	s.mem( emitter::EDX, emitter::R11, emitter::EAX, 0 );                // mov [r11+rax], rdx
+	s.rex( false, emitter::ECX, emitter::R11 ); s << '\x89';
+	s.mem( emitter::ECX, emitter::R11, emitter::EAX, emitter::SLOT );    // mov [r11+rax+8], ecx
+#else
+	s << '\xE8'; write( s, (unsigned long)0 );                           // call $+5
+	s << '\x5A';                                                         // pop edx
+	s << "\x81\xC2"; at = tellp(); write( s, (unsigned long)0 );         // add edx, pad-$
+	s.mov_r_m( emitter::EAX, &returns->top );                            // mov eax, [top]
+	s << "\x83\xC0" << (char)sizeof(return_stack::entry);                // add eax, entry
+	s << '\x25'; write( s, (unsigned long)return_stack::MASK );          // and eax, mask
+	s.mov_m_r( &returns->top, emitter::EAX );                            // mov [top], eax
+	s << "\x89\x90"; WRITE_P(&returns->entries[0].pad);                  // mov [eax+pad], edx
+	s << "\x89\x88"; WRITE_P(&returns->entries[0].addr);                 // mov [eax+addr], ecx
+#endif
+	return at;
+}
+
+// landing pad behind a call, returns predicted by the shadow return stack
+// arrive here with ecx = return address, everything spilled and R15 set
+void compiler::return_pad(size_t at)
+{
+#ifdef JIT_X64
+	s.patch32( at );
+#else
+	s.patch_distance( at, at - 3 ); // relative to the pop
+#endif
+	bool dirty = cache_dirty;
+	cache_dirty = false;
+	link_branch();
+	cache_dirty = dirty;
+}
+
+// jump to the ARM address in ecx (R15 has to be updated already)
+// through the top entry of the shadow return stack if that matches
+void compiler::jmp_return()
+{
+	spill();
+#ifdef JIT_X64
+	long top = (long)((char*)&returns->top - (char*)returns);
+	s.mov_r_p( emitter::R11, returns );                                  // mov r11, &returns
+	s.mov_r_m( emitter::EAX, emitter::R11, top );                        // mov eax, [r11+top]
+	s.rex( false, emitter::ECX, emitter::R11 ); s << '\x3B';
+	s.mem( emitter::ECX, emitter::R11, emitter::EAX, emitter::SLOT );    // cmp ecx, [r11+rax+8]
+	size_t miss = s.jcc8( 5 );                                           // jnz miss
+	s.rex( true, emitter::EDX, emitter::R11 ); s << '\x8B';
+	s.mem( emitter::EDX, emitter::R11, emitter::EAX, 0 );                // mov rdx, [r11+rax]
+	s << "\x83\xE8" << (char)sizeof(return_stack::entry);                // sub eax, entry
+	s << '\x25'; write( s, (unsigned long)return_stack::MASK );          // and eax, mask
+	s.mov_m_r( emitter::R11, top, emitter::EAX );                        // mov [r11+top], eax
+#else
+	s.mov_r_m( emitter::EAX, &returns->top );                            // mov eax, [top]
+	s << "\x3B\x88"; WRITE_P(&returns->entries[0].addr);                 // cmp ecx, [eax+addr]
+	size_t miss = s.jcc8( 5 );                                           // jnz miss
+	s << "\x8B\x90"; WRITE_P(&returns->entries[0].pad);                  // mov edx, [eax+pad]
+	s << "\x83\xE8" << (char)sizeof(return_stack::entry);                // sub eax, entry
+	s << '\x25'; write( s, (unsigned long)return_stack::MASK );          // and eax, mask
+	s.mov_m_r( &returns->top, emitter::EAX );                            // mov [top], eax
+#endif
+	s << "\xFF\xE2";                                                     // jmp edx
+	s.patch8( miss );
+	s.jmp( compile_and_link_branch_a );                                  // already spilled
+}
+
+void compiler::link(block_link *l, compiled_block_links *to, int cached_reg,
+	unsigned long addr, memory_block *page, unsigned long dirty, char *dest)
+{
+	if (l->to)
+		unlink(l);
+	char *site = code_arena::writable(l->site);
+	*(unsigned int*)(site + LINK_ADDR) = (unsigned int)addr;
+	*(unsigned long**)(site + LINK_FLAGS) = &page->flags;
+	*(unsigned int*)(site + LINK_DIRTY) = (unsigned int)dirty;
+	*(memory_block**)(site + LINK_PAGE) = page;
+#ifdef JIT_X64
+	if (cached_reg >= 0)
+		memcpy( site + LINK_RELOAD, "\x44\x8B\x65", 3 ); // mov r12d, [rbp+Rc]
+	else memcpy( site + LINK_RELOAD, "\x0F\x1F\x40", 3 ); // nop
+	site[LINK_RELOAD+3] = cached_reg >= 0 ? (char)OFFSET(regs[cached_reg]) : '\0';
+#else
+	if (cached_reg >= 0)
 	{
-		s << '\x68';
-		write(s, imm);
+		site[LINK_RELOAD+0] = '\x8B'; // mov edi, [ebp+Rc]
+		site[LINK_RELOAD+1] = '\x7D';
+		site[LINK_RELOAD+2] = (char)OFFSET(regs[cached_reg]);
+	} else
+	{
+		site[LINK_RELOAD+0] = '\x0F'; // nop
+		site[LINK_RELOAD+1] = '\x1F';
+		site[LINK_RELOAD+2] = '\0';
 	}
-	pushs++;
+#endif
+	*(int*)(site + LINK_JUMP) = (int)(dest - (l->site + LINK_SLOW));
+	l->to = to;
+	l->pos = to->incoming.insert( to->incoming.end(), l );
 }
 
-void compiler::compile_instruction()
+void compiler::unlink(block_link *l)
 {
-	bool patch_jump = false;
-	std::ostringstream::pos_type jmpbyte;
+	if (!l->to)
+		return;
+	char *site = code_arena::writable(l->site);
+	*(unsigned long**)(site + LINK_FLAGS) = &unlinked_flags;
+	*(int*)(site + LINK_JUMP) = 0;
+	site[LINK_MISS] = (char)(LINK_SLOW - LINK_MISS - 1);
+	l->to->incoming.erase( l->pos );
+	l->to = 0;
+}
+
+// lets the address check of the linked inline cache way l continue with
+// the way behind it rather than the slow path
+void compiler::chain(block_link *l)
+{
+	char *site = code_arena::writable(l->site);
+	site[LINK_MISS] = (char)(LINK_SIZE - LINK_MISS - 1);
+}
+
+// the address and page a site got linked to, false if it is unlinked
+bool compiler::linked_to(const block_link *l, unsigned long &addr, memory_block* &page)
+{
+	if (!l->to)
+		return false;
+	addr = *(unsigned int*)(l->site + LINK_ADDR);
+	page = *(memory_block**)(l->site + LINK_PAGE);
+	return true;
+}
+
+void compiled_block_links::unlink_incoming()
+{
+	while (!incoming.empty())
+		compiler::unlink( incoming.front() );
+}
 
-#ifdef HLE_CORE
-	if ((ctx.cond != CONDITION::AL) && (ctx.cond != CONDITION::NV))
+compiled_block_links::~compiled_block_links()
+{
+	_InterlockedIncrement( (long*)&generation );
+	// drop own sites first, the code they are located in is gone already
+	for (size_t i = 0; i < outgoing.size(); i++)
 	{
-		CALLP(hlc_checkflags);
-		s << "\x0B\xC0"  // or eax, eax
-		  << "\x75"; // jne $+5
-		jmpbyte = s.tellp();
-		patch_jump = true;
-		s << '\x00';
+		block_link *l = outgoing[i];
+		if (l->to)
+			l->to->incoming.erase( l->pos );
+		delete l;
 	}
+	unlink_incoming();
+}
 
-	// use disassembly string to determine args to push
-	pushs = 0;
-	const char *dasm = INST::strings[ctx.instruction];
-	const char *p = dasm;
-	while (*p)
+boost::mutex block_pool::lock;
+block_pool::size_class block_pool::classes[block_pool::MAX_SIZES];
+int block_pool::num_classes = 0;
+
+block_pool::size_class& block_pool::get(size_t size)
+{
+	for (int i = 0; i < num_classes; i++)
+		if (classes[i].size == size)
+			return classes[i];
+	assert(num_classes < MAX_SIZES);
+	size_class &c = classes[num_classes++];
+	c.size = size;
+	c.free = 0;
+	return c;
+}
+
+void* block_pool::allocate(size_t size)
+{
+	if (size < sizeof(free_node))
+		size = sizeof(free_node);
+	boost::mutex::scoped_lock g(lock);
+	size_class &c = get( size );
+	if (!c.free)
 	{
-		char c = *p++;
-		if (c == '%')
+		char *chunk = (char*)::operator new( size * CHUNK_BLOCKS );
+		for (int i = CHUNK_BLOCKS; i-- > 0; )
 		{
-			char c = *p++;
-			switch (c)
-			{
-			case '^': continue; // flags
-			case '-': continue; // flags
-			case '?': continue;
-			case 'c': continue;
-			case 's': continue; // flags
-			case 'F': push( cpsr_masks[ctx.rn] ); continue;
-			case 'S': push(ctx.shift); continue;
-			case 'R': // Register
-				{
-DecodeReg:
-					char c = *p++;
-					switch (c)
-					{
-					case 'd': push(ctx.rd); break;
-					case 'n': push(ctx.rn); break;
-					case 'm': push(ctx.rm); break;
-					case 's': push(ctx.rs); break;
-					case 'L': push(ctx.imm); break;
-					}
-					continue;
-				}
-			case 'M': push(ctx.addressing_mode); continue;
-			case 'E': push(ctx.extend_mode); continue;
-			case 'I': push(ctx.imm); continue;
-			case 'A': push(ctx.imm); continue;
-			case 'C':
-				// coproc entity
-
-				char c = *p++;
-				switch (c)
-				{
-				case 'p': push(ctx.cp_num); break;
-				case '1': push(ctx.cp_op1); break;
-				case '2': push(ctx.cp_op2); break;
-				case 'R':
-					goto DecodeReg;
-				}
-				continue;
-			}
-			continue;
+			free_node *n = (free_node*)(chunk + i * size);
+			n->next = c.free;
+			c.free = n;
 		}
 	}
+	free_node *n = c.free;
+	c.free = n->next;
+	return n;
+}
+
+void block_pool::release(void *p, size_t size)
+{
+	if (!p)
+		return;
+	if (size < sizeof(free_node))
+		size = sizeof(free_node);
+	boost::mutex::scoped_lock g(lock);
+	free_node *n = (free_node*)p;
+	size_class &c = get( size );
+	n->next = c.free;
+	c.free = n;
+}
+
+void return_stack::init(char *lookup)
+{
+	miss = lookup;
+	top = 0;
+	for (int i = 0; i < DEPTH; i++)
+	{
+		entries[i].pad = miss;
+		entries[i].addr = 0;
+	}
+	for (int i = 0; i < num_stacks; i++)
+		if (stacks[i] == this)
+			return;
+	assert(num_stacks < MAX_STACKS);
+	stacks[num_stacks++] = this;
+}
+
+void return_stack::drop(const char *code, size_t size)
+{
+	for (int i = 0; i < num_stacks; i++)
+	{
+		return_stack *r = stacks[i];
+		for (int j = 0; j < DEPTH; j++)
+			if ((r->entries[j].pad >= code) && (r->entries[j].pad < code + size))
+				r->entries[j].pad = r->miss;
+	}
+}
+
+void compiler::compile_instruction()
+{
+	bool patch_jump = false;
+	size_t jmpbyte = 0;
+	size_t links_before = links.size();
 
-	push(ctx.flags); // always need those for S_BIT at least
-	CALLP( hlc_funcs[ctx.instruction] );
-	// cleanup stack
-	s << "\x83\xC4"; // add esp,
-	s << (char)(pushs*4);
-	// HLE Core doesnt understand DEBUG magic yet
-#else
 	// JIT CORE STARTS HERE
 	//unsigned long bpre = preoff;
 	//preoff = 0;
 	int flags_actual = flags_updated;
 
-	
-#ifdef CLOCK_CYCLES
-	if (lookahead_s)
+	if (run_member)
 	{
-		s << '\x43'; // inc ebx
-		flags_actual = 0;
+		// the jump of the run head skips this one as well
+		run_entry e;
+		e.inst = inst;
+		e.code = s.tellp();
+		e.end = 0;
+		e.cond = ctx.cond;
+		e.cycles = run_left;
+		run_entries.push_back( e );
 	} else
-		s << "\x8D\x5B\x01"; // lea ebx, [ebx+1]
+	{
+#ifdef CLOCK_CYCLES
+		// the run head accounts for the whole run
+		if (flags_dead)
+		{
+			if (run_left == 1)
+				s << '\x43'; // inc ebx
+			else s << "\x83\xC3" << (char)run_left; // add ebx, run
+			flags_actual = 0;
+		} else
+			s << "\x8D\x5B" << (char)run_left; // lea ebx, [ebx+run]
 #endif
 
-	if (ctx.cond != CONDITION::AL)
-	{
-		if (ctx.cond != CONDITION::NV)
+		if ((ctx.cond != CONDITION::AL) && (ctx.cond != CONDITION::NV))
 		{
+			if ((run_left == 1) && predicate_cmov( flags_actual ))
+			{
+				// EFLAGS hold the flags again behind the cmov
+				flags_updated = 1;
+				flush_flags();
+				return;
+			}
+			if (flags_pending)
+			{
+				// keeps_flags promised a cmov, the instruction reads them anyway
+				flags_pending = false;
+				save_flags();
+			}
 			if (!flags_actual)
 			{
 				load_flags();
 				flags_actual = 1;
 			}
-			switch (ctx.cond)
-			{
-			// conditions are _reversed_ in the jumps because a jump taken
-			// means the instruction will _not_ be executed.
-			case CONDITION::EQ: s << '\x75'; break; // jnz  (ZF = 0)              Z=1
-			case CONDITION::NE: s << '\x74'; break; // jz   (ZF = 1)              Z=0
-			case CONDITION::CS: s << '\x73'; break; // jnc  (CF = 0)              C=1
-			case CONDITION::CC: s << '\x72'; break; // jc   (CF = 1)              C=0
-			case CONDITION::MI: s << '\x79'; break; // jns  (SF = 0)              N=1
-			case CONDITION::PL: s << '\x78'; break; // js   (SF = 1)              N=0
-			case CONDITION::VS: s << '\x71'; break; // jno  (OF = 0)              V=1
-			case CONDITION::VC: s << '\x70'; break; // jo   (OF = 1)              V=0
-			case CONDITION::HI: s << "\xF5\x76"; break; // jbe  (CF = 1 or  ZF = 1)   C=1 Z=0 (needs cmc!)
-			case CONDITION::LS: s << "\xF5\x77"; break; // jnbe (CF = 0 and ZF = 0)   C=0 Z=1 (needs cmc!)
-			case CONDITION::GE: s << '\x7C'; break; // jl   (SF != OF)            N==V
-			case CONDITION::LT: s << '\x7D'; break; // jge  (SF == OF)            N!=V
-			case CONDITION::GT: s << '\x7E'; break; // jle  (ZF = 0 or  SF != OF) Z==0 or N==V (needs OF swap!)
-			case CONDITION::LE: s << '\x7F'; break; // jg   (ZF = 0 and SF == OF) Z==1 or N!=V
-			}
+			s << (char)(0x70 + skip_condition( ctx.cond )); // j<skip>
 			jmpbyte = s.tellp();
 			patch_jump = true;
 			s << '\x00';
@@ -841,11 +1555,11 @@ DecodeReg:
 
 	case INST::MOV_I:
 		break_if_pc(ctx.rd);
-		s << "\xC7\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], imm32
+		reg_op( "\xC7", 0, ctx.rd ); // mov [ebp+rd], imm32
 		write( s, ctx.imm );
 		if (ctx.flags & disassembler::S_BIT)
 		{
-			s << "\x83\x4D" << (char)OFFSET(regs[ctx.rd]) << '\0'; // or [ebp+rd], 0
+			reg_op( "\x83", 1, ctx.rd ); s << '\0'; // or [ebp+rd], 0
 			store_flags();
 		}
 		break;
@@ -869,14 +1583,16 @@ DecodeReg:
 		{
 			if (ctx.flags & disassembler::S_BIT)
 				s << DEBUG_BREAK;
-			s << "\x8B\x4D" << (char)OFFSET(regs[15]); // mov ecx, [r15]
+			reg_op( "\x8B", emitter::ECX, 15 ); // mov ecx, [r15]
 			s << "\x83\xE1\x01";                       // and ecx, 1
 			s << "\x0B\xC8";                           // or ecx, eax
-			s << "\x89\x4D" << (char)OFFSET(regs[15]); // mov [ebp+rd], ecx
-			JMPP(compile_and_link_branch_a)
+			reg_op( "\x89", emitter::ECX, 15 ); // mov [ebp+rd], ecx
+			if (ctx.rm == 14)
+				jmp_return();
+			else jmp_indirect();
 		} else
 		{
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+			reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		}
 
 		load_carry();
@@ -894,7 +1610,7 @@ DecodeReg:
 		load_ecx_reg_or_pc(ctx.rs);          // ecx = reg[rn]
 		load_eax_ecx_or_reg(ctx.rm, ctx.rs); // eax = reg[rd]
 		shiftop_eax_ecx();
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		if (ctx.flags & disassembler::S_BIT)
 		{
 			// todo optimize the flagcheck (doesnt need to do the cmp)
@@ -910,7 +1626,7 @@ DecodeReg:
 		load_ecx_reg_or_pc(ctx.rs);          // ecx = reg[rn]
 		load_eax_ecx_or_reg(ctx.rm, ctx.rs); // eax = reg[rd]
 		shiftop_eax_ecx();
-		s << "\x09\x45" << (char)OFFSET(regs[ctx.rd]); // or [ebp+rd], eax
+		reg_op( "\x09", emitter::EAX, ctx.rd ); // or [ebp+rd], eax
 		if (ctx.flags & disassembler::S_BIT)
 		{
 			load_carry();
@@ -920,19 +1636,19 @@ DecodeReg:
 
 	case INST::MVN_I:
 		break_if_pc(ctx.rd);
-		s << "\xC7\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], ~imm32
+		reg_op( "\xC7", 0, ctx.rd ); // mov [ebp+rd], ~imm32
 		write( s, ~ctx.imm );
 		break;
 	case INST::MVN_R:
 		break_if_pc(ctx.rd);
 		if ((ctx.rd == ctx.rm) && (ctx.shift == SHIFT::LSL) && (ctx.imm == 0))
 		{
-			s << "\xF7\x55" << (char)OFFSET(regs[ctx.rd]);  // not [ebp+rd]
+			reg_op( "\xF7", 2, ctx.rd );  // not [ebp+rd]
 		} else
 		{
 			load_shifter_imm();
 			s << "\xF7\xD0";                                // not eax
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+			reg_op( "\x89", emitter::EAX, ctx.rd );  // mov [ebp+rd], eax
 		}
 		load_carry();
 		if (ctx.flags & disassembler::S_BIT)
@@ -999,11 +1715,13 @@ DecodeReg:
 		generic_load_post();
 		generic_loadstore_postupdate_imm();
 		CALLP(load32)
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd );  // mov [ebp+rd], eax
 		break;
 
 	// Pre index loads
 	case INST::LDR_IP:
+		if (fold_literal())
+			break;
 		generic_load();
 		CALLP(load32)
 		store_rd_eax();
@@ -1047,38 +1765,38 @@ DecodeReg:
 	case INST::LDR_RP:
 		generic_load_rs(true, false);
 		CALLP(load32) 
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd );  // mov [ebp+rd], eax
 		break;
 
 	case INST::LDR_RPW:
 		generic_load_rs(true, true);
-		s << "\x89\x4D" << (char)OFFSET(regs[ctx.rn]);  // mov [ebp+rn], ecx
+		reg_op( "\x89", emitter::ECX, ctx.rn );  // mov [ebp+rn], ecx
 		CALLP(load32) 
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd );  // mov [ebp+rd], eax
 		break;
 
 	case INST::LDRB_I:
 		generic_load_post();
 		generic_loadstore_postupdate_imm();
 		CALLP(load8u)
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd );  // mov [ebp+rd], eax
 		break;
 	case INST::LDRB_IP:
 		break_if_pc(ctx.rd);                  // todo handle rd = PC
 		generic_load();
 		CALLP(load8u)
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd );  // mov [ebp+rd], eax
 		break;
 	case INST::LDRB_RP: // fails with ldrb r0,[r6,r5 lsr#0x18]
 		generic_load_r();
 		CALLP(load8u)
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd );  // mov [ebp+rd], eax
 		break;
 
 	case INST::LDRX_RP: // bogus!
 		generic_load_r();
 		generic_load_x();
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);  // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd );  // mov [ebp+rd], eax
 		break;
 
 
@@ -1086,30 +1804,40 @@ DecodeReg:
 		// Branch and link
 		load_r15_ecx();
 		s << "\x81\xC1"; write( s, (unsigned long)(inst+1) << INST_BITS);        // add ecx, imm
-		s << "\x89\x4D" << (char)OFFSET(regs[14]);             // mov [ebp+r14], ecx
+		reg_op( "\x89", emitter::ECX, 14 );             // mov [ebp+r14], ecx
 		record_callstack();
-		s << "\x81\xE1"; write( s, (unsigned long)(~1) );  // and ecx, ~1
-		s << "\x83\xE0\xFE";                               // and eax, 0FFFFFFFEh 
-		add_ecx_bpre();
-		s << "\x89\x4D" << (char)OFFSET(regs[15]);         // mov [ebp+r15], ecx
-		JMPP(compile_and_link_branch_a)
+		{
+			size_t pad = push_return();
+			s << "\x81\xE1"; write( s, (unsigned long)(~1) );  // and ecx, ~1
+			s << "\x83\xE0\xFE";                               // and eax, 0FFFFFFFEh 
+			add_ecx_bpre();
+			reg_op( "\x89", emitter::ECX, 15 );         // mov [ebp+r15], ecx
+			link_branch();
+			return_pad( pad );
+		}
 		break;
 	case INST::BL:
 		// Branch and link
 		load_r15_ecx();
 		s << "\x81\xC1"; write( s, (unsigned long)(inst+1) << INST_BITS);        // add ecx, imm
-		s << "\x89\x4D" << (char)OFFSET(regs[14]);             // mov [ebp+r14], ecx
+		reg_op( "\x89", emitter::ECX, 14 );             // mov [ebp+r14], ecx
 		record_callstack();
-		add_ecx_bpre();
-		s << "\x89\x4D" << (char)OFFSET(regs[15]);             // mov [ebp+r15], ecx
-		JMPP(compile_and_link_branch_a)
+		{
+			size_t pad = push_return();
+			add_ecx_bpre();
+			reg_op( "\x89", emitter::ECX, 15 );             // mov [ebp+r15], ecx
+			link_branch();
+			return_pad( pad );
+		}
 		break;
 	case INST::BX:
 		// Branch to register (generally R14)
 		load_ecx_reg_or_pc(ctx.rm, 0);              // mov ecx, [ebp+rm]
-		s << "\x89\x4D" << (char)OFFSET(regs[15]);  // mov [ebp+r15], ecx
+		reg_op( "\x89", emitter::ECX, 15 );  // mov [ebp+r15], ecx
 		update_callstack();
-		JMPP(compile_and_link_branch_a)
+		if (ctx.rm == 14)
+			jmp_return();
+		else jmp_indirect();
 		//s << "\xFF\xE0";                          // jmp eax
 		break;
 
@@ -1117,26 +1845,39 @@ DecodeReg:
 		// link
 		load_r15_ecx();
 		s << "\x81\xC1"; write( s, (unsigned long)(inst+1) << INST_BITS); // add ecx, imm
-		s << "\x89\x4D" << (char)OFFSET(regs[14]);             // mov [ebp+r14], ecx
+		reg_op( "\x89", emitter::ECX, 14 );             // mov [ebp+r14], ecx
 		record_callstack();
-		// branch
-		load_ecx_reg_or_pc(ctx.rm, 0);                         // mov ecx, [ebp+rm]
-		s << "\x89\x4D" << (char)OFFSET(regs[15]);             // mov [ebp+r15], ecx
-		JMPP(compile_and_link_branch_a)
-		//s << "\xFF\xE0";                                       // jmp eax
+		{
+			size_t pad = push_return();
+			// branch
+			load_ecx_reg_or_pc(ctx.rm, 0);                         // mov ecx, [ebp+rm]
+			reg_op( "\x89", emitter::ECX, 15 );             // mov [ebp+r15], ecx
+			jmp_indirect();
+			//s << "\xFF\xE0";                                       // jmp eax
+			return_pad( pad );
+		}
 		break;
 	// case BLX_I => use +bpre
 
 	case INST::B:
+		if (idle_branch)
+			idle_wait();
 		// This branch jumps correct now
 		load_r15_ecx();
 		s << "\x81\xC1"; write( s, ctx.imm + (unsigned long)((inst) << INST_BITS)); // add ecx, imm
-		s << "\x89\x4D" << (char)OFFSET(regs[15]);    // mov [ebp+r15], ecx
+		reg_op( "\x89", emitter::ECX, 15 );    // mov [ebp+r15], ecx
 		update_callstack();
-		JMPP(compile_and_link_branch_a)
-		//s << "\xFF\xE0";                              // jmp eax
+		link_branch();
 		break;
 	case INST::BPRE:
+		// the suffix follows within the piece, it adds the offset itself
+		// so neither needs to go through [ebp+bpre]
+		if (fuse_bpre)
+		{
+			bpre_fused = true;
+			bpre_imm = ctx.imm;
+			break;
+		}
 		//preoff = ctx.imm;
 		// VC bug: mov [ebp+0x10], 0xbadc0de => mov byte ptr ...
 		s << "\xC7\x45" << (char)OFFSET(bpre); write( s, (unsigned long)ctx.imm); // mov [ebp+bpre], offset
@@ -1166,7 +1907,7 @@ DecodeReg:
 				case 0: // Main ID register
 				default: // if unimplemented register is queried return Main ID register
 					// no$gba returns 0x41059461
-					s << "\xC7\x45" << (char)OFFSET(regs[ctx.rd]); write( s, (unsigned long)0x41059460 );
+					reg_op( "\xC7", 0, ctx.rd ); write( s, (unsigned long)0x41059460 );
 					break;
 				}
 				break;
@@ -1175,7 +1916,7 @@ DecodeReg:
 				//if ((ctx.rm != 0) || (ctx.cp_op2 != 0))
 				//	goto default_;
 				s << "\x8B\x45" << (char)OFFSET(syscontrol.control_register); // mov eax,[ebp+creg]
-				s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);                // mov [ebp+rd],eax
+				reg_op( "\x89", emitter::EAX, ctx.rd );                // mov [ebp+rd],eax
 				break;
 			default:
 				goto default_; // not supported yet
@@ -1202,7 +1943,7 @@ DecodeReg:
 				// SBZ but ignored
 				//if ((ctx.rm != 0) || (ctx.cp_op2 != 0))
 				//	goto default_;
-				s << "\x8B\x45" << (char)OFFSET(regs[ctx.rd]);                // mov eax, [ebp+rd]
+				reg_op( "\x8B", emitter::EAX, ctx.rd );                // mov eax, [ebp+rd]
 				s << "\x89\x45" << (char)OFFSET(syscontrol.control_register); // mov [ebp+creg], eax
 				s << "\x0B\xC0"; // or eax, eax
 				s << "\x75\x05"; // jmp $+5
@@ -1250,11 +1991,11 @@ DecodeReg:
 		s << "\xF7\xD0";                               // not eax;
 		if (ctx.rn == ctx.rd)
 		{
-			s << "\x21\x45" << (char)OFFSET(regs[ctx.rn]); // and [ebp+rd], eax
+			reg_op( "\x21", emitter::EAX, ctx.rn ); // and [ebp+rd], eax
 		} else
 		{
-			s << "\x23\x45" << (char)OFFSET(regs[ctx.rn]); // and eax, [ebp+rn]
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+			reg_op( "\x23", emitter::EAX, ctx.rn ); // and eax, [ebp+rn]
+			reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		}
 		load_carry();
 		if (ctx.flags & disassembler::S_BIT)
@@ -1264,11 +2005,11 @@ DecodeReg:
 		load_shifter_imm();
 		if (ctx.rn == ctx.rd)
 		{
-			s << "\x21\x45" << (char)OFFSET(regs[ctx.rn]); // and [ebp+rd], eax
+			reg_op( "\x21", emitter::EAX, ctx.rn ); // and [ebp+rd], eax
 		} else
 		{
-			s << "\x23\x45" << (char)OFFSET(regs[ctx.rn]); // and eax, [ebp+rn]
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+			reg_op( "\x23", emitter::EAX, ctx.rn ); // and eax, [ebp+rn]
+			reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		}
 		load_carry();
 		if (ctx.flags & disassembler::S_BIT)
@@ -1278,11 +2019,11 @@ DecodeReg:
 		load_shifter_imm();
 		if (ctx.rn == ctx.rd)
 		{
-			s << "\x31\x45" << (char)OFFSET(regs[ctx.rn]); // xor [ebp+rd], eax
+			reg_op( "\x31", emitter::EAX, ctx.rn ); // xor [ebp+rd], eax
 		} else
 		{
-			s << "\x33\x45" << (char)OFFSET(regs[ctx.rn]); // xor eax, [ebp+rn]
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+			reg_op( "\x33", emitter::EAX, ctx.rn ); // xor eax, [ebp+rn]
+			reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		}
 		load_carry();
 		if (ctx.flags & disassembler::S_BIT)
@@ -1293,9 +2034,9 @@ DecodeReg:
 	case INST::BIC_I:
 		break_if_pc(ctx.rn);
 		break_if_pc(ctx.rd);
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rn]); // mov eax,[ebp+Rn]
+		reg_op( "\x8B", emitter::EAX, ctx.rn ); // mov eax,[ebp+Rn]
 		s << '\x25'; write(s, ~ctx.imm);               // and eax, ~imm
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
 		break;
@@ -1305,13 +2046,13 @@ DecodeReg:
 		break_if_pc(ctx.rd);
 		if (ctx.rn == ctx.rd)
 		{
-			s << "\x81\x4D" << (char)OFFSET(regs[ctx.rn]); // or [ebp+rn],
+			reg_op( "\x81", 1, ctx.rn ); // or [ebp+rn],
 			write( s, ctx.imm );                           //  imm
 		} else
 		{
-			s << "\x8B\x45" << (char)OFFSET(regs[ctx.rn]); // mov eax, [ebp+rn]
+			reg_op( "\x8B", emitter::EAX, ctx.rn ); // mov eax, [ebp+rn]
 			s << "\x0D"; write(s, ctx.imm );               // or eax, imm
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+			reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		}
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
@@ -1322,13 +2063,13 @@ DecodeReg:
 		break_if_pc(ctx.rd);
 		if (ctx.rn == ctx.rd)
 		{
-			s << "\x81\x65" << (char)OFFSET(regs[ctx.rn]); // and [ebp+rn],
+			reg_op( "\x81", 4, ctx.rn ); // and [ebp+rn],
 			write( s, ctx.imm );                           //  imm
 		} else
 		{
-			s << "\x8B\x45" << (char)OFFSET(regs[ctx.rn]); // mov eax, [ebp+rn]
+			reg_op( "\x8B", emitter::EAX, ctx.rn ); // mov eax, [ebp+rn]
 			s << "\x25"; write(s, ctx.imm );               // and eax, imm
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+			reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		}
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
@@ -1339,13 +2080,13 @@ DecodeReg:
 		break_if_pc(ctx.rd);
 		if (ctx.rn == ctx.rd)
 		{
-			s << "\x81\x75" << (char)OFFSET(regs[ctx.rn]); // xor [ebp+rn],
+			reg_op( "\x81", 6, ctx.rn ); // xor [ebp+rn],
 			write( s, ctx.imm );                           //  imm
 		} else
 		{
-			s << "\x8B\x45" << (char)OFFSET(regs[ctx.rn]); // mov eax, [ebp+rn]
+			reg_op( "\x8B", emitter::EAX, ctx.rn ); // mov eax, [ebp+rn]
 			s << "\x35"; write(s, ctx.imm );               // xor eax, imm
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+			reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		}
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
@@ -1356,12 +2097,12 @@ DecodeReg:
 		if (ctx.rn == ctx.rd)
 		{
 			break_if_pc(ctx.rn);
-			s << "\x81\x45" << (char)OFFSET(regs[ctx.rn]); // add [ebp+rn],
+			reg_op( "\x81", 0, ctx.rn ); // add [ebp+rn],
 			write( s, ctx.imm );                           // imm
 		} else
 		{
 			load_ecx_reg_or_pc(ctx.rn, ctx.imm);           // ecx = [ebp+rn] + imm
-			s << "\x89\x4D" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], ecx
+			reg_op( "\x89", emitter::ECX, ctx.rd ); // mov [ebp+rd], ecx
 		}
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
@@ -1371,11 +2112,11 @@ DecodeReg:
 			load_shifter_imm();
 			if (ctx.rn == ctx.rd)
 			{
-				s << "\x01\x45" << (char)OFFSET(regs[ctx.rn]); // add [ebp+Rn], eax
+				reg_op( "\x01", emitter::EAX, ctx.rn ); // add [ebp+Rn], eax
 			} else
 			{
-				s << "\x03\x45" << (char)OFFSET(regs[ctx.rn]); // add eax, [ebp+Rn]
-				s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+				reg_op( "\x03", emitter::EAX, ctx.rn ); // add eax, [ebp+Rn]
+				reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 			}
 			if (ctx.flags & disassembler::S_BIT)
 				store_flags();
@@ -1393,14 +2134,14 @@ DecodeReg:
 			{
 				break_if_pc(ctx.rn);
 				load_flags();
-				s << "\x81\x55" << (char)OFFSET(regs[ctx.rn]); // adc [ebp+rn],
+				reg_op( "\x81", 2, ctx.rn ); // adc [ebp+rn],
 				write( s, ctx.imm );                           // imm
 			} else
 			{
 				load_ecx_reg_or_pc(ctx.rn, ctx.imm);           // ecx = [ebp+rn] + imm
 				load_flags();
 				s << "\x83\xD1" << (char)0;                    // adc ecx, 0				
-				s << "\x89\x4D" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], ecx
+				reg_op( "\x89", emitter::ECX, ctx.rd ); // mov [ebp+rd], ecx
 			}
 			if (ctx.flags & disassembler::S_BIT)
 				store_flags();
@@ -1414,11 +2155,11 @@ DecodeReg:
 
 			if (ctx.rn == ctx.rd)
 			{
-				s << "\x11\x45" << (char)OFFSET(regs[ctx.rn]); // adc [ebp+Rn], eax
+				reg_op( "\x11", emitter::EAX, ctx.rn ); // adc [ebp+Rn], eax
 			} else
 			{
-				s << "\x13\x45" << (char)OFFSET(regs[ctx.rn]); // adc eax, [ebp+Rn]
-				s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+				reg_op( "\x13", emitter::EAX, ctx.rn ); // adc eax, [ebp+Rn]
+				reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 			}
 			if (ctx.flags & disassembler::S_BIT)
 				store_flags();
@@ -1436,11 +2177,11 @@ DecodeReg:
 			s << '\x58'; // pop eax
 			if (ctx.rn == ctx.rd)
 			{
-				s << "\x11\x45" << (char)OFFSET(regs[ctx.rn]); // adc [ebp+Rn], eax
+				reg_op( "\x11", emitter::EAX, ctx.rn ); // adc [ebp+Rn], eax
 			} else
 			{
-				s << "\x13\x45" << (char)OFFSET(regs[ctx.rn]); // adc eax, [ebp+Rn]
-				s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+				reg_op( "\x13", emitter::EAX, ctx.rn ); // adc eax, [ebp+Rn]
+				reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 			}
 			if (ctx.flags & disassembler::S_BIT)
 				store_flags();
@@ -1452,12 +2193,12 @@ DecodeReg:
 		if (ctx.rn == ctx.rd)
 		{
 			break_if_pc(ctx.rn);
-			s << "\x81\x6D" << (char)OFFSET(regs[ctx.rn]); // sub [ebp+rn],
+			reg_op( "\x81", 5, ctx.rn ); // sub [ebp+rn],
 			write( s, ctx.imm );                           // imm
 		} else
 		{
 			load_ecx_reg_or_pc(ctx.rn, (unsigned long)(-(signed long)ctx.imm));
-			s << "\x89\x4D" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], ecx
+			reg_op( "\x89", emitter::ECX, ctx.rd ); // mov [ebp+rd], ecx
 		}
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
@@ -1467,12 +2208,12 @@ DecodeReg:
 			load_shifter_imm();
 			if (ctx.rn == ctx.rd)
 			{
-				s << "\x29\x45" << (char)OFFSET(regs[ctx.rn]); // sub [ebp+Rn], eax
+				reg_op( "\x29", emitter::EAX, ctx.rn ); // sub [ebp+Rn], eax
 			} else
 			{
-				s << "\x8B\x55" << (char)OFFSET(regs[ctx.rn]); // mov edx, [ebp+Rn]
+				reg_op( "\x8B", emitter::EDX, ctx.rn ); // mov edx, [ebp+Rn]
 				s << "\x2B\xD0";                               // sub edx, eax
-				s << "\x89\x55" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], edx
+				reg_op( "\x89", emitter::EDX, ctx.rd ); // mov [ebp+rd], edx
 			}
 			if (ctx.flags & disassembler::S_BIT)
 				store_flags(); // todo: set carry = shifter carry
@@ -1483,10 +2224,10 @@ DecodeReg:
 		{
 			if (!flags_actual)
 				load_flags();
-			s << "\x8B\x45" << (char)OFFSET(regs[ctx.rn]); // mov eax, [ebp+rn]
+			reg_op( "\x8B", emitter::EAX, ctx.rn ); // mov eax, [ebp+rn]
 			s << "\xF5";                                   // cmc
 			s << "\x1D"; write(s, ctx.imm);                // sbb eax, imm
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+			reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 			if (ctx.flags & disassembler::S_BIT)
 			{
 				s << "\xF5";   // cmc
@@ -1506,12 +2247,12 @@ DecodeReg:
 			s << "\xF5";                                   // cmc
 			if (ctx.rn == ctx.rd)
 			{
-				s << "\x19\x4D" << (char)OFFSET(regs[ctx.rn]); // sbb [ebp+Rn], ecx
+				reg_op( "\x19", emitter::ECX, ctx.rn ); // sbb [ebp+Rn], ecx
 			} else
 			{
-				s << "\x8B\x55" << (char)OFFSET(regs[ctx.rn]); // mov edx, [ebp+Rn]
+				reg_op( "\x8B", emitter::EDX, ctx.rn ); // mov edx, [ebp+Rn]
 				s << "\x1B\xD1";                               // sbb edx, ecx
-				s << "\x89\x55" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], edx
+				reg_op( "\x89", emitter::EDX, ctx.rd ); // mov [ebp+rd], edx
 			}
 			if (ctx.flags & disassembler::S_BIT)
 			{
@@ -1528,7 +2269,7 @@ DecodeReg:
 		{
 			if (ctx.imm == 0)
 			{
-				s << "\xF7\x5D" << (char)OFFSET(regs[ctx.rn]); // neg [ebp+Rn]
+				reg_op( "\xF7", 3, ctx.rn ); // neg [ebp+Rn]
 				if (ctx.flags & disassembler::S_BIT)
 					store_flags();
 				break;
@@ -1538,9 +2279,9 @@ DecodeReg:
 			if (ctx.imm == 0)
 			{
 				// dst = neg src
-				s << "\x8B\x45" << (char)OFFSET(regs[ctx.rn]); // mov eax, [ebp+rn]
+				reg_op( "\x8B", emitter::EAX, ctx.rn ); // mov eax, [ebp+rn]
 				s << "\xF7\xD8";                               // neg eax
-				s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+				reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 				if (ctx.flags & disassembler::S_BIT)
 					store_flags();				
 				break;
@@ -1551,13 +2292,13 @@ DecodeReg:
 		// generic form
 		// dst = shifter_imm - rn
 		s << '\xB8'; write(s, ctx.imm);                // mov eax, imm
-		s << "\x2B\x45" << (char)OFFSET(regs[ctx.rn]); // sub eax, [ebp+rn]
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x2B", emitter::EAX, ctx.rn ); // sub eax, [ebp+rn]
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		break;
 	case INST::RSB_R:
 		load_shifter_imm();
-		s << "\x2B\x45" << (char)OFFSET(regs[ctx.rn]); // sub eax, [ebp+rn]
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x2B", emitter::EAX, ctx.rn ); // sub eax, [ebp+rn]
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
 		break;
@@ -1565,8 +2306,8 @@ DecodeReg:
 
 	case INST::ORR_R: // Rd = Rn | shifter_imm
 		load_shifter_imm();
-		s << "\x0B\x45" << (char)OFFSET(regs[ctx.rn]); // or eax, [ebp+Rn]
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x0B", emitter::EAX, ctx.rn ); // or eax, [ebp+Rn]
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		load_carry();
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
@@ -1575,11 +2316,11 @@ DecodeReg:
 		if (!flags_actual)
 			load_flags();
 		s << "\xF5";                                   // cmc
-		s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]); // mov ecx, [ebp+Rn]
+		reg_op( "\x8B", emitter::ECX, ctx.rn ); // mov ecx, [ebp+Rn]
 		s << "\x83\xD1" << '\x00';                     // adc ecx, 0
 		load_shifter_imm();
 		s << "\x2B\xC1";                               // sub eax, ecx
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		if (ctx.flags & disassembler::S_BIT)
 		{
 			s << "\xF5";   // cmc
@@ -1589,12 +2330,12 @@ DecodeReg:
 		/*
 	case INST::SBC_R: // Rd = Rn - shifter - !carry
 		s << "\xF5";                                   // cmc
-		s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]); // mov ecx, [ebp+Rn]
+		reg_op( "\x8B", emitter::ECX, ctx.rn ); // mov ecx, [ebp+Rn]
 		__asm sbb ecx, 0
-		s << "\x1B\x4D" << (char)OFFSET(regs[ctx.rn]); // sbb ecx, 0
+		reg_op( "\x1B", emitter::ECX, ctx.rn ); // sbb ecx, 0
 		load_shifter_imm();
 		s << "\x2B\xC1";                               // sub eax, ecx
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
 		break;
@@ -1607,7 +2348,7 @@ DecodeReg:
 		
 		//s << DEBUG_BREAK;
 		/*
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+Rm]
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+Rm]
 		s << "\x33\xC9"; // xor ecx, ecx
 		s << "\xD1\xE8"; // shr eax, 1
 		s << "\x74\x03"; // jz $+3
@@ -1616,7 +2357,7 @@ DecodeReg:
 
 		s << "\xB8"; write(s, (unsigned long)0x20); // mov eax, 20
 		s << "\x2B\xC1"; // sub eax, ecx
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		//#s << "\x89\x4D" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], ecx
 		*/
 
@@ -1630,11 +2371,11 @@ DecodeReg:
 
 
 		/*
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+Rm]
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+Rm]
 		s << "\xF7\xD0";                               // not eax
 		//s << "\x0F\xBC\xC8";                           // bsf ecx, eax
 		s << "\x0F\xBD\xC8";                           // bsr ecx, eax
-		s << "\x89\x4D" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], ecx
+		reg_op( "\x89", emitter::ECX, ctx.rd ); // mov [ebp+rd], ecx
 		*/
 
 
@@ -1652,26 +2393,26 @@ DecodeReg:
 		
 		/*
 		s << "\x33\xC9";             // xor ecx, ecx
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+Rm]
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+Rm]
 		s << "\xC1\xE8" << (char)1;  // shr eax, 1
 		s << "\x76\x03";             // jbe $+3 (if zero or carry was set exit)
 		s << "\x41";                 // inc ecx
 		s << "\xEB\xF9";             // jmp $-7
 		s << "\x72\x03";             // jc $+1
 		s << "\x41";                 // inc ecx (add 1 more when carry was not set)		
-		s << "\x89\x4D" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], ecx
+		reg_op( "\x89", emitter::ECX, ctx.rd ); // mov [ebp+rd], ecx
 		*/
 
 		
 		s << "\xB9"; write(s, (unsigned long)0xFFFFFFFF); // mov ecx, 0xFFFFFFFF
-		s << "\xC7\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], 
+		reg_op( "\xC7", 0, ctx.rd ); // mov [ebp+rd], 
 		write(s, (unsigned long)32);                   //   32
 		s << "\x8B\xC1";                               // mov eax, ecx
-		s << "\x23\x45" << (char)OFFSET(regs[ctx.rm]); // and eax, [ebp+rm]
+		reg_op( "\x23", emitter::EAX, ctx.rm ); // and eax, [ebp+rm]
 		s << "\x74\x07";                               // jz $+7
 		//s << "\xD1\xE9";                               // shr ecx, 1
 		s << "\xD1\xE1";                               // shr ecx, 1
-		s << "\xFF\x4D" << (char)OFFSET(regs[ctx.rd]); // dec [ebp+rd]
+		reg_op( "\xFF", 1, ctx.rd ); // dec [ebp+rd]
 		s << "\xEB\xF2";                               // jmp $-14
 		break;
 
@@ -1683,10 +2424,10 @@ DecodeReg:
 		
 		// Rd = Rm * Rs + Rn
 		s << "\x33\xD2"; // xor edx, edx
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+rm]
-		s << "\xF7\x65" << (char)OFFSET(regs[ctx.rs]); // mul [ebp+rs]
-		s << "\x03\x45" << (char)OFFSET(regs[ctx.rn]); // add eax, [ebp+Rn]
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+rm]
+		reg_op( "\xF7", 4, ctx.rs ); // mul [ebp+rs]
+		reg_op( "\x03", emitter::EAX, ctx.rn ); // add eax, [ebp+Rn]
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		// flag need to be updated to not be affected by high 32bit...
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
@@ -1694,38 +2435,38 @@ DecodeReg:
 	
 	case INST::UMULL:
 		s << "\x33\xD2"; // xor edx, edx
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+rm]
-		s << "\xF7\x65" << (char)OFFSET(regs[ctx.rs]); // mul [ebp+rs]
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
-		s << "\x89\x55" << (char)OFFSET(regs[ctx.rn]); // mov [ebp+rd], edx 
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+rm]
+		reg_op( "\xF7", 4, ctx.rs ); // mul [ebp+rs]
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EDX, ctx.rn ); // mov [ebp+rd], edx 
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
 		break;
 	case INST::UMLAL:
 		s << "\x33\xD2"; // xor edx, edx
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+rm]
-		s << "\xF7\x65" << (char)OFFSET(regs[ctx.rs]); // mul [ebp+rs]
-		s << "\x01\x45" << (char)OFFSET(regs[ctx.rd]); // add [ebp+rd], eax
-		s << "\x11\x55" << (char)OFFSET(regs[ctx.rn]); // adc [ebp+rd], edx 
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+rm]
+		reg_op( "\xF7", 4, ctx.rs ); // mul [ebp+rs]
+		reg_op( "\x01", emitter::EAX, ctx.rd ); // add [ebp+rd], eax
+		reg_op( "\x11", emitter::EDX, ctx.rn ); // adc [ebp+rd], edx 
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
 		break;
 
 	case INST::SMULL:
 		s << "\x33\xD2"; // xor edx, edx
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+rm]
-		s << "\xF7\x6D" << (char)OFFSET(regs[ctx.rs]); // imul [ebp+rs]
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
-		s << "\x89\x55" << (char)OFFSET(regs[ctx.rn]); // mov [ebp+rd], edx 
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+rm]
+		reg_op( "\xF7", 5, ctx.rs ); // imul [ebp+rs]
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
+		reg_op( "\x89", emitter::EDX, ctx.rn ); // mov [ebp+rd], edx 
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
 		break;
 	case INST::SMLAL:
 		s << "\x33\xD2"; // xor edx, edx
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+rm]
-		s << "\xF7\x6D" << (char)OFFSET(regs[ctx.rs]); // imul [ebp+rs]
-		s << "\x01\x45" << (char)OFFSET(regs[ctx.rd]); // add [ebp+rd], eax
-		s << "\x11\x55" << (char)OFFSET(regs[ctx.rn]); // adc [ebp+rd], edx 
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+rm]
+		reg_op( "\xF7", 5, ctx.rs ); // imul [ebp+rs]
+		reg_op( "\x01", emitter::EAX, ctx.rd ); // add [ebp+rd], eax
+		reg_op( "\x11", emitter::EDX, ctx.rn ); // adc [ebp+rd], edx 
 		if (ctx.flags & disassembler::S_BIT)
 			store_flags();
 		break;
@@ -1736,13 +2477,13 @@ DecodeReg:
 		break_if_pc(ctx.rd);
 
 		
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+rm]
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+rm]
 		s << '\x99';                                   // cdq (sign extend)
 		//s << "\x33\xD2";                               // xor edx, edx (zero extend)
 		//s << "\xF7\x65" << (char)OFFSET(regs[ctx.rs]); // mul [ebp+rs]
 		
-		s << "\xF7\x6D" << (char)OFFSET(regs[ctx.rs]); // imul [ebp+rs]
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\xF7", 5, ctx.rs ); // imul [ebp+rs]
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		s << "\x0B\xC0";                               // or eax, eax // flag update
 
 		
@@ -1752,22 +2493,22 @@ DecodeReg:
 		break;
 
 	case INST::SWP:
-		s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]); // mov ecx, [ebp+rn]
+		reg_op( "\x8B", emitter::ECX, ctx.rn ); // mov ecx, [ebp+rn]
 		s << '\x51'; // push ecx
 		CALLP(load32)
 		s << '\x59'; // pop ecx
-		s << "\x8B\x55" << (char)OFFSET(regs[ctx.rm]); // mov edx, [ebp+rm]
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x8B", emitter::EDX, ctx.rm ); // mov edx, [ebp+rm]
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		CALLP(store32)
 		break;
 
 	case INST::SWPB:
-		s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]); // mov ecx, [ebp+rn]
+		reg_op( "\x8B", emitter::ECX, ctx.rn ); // mov ecx, [ebp+rn]
 		s << '\x51'; // push ecx
 		CALLP(load8u)
 		s << '\x59'; // pop ecx
-		s << "\x8B\x55" << (char)OFFSET(regs[ctx.rm]); // mov edx, [ebp+rm]
-		s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]); // mov [ebp+rd], eax
+		reg_op( "\x8B", emitter::EDX, ctx.rm ); // mov edx, [ebp+rm]
+		reg_op( "\x89", emitter::EAX, ctx.rd ); // mov [ebp+rd], eax
 		CALLP(store8)
 		break;
 
@@ -1781,7 +2522,7 @@ DecodeReg:
 			{
 				CALLP(storecpsr)
 			}
-			s << "\x89\x45" << (char)OFFSET(regs[ctx.rd]);     // mov [ebp+rd], eax
+			reg_op( "\x89", emitter::EAX, ctx.rd );     // mov [ebp+rd], eax
 			break;
 		}
 
@@ -1857,7 +2598,8 @@ DecodeReg:
 				s << '\xB9'; write(s, ctx.imm);                // mov ecx, imm
 				s << '\xBA'; write(s, cpsr_masks[ctx.rn]);     // mov edx, mask
 				CALLP(loadcpsr)
-				s << "\x8B\xE8";                               // mov ebp, eax handle register set swap
+				load_context_eax();                            // handle register set swap
+				reload();
 			}
 			break;
 		}
@@ -1883,7 +2625,7 @@ DecodeReg:
 				if (ctx.rn & 0x7)
 					CALLP(is_priviledged)
 				
-				s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+Rm]
+				reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+Rm]
 				if (ctx.rn != 0xF)
 				{
 					// mask out
@@ -1903,7 +2645,7 @@ DecodeReg:
 			
 			if (ctx.instruction == INST::MSR_SPSR_R)
 			{
-				s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]);     // mov eax, [ebp+Rm]
+				reg_op( "\x8B", emitter::EAX, ctx.rm );     // mov eax, [ebp+Rm]
 				if (ctx.rn != 0xF)
 				{
 					// mask out
@@ -1912,46 +2654,47 @@ DecodeReg:
 				s << "\x89\x45" << (char)OFFSET(spsr);         // mov [ebp+spsr], eax
 			} else
 			{
-				s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+Rm]
+				reg_op( "\x8B", emitter::ECX, ctx.rm ); // mov eax, [ebp+Rm]
 				s << '\xBA'; write(s, cpsr_masks[ctx.rn]);     // mov edx, mask
 				CALLP(loadcpsr)
-				s << "\x8B\xE8";                               // mov ebp, eax handle register set swap
+				load_context_eax();                            // handle register set swap
+				reload();
 			}
 			break;
 		}
 	case INST::TST_I: // TST Rn, imm
 		break_if_pc(ctx.rn);
-		s << "\xF7\x45" << (char)OFFSET(regs[ctx.rn]); // test [ebp+Rm],
+		reg_op( "\xF7", 0, ctx.rn ); // test [ebp+Rm],
 		write( s, ctx.imm );                           // imm
 		store_flags();
 		break;
 	case INST::TST_R:
 		break_if_pc(ctx.rn);
 		load_shifter_imm(); // eax = [ebp+Rm] x shifter
-		s << "\x85\x45" << (char)OFFSET(regs[ctx.rn]); // test [ebp+Rd], eax
+		reg_op( "\x85", emitter::EAX, ctx.rn ); // test [ebp+Rd], eax
 		store_flags();		
 		break;
 
 	case INST::TEQ_I: // TEQ Rn, imm
 		break_if_pc(ctx.rn);
-		s << "\x8B\x45" << (char)OFFSET(regs[ctx.rm]); // mov eax, [ebp+rm]
+		reg_op( "\x8B", emitter::EAX, ctx.rm ); // mov eax, [ebp+rm]
 		s << '\x35'; write( s, ctx.imm );              // xor eax, imm
 		store_flags();
 		break;
 	case INST::TEQ_R:
 		break_if_pc(ctx.rn);
 		load_shifter_imm(); // eax = [ebp+Rm] x shifter
-		s << "\x33\x45" << (char)OFFSET(regs[ctx.rn]); // xor eax, [ebp+Rd]
+		reg_op( "\x33", emitter::EAX, ctx.rn ); // xor eax, [ebp+Rd]
 		store_flags();		
 		break;
 
 	case INST::CMP_I:
 		break_if_pc(ctx.rn);
-		s << "\x81\x7D" << (char)OFFSET(regs[ctx.rn]); // cmp [ebp+Rn],
+		reg_op( "\x81", 7, ctx.rn ); // cmp [ebp+Rn],
 		write(s, ctx.imm);                             // imm
 		/*
 		s << "\xB8"; write( s, (unsigned long)(-(signed long)ctx.imm));             // mov eax, -imm
-		s << "\x03\x45" << (char)OFFSET(regs[ctx.rn]); // add eax, [ebp+Rn]
+		reg_op( "\x03", emitter::EAX, ctx.rn ); // add eax, [ebp+Rn]
 		*/
 
 		s << "\xF5";                                   // cmc
@@ -1960,7 +2703,7 @@ DecodeReg:
 	case INST::CMN_I:
 		break_if_pc(ctx.rn);		
 		s << "\xB8"; write( s, ctx.imm );              // mov eax, imm
-		s << "\x03\x45" << (char)OFFSET(regs[ctx.rn]); // add eax, [ebp+Rn]
+		reg_op( "\x03", emitter::EAX, ctx.rn ); // add eax, [ebp+Rn]
 		store_flags();
 		break;
 
@@ -1968,7 +2711,7 @@ DecodeReg:
 	case INST::CMP_R:
 		break_if_pc(ctx.rn);
 		load_shifter_imm();
-		s << "\x39\x45" << (char)OFFSET(regs[ctx.rn]); // cmp [ebp+Rn], eax
+		reg_op( "\x39", emitter::EAX, ctx.rn ); // cmp [ebp+Rn], eax
 		
 		//s << "\x8B\x4D" << (char)OFFSET(regs[ctx.rn]); // mov ecx, [ebp+rn]
 		//s << "\xF7\xD8";                               // neg eax
@@ -1980,7 +2723,7 @@ DecodeReg:
 	case INST::CMN_R:
 		break_if_pc(ctx.rn);
 		load_shifter_imm();
-		s << "\x03\x45" << (char)OFFSET(regs[ctx.rn]); // add eax, [ebp+Rn]
+		reg_op( "\x03", emitter::EAX, ctx.rn ); // add eax, [ebp+Rn]
 		store_flags();
 		break;
 
@@ -1993,6 +2736,9 @@ DecodeReg:
 			unsigned long num, highest, lowest;
 			bool region;
 			count( ctx.imm, num, lowest, highest, region );
+#ifdef JIT_X64
+			region = false; // the array functions take native words, the registers are 32 bit
+#endif
 			switch (num)
 			{
 			case 0: // spec says this is undefined
@@ -2000,7 +2746,7 @@ DecodeReg:
 				break;
 			case 1: // simple 32bit store
 				load_ecx_single();      // load ecx, start_address
-				s << "\x8B\x55" << (char)OFFSET(regs[highest]); // mov edx, dword ptr [ebp+R_highest]
+				reg_op( "\x8B", emitter::EDX, highest ); // mov edx, dword ptr [ebp+R_highest]
 				CALLP(store32) // dont use array store but simple store here!
 				break;
 			default:
@@ -2012,6 +2758,7 @@ DecodeReg:
 						s << '\x55';            // push ebp
 					else
 					{
+						s.rex( emitter::SLOT == 8, emitter::EAX, emitter::EBP );
 						s << "\x8D\x45" << ofs; // lea eax, [ebp+Rlow]
 						s << '\x50';                // push eax
 					}
@@ -2032,7 +2779,7 @@ DecodeReg:
 					{
 						if (ctx.imm & (1 << i))
 						{
-							s << "\xFF\x75" << (char)OFFSET(regs[i]); // push dword ptr[ebp+Ri]
+							push_reg( i ); // push dword ptr[ebp+Ri]
 						}
 					}
 					s << '\x54';              // push esp
@@ -2040,8 +2787,8 @@ DecodeReg:
 				s << '\x6A' << (char)num; // push num
 				// determine start address
 				push_multiple(num);
-				CALLP(store32_array) 
-				s << "\x83\xC4" << (char)((pop+3) << 2);       // add esp, num*4
+				call_stack( store32_array, 3 );
+				s.add_sp( pop );                                 // add esp, num*4
 			}
 
 			// w-bit is set, update destination register
@@ -2060,6 +2807,9 @@ DecodeReg:
 			bool region;
 			bool special = false; // rn needs backup
 			count( ctx.imm, num, lowest, highest, region );
+#ifdef JIT_X64
+			region = false; // the array functions take native words, the registers are 32 bit
+#endif
 
 			if (ctx.instruction == INST::LDM_W)
 			{
@@ -2069,7 +2819,7 @@ DecodeReg:
 					if (!(((1 << ctx.rn) - 1) & ctx.imm))
 					{
 						// special case keep original
-						s << "\xFF\x75" << (char)OFFSET(regs[ctx.rn]); // push [ebp+rn]
+						push_reg( ctx.rn ); // push [ebp+rn]
 						special = true;
 					} else
 						ctx.instruction = INST::LDM; // keep loaded
@@ -2080,19 +2830,23 @@ DecodeReg:
 			{
 				/* use the "simple" version for simple register bank switchs */
 
-				s << "\x83\xEC" << (char)(num << 2); // sub esp, num*4
+				s.add_sp( -(long)num );              // sub esp, num*4
 				s << '\x54';                         // push esp
 				s << '\x6A' << (char)num;            // push num
 				push_multiple(num);
-				CALLP(load32_array) 
-				s << "\x83\xC4\x0C";                 // add esp, 3*4
+				call_stack( load32_array, 3 );
 				ldm_switchuser();
 				unsigned long mask = ctx.imm;
 				for (int i = 0; i < 16; i++)
 				{
 					if (mask & 1)
 					{
+#ifdef JIT_X64
+						s << "\x41\x5B";                                        // pop r11
+						s.mov_m_r( emitter::EAX, OFFSET(regs[i]), emitter::R11 ); // mov [rax+Ri], r11d
+#else
 						s << "\x8F\x40" << (char)OFFSET(regs[i]); // pop dword ptr[eax+Ri]
+#endif
 					}
 					mask >>= 1;
 				}
@@ -2107,7 +2861,7 @@ DecodeReg:
 			case 1: // simple 32bit store
 				load_ecx_single(); // load ecx, start_address
 				CALLP(load32)      // dont use array load but simple load here!
-				s << "\x89\x45" << (char)OFFSET(regs[highest]); // mov [ebp+R_highest], eax
+				reg_op( "\x89", emitter::EAX, highest ); // mov [ebp+R_highest], eax
 				break;
 			default:
 				if (region) // optimized version when a region Ra-Rb is stored
@@ -2117,29 +2871,28 @@ DecodeReg:
 						s << '\x55';            // push ebp
 					else
 					{
+						s.rex( emitter::SLOT == 8, emitter::EAX, emitter::EBP );
 						s << "\x8D\x45" << ofs; // lea eax, [ebp+Rlow]
 						s << '\x50';            // push eax
 					}
 					s << '\x6A' << (char)num;   // push num
 					push_multiple(num);
-					CALLP(load32_array) // (addr, num, data)
-					s << "\x83\xC4\x0C";        // add esp, 3*4
+					call_stack( load32_array, 3 ); // (addr, num, data)
 				} else
 				{
 					//s << '\x90' << DEBUG_BREAK; // not supported yet
-					s << "\x83\xEC" << (char)(num << 2); // sub esp, num*4
+					s.add_sp( -(long)num );              // sub esp, num*4
 					s << '\x54';                         // push esp
 					s << '\x6A' << (char)num;            // push num
 					push_multiple(num);
-					CALLP(load32_array) 
-					s << "\x83\xC4\x0C";                 // add esp, 3*4
+					call_stack( load32_array, 3 );
 
 					unsigned long mask = ctx.imm;
 					for (int i = 0; i < 16; i++)
 					{
 						if (mask & 1)
 						{
-							s << "\x8F\x45" << (char)OFFSET(regs[i]); // pop dword ptr[ebp+Ri]
+							pop_reg( i ); // pop dword ptr[ebp+Ri]
 						}
 						mask >>= 1;
 					}
@@ -2157,7 +2910,7 @@ DecodeReg:
 				// according to armwrestler
 		
 				if (special)
-					s << "\x8F\x45" << (char)OFFSET(regs[ctx.rn]); // pop dword ptr[ebp+rn]
+					pop_reg( ctx.rn ); // pop dword ptr[ebp+rn]
 				update_dest(num);
 			}
 
@@ -2165,9 +2918,11 @@ DecodeReg:
 			// if PC was specified handle the jump!
 			if (ctx.imm & (1 << 15))
 			{
-				s << "\x8B\x4D" << (char)OFFSET(regs[15]); // mov ecx, [ebp+R15]
+				reg_op( "\x8B", emitter::ECX, 15 ); // mov ecx, [ebp+R15]
 				update_callstack();
-				JMPP(compile_and_link_branch_a)
+				if (ctx.flags & disassembler::S_BIT)
+					JMPP(compile_and_link_branch_a)
+				else jmp_return();
 			}
 		}
 		break;
@@ -2182,62 +2937,591 @@ DecodeReg:
 	default_:
 		s << DEBUG_BREAK; // no idea how to handle this!
 	}
-#endif // JIT CORE
 	if (patch_jump)
 	{
-		std::ostringstream::pos_type cur = s.tellp();
-		size_t off = cur - jmpbyte - 1;
-		if(off >= 128)
+		run_skip = jmpbyte;
+		run_links = links_before;
+		run_first = run_entries.size();
+		run_open = true;
+		patch_jump = false;
+	}
+	if (run_open && !run_next)
+		close_run();
+}
+
+// lets the skip jump of the run head land behind the current instruction
+void compiler::close_run()
+{
+	if (!s.patch8( run_skip ))
+	{
+		// too large for skipping with a short jump, use a near one
+		s.patch32( s.widen8( run_skip ) );
+		for (size_t i = run_links; i < links.size(); i++)
+			if ((size_t)links[i]->site > run_skip)
+				links[i]->site += 4;
+		for (size_t i = run_first; i < run_entries.size(); i++)
+			run_entries[i].code += 4;
+	}
+	for (size_t i = run_first; i < run_entries.size(); i++)
+		run_entries[i].end = s.tellp();
+	run_open = false;
+}
+
+// x86 condition code under which an instruction with condition c is
+// skipped, emits the cmc needed by HI and LS as they read the carry
+// the other way round (conditions are _reversed_ as in a jump taken
+// means the instruction will _not_ be executed)
+int compiler::skip_condition(CONDITION::CODE c)
+{
+	switch (c)
+	{
+	case CONDITION::EQ: return 0x5; // jnz  (ZF = 0)              Z=1
+	case CONDITION::NE: return 0x4; // jz   (ZF = 1)              Z=0
+	case CONDITION::CS: return 0x3; // jnc  (CF = 0)              C=1
+	case CONDITION::CC: return 0x2; // jc   (CF = 1)              C=0
+	case CONDITION::MI: return 0x9; // jns  (SF = 0)              N=1
+	case CONDITION::PL: return 0x8; // js   (SF = 1)              N=0
+	case CONDITION::VS: return 0x1; // jno  (OF = 0)              V=1
+	case CONDITION::VC: return 0x0; // jo   (OF = 1)              V=0
+	case CONDITION::HI: s << '\xF5'; return 0x6; // jbe  (CF = 1 or  ZF = 1)   C=1 Z=0 (needs cmc!)
+	case CONDITION::LS: s << '\xF5'; return 0x7; // jnbe (CF = 0 and ZF = 0)   C=0 Z=1 (needs cmc!)
+	case CONDITION::GE: return 0xC; // jl   (SF != OF)            N==V
+	case CONDITION::LT: return 0xD; // jge  (SF == OF)            N!=V
+	case CONDITION::GT: return 0xE; // jle  (ZF = 0 or  SF != OF) Z==0 or N==V (needs OF swap!)
+	case CONDITION::LE: return 0xF; // jg   (ZF = 0 and SF == OF) Z==1 or N!=V
+	default:
+		assert(0);
+		return 0x0;
+	}
+}
+
+// a lone predicated move or immediate ALU op gets its result selected
+// with cmovcc rather than jumped around
+// returns false (emitting nothing) for anything else
+bool compiler::predicate_cmov(int flags_actual)
+{
+	if ((ctx.flags & disassembler::S_BIT) || (ctx.rd == 15))
+		return false;
+	const char *op = 0;
+	unsigned long imm = ctx.imm;
+	switch (ctx.instruction)
+	{
+	case INST::MOV_I:
+		break;
+	case INST::MOV_R:
+		if ((ctx.imm != 0) || (ctx.shift != SHIFT::LSL) || (ctx.rm == 15) || (ctx.rm == ctx.rd))
+			return false;
+		break;
+	case INST::ADD_I: op = "\x81\xC2"; break; // add edx, imm
+	case INST::SUB_I: op = "\x81\xEA"; break; // sub edx, imm
+	case INST::AND_I: op = "\x81\xE2"; break; // and edx, imm
+	case INST::ORR_I: op = "\x81\xCA"; break; // or edx, imm
+	case INST::EOR_I: op = "\x81\xF2"; break; // xor edx, imm
+	case INST::BIC_I: op = "\x81\xE2"; imm = ~imm; break;
+	default:
+		return false;
+	}
+
+	// edx = the value rd gets if the condition holds
+	if (op)
+	{
+		if (ctx.rn == 15)
+			return false;
+		reg_op( "\x8B", emitter::EDX, ctx.rn ); // mov edx, [ebp+rn]
+		s << op; write( s, imm );                // op edx, imm
+		flags_actual = 0;
+	} else if (ctx.instruction == INST::MOV_I)
+	{
+		s << '\xBA'; write( s, imm );           // mov edx, imm
+	} else reg_op( "\x8B", emitter::EDX, ctx.rm ); // mov edx, [ebp+rm]
+
+	reg_op( "\x8B", emitter::ECX, ctx.rd );     // mov ecx, [ebp+rd]
+	if (!flags_actual)
+		load_flags();
+	int cc = skip_condition( ctx.cond ) ^ 1;
+	s << '\x0F' << (char)(0x40 + cc);           // cmov<cc> ecx, edx
+	s.modrm( 3, emitter::ECX, emitter::EDX );
+	reg_op( "\x89", emitter::ECX, ctx.rd );     // mov [ebp+rd], ecx
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// IR lowering
+//
+// A segment is emitted as a whole and counted at once. The registers are
+// accessed through reg_op like everywhere else, eax and edx are scratch.
+// EFLAGS get clobbered (the flags of S forms in a segment are dead).
+
+void compiler::emit_ir(const ir::code &code)
+{
+#ifdef CLOCK_CYCLES
+	s << "\x83\xC3" << (char)code.size(); // add ebx, len
+#endif
+	for (size_t k = 0; k < code.size(); k++)
+		lower_ir( code[k] );
+	flags_updated = 0;
+}
+
+// r = operand
+void compiler::load_operand(emitter::reg r, const ir::operand &o)
+{
+	if (o.is_imm)
+	{
+		s.mov_r_i( r, o.imm );                 // mov r, imm
+		return;
+	}
+	reg_op( "\x8B", r, o.reg );                // mov r, [ebp+reg]
+	if (o.amount == 0)
+		return;
+	int ext;
+	switch (o.shift)
+	{
+	case SHIFT::LSL: ext = 4; break;           // shl
+	case SHIFT::LSR: ext = 5; break;           // shr
+	case SHIFT::ASR: ext = 7; break;           // sar
+	default:         ext = 1; break;           // ror
+	}
+	s << '\xC1'; s.modrm( 3, ext, r ); s << (char)o.amount; // shift r, amount
+}
+
+void compiler::lower_ir(const ir::inst &i)
+{
+	int ext;   // opcode extension of op r/m, imm32
+	char op;   // op r/m, reg
+	switch (i.op)
+	{
+	case ir::NOP:
+		return;
+	case ir::MOV:
+	case ir::MVN:
+		if (i.b.is_imm)
 		{
-			//char buffer[100];
-			//sprintf_s(buffer, 100, "Generated code too large: %i", off );
-			//MessageBoxA(0,buffer,0,0);
-			std::cerr << "Generated code too large: " << off << "\n";			
-			assert(0);
+			reg_op( "\xC7", 0, i.rd );         // mov [ebp+rd], imm32
+			write( s, i.op == ir::MVN ? ~i.b.imm : i.b.imm );
+			return;
 		}
-		s.seekp( jmpbyte );
-		s << (char)off;
-		s.seekp( cur );
-		patch_jump = false;
+		load_operand( emitter::EAX, i.b );
+		if (i.op == ir::MVN)
+			s << "\xF7\xD0";                   // not eax
+		reg_op( "\x89", emitter::EAX, i.rd );  // mov [ebp+rd], eax
+		return;
+	case ir::ADD: ext = 0; op = '\x01'; break;
+	case ir::ORR: ext = 1; op = '\x09'; break;
+	case ir::AND:
+	case ir::BIC: ext = 4; op = '\x21'; break;
+	case ir::SUB:
+	case ir::RSB: ext = 5; op = '\x29'; break;
+	case ir::EOR: ext = 6; op = '\x31'; break;
+	default:
+		assert(0);
+		return;
+	}
+
+	// RSB is a SUB with the operands swapped
+	const ir::operand &a = (i.op == ir::RSB) ? i.b : i.a;
+	const ir::operand &b = (i.op == ir::RSB) ? i.a : i.b;
+	if (b.is_imm)
+	{
+		unsigned long imm = (i.op == ir::BIC) ? ~b.imm : b.imm;
+		if (!a.is_imm && (a.reg == i.rd) && (a.amount == 0))
+		{
+			reg_op( "\x81", ext, i.rd );       // op [ebp+rd], imm
+			write( s, imm );
+			return;
+		}
+		load_operand( emitter::EAX, a );
+		s << '\x81'; s.modrm( 3, ext, emitter::EAX ); write( s, imm ); // op eax, imm
+	} else
+	{
+		load_operand( emitter::EAX, a );
+		load_operand( emitter::EDX, b );
+		if (i.op == ir::BIC)
+			s << "\xF7\xD2";                   // not edx
+		s << op; s.modrm( 3, emitter::EDX, emitter::EAX ); // op eax, edx
+	}
+	reg_op( "\x89", emitter::EAX, i.rd );      // mov [ebp+rd], eax
+}
+
+// leaves the plain copy of a segment for the code behind it
+// that code may assume the cached register was spilled already
+void compiler::resume_segment(size_t pos)
+{
+	if (cached_reg >= 0)
+	{
+		cache_dirty = true;
+		spill();
+	}
+	s << '\xE9'; write( s, (unsigned long)(pos - (s.tellp() + 4)) ); // jmp resume
+}
+
+// entry for a run member jumped to directly (see compile_instruction)
+// checks the condition the run head would have checked
+void compiler::run_entry_stub(const run_entry &e)
+{
+#ifdef CLOCK_CYCLES
+	s << "\x8D\x5B" << (char)e.cycles; // lea ebx, [ebx+left in run]
+#endif
+	load_flags();
+	s << '\x0F' << (char)(0x80 + skip_condition( e.cond ));     // j<skip> end of run
+	write( s, (unsigned long)(e.end - (s.tellp() + 4)) );
+	s << '\xE9'; write( s, (unsigned long)(e.code - (s.tellp() + 4)) ); // jmp instruction
+}
+
+void compiler::flag_entry_stub(const flag_entry &e)
+{
+	load_flags();
+	s << '\xE9'; write( s, (unsigned long)(e.code - (s.tellp() + 4)) ); // jmp instruction
+}
+
+// true if predicate_cmov handles the instruction straight from EFLAGS
+// without touching them, so a flag store before it can be deferred
+bool compiler::keeps_flags(const disassembler::context &c)
+{
+	if ((c.cond == CONDITION::AL) || (c.cond == CONDITION::NV) ||
+		(c.flags & disassembler::S_BIT) || (c.rd == 15))
+		return false;
+	switch (c.instruction)
+	{
+	case INST::MOV_I:
+		return true;
+	case INST::MOV_R:
+		return (c.imm == 0) && (c.shift == SHIFT::LSL) && (c.rm != 15) && (c.rm != c.rd);
+	default:
+		return false;
 	}
 }
 
-void compiler::epilogue(char *&mem, size_t &size)
+// true if an instruction leaves the flags alone when executed, so
+// instructions with the same condition after it can share its skip jump
+bool compiler::run_transparent(const disassembler::context &c)
+{
+	disassembler::context u = c;
+	u.cond = CONDITION::AL;
+	return (flag_usage( u ) == 0) && !ends_piece( c );
+}
+
+// true if the instruction never continues with the next one
+// (so a piece compiled from an entry point can end behind it)
+bool compiler::ends_piece(const disassembler::context &c)
+{
+	if (c.cond != CONDITION::AL)
+		return false;
+	switch (c.instruction)
+	{
+	case INST::B:
+	case INST::BX:
+	case INST::UD:
+	case INST::UNKNOWN:
+		return true;
+	case INST::LDM:
+	case INST::LDM_W:
+		return (c.imm & 0x8000) != 0;
+	case INST::AND_I: case INST::EOR_I: case INST::SUB_I: case INST::RSB_I:
+	case INST::ADD_I: case INST::ADC_I: case INST::SBC_I: case INST::RSC_I:
+	case INST::ORR_I: case INST::MOV_I: case INST::BIC_I: case INST::MVN_I:
+	case INST::AND_R: case INST::EOR_R: case INST::SUB_R: case INST::RSB_R:
+	case INST::ADD_R: case INST::ADC_R: case INST::SBC_R: case INST::RSC_R:
+	case INST::ORR_R: case INST::MOV_R: case INST::BIC_R: case INST::MVN_R:
+	case INST::AND_RR: case INST::EOR_RR: case INST::SUB_RR: case INST::RSB_RR:
+	case INST::ADD_RR: case INST::ADC_RR: case INST::SBC_RR: case INST::RSC_RR:
+	case INST::ORR_RR: case INST::MOV_RR: case INST::BIC_RR: case INST::MVN_RR:
+	case INST::LDR_I: case INST::LDR_IW: case INST::LDR_IP: case INST::LDR_IPW:
+	case INST::LDR_R: case INST::LDR_RW: case INST::LDR_RP: case INST::LDR_RPW:
+		return c.rd == 15;
+	default:
+		return false;
+	}
+}
+
+// how the instruction uses the ARM flags kept in x86_flags
+// FLAGS_WRITE is only reported for unconditional complete updates
+// anything not known to leave the flags alone counts as reading them
+// (calls, branches and debug breaks out of the piece expect them stored)
+int compiler::flag_usage(const disassembler::context &c)
+{
+	if (c.cond == CONDITION::NV)
+		return 0;
+	if (c.shift == SHIFT::RRX)
+		return FLAGS_READ;
+	int usage = (c.cond != CONDITION::AL) ? FLAGS_READ : 0;
+	switch (c.instruction)
+	{
+	case INST::TST_I: case INST::TEQ_I: case INST::CMP_I: case INST::CMN_I:
+	case INST::TST_R: case INST::TEQ_R: case INST::CMP_R: case INST::CMN_R:
+		return usage ? usage : FLAGS_WRITE;
+	case INST::AND_I: case INST::EOR_I: case INST::SUB_I: case INST::RSB_I:
+	case INST::ADD_I: case INST::ORR_I: case INST::MOV_I: case INST::BIC_I:
+	case INST::AND_R: case INST::EOR_R: case INST::SUB_R: case INST::RSB_R:
+	case INST::ADD_R: case INST::ORR_R: case INST::MOV_R: case INST::BIC_R:
+	case INST::MVN_R: case INST::ORR_RR: case INST::MOV_RR:
+		if (c.rd == 15)
+			return FLAGS_READ;
+		if ((c.flags & disassembler::S_BIT) && !usage)
+			return FLAGS_WRITE;
+		return usage;
+	case INST::MVN_I: // never stores the flags
+		if (c.rd == 15)
+			return FLAGS_READ;
+		return usage;
+	case INST::LDR_I: case INST::LDR_IP: case INST::LDR_IPW:
+	case INST::LDR_R: case INST::LDR_RP: case INST::LDR_RPW:
+		if (c.rd == 15)
+			return FLAGS_READ;
+		return usage;
+	case INST::LDM:
+	case INST::LDM_W:
+		if (c.imm & 0x8000)
+			return FLAGS_READ;
+		return usage;
+	case INST::STR_I: case INST::STR_IW: case INST::STR_IP: case INST::STR_IPW:
+	case INST::STRB_I: case INST::STRB_IP: case INST::STR_RP: case INST::STRB_RP:
+	case INST::LDRB_I: case INST::LDRB_IP: case INST::LDRB_IPW: case INST::LDRB_RP:
+	case INST::STRX_I: case INST::STRX_IP: case INST::STRX_RP:
+	case INST::LDRX_IP: case INST::LDRX_IPW: case INST::LDRX_RP:
+	case INST::STM: case INST::STM_W:
+	case INST::CLZ: case INST::SWP: case INST::SWPB:
+	case INST::BPRE: case INST::PLD_I: case INST::PLD_R:
+		return usage;
+	case INST::MUL_R: case INST::MLA_R:
+	case INST::UMULL: case INST::UMLAL: case INST::SMULL: case INST::SMLAL:
+		// the S forms only update part of the flags
+		if (c.flags & disassembler::S_BIT)
+			return FLAGS_READ;
+		return usage;
+	default:
+		return FLAGS_READ;
+	}
+}
+
+void compiler::epilogue(unsigned int next)
 {
 	//s << DEBUG_BREAK << '\xC3'; // terminate with int 3 and return
 
-	// branch to next page
+	// branch to the instruction following the piece
+	// (the start of the next page if the piece ends the page)
 	load_r15_ecx();
-	s << "\x81\xC1"; write( s, (unsigned long)PAGING::SIZE);  // add ecx, imm
-	s << "\x89\x4D" << (char)OFFSET(regs[15]); // mov [ebp+r15], ecx
-	JMPP(compile_and_link_branch_a)
-	//s << "\xFF\xE0";                           // jmp eax
+	s << "\x81\xC1"; write( s, (unsigned long)next << INST_BITS);  // add ecx, imm
+	reg_op( "\x89", emitter::ECX, 15 ); // mov [ebp+r15], ecx
+	if ((next << INST_BITS) == PAGING::SIZE)
+	{
+		page_exit = (int)links.size();
+		if (trace_page)
+		{
+			trace_guard();
+			return;
+		}
+	}
+	link_branch();
 	
 	// some instruction reaches end of block
 	// this has to be replaced with a jump to the next block
+}
 
-	size = s.tellp();
-	mem = new char[size];
-	if (mprotect2( mem, size, PROT_READ | PROT_WRITE | PROT_EXEC ) != 0)
-		logging<_DEFAULT>::log("Failed to adjust JIT memory to executable");
+// enters the trace into the next page if ecx is the address recorded for
+// it and its code did not change, else falls back to a usual site
+// skips the interrupt check, the branches within the trace still do it
+void compiler::trace_guard()
+{
+	s << "\x81\xF9"; write( s, (unsigned long)trace_addr );             // cmp ecx, addr
+	size_t miss = s.jcc8( 5 );                                            // jnz miss
+#ifdef JIT_X64
+	s.mov_r_p( emitter::EAX, &trace_page->flags );                        // mov rax, &flags
+	s << "\xF7\x00"; write( s, trace_dirty );                              // test dword ptr [rax], dirty
+	size_t dirty = s.jcc8( 5 );                                           // jnz miss
+	s.mov_r_p( emitter::EAX, trace_page );                                // mov rax, page
+	s << "\x48\xA3"; WRITE_P(last_page);                                  // mov [last_page], rax
+#else
+	s << "\xF7\x05"; WRITE_P(&trace_page->flags); write( s, trace_dirty ); // test dword ptr [flags], dirty
+	size_t dirty = s.jcc8( 5 );                                           // jnz miss
+	s << "\xC7\x05"; WRITE_P(last_page); WRITE_P(trace_page);             // mov dword ptr [last_page], page
+#endif
+	s << '\xE9'; trace_jump = tellp(); write( s, (unsigned long)0 );     // jmp trace
+	// miss:
+	s.patch8( miss );
+	s.patch8( dirty );
+	link_branch();
+}
 
-#pragma warning(push)
-#pragma warning(disable: 4996)
-	s.str().copy( mem, size );
-#pragma warning(push)
+bool compiler::finish(char *&mem, size_t &size)
+{
+	size = s.code_size(); // may hit the thunk limit
+	if (s.failed())
+		return false;
+	mem = code_arena::allocate( size );
+	if (!mem)
+		return false; // too large or out of JIT memory
+
+	// copy and relocate all relative addresses
+	s.relocate( code_arena::writable(mem), mem );
+	return true;
+}
+#undef OFFSET
 
+size_t compiler::tellp()
+{
+	return s.tellp();
+}
 
-	// relocate all relative addresses
-	for (std::list<unsigned long>::iterator it = reloc_table.begin(); 
-		it != reloc_table.end(); ++it)
+#ifdef JIT_CACHE
+// host objects cached code may refer to, filled from init_cpu
+// the order is part of the cache format (see jit_cache::CODEGEN_VERSION)
+size_t compiler::host_symbols(jit_cache::symbol *syms)
+{
+	const void* funcs[] = {
+		store32, store16, store8, store32_array,
+		load32, load16u, load16s, load8u, load32_array, mem_pages,
+		loadcpsr, storecpsr, pushcallstack, popcallstack,
+		compile_and_link_branch_a, compile_and_link_branch_l, compile_and_link_branch_c,
+		irq_signaled, last_page, remap_tcm, is_priviledged, swi, debug_magic, idle_hook,
+		&unlinked_flags
+	};
+	size_t n = sizeof(funcs) / sizeof(funcs[0]);
+	for (size_t i = 0; i < n; i++)
 	{
-		char** c = (char**)&mem[*it];
-		*c -= (size_t)c;
+		syms[i].p = funcs[i];
+		syms[i].size = 1; // only the address itself
 	}
+	syms[n].p = returns;
+	syms[n].size = sizeof(*returns);
+	return n + 1;
 }
-#undef OFFSET
 
-std::ostringstream::pos_type compiler::tellp()
+// classifies a host address embedded in the code for the cache
+// returns false if it cannot be persisted
+bool compiler::symbol(const void *p, jit_cache::reloc &r)
 {
-	return s.tellp();
+	r.kind = jit_cache::SYM_NULL;
+	r.value = 0;
+	if (!p)
+		return true;
+	for (size_t i = 0; i < links.size(); i++)
+	{
+		if (links[i] == p)
+		{
+			r.kind = jit_cache::SYM_LINK;
+			r.value = (long long)i;
+			return true;
+		}
+	}
+	jit_cache::symbol syms[MAX_SYMBOLS];
+	size_t n = host_symbols( syms );
+	r.kind = jit_cache::SYM_HOST;
+	return jit_cache::to_symbol( syms, n, p, r.value );
+}
+
+const void* compiler::resolve(const jit_cache::reloc &r)
+{
+	switch (r.kind)
+	{
+	case jit_cache::SYM_LINK: return links[(size_t)r.value];
+	case jit_cache::SYM_HOST:
+		{
+			jit_cache::symbol syms[MAX_SYMBOLS];
+			size_t n = host_symbols( syms );
+			return jit_cache::from_symbol( syms, n, r.value );
+		}
+	}
+	return 0;
+}
+
+// true if the relocation r of width bytes lies within size bytes of code
+// and refers to one of the n symbols of syms or a link site
+bool compiler::valid_reloc(const jit_cache::reloc &r, size_t width, size_t size, size_t sites,
+	const jit_cache::symbol *syms, size_t n)
+{
+	if ((r.at > size) || (size - r.at < width))
+		return false;
+	switch (r.kind)
+	{
+	case jit_cache::SYM_HOST:
+		return jit_cache::from_symbol( syms, n, r.value ) != 0;
+	case jit_cache::SYM_NULL:
+		return true;
+	case jit_cache::SYM_LINK:
+		return (r.value >= 0) && ((unsigned long long)r.value < sites);
+	}
+	return false;
 }
+
+// refills the emitter with the cached piece for k
+// remap gets the code offsets into the piece as compile would set them
+bool compiler::restore(const jit_cache::key &k, unsigned short *remap, std::vector<unsigned long> &exits,
+	code_map &used)
+{
+	jit_cache::entry e;
+	if (!jit_cache::find( k, e ) || (e.remap.size() != (size_t)(k.end - k.start)))
+		return false;
+
+	// the file might be damaged, nothing may point outside the code
+	size_t size = e.code.size();
+	if (!size || (size > emitter::CAPACITY) || (e.relocs.size() > emitter::MAX_RELOCS) || 
+		(e.ptrs.size() > emitter::MAX_PTRS))
+		return false;
+	jit_cache::symbol syms[MAX_SYMBOLS];
+	size_t n = host_symbols( syms );
+	for (size_t i = 0; i < e.relocs.size(); i++)
+		if (!valid_reloc( e.relocs[i], 4, size, e.sites.size(), syms, n ))
+			return false;
+	for (size_t i = 0; i < e.ptrs.size(); i++)
+		if (!valid_reloc( e.ptrs[i], sizeof(void*), size, e.sites.size(), syms, n ))
+			return false;
+	for (size_t i = 0; i < e.sites.size(); i++)
+		if ((e.sites[i] > size) || (size - e.sites[i] < LINK_SIZE))
+			return false;
+	for (size_t i = 0; i < e.remap.size(); i++)
+		if (e.remap[i] >= size)
+			return false;
+
+	s.load( &e.code[0], e.code.size() );
+	for (size_t i = 0; i < e.sites.size(); i++)
+	{
+		block_link *l = new block_link;
+		l->site = (char*)0 + e.sites[i];
+		l->from = 0;
+		l->to = 0;
+		links.push_back(l);
+	}
+	for (size_t i = 0; i < e.relocs.size(); i++)
+		s.add_relocation( e.relocs[i].at, resolve( e.relocs[i] ) );
+	for (size_t i = 0; i < e.ptrs.size(); i++)
+		s.add_pointer( e.ptrs[i].at, resolve( e.ptrs[i] ) );
+	for (size_t i = 0; i < e.remap.size(); i++)
+		remap[k.start + i] = (unsigned short)e.remap[i];
+	exits.insert( exits.end(), e.exits.begin(), e.exits.end() );
+	used = e.used;
+	return true;
+}
+
+// hands the piece just compiled to the cache
+// needs the state before the links got relocated
+void compiler::store(const jit_cache::key &k, const unsigned short *remap, 
+	const std::vector<unsigned long> &exits, size_t first_exit, const code_map &used)
+{
+	jit_cache::entry e;
+	e.k = k;
+	e.used = used;
+	e.code.assign( s.data(), s.data() + s.tellp() );
+	for (size_t i = 0; i < s.relocations(); i++)
+	{
+		jit_cache::reloc r;
+		if (!symbol( s.relocation_target(i), r ))
+			return;
+		r.at = (unsigned int)s.relocation(i);
+		e.relocs.push_back( r );
+	}
+	for (size_t i = 0; i < s.pointers(); i++)
+	{
+		jit_cache::reloc r;
+		if (!symbol( s.get_pointer( s.pointer(i) ), r ))
+			return;
+		r.at = (unsigned int)s.pointer(i);
+		e.ptrs.push_back( r );
+	}
+	for (unsigned int i = k.start; i < k.end; i++)
+		e.remap.push_back( remap[i] );
+	for (size_t i = 0; i < links.size(); i++)
+		e.sites.push_back( (unsigned int)(links[i]->site - (char*)0) );
+	e.exits.assign( exits.begin() + first_exit, exits.end() );
+	jit_cache::add( e );
+}
+#endif
@@ -1,22 +1,30 @@
 #ifndef _COMPILER_H_
 #define _COMPILER_H_
 
-// replaces the JIT with a nearly pure HL core
+// interprets everything the HL core has handlers for, the JIT only runs
+// what it cannot (see memory_block::interpreted)
 #undef HLE_CORE
 
+// compile pages piecewise starting at the entry points actually branched
+// to, rather than all instructions of a page at once
+// keeps literal pools and data out of the JIT
+#define JIT_ENTRY_BLOCKS
+
 // todo: pull all methods to template based versions rather than using 
 // init_cpu / init_mode to gain some more performance
 
 #include <map>
 #include <sstream>
 #include <list>
+#include <vector>
 #include "forward.h"
 #include "Disassembler.h"
 #include "Mem.h"
-
-#ifdef HLE_CORE
-#include "HLCore.h"
-#endif
+#include "Emitter.h"
+#include "CodeArena.h"
+#include "CompiledBlock.h"
+#include "JitCache.h"
+#include "IR.h"
 
 #define STRINGIFY(x) #x
 #define TOSTRING(x)  STRINGIFY(x)
@@ -41,15 +49,106 @@ inline void DebugBreak_()
 class compiler
 {
 private:
-	std::ostringstream s;
-	std::list<unsigned long> reloc_table;
+	emitter s;
+	std::vector<block_link*> links;
 	int flags_updated;
 	//unsigned long preoff; // for thumb BPRE
 	disassembler::context ctx;
 	compiler();
 	int INST_BITS;
 	unsigned int inst;
-	unsigned long lookahead_s;
+	const char *literals; // page memory to fold pc relative loads from (0 = never)
+	code_map used;        // the parts of the page the code depends on
+	bool flags_dead; // flags written by the instruction are never read
+
+	// lazy flag stores (see store_flags)
+	bool flags_pending;    // the flags are only held in EFLAGS, x86_flags is stale
+	bool next_keeps_flags; // the next instruction runs on EFLAGS without touching them
+	bool flags_live_out;   // the flags are read after this instruction
+	static bool keeps_flags(const disassembler::context &c);
+	void flush_flags();
+	void save_flags();
+
+	// instructions compiled while EFLAGS hold the flags (flags_updated) are
+	// entered from elsewhere through a stub loading them first
+	struct flag_entry
+	{
+		unsigned int inst;
+		size_t code; // code of the instruction
+	};
+	std::vector<flag_entry> flag_entries;
+	void flag_entry_stub(const flag_entry &e);
+
+	// segments compiled through the IR (see IR.h)
+	// the instructions behind the first one are entered through a plain
+	// copy of the rest of the segment, as the optimized code relies on
+	// what the instructions before computed
+	struct ir_segment
+	{
+		unsigned int first; // first instruction entered through the copy
+		unsigned int end;
+		size_t resume;      // code following the segment
+	};
+	std::vector<ir_segment> ir_segments;
+	void emit_ir(const ir::code &code);
+	void lower_ir(const ir::inst &i);
+	void load_operand(emitter::reg r, const ir::operand &o);
+	void resume_segment(size_t pos);
+
+	// tiers: the baseline code skips the analysis below and counts its
+	// branches down, the optimizing tier compiles hot blocks again
+	bool optimize;            // compiling for the optimizing tier
+	int *heat;                // countdown of the baseline block (0 = none)
+	unsigned long *hot_flags; // page flags to set hot_flag in once hot
+	unsigned long hot_flag;
+	void count_branch();
+
+	// traces: a hot piece falling through the end of its page continues
+	// with the code of the next page (see emit_trace)
+	int page_exit;            // link of the site falling through to the next page (-1 = none)
+	memory_block *trace_page; // page to continue into (0 = none)
+	unsigned long trace_addr; // ARM address of that page recorded for the block
+	unsigned long trace_dirty;
+	size_t trace_jump;        // jump of the guard into the trace to patch (0 = none)
+	code_map trace_used;      // the parts of the next page the trace depends on
+	void trace_guard();
+
+	// idle loop detection (see find_idle_loop)
+	enum { MAX_IDLE_LOOP = 8 };
+	bool idle_branch;                 // the B being compiled closes an idle loop
+	disassembler::context idle_load;  // the load watched by the idle hook
+	unsigned int idle_load_inst;
+	unsigned long idle_size;          // its size, 0 = nothing to watch
+
+	// Thumb BL prefix folded into the suffix following it (see INST::BPRE)
+	bool fuse_bpre;     // the prefix being compiled is to be folded
+	bool bpre_fused;    // a folded prefix waits for its suffix
+	unsigned long bpre_imm;
+
+	// predicated runs: consecutive instructions with the same condition
+	// share the skip jump of the first one (see compile_instruction)
+	struct run_entry
+	{
+		unsigned int inst;
+		size_t code;          // code of the instruction
+		size_t end;           // behind the run
+		CONDITION::CODE cond;
+		unsigned int cycles;  // instructions left in the run
+	};
+	enum { MAX_RUN = 32 };
+	bool run_member;        // the condition was checked by the run head
+	bool run_next;          // the following instruction joins the run
+	unsigned int run_left;  // instructions left in the run including this one
+	bool run_open;          // the skip jump of the run head waits for patching
+	size_t run_skip;
+	size_t run_links;
+	size_t run_first;
+	std::vector<run_entry> run_entries; // members, they get entry stubs
+	void close_run();
+	void run_entry_stub(const run_entry &e);
+	static bool run_transparent(const disassembler::context &c);
+	int skip_condition(CONDITION::CODE c);
+	bool predicate_cmov(int flags_actual);
 
 
 	// helper funcs
@@ -74,6 +173,7 @@ private:
 	void generic_store_p();
 	void generic_store_r();
 	void generic_load();
+	bool fold_literal();
 	void generic_load_r();
 	void generic_load_rs(bool post, bool wb);
 	void generic_loadstore_shift();
@@ -101,18 +201,92 @@ private:
 	void update_callstack();
 	void add_ecx_bpre();
 	void load_r15_ecx();
+	void link_branch(bool chained = false);
+	enum { IC_WAYS = 2 }; // targets cached per indirect branch
+	void jmp_indirect();
+	size_t push_return();
+	void return_pad(size_t at);
+	void jmp_return();
+	void idle_wait();
+	static bool idle_instruction(const disassembler::context &c, 
+		unsigned long &reads, unsigned long &writes, unsigned long &size);
+
+	// checks if the backward branch at branch to target closes a loop that
+	// just polls memory: loads, compares and computations on registers
+	// without anything carried over between iterations. such a loop only
+	// ends once an interrupt or some other component changes the memory
+	// the first load from an address invariant in the loop gets watched
+	template <typename U>
+	bool find_idle_loop(const typename U::T *p, unsigned int target, unsigned int branch)
+	{
+		disassembler d;
+		unsigned long live_in = 0, written = 0;
+		bool watch = false;
+		idle_size = 0;
+		for (unsigned int i = target; i < branch; i++)
+		{
+			unsigned long reads, writes, size;
+			d.decode<U>( p[i], 0 );
+			const disassembler::context &c = d.get_context();
+			if (!idle_instruction( c, reads, writes, size ))
+				return false;
+			live_in |= reads & ~written;
+			written |= writes;
+			if (size && !watch)
+			{
+				watch = true;
+				idle_load = c;
+				idle_load_inst = i;
+				idle_size = size;
+			}
+		}
+		if (live_in & written)
+			return false; // something is carried to the next iteration
+		if (idle_size && (written & (1 << idle_load.rn)))
+			idle_size = 0; // address computed within the loop
+		if (branch > target)
+			used.set( target << U::INSTRUCTION_SIZE_LG2, (branch - target) << U::INSTRUCTION_SIZE_LG2 );
+		return true;
+	}
 
-	void compile_instruction();
-	void epilogue(char *&mem, size_t &size);
-	std::ostringstream::pos_type tellp();
-
-	int pushs;
-	void push(unsigned long imm);
+	// host register caching (see Compiler.cpp)
+	enum { MIN_CACHED_USES = 8 };
+	int cached_reg;   // ARM register held in edi for this page (-1 = none)
+	bool cache_dirty; // edi differs from the context copy
+	static void count_reg_uses(const disassembler::context &c, unsigned long *uses);
+	static int choose_cached_reg(const unsigned long *uses);
+	static bool writes_rm(const char *op, int r);
+	void reg_op(const char *op, int r, int n);
+	void push_reg(int n);
+	void pop_reg(int n);
+	void spill();
+	void reload();
+	void call(void *f);
+	bool inline_access(void *f);
+	void call_stack(void *f, int args);
+	void host_call(void *f, bool arg3);
+	void jmp(void *f);
+	void load_context_eax();
 
-#ifdef HLE_CORE
-	void* hlc_funcs[INST::MAX_INSTRUCTIONS];
-	void* hlc_checkflags;
+	void compile_instruction();
+	void epilogue(unsigned int next);
+	bool finish(char *&mem, size_t &size);
+#ifdef JIT_CACHE
+	enum { MAX_SYMBOLS = 32 };
+	size_t host_symbols(jit_cache::symbol *syms);
+	bool symbol(const void *p, jit_cache::reloc &r);
+	const void* resolve(const jit_cache::reloc &r);
+	bool restore(const jit_cache::key &k, unsigned short *remap, std::vector<unsigned long> &exits,
+		code_map &used);
+	static bool valid_reloc(const jit_cache::reloc &r, size_t width, size_t size, size_t sites,
+		const jit_cache::symbol *syms, size_t n);
+	void store(const jit_cache::key &k, const unsigned short *remap, 
+		const std::vector<unsigned long> &exits, size_t first_exit, const code_map &used);
 #endif
+	static bool ends_piece(const disassembler::context &c);
+	enum { FLAGS_READ = 1, FLAGS_WRITE = 2 };
+	static int flag_usage(const disassembler::context &c);
+	size_t tellp();
 
 	void* store32;
 	void* store16;
@@ -123,16 +297,23 @@ private:
 	void* load16s;
 	void* load8u;
 	void* load32_array;
+	void* mem_pages; // memory_map<T> page table
 	void* loadcpsr;
 	void* storecpsr;
 	
 	void* pushcallstack;
 	void* popcallstack;
 	void* compile_and_link_branch_a;
+	void* compile_and_link_branch_l;
+	void* compile_and_link_branch_c;
+	void* irq_signaled;
+	void* last_page;
 	void* remap_tcm;
 	void* is_priviledged;
 	void* swi;
 	void* debug_magic;
+	void* idle_hook;
+	return_stack *returns;
 
 	template <typename T> void* FUNC2PTR(T p)
 	{
@@ -142,7 +323,41 @@ private:
 	}
 
 
+	// layout of a jump site emitted by link_branch
+#ifdef JIT_X64
+	enum {
+		LINK_ADDR   = 17, // imm32: ARM address the site is linked to
+		LINK_MISS   = 22, // rel8: taken if the address does not match
+		LINK_FLAGS  = 25, // imm64: flags of the destination page
+		LINK_DIRTY  = 35, // imm32: dirty mask tested on the destination page
+		LINK_PAGE   = 43, // imm64: memory_block stored to processor<T>::last_page
+		LINK_RELOAD = 61, // 4 bytes: loads r12d for the destination block or nop
+		LINK_JUMP   = 66, // rel32: direct jump into the destination block
+		LINK_SLOW   = 70, // start of the fallback through compile_and_link_branch_l
+		LINK_SIZE   = 85
+	};
+#else
+	enum {
+		LINK_ADDR  = 11, // imm32: ARM address the site is linked to
+		LINK_MISS  = 16, // rel8: taken if the address does not match
+		LINK_FLAGS = 19, // abs32: flags of the destination page
+		LINK_DIRTY = 23, // imm32: dirty mask tested on the destination page
+		LINK_PAGE  = 35, // imm32: memory_block stored to processor<T>::last_page
+		LINK_RELOAD= 39, // 3 bytes: loads edi for the destination block or nop
+		LINK_JUMP  = 43, // rel32: direct jump into the destination block
+		LINK_SLOW  = 47, // start of the fallback through compile_and_link_branch_l
+		LINK_SIZE  = 57
+	};
+#endif
+	static unsigned long unlinked_flags;
+
 public:
+	static void link(block_link *l, compiled_block_links *to, int cached_reg,
+		unsigned long addr, memory_block *page, unsigned long dirty, char *dest);
+	static void unlink(block_link *l);
+	static void chain(block_link *l);
+	static bool linked_to(const block_link *l, unsigned long &addr, memory_block* &page);
+
 	template <typename U> void init_mode()
 	{
 		INST_BITS = U::INSTRUCTION_SIZE_LG2;
@@ -150,11 +365,6 @@ public:
 	
 	template <typename T> void init_cpu()
 	{
-#ifdef HLE_CORE
-		for (int i = 0; i < INST::MAX_INSTRUCTIONS; i++)
-			hlc_funcs[i] = HLCore<T>::funcs[i];
-		hlc_checkflags = HLCore<T>::check_flags;
-#endif
 		store32 = FUNC2PTR(HLE<T>::store32);
 		store16 = FUNC2PTR(HLE<T>::store16);
 		store8 = FUNC2PTR(HLE<T>::store8);
@@ -165,6 +375,7 @@ public:
 		load16s = FUNC2PTR(HLE<T>::load16s);
 		load8u = FUNC2PTR(HLE<T>::load8u);
 		load32_array = FUNC2PTR(HLE<T>::load32_array);
+		mem_pages = (void*)memory_map<T>::pages();
 
 		loadcpsr = FUNC2PTR(HLE<T>::loadcpsr);
 		storecpsr = FUNC2PTR(HLE<T>::storecpsr);
@@ -173,64 +384,438 @@ public:
 		popcallstack = FUNC2PTR(HLE<T>::popcallstack);
 
 		compile_and_link_branch_a = FUNC2PTR(HLE<T>::compile_and_link_branch_a);
+		compile_and_link_branch_l = FUNC2PTR(HLE<T>::compile_and_link_branch_l);
+		compile_and_link_branch_c = FUNC2PTR(HLE<T>::compile_and_link_branch_c);
+		irq_signaled = (void*)&interrupt<T>::signaled;
+		last_page = (void*)&processor<T>::last_page;
 		remap_tcm = FUNC2PTR(HLE<T>::remap_tcm);
 		is_priviledged = FUNC2PTR(HLE<T>::is_priviledged);
 		swi = FUNC2PTR(HLE<T>::swi);
 		debug_magic = FUNC2PTR(HLE<T>::debug_magic);
+		idle_hook = FUNC2PTR(HLE<T>::idle_loop);
+		returns = &HLE<T>::returns;
 	}
 
 
-	template <typename T, typename U>
-	static void compile(compiled_block<U> &cb)
+	// emits the instructions [start, end) of the page
+	template <typename U>
+	void emit_piece(unsigned short *remap, std::vector<unsigned long> &exits, 
+		const typename U::T *p, unsigned int start, unsigned int end)
 	{
-		compiler c;
 		disassembler d;
-		typename U::T* p = (typename U::T*)cb.block->mem;
-		c.init_mode<U>();
-		c.init_cpu<T>();
+		const unsigned int NUM = PAGING::INST<U>::NUM;
+		bpre_fused = false;
+		ir_segments.clear();
+		run_entries.clear();
+		flag_entries.clear();
+		used.set( start << U::INSTRUCTION_SIZE_LG2, (end - start) << U::INSTRUCTION_SIZE_LG2 );
+
+		// predicated runs: an instruction joins the run of the one before
+		// if that has the same condition and leaves the flags alone
+		// instructions branched to statically start a run of their own
+		unsigned char in_run[NUM];
+		memset( in_run, 0, sizeof(in_run) );
+
+		// flag liveness: walking backwards a flag store is dead when an
+		// unconditional update follows before anything reads the flags.
+		// the flags are live when leaving the piece
+		// also mark the static branch targets within the page, as those
+		// may be entered without the flags held in EFLAGS
+		unsigned char dead[NUM];
+		unsigned char live_out[NUM];
+		unsigned char keeps[NUM];
+		unsigned char branch_target[NUM];
+		unsigned char usage[NUM];
+		memset( branch_target, 0, sizeof(branch_target) );
+		for (unsigned int i = start; i < end; i++ )
+		{
+			d.decode<U>( p[i], 0 ); // ,0 => use relative addressing
+			const disassembler::context &c = d.get_context();
+			usage[i] = (unsigned char)flag_usage( c );
+			if (c.instruction == INST::B)
+			{
+				unsigned long target = c.imm + (i << U::INSTRUCTION_SIZE_LG2);
+				if (target < PAGING::SIZE)
+					branch_target[target >> U::INSTRUCTION_SIZE_LG2] = 1;
+				else exits.push_back( target );
+			}
+			if ((i == NUM - 1) && !ends_piece( c ))
+				exits.push_back( PAGING::SIZE ); // falls through to the next page
+		}
+		for (unsigned int i = start, len = 1; i + 1 < end; i++ )
+		{
+			d.decode<U>( p[i], 0 );
+			const disassembler::context c = d.get_context();
+			d.decode<U>( p[i + 1], 0 );
+			if ((c.cond != CONDITION::AL) && (c.cond != CONDITION::NV) && !branch_target[i + 1] &&
+				(d.get_context().cond == c.cond) && run_transparent( c ) && (len < MAX_RUN))
+			{
+				in_run[i + 1] = 1;
+				len++;
+			} else len = 1;
+		}
+		bool live = true;
+		for (unsigned int i = end; i-- > start; )
+		{
+			live_out[i] = live;
+			dead[i] = !live;
+			if (!optimize)
+				continue; // the baseline tier keeps all flags
+			if (usage[i] & FLAGS_WRITE)
+				live = false;
+			if (usage[i] & FLAGS_READ)
+				live = true;
+		}
+
+		// instructions a flag store can be deferred past: predicated by a
+		// cmov on EFLAGS, never entered directly and no shared skip jump
+		memset( keeps, 0, sizeof(keeps) );
+		for (unsigned int i = start; optimize && (i < end); i++ )
+		{
+			d.decode<U>( p[i], 0 );
+			keeps[i] = keeps_flags( d.get_context() ) && !branch_target[i] && !in_run[i] &&
+				!((i + 1 < end) && in_run[i + 1]);
+#ifdef CLOCK_CYCLES
+			if (dead[i])
+				keeps[i] = 0; // counted with an add then
+#endif
+		}
+		flags_pending = false;
 
-		// decode first instruction
-		d.decode<U>( *p++, 0 ); // ,0 => use relative addressing
-		for (int i = 0; i < PAGING::INST<U>::NUM-1; i++ )
+		// unconditional data processing goes through the IR in segments
+		// a static branch target starts a segment of its own
+		unsigned char segment[NUM];
+		memset( segment, 0, sizeof(segment) );
+		for (unsigned int i = start; optimize && (i < end); )
 		{
-			c.ctx = d.get_context();
-			d.decode<U>( *p++, 0 ); // decode next
-			cb.remap[i] = (char*)0 + c.tellp();
-			c.inst = i;
-			const disassembler::context &cnext = d.get_context();
-			c.lookahead_s = (cnext.flags & disassembler::S_BIT);
-			if (c.lookahead_s)
+			unsigned int len = 0;
+			ir::inst op;
+			while ((i + len < end) && (len < ir::MAX_SEGMENT) && (!len || !branch_target[i + len]))
+			{
+				d.decode<U>( p[i + len], 0 );
+				if (!ir::translate( d.get_context(), dead[i + len] != 0, op ))
+					break;
+				len++;
+			}
+			if (len >= 2)
+				segment[i] = (unsigned char)len;
+			i += len ? len : 1;
+		}
+
+		for (unsigned int i = start; i < end; i++ )
+		{
+			d.decode<U>( p[i], 0 );
+			ctx = d.get_context();
+			flags_dead = dead[i] != 0;
+			flags_live_out = live_out[i] != 0;
+			next_keeps_flags = (i + 1 < end) && keeps[i + 1];
+			if (branch_target[i])
+				flags_updated = 0; // EFLAGS unknown when branched to
+			remap[i] = (unsigned short)tellp();
+			if (segment[i])
+			{
+				ir::code code;
+				for (unsigned int k = i; k < i + segment[i]; k++)
+				{
+					ir::inst op;
+					d.decode<U>( p[k], 0 );
+					ir::translate( d.get_context(), dead[k] != 0, op );
+					code.push_back( op );
+				}
+				// left to compile_instruction unless the passes gained something
+				if (ir::optimize( code ))
+				{
+					emit_ir( code );
+					ir_segment g = { i + 1, i + segment[i], tellp() };
+					ir_segments.push_back( g );
+					i += segment[i] - 1;
+					continue;
+				}
+			}
+			inst = i;
+			run_member = in_run[i] != 0;
+			run_next = (i + 1 < end) && in_run[i + 1];
+			if (flags_updated && !run_member)
+			{
+				flag_entry e = { i, tellp() };
+				flag_entries.push_back( e );
+			}
+			if (run_member)
+				run_left--;
+			else
+			{
+				run_left = 1;
+				while ((i + run_left < end) && in_run[i + run_left])
+					run_left++;
+			}
+			idle_branch = false;
+			fuse_bpre = false;
+			if ((ctx.instruction == INST::BPRE) && (i + 1 < end) && !branch_target[i + 1])
 			{
-				// check if lookahead instruction is flag consuming
-				switch (cnext.instruction)
+				disassembler n;
+				n.decode<U>( p[i + 1], 0 );
+				const disassembler::context &suffix = n.get_context();
+				if ((suffix.instruction == INST::BL) || (suffix.instruction == INST::BLX_I))
 				{
-				case INST::ADC_I:
-				case INST::ADC_R:
-				case INST::ADC_RR:
-				case INST::SBC_I:
-				case INST::SBC_R:
-				case INST::SBC_RR:
-					c.lookahead_s = 0;
+					fuse_bpre = true;
+					unsigned long target = ((i + 2) << U::INSTRUCTION_SIZE_LG2) + suffix.imm - 4 + ctx.imm;
+					if ((suffix.instruction == INST::BL) && (target >= PAGING::SIZE))
+						exits.push_back( target );
 				}
+			}
+			if (ctx.instruction == INST::B)
+			{
+				unsigned long target = ctx.imm + (i << U::INSTRUCTION_SIZE_LG2);
+				if ((target < PAGING::SIZE) && ((target >> U::INSTRUCTION_SIZE_LG2) <= i) &&
+					(i - (target >> U::INSTRUCTION_SIZE_LG2) <= MAX_IDLE_LOOP))
+					idle_branch = find_idle_loop<U>( p, target >> U::INSTRUCTION_SIZE_LG2, i );
+			}
+			compile_instruction();
+		}
+
+		epilogue(end);
+
+		for (size_t k = 0; k < ir_segments.size(); k++)
+		{
+			const ir_segment &g = ir_segments[k];
+			for (unsigned int i = g.first; i < g.end; i++)
+			{
+				d.decode<U>( p[i], 0 );
+				ctx = d.get_context();
+				flags_dead = dead[i] != 0;
+				flags_live_out = live_out[i] != 0;
+				next_keeps_flags = false;
+				flags_updated = 0;
+				remap[i] = (unsigned short)tellp();
+				inst = i;
+				run_member = false;
+				run_next = false;
+				run_left = 1;
+				idle_branch = false;
+				fuse_bpre = false;
+				compile_instruction();
+			}
+			resume_segment( g.resume );
+		}
 
-				if (cnext.shift == SHIFT::RRX)
-					c.lookahead_s = 0;
+		// members of predicated runs are entered through a stub
+		for (size_t k = 0; k < run_entries.size(); k++)
+		{
+			remap[run_entries[k].inst] = (unsigned short)tellp();
+			run_entry_stub( run_entries[k] );
+		}
+		for (size_t k = 0; k < flag_entries.size(); k++)
+		{
+			remap[flag_entries[k].inst] = (unsigned short)tellp();
+			flag_entry_stub( flag_entries[k] );
+		}
+	}
+
+	// continues the piece behind the guard emitted by the epilogue with
+	// the code of the next page up to the first instruction not falling
+	// through. the instructions are not entered from elsewhere, branches
+	// within that page go through sites into its own block
+	template <typename T, typename U>
+	void emit_trace()
+	{
+		disassembler d;
+		const unsigned int NUM = PAGING::INST<U>::NUM;
+		memory_block *b = trace_page;
+		const typename U::T* p = (typename U::T*)b->mem;
+		unsigned int end = 0;
+		while (end < NUM)
+		{
+			d.decode<U>( p[end++], 0 );
+			if (ends_piece( d.get_context() ))
+				break;
+		}
+
+		unsigned short remap[NUM];
+		std::vector<unsigned long> exits;
+		code_map own = used;
+		const char *own_literals = literals;
+		used.clear();
+		if (b->flags & (memory_block::PAGE_READPROT | memory_block::PAGE_ACCESSHANDLER))
+			literals = 0;
+		else literals = b->mem;
+		trace_page = 0; // the trace ends with the next page
+		s.patch32( trace_jump );
+		flags_updated = 0;
+		emit_piece<U>( remap, exits, p, 0, end );
+
+		// registered with the page once the code is published
+		trace_used = used;
+		used = own;
+		literals = own_literals;
+	}
+
+	// compiles the code reachable from instruction start of the page
+	// and returns the instruction following the compiled piece
+	//
+	// with JIT_ENTRY_BLOCKS this stops behind the first instruction that
+	// never falls through (or when reaching code compiled before),
+	// otherwise the whole page gets compiled at once
+	//
+	// a piece whose code exceeds the emitter limits or cannot be allocated
+	// is split (smaller pieces may still fit freed code), the instructions
+	// left out get compiled when first entered
+	template <typename T, typename U>
+	static unsigned int compile(compiled_block<U> &cb, unsigned int start = 0)
+	{
+		disassembler d;
+		const typename U::T* p = (typename U::T*)cb.block->mem;
+		const unsigned int NUM = PAGING::INST<U>::NUM;
+
+		// pick the register to keep in edi
+		// done once per block as all entries have to agree on it
+		// the baseline tier does without
+		if (!cb.code && cb.optimized)
+		{
+			unsigned long uses[16];
+			memset( uses, 0, sizeof(uses) );
+			for (unsigned int i = 0; i < NUM; i++ )
+			{
+				d.decode<U>( p[i], 0 );
+				count_reg_uses( d.get_context(), uses );
 			}
-			c.compile_instruction();
+			cb.cached_reg = choose_cached_reg( uses );
+		}
+
+		unsigned int end = NUM;
+#ifdef JIT_ENTRY_BLOCKS
+		for (end = start; end < NUM; )
+		{
+			if ((end != start) && cb.compiled( end ))
+				break; // continue in an earlier piece
+			d.decode<U>( p[end++], 0 );
+			if (ends_piece( d.get_context() ))
+				break;
+		}
+#endif
+
+		while (!compile_piece<T,U>( cb, start, end ))
+		{
+			if (end - start == 1)
+			{
+				std::cerr << "Failed to compile a single instruction, out of JIT memory?\n";
+				DebugBreak_();
+				return end;
+			}
+			end = start + (end - start) / 2;
+		}
+		return end;
+	}
+
+	// compiles instructions start to end of the page as a piece
+	// returns false and leaves the block untouched if the code does not fit
+	// or no memory is left for it
+	template <typename T, typename U>
+	static bool compile_piece(compiled_block<U> &cb, unsigned int start, unsigned int end)
+	{
+		// the emitter buffer alone would overflow the emulation fiber's stack
+		compiler *c = new compiler;
+		bool ok = c->compile_into<T,U>( cb, start, end );
+		delete c;
+		return ok;
+	}
+
+	template <typename T, typename U>
+	bool compile_into(compiled_block<U> &cb, unsigned int start, unsigned int end)
+	{
+		const typename U::T* p = (typename U::T*)cb.block->mem;
+		init_mode<U>();
+		init_cpu<T>();
+
+		optimize = cb.optimized;
+		if (cb.optimized)
+			heat = 0;
+		else
+		{
+			heat = &cb.heat;
+			hot_flags = &cb.block->flags;
+			hot_flag = code_dirty_flag<T, U>::VALUE;
+		}
+
+		cached_reg = cb.cached_reg;
+		cache_dirty = false;
+		used.clear();
+		if (cb.block->flags & (memory_block::PAGE_INVALID | memory_block::PAGE_READPROT | 
+			memory_block::PAGE_ACCESSHANDLER))
+			literals = 0;
+		else literals = cb.block->mem;
+		trace_page = cb.trace_page;
+		trace_addr = cb.trace_addr;
+		trace_dirty = code_dirty_flag<T, U>::VALUE;
+		size_t first_exit = cb.exits.size();
+
+#ifdef JIT_CACHE
+		// a piece compiled by an earlier run only needs its relocations
+		// resolved again
+		jit_cache::key key;
+		key.cpu = (unsigned char)T::VALUE;
+		key.thumb = U::INSTRUCTION_SIZE_LG2 == 1;
+		key.literals = literals != 0;
+		key.cached_reg = (signed char)cached_reg;
+		key.start = (unsigned short)start;
+		key.end = (unsigned short)end;
+		memcpy( key.mem, cb.block->mem, PAGING::SIZE );
+		// only the optimizing tier is cached, baseline code counts into its block
+		// and traces depend on the next page as well
+		bool cached = cb.optimized && !cb.trace_page && restore( key, cb.remap, cb.exits, used );
+#else
+		bool cached = false;
+#endif
+		if (!cached)
+		{
+			emit_piece<U>( cb.remap, cb.exits, p, start, end );
+			if (trace_jump)
+				emit_trace<T,U>();
+		}
+
+		char *code;
+		size_t code_size;
+		if (!finish(code, code_size))
+		{
+			// drop everything recorded for the piece
+			for (unsigned int i = start; i < end; i++ )
+				cb.remap[i] = compiled_block_base<U>::UNMAPPED;
+			cb.exits.resize( first_exit );
+			for (size_t i = 0; i < links.size(); i++)
+				delete links[i];
+			return false;
+		}
+#ifdef JIT_CACHE
+		if (!cached && cb.optimized && !trace_jump)
+			store( key, cb.remap, cb.exits, first_exit, used );
+#endif
+
+		// the remapping table already holds the offsets into the piece
+		unsigned int piece = cb.add_piece( code, code_size );
+		for (unsigned int i = start; i < end; i++ )
+			cb.remap_piece[i] = (unsigned char)piece;
+
+		// relocate and hand over the jump sites
+		for (size_t i = 0; i < links.size(); i++)
+		{
+			block_link *l = links[i];
+			l->site = code + (size_t)l->site;
+			l->from = &cb;
+			cb.outgoing.push_back( l );
 		}
-		// final interation
-		c.ctx = d.get_context();
-		c.lookahead_s = false;
-		cb.remap[PAGING::INST<U>::NUM-1] = (char*)0 + c.tellp();
-		c.inst = PAGING::INST<U>::NUM-1;
-		c.compile_instruction();
-
-		cb.remap[0] = 0;
-		c.epilogue(cb.code, cb.code_size);
-
-		// relocate remapping table
-		for (int i = 0; i < PAGING::INST<U>::NUM; i++ )
-			cb.remap[i] = cb.code + (size_t)cb.remap[i];
+		if (page_exit >= 0)
+			cb.page_exit = links[page_exit];
+
+		// stores to the page only recompile it when hitting these parts
+		cb.block->template add_code<T,U>( used );
+
+		// the next page records the owner of a trace so changes to it
+		// recompile the owner
+		if (trace_jump)
+		{
+			cb.trace_page->template add_code<T,U>( trace_used );
+			cb.trace_page->template add_trace<T,U>( cb.block );
+		}
+		return true;
 	}
 };
 
@@ -240,7 +825,21 @@ template <typename U>
 struct compiled_block: public compiled_block_base<U>
 {
 protected:
-	compiled_block() { compiled_block_base<U>::block = 0; }
+	compiled_block()
+	{
+		compiled_block_base<U>::block = 0;
+		compiled_block_base<U>::cached_reg = -1;
+		compiled_block_base<U>::optimized = false;
+		compiled_block_base<U>::heat = compiled_block_base<U>::HOT_BRANCHES;
+		compiled_block_base<U>::page_exit = 0;
+		compiled_block_base<U>::trace_page = 0;
+		compiled_block_base<U>::trace_addr = 0;
+		compiled_block_base<U>::breaks_pending = false;
+		compiled_block_base<U>::code = 0;
+		compiled_block_base<U>::code_size = 0;
+		memset( compiled_block_base<U>::remap, 0xFF, sizeof(compiled_block_base<U>::remap) );
+		memset( compiled_block_base<U>::remap_piece, 0, sizeof(compiled_block_base<U>::remap_piece) );
+	}
 public:
 
 	// X86 only! (doesnt matter though since we assemble X86 JIT ;P)
@@ -252,15 +851,32 @@ public:
 
 	void emulate(unsigned long subaddr, emulation_context &ctx);
 
-	compiled_block(memory_block *blk)
+	compiled_block(memory_block *blk, bool optimize = false)
 	{
 		compiled_block_base<U>::block = blk;
+		compiled_block_base<U>::cached_reg = -1;
+		compiled_block_base<U>::optimized = optimize;
+		compiled_block_base<U>::heat = compiled_block_base<U>::HOT_BRANCHES;
+		compiled_block_base<U>::page_exit = 0;
+		compiled_block_base<U>::trace_page = 0;
+		compiled_block_base<U>::trace_addr = 0;
+		compiled_block_base<U>::breaks_pending = false;
+		compiled_block_base<U>::code = 0;
+		compiled_block_base<U>::code_size = 0;
+		memset( compiled_block_base<U>::remap, 0xFF, sizeof(compiled_block_base<U>::remap) );
+		memset( compiled_block_base<U>::remap_piece, 0, sizeof(compiled_block_base<U>::remap_piece) );
 		//compiler::compile( *this ); // callee needs to do this now!
 	}
 
 	~compiled_block()
 	{
-		delete []compiled_block_base<U>::code;
+		return_stack::drop( compiled_block_base<U>::code, compiled_block_base<U>::code_size );
+		code_arena::release( compiled_block_base<U>::code, compiled_block_base<U>::code_size );
+		for (size_t i = 0; i < compiled_block_base<U>::pieces.size(); i++)
+		{
+			return_stack::drop( compiled_block_base<U>::pieces[i].code, compiled_block_base<U>::pieces[i].size );
+			code_arena::release( compiled_block_base<U>::pieces[i].code, compiled_block_base<U>::pieces[i].size );
+		}
 	}
 };
 
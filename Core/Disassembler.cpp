@@ -1,3 +1,4 @@
+#include <string.h>
 #include "Disassembler.h"
 
 
@@ -374,8 +375,10 @@ const char* EXTEND_MODE::strings[4] = {
 const char STRINGS::S_BIT = 's';
 const char STRINGS::R_PREFIX = 'r';
 
+#endif
+
 template <>
-void disassembler::decode<IS_ARM>(unsigned int op, unsigned int addr)
+void disassembler::decode_tree<IS_ARM>(unsigned int op, unsigned int addr)
 {
 	ctx.op = op;
 	ctx.flags = 0;
@@ -387,7 +390,7 @@ void disassembler::decode<IS_ARM>(unsigned int op, unsigned int addr)
 }
 
 template <>
-void disassembler::decode<IS_THUMB>(unsigned int op, unsigned int addr)
+void disassembler::decode_tree<IS_THUMB>(unsigned int op, unsigned int addr)
 {
 	ctx.op = op & 0xFFFF;
 	ctx.flags = 0;
@@ -396,5 +399,317 @@ void disassembler::decode<IS_THUMB>(unsigned int op, unsigned int addr)
 	decode_instruction_thumb();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// DECODE TABLES
+//
+// built once at startup, decoding then is a lookup plus pulling the
+// operand fields. the Thumb entries are the tree's output itself. the ARM
+// entries come from arm_entry_for, which repeats the tree's branches by
+// hand as the operand forms and SBZ/SBO checks are not part of its output.
+// "make check" compares both, see bench/decode.cpp
+
+disassembler::arm_entry disassembler::arm_table[ARM_ENTRIES];
+disassembler::thumb_entry disassembler::thumb_table[THUMB_ENTRIES];
+
+// PBWL bits (24, 22, 21, 20) to the first instruction of their group
+static unsigned int pbwl(unsigned long op)
+{
+	return ((op >> 20) & 0x7) | ((op >> 21) & 0x8);
+}
+
+// op only has bits 27-20 and 7-4 set, see decode_instruction
+disassembler::arm_entry disassembler::arm_entry_for(unsigned int op)
+{
+	arm_entry e;
+	e.operands = &disassembler::operands_none;
+	e.instruction = INST::UD;
+	e.shift = SHIFT::LSL; // the shifted forms decode it themselves
+	e.addressing_mode = 0;
+	e.extend_mode = 0;
+	e.flags = 0;
+	e.check_mask = 0;
+	e.check_value = 0;
+
+	bool sbit = (op & (1 << 20)) != 0;
+	unsigned int opcode = (op >> 21) & 0xF;
+	unsigned int misc = (op >> 4) & 0x7;
+	unsigned int sub_op = (op >> 21) & 0x3;
+	switch ((op >> 25) & 0x7)
+	{
+	case 0x0:
+		if ((op & (1 << 4)) && (op & (1 << 7)))
+		{
+			// multiplies, swap, extra load store
+			e.operands = &disassembler::operands_extra;
+			if (op & (1 << 23))
+				e.flags |= U_BIT;
+			e.extend_mode = (op >> 5) & 0x3;
+			if (e.extend_mode == EXTEND_MODE::INVALID)
+			{
+				switch ((op >> 23) & 0x3)
+				{
+				case 0x0:
+					if (op & (1 << 22))
+						return e;
+					e.operands = &disassembler::operands_mula;
+					if (sbit)
+						e.flags |= S_BIT;
+					if (op & (1 << 21))
+						e.instruction = INST::MLA_R;
+					else
+					{
+						e.instruction = INST::MUL_R;
+						e.check_mask = 0xF000; // Rn SBZ
+					}
+					return e;
+				case 0x1:
+					e.operands = &disassembler::operands_mulal;
+					if (sbit)
+						e.flags |= S_BIT;
+					e.instruction = INST::UMULL + ((op >> 21) & 0x3);
+					return e;
+				case 0x2:
+					switch ((op >> 20) & 0x7)
+					{
+					case 0: e.instruction = INST::SWP; break;
+					case 4: e.instruction = INST::SWPB; break;
+					}
+					return e;
+				}
+				return e;
+			}
+			if ((e.extend_mode == EXTEND_MODE::SB) && !sbit)
+			{
+				static const unsigned char ldrd[4] = {
+					INST::LDRD_R, INST::LDRD_RI, INST::LDRD_RP, INST::LDRD_RIP
+				};
+				e.instruction = ldrd[((op >> 22) & 0x1) | ((op >> 23) & 0x2)] + ((op >> 21) & 0x1);
+				return e;
+			}
+			static const unsigned char extra[16] = {
+				INST::STRX_R,  INST::LDRX_R,  INST::STRX_RW,  INST::LDRX_RW,
+				INST::STRX_I,  INST::LDRX_I,  INST::STRX_IW,  INST::LDRX_IW,
+				INST::STRX_RP, INST::LDRX_RP, INST::STRX_RPW, INST::LDRX_RPW,
+				INST::STRX_IP, INST::LDRX_IP, INST::STRX_IPW, INST::LDRX_IPW
+			};
+			e.instruction = extra[pbwl(op)];
+			if (!(op & (1 << 22)))
+				e.operands = &disassembler::operands_extra_reg;
+			return e;
+		}
+
+		if (sbit)
+			e.flags |= S_BIT;
+		if (op & (1 << 4))
+		{
+			e.operands = &disassembler::operands_shift_reg;
+			e.instruction = INST::AND_RR + opcode;
+		} else
+		{
+			e.operands = &disassembler::operands_shift_imm;
+			e.instruction = INST::AND_R + opcode;
+		}
+		if ((opcode == 0x5) || (opcode == 0x6))
+			e.flags |= S_CONSUMING;
+		if (((opcode & 0xC) != 0x8) || sbit)
+			return e;
+
+		// fig. 3.3, see decode_misc
+		e.instruction = INST::UD;
+		if (!(op & (1 << 4)))
+			e.operands = &disassembler::operands_shift_imm_rs;
+		if (op & (1 << 7))
+			return e;
+		switch (misc)
+		{
+		case 0x0:
+			{
+				static const unsigned char status[4] = {
+					INST::MRS_CPSR, INST::MSR_CPSR_R, INST::MRS_SPSR, INST::MSR_SPSR_R
+				};
+				e.instruction = status[sub_op];
+				if (sub_op & 1)
+				{
+					e.check_mask = 0x0000FF00; // Rd SBO, Rs SBZ
+					e.check_value = 0x0000F000;
+				} else
+				{
+					e.check_mask = 0x000F0F00; // Rn SBO, Rs SBZ
+					e.check_value = 0x000F0000;
+				}
+				return e;
+			}
+		case 0x1:
+			e.check_mask = e.check_value = 0x000F0F00; // Rn, Rs SBO
+			if (sub_op == 0x1)
+			{
+				e.instruction = INST::BX;
+				e.check_mask = e.check_value = 0x000FFF00; // Rd too
+			} else if (sub_op == 0x3)
+				e.instruction = INST::CLZ;
+			return e;
+		case 0x3:
+			if (sub_op != 0x1)
+				return e;
+			e.instruction = INST::BLX;
+			e.check_mask = e.check_value = 0x000FFF00; // Rn, Rd, Rs SBO
+			return e;
+		case 0x7:
+			if (sub_op != 0x1)
+				return e;
+			e.operands = &disassembler::operands_bkpt;
+			e.instruction = INST::DEBUG;
+			e.check_mask = 0xF0000000; // AL only
+			e.check_value = CONDITION::AL << 28;
+			return e;
+		}
+		return e;
+
+	case 0x1:
+		e.operands = &disassembler::operands_data_imm;
+		if (sbit)
+			e.flags |= S_BIT;
+		e.instruction = INST::AND_I + opcode;
+		if ((opcode == 0x5) || (opcode == 0x6))
+			e.flags |= S_CONSUMING;
+		if (sbit)
+			return e;
+		switch (opcode)
+		{
+		case 0x8: case 0xA: e.instruction = INST::UD; break;
+		case 0x9:
+			e.instruction = INST::MSR_CPSR_I;
+			e.check_mask = e.check_value = 0xF000; // SBO
+			break;
+		case 0xB:
+			e.instruction = INST::MSR_SPSR_I;
+			e.check_mask = 0xF000; // SBZ
+			break;
+		}
+		return e;
+
+	case 0x2:
+		e.operands = &disassembler::decode_addressingmode2;
+		e.instruction = INST::STR_I + pbwl(op);
+		return e;
+
+	case 0x3:
+		if (op & (1 << 4))
+			return e;
+		e.operands = &disassembler::operands_shift_imm;
+		if (op & (1 << 23))
+			e.flags |= U_BIT;
+		e.instruction = INST::STR_R + pbwl(op);
+		return e;
+
+	case 0x4:
+		e.operands = &disassembler::operands_multiple;
+		if (op & (1 << 22))
+			e.flags |= S_BIT;
+		e.addressing_mode = (op >> 23) & 0x3;
+		e.instruction = INST::STM + ((op >> 20) & 0x3);
+		return e;
+
+	case 0x5:
+		e.operands = &disassembler::decode_simm24;
+		if (op & (1 << 24))
+			e.instruction = INST::BL;
+		else e.instruction = INST::B;
+		return e;
+
+	case 0x6:
+		return e;
+
+	case 0x7:
+		if (op & (1 << 24))
+		{
+			e.operands = &disassembler::operands_swi;
+			e.instruction = INST::SWI;
+		} else if (op & (1 << 4))
+		{
+			e.operands = &disassembler::operands_coproc_rt;
+			if (op & (1 << 20))
+				e.instruction = INST::MRC;
+			else e.instruction = INST::MCR;
+		} else e.operands = &disassembler::operands_coproc_dp;
+		return e;
+	}
+	return e;
+}
+
+void disassembler::init_tables()
+{
+	for (unsigned int i = 0; i < ARM_ENTRIES; i++)
+		arm_table[i] = arm_entry_for( ((i & 0xFF0) << 16) | ((i & 0xF) << 4) );
+
+	disassembler d;
+	for (unsigned int i = 0; i < THUMB_ENTRIES; i++)
+	{
+		memset( &d.ctx, 0, sizeof(d.ctx) );
+		d.decode_tree<IS_THUMB>( i, 0 );
+		thumb_entry &e = thumb_table[i];
+		e.instruction     = d.ctx.instruction;
+		e.cond            = d.ctx.cond;
+		e.shift           = d.ctx.shift;
+		e.addressing_mode = d.ctx.addressing_mode;
+		e.extend_mode     = d.ctx.extend_mode;
+		e.flags           = d.ctx.flags;
+		e.rd              = d.ctx.rd;
+		e.rn              = d.ctx.rn;
+		e.rm              = d.ctx.rm;
+		e.rs              = d.ctx.rs;
+		e.relative = (d.ctx.instruction == INST::B) || (d.ctx.instruction == INST::BPRE);
+		e.imm = (signed int)d.ctx.imm;
+	}
+}
+
+// the DLL disassembly exports may run before Init
+static struct decode_tables
+{
+	decode_tables() { disassembler::init_tables(); }
+} tables;
 
-#endif
\ No newline at end of file
+template <>
+void disassembler::decode<IS_ARM>(unsigned int op, unsigned int addr)
+{
+	ctx.op = op;
+	ctx.addr = addr;
+	decode_condition();
+	if (ctx.cond == CONDITION::NV)
+	{
+		ctx.flags = 0;
+		ctx.shift = SHIFT::LSL;
+		return decode_instruction_NV();
+	}
+
+	const arm_entry &e = arm_table[((op >> 16) & 0xFF0) | ((op >> 4) & 0xF)];
+	ctx.instruction     = (INST::CODE)e.instruction;
+	ctx.shift           = (SHIFT::CODE)e.shift;
+	ctx.addressing_mode = (ADDRESSING_MODE::CODE)e.addressing_mode;
+	ctx.extend_mode     = (EXTEND_MODE::CODE)e.extend_mode;
+	ctx.flags           = e.flags;
+	(this->*e.operands)();
+	if ((op & e.check_mask) != e.check_value)
+		inst_unknown();
+}
+
+template <>
+void disassembler::decode<IS_THUMB>(unsigned int op, unsigned int addr)
+{
+	const thumb_entry &e = thumb_table[op & 0xFFFF];
+	ctx.op = op & 0xFFFF;
+	ctx.addr = addr;
+	ctx.instruction     = (INST::CODE)e.instruction;
+	ctx.cond            = (CONDITION::CODE)e.cond;
+	ctx.shift           = (SHIFT::CODE)e.shift;
+	ctx.addressing_mode = (ADDRESSING_MODE::CODE)e.addressing_mode;
+	ctx.extend_mode     = (EXTEND_MODE::CODE)e.extend_mode;
+	ctx.flags           = e.flags;
+	ctx.rd              = e.rd;
+	ctx.rn              = e.rn;
+	ctx.rm              = e.rm;
+	ctx.rs              = e.rs;
+	ctx.imm = (unsigned long)(signed long)e.imm;
+	if (e.relative)
+		ctx.imm += addr;
+}
@@ -1125,9 +1125,162 @@ public:
 		inst_ud();
 	}
 
+	// looks the op up in the decode tables, see Disassembler.cpp
 	template <typename T>
 	void decode(unsigned int op, unsigned int addr);
 
+	// walks the switch trees, the Thumb table is generated from these
+	// and the ARM one follows their paths (checked by bench/decode.cpp)
+	template <typename T>
+	void decode_tree(unsigned int op, unsigned int addr);
+
+	static void init_tables();
+
+private:
+	// pulls the operands from the bits an ARM table entry doesnt cover
+	typedef void (disassembler::*operand_form)();
+
+	// ARM ops indexed by bits 27-20 and 7-4, which are all the tree
+	// branches on. what is left per op are the operand fields and the
+	// SBZ/SBO checks
+	struct arm_entry
+	{
+		operand_form operands;
+		unsigned char instruction;
+		unsigned char shift;
+		unsigned char addressing_mode;
+		unsigned char extend_mode;
+		unsigned char flags;
+		unsigned int check_mask;  // ops not matching check_value
+		unsigned int check_value; // here decode to UNKNOWN
+	};
+
+	// Thumb ops indexed by the whole op
+	struct thumb_entry
+	{
+		unsigned char instruction;
+		unsigned char cond;
+		unsigned char shift;
+		unsigned char addressing_mode;
+		unsigned char extend_mode;
+		unsigned char flags;
+		unsigned char rd;
+		unsigned char rn;
+		unsigned char rm;
+		unsigned char rs;
+		unsigned char relative; // imm needs addr added (B, BPRE)
+		signed int imm;
+	};
+
+	enum { ARM_ENTRIES = 1 << 12, THUMB_ENTRIES = 1 << 16 };
+	static arm_entry arm_table[ARM_ENTRIES];
+	static thumb_entry thumb_table[THUMB_ENTRIES];
+	static arm_entry arm_entry_for(unsigned int op);
+
+	void operands_none()
+	{
+	}
+
+	void operands_shift_imm()
+	{
+		ctx.rn = decode_reg<16>();
+		ctx.rd = decode_reg<12>();
+		ctx.rm = decode_reg<0>();
+		decode_shift();
+	}
+
+	void operands_shift_imm_rs()
+	{
+		operands_shift_imm();
+		ctx.rs = decode_reg<8>();
+	}
+
+	void operands_shift_reg()
+	{
+		ctx.rn = decode_reg<16>();
+		ctx.rd = decode_reg<12>();
+		ctx.rm = decode_reg<0>();
+		decode_shift_reg();
+	}
+
+	void operands_bkpt()
+	{
+		operands_shift_reg();
+		ctx.imm = (ctx.op & 0xF) | ((ctx.op & 0xFFF00) >> 4);
+	}
+
+	void operands_extra()
+	{
+		ctx.rn = decode_reg<16>();
+		ctx.rd = decode_reg<12>();
+		ctx.rm = decode_reg<0>();
+		int imm = ((ctx.op & 0xF00) >> 4) | (ctx.rm);
+		if (ctx.op & (1 << 23))
+			ctx.imm = (unsigned long)imm;
+		else ctx.imm = (unsigned long)(-imm);
+	}
+
+	void operands_extra_reg()
+	{
+		operands_extra();
+		ctx.imm = 0;
+	}
+
+	void operands_mula()
+	{
+		operands_extra();
+		ctx.rs = decode_reg<8>();
+		ctx.rn = decode_reg<12>();
+		ctx.rd = decode_reg<16>();
+	}
+
+	void operands_mulal()
+	{
+		operands_extra();
+		ctx.rs = decode_reg<8>();
+	}
+
+	void operands_data_imm()
+	{
+		ctx.rn = decode_reg<16>();
+		ctx.rd = decode_reg<12>();
+		decode_imm_shifter();
+	}
+
+	void operands_multiple()
+	{
+		ctx.rn  = decode_reg<16>();
+		ctx.imm = ctx.op & 0xFFFF;
+	}
+
+	void operands_swi()
+	{
+		ctx.imm = ctx.op & 0xFFFFFF;
+	}
+
+	void operands_coproc()
+	{
+		ctx.rn = decode_reg<16>();
+		ctx.rd = decode_reg<12>();
+		ctx.cp_num = decode_reg<8>();
+		ctx.rm = decode_reg<0>();
+		ctx.cp_op2 = (ctx.op >> 5) & 0x7;
+	}
+
+	void operands_coproc_rt()
+	{
+		operands_coproc();
+		ctx.cp_op1 = (ctx.op >> 21) & 0x7;
+	}
+
+	void operands_coproc_dp()
+	{
+		operands_coproc();
+		ctx.cp_op1 = (ctx.op >> 20) & 0xF;
+	}
+
+public:
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // THUMB DECODER
@@ -1527,7 +1680,7 @@ public:
 		ctx.cond = (CONDITION::CODE)((ctx.op >> 8) & 0xF);
 
 		// sign extend shl 1
-		signed long imm = ctx.op & 0xFF;
+		signed int imm = ctx.op & 0xFF;
 	
 		switch (ctx.cond)
 		{
@@ -1568,7 +1721,7 @@ public:
 		case 0x0: // simple B
 			{
 				// << 1 sign extend
-				signed long imm = ctx.imm;
+				signed int imm = ctx.imm;
 				imm <<= 21;
 				imm >>= 20;
 				ctx.imm = ctx.addr + 4 + (unsigned long)imm;
@@ -1585,7 +1738,7 @@ public:
 		case 0x2: // BL/BLX prefix
 			{
 				// << 12 sign extend
-				signed long imm = ctx.imm;
+				signed int imm = ctx.imm;
 				imm <<= 21;
 				imm >>= 9;
 				ctx.imm = ctx.addr + 4 + (unsigned long)imm;
@@ -0,0 +1,475 @@
+#ifndef _EMITTER_H_
+#define _EMITTER_H_
+
+// fixed capacity x86 code buffer used by the compiler
+// replaces the std::ostringstream so no stream formatting or
+// reallocation happens while compiling a page
+
+#include <cstring>
+#include <cstddef>
+#include <iostream>
+#include <assert.h>
+
+// x86-64 hosts (SysV ABI) use the 64 bit backend
+// the generated code still works on 32 bit values, only pointers,
+// the stack and calls into the HLE functions differ
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X64
+#ifdef WIN32
+#error "The x86-64 backend only supports the SysV ABI"
+#endif
+#endif
+
+class emitter
+{
+public:
+	// max code generated for a single piece, one byte short of 64K so
+	// offsets into it stay below compiled_block_base::UNMAPPED
+	enum { CAPACITY   = 0xFFFF };
+	enum { MAX_RELOCS = 4096 };      // max relative calls/jumps out of a page
+	enum { MAX_PTRS   = 4096 };      // max absolute pointers embedded in a page
+	enum { MAX_THUNKS = 64 };        // max distinct call/jump targets of a page
+
+	// R8-R15 only exist on x86-64
+	enum reg { EAX = 0, ECX, EDX, EBX, ESP, EBP, ESI, EDI,
+	           R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#ifdef JIT_X64
+	enum { CACHE      = R12 };  // holds the cached ARM register (callee saved)
+	enum { SLOT       = 8 };    // size of a stack slot
+	enum { THUNK_SIZE = 14 };   // jmp [rip+0] / dq target
+#else
+	enum { CACHE      = EDI };
+	enum { SLOT       = 4 };
+	enum { THUNK_SIZE = 0 };
+#endif
+
+private:
+	size_t pos;
+	size_t num_relocs;
+	unsigned long relocs[MAX_RELOCS];
+	const char *targets[MAX_RELOCS];
+	size_t num_ptrs;
+	unsigned long ptrs[MAX_PTRS];    // positions of embedded pointers
+	mutable bool overflowed;         // a limit was hit, the code is unusable
+	// the slack keeps late patches of an overflowed buffer in bounds
+	char buffer[CAPACITY + 16];
+
+	// on overflow the output starts over at the beginning of the buffer
+	// and the code is marked unusable, see failed()
+	inline void reserve(size_t n)
+	{
+		if (pos + n > CAPACITY)
+		{
+			overflowed = true;
+			pos = 0;
+		}
+	}
+
+	// record a relative call/jump at the current position
+	// the field gets resolved by relocate()
+	inline void rel32(const void *target)
+	{
+		if (num_relocs >= MAX_RELOCS)
+		{
+			overflowed = true;
+			num_relocs = 0;
+		}
+		relocs[num_relocs] = (unsigned long)pos;
+		targets[num_relocs++] = (const char*)target;
+		imm32( 0 );
+	}
+
+	// collects the distinct targets of all relocations
+	size_t distinct_targets(const char **t) const
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < num_relocs; i++)
+		{
+			size_t j = 0;
+			while ((j < n) && (t[j] != targets[i]))
+				j++;
+			if (j == n)
+			{
+				if (n == MAX_THUNKS)
+				{
+					overflowed = true;
+					break;
+				}
+				t[n++] = targets[i];
+			}
+		}
+		return n;
+	}
+
+public:
+	emitter() : pos(0), num_relocs(0), num_ptrs(0), overflowed(false) {}
+
+	// true if the code did not fit into the limits above
+	// the caller has to throw it away and compile less at once
+	inline bool failed() const { return overflowed; }
+
+	////////////////////////////////////////////////////////////////////////
+	// raw output
+
+	inline emitter& operator<<(char c)
+	{
+		reserve(1);
+		buffer[pos++] = c;
+		return *this;
+	}
+
+	inline emitter& operator<<(unsigned char c) { return *this << (char)c; }
+	inline emitter& operator<<(signed char c)   { return *this << (char)c; }
+
+	// zero terminated opcode strings as in s << "\x8B\x45"
+	inline emitter& operator<<(const char *str)
+	{
+		write( str, strlen(str) );
+		return *this;
+	}
+
+	inline void write(const void *data, size_t n)
+	{
+		reserve(n);
+		memcpy( buffer + pos, data, n );
+		pos += n;
+	}
+
+	template <typename T> inline void put(const T &t)
+	{
+		write( &t, sizeof(t) );
+	}
+
+	// immediates and displacements are 32 bit on both hosts
+	inline void imm32(unsigned long v) { put( (unsigned int)v ); }
+
+	// an absolute host pointer, recorded so the code can be persisted
+	// (see jit_cache)
+	inline void ptr(const void *p)
+	{
+		if (num_ptrs >= MAX_PTRS)
+		{
+			overflowed = true;
+			num_ptrs = 0;
+		}
+		ptrs[num_ptrs++] = (unsigned long)pos;
+		put( p );
+	}
+
+	inline size_t tellp() const   { return pos; }
+	inline void seekp(size_t p)   { pos = p; }
+	inline const char* data() const { return buffer; }
+
+	////////////////////////////////////////////////////////////////////////
+	// typed helpers
+
+	inline void modrm(int mod, int r, int rm)
+	{
+		*this << (char)((mod << 6) | ((r & 7) << 3) | (rm & 7));
+	}
+
+	// REX prefix for 64 bit operands (w) or the registers R8-R15
+	// emits nothing on x86 or when not needed
+	inline void rex(bool w, int r, int rm)
+	{
+#ifdef JIT_X64
+		if (w || (r > 7) || (rm > 7))
+			*this << (char)(0x40 | (w << 3) | ((r > 7) << 2) | (rm > 7));
+#else
+		assert(!w && (r < 8) && (rm < 8));
+#endif
+	}
+
+	// modrm (+ sib) (+ disp) for [base+disp]
+	inline void mem(int r, reg base, long disp)
+	{
+		int mod;
+		if ((disp == 0) && ((base & 7) != EBP))
+			mod = 0;
+		else if ((disp >= -128) && (disp <= 127))
+			mod = 1;
+		else mod = 2;
+
+		modrm( mod, r, base );
+		if ((base & 7) == ESP)
+			*this << '\x24'; // sib [esp]
+		if (mod == 1)
+			*this << (char)disp;
+		else if (mod == 2)
+			imm32( disp );
+	}
+
+#ifndef JIT_X64
+	// modrm for [abs32]
+	// x86-64 has no absolute addressing, load the pointer to a register there
+	inline void mem(int r, const void *addr)
+	{
+		modrm( 0, r, 5 );
+		ptr( addr );
+	}
+	inline void mov_r_m(reg dst, const void *addr)     { *this << '\x8B'; mem( dst, addr ); }
+	inline void mov_m_r(const void *addr, reg src)     { *this << '\x89'; mem( src, addr ); }
+#endif
+
+	// modrm/sib for [base+index+disp], index must not be esp
+	inline void mem(int r, reg base, reg index, long disp)
+	{
+		int mod = 2;
+		if ((disp == 0) && ((base & 7) != EBP))
+			mod = 0;
+		else if ((disp >= -128) && (disp <= 127))
+			mod = 1;
+		modrm( mod, r, ESP ); // sib follows
+		*this << (char)(((index & 7) << 3) | (base & 7));
+		if (mod == 1)
+			*this << (char)disp;
+		else if (mod == 2)
+			imm32( disp );
+	}
+
+	inline void mov_r_r(reg dst, reg src)              { rex( false, dst, src ); *this << '\x8B'; modrm( 3, dst, src ); }
+	inline void mov_r_m(reg dst, reg base, long disp)  { rex( false, dst, base ); *this << '\x8B'; mem( dst, base, disp ); }
+	inline void mov_m_r(reg base, long disp, reg src)  { rex( false, src, base ); *this << '\x89'; mem( src, base, disp ); }
+
+	inline void mov_r_i(reg dst, unsigned long imm)
+	{
+		rex( false, 0, dst );
+		*this << (char)(0xB8 + (dst & 7));
+		imm32( imm );
+	}
+
+	// loads a pointer (imm64 on x86-64)
+	inline void mov_r_p(reg dst, const void *p)
+	{
+		rex( sizeof(p) == 8, 0, dst );
+		*this << (char)(0xB8 + (dst & 7));
+		ptr( p );
+	}
+
+	// pointer sized register moves (mov rdst, rsrc on x86-64)
+	inline void mov_p_r(reg dst, reg src)
+	{
+		rex( SLOT == 8, dst, src ); *this << '\x8B'; modrm( 3, dst, src );
+	}
+
+	inline void mov_m_i(reg base, long disp, unsigned long imm)
+	{
+		*this << '\xC7'; mem( 0, base, disp );
+		imm32( imm );
+	}
+
+	// add with the shortest immediate encoding, emits nothing for imm = 0
+	inline void add_r_i(reg dst, unsigned long imm)
+	{
+		long i = (long)imm;
+		if (i == 0)
+			return;
+		if ((i >= -128) && (i <= 127))
+		{
+			*this << '\x83'; modrm( 3, 0, dst );
+			*this << (char)i;
+		} else if (dst == EAX)
+		{
+			*this << '\x05';
+			imm32( imm );
+		} else
+		{
+			*this << '\x81'; modrm( 3, 0, dst );
+			imm32( imm );
+		}
+	}
+
+	// adjusts the stack pointer by the given number of stack slots
+	inline void add_sp(long slots)
+	{
+		long i = slots * SLOT;
+		if (i == 0)
+			return;
+		rex( SLOT == 8, 0, ESP );
+		if ((i >= -128) && (i <= 127))
+		{
+			*this << '\x83'; modrm( 3, 0, ESP );
+			*this << (char)i;
+		} else
+		{
+			*this << '\x81'; modrm( 3, 0, ESP );
+			imm32( i );
+		}
+	}
+
+	inline void add_m_i(reg base, long disp, unsigned long imm)
+	{
+		long i = (long)imm;
+		if (i == 0)
+			return;
+		if ((i >= -128) && (i <= 127))
+		{
+			*this << '\x83'; mem( 0, base, disp );
+			*this << (char)i;
+		} else
+		{
+			*this << '\x81'; mem( 0, base, disp );
+			imm32( imm );
+		}
+	}
+
+	inline void call(const void *target) { *this << '\xE8'; rel32( target ); }
+	inline void jmp(const void *target)  { *this << '\xE9'; rel32( target ); }
+
+	// short conditional jump (opcode 0x70 + cc) with a displacement
+	// patched later, returns the position of the displacement byte
+	inline size_t jcc8(int cc)
+	{
+		*this << (char)(0x70 + cc);
+		size_t at = pos;
+		*this << '\0';
+		return at;
+	}
+
+	// let the displacement byte at 'at' jump to the current position
+	// returns false if the distance does not fit into a rel8
+	inline bool patch8(size_t at)
+	{
+		size_t off = pos - at - 1;
+		if (off >= 128)
+			return false;
+		buffer[at] = (char)off;
+		return true;
+	}
+
+	// turns the short conditional jump with its displacement at 'at' into
+	// a near one (0F 80+cc rel32), moving the code following it
+	// returns the position of the new displacement to patch32()
+	inline size_t widen8(size_t at)
+	{
+		reserve(4);
+		if (overflowed)
+			return at + 1; // the position may be stale, move nothing
+		memmove( buffer + at + 5, buffer + at + 1, pos - at - 1 );
+		char cc = buffer[at - 1] - 0x70;
+		buffer[at - 1] = '\x0F';
+		buffer[at] = (char)(0x80 + cc);
+		pos += 4;
+		for (size_t i = 0; i < num_relocs; i++)
+			if (relocs[i] > at)
+				relocs[i] += 4;
+		for (size_t i = 0; i < num_ptrs; i++)
+			if (ptrs[i] > at)
+				ptrs[i] += 4;
+		return at + 1;
+	}
+
+	// let the rel32 at 'at' jump to the current position
+	inline void patch32(size_t at)
+	{
+		int off = (int)(pos - at - 4);
+		memcpy( buffer + at, &off, 4 );
+	}
+
+	// let the imm32 at 'at' hold the distance from position 'from' to the
+	// current position
+	inline void patch_distance(size_t at, size_t from)
+	{
+		int off = (int)(pos - from);
+		memcpy( buffer + at, &off, 4 );
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	// relocation records (used by the persistent code cache)
+
+	inline size_t relocations() const                 { return num_relocs; }
+	inline size_t relocation(size_t i) const          { return relocs[i]; }
+	inline const char* relocation_target(size_t i) const { return targets[i]; }
+	inline size_t pointers() const                    { return num_ptrs; }
+	inline size_t pointer(size_t i) const             { return ptrs[i]; }
+
+	// reads/replaces the embedded pointer at position at
+	inline const void* get_pointer(size_t at) const
+	{
+		const void *p;
+		memcpy( &p, buffer + at, sizeof(p) );
+		return p;
+	}
+	inline void set_pointer(size_t at, const void *p)
+	{
+		memcpy( buffer + at, &p, sizeof(p) );
+	}
+
+	// starts over with previously generated code
+	// the relocations and pointers have to be added again
+	inline void load(const char *code, size_t size)
+	{
+		pos = 0;
+		num_relocs = 0;
+		num_ptrs = 0;
+		overflowed = false;
+		write( code, size );
+	}
+	inline void add_relocation(size_t at, const void *target)
+	{
+		size_t p = pos;
+		pos = at;
+		rel32( target );
+		pos = p;
+	}
+	inline void add_pointer(size_t at, const void *p)
+	{
+		size_t q = pos;
+		pos = at;
+		ptr( p );
+		pos = q;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	// finalize
+
+	// bytes needed for the final code
+	// on x86-64 targets out of rel32 range are reached through thunks
+	// placed behind the code, so room for those is reserved
+	size_t code_size() const
+	{
+		const char *t[MAX_THUNKS];
+		return pos + distinct_targets( t ) * THUNK_SIZE;
+	}
+
+	// copy the code to mem and resolve all relative calls/jumps
+	// for running it at exec (differs from mem if the code is dual mapped)
+	void relocate(char *mem, char *exec) const
+	{
+		memcpy( mem, buffer, pos );
+#ifdef JIT_X64
+		const char *t[MAX_THUNKS];
+		size_t n = distinct_targets( t );
+		memset( mem + pos, 0xCC, n * THUNK_SIZE ); // int 3
+		bool used[MAX_THUNKS];
+		memset( used, 0, sizeof(used) );
+#endif
+		for (size_t i = 0; i < num_relocs; i++)
+		{
+			const char *target = targets[i];
+			const char *next = &exec[relocs[i]] + 4;
+#ifdef JIT_X64
+			long long rel = target - next;
+			if (rel != (int)rel)
+			{
+				size_t j = 0;
+				while (t[j] != target)
+					j++;
+				size_t at = pos + j * THUNK_SIZE;
+				if (!used[j])
+				{
+					used[j] = true;
+					memcpy( mem + at, "\xFF\x25\0\0\0\0", 6 ); // jmp [rip+0]
+					memcpy( mem + at + 6, &target, 8 );
+				}
+				target = exec + at;
+			}
+#endif
+			int d = (int)(target - next);
+			memcpy( &mem[relocs[i]], &d, 4 );
+		}
+	}
+};
+
+#endif
@@ -1,10 +1,10 @@
 #include "HLCore.h"
 #include "HLE.h"
 #include "Namespaces.h"
-#include "Compiler.h"
 
 #include "MemMap.h"
 #include "Processor.h"
+#include "Prefetch.h"
 
 enum
 {
@@ -14,39 +14,28 @@ enum
 	FLAG_V = 0x10000000
 };
 
-#define UPDATE_FLAGS(mask) u32 org = ctx.regs[Rd]; (org)=(org); u32 nzcv = (ctx.cpsr & (~(mask)))
-#define UPDATE_Z() if (ctx.regs[Rd] == 0) nzcv |= FLAG_Z
-#define UPDATE_N() nzcv |= (ctx.regs[Rd] & 0x80000000)
-#define UPDATE_NC() if ((signed)ctx.regs[Rd] < 0) nzcv |= FLAG_N | FLAG_C
-#define UPDATE_V() if (ctx.regs[Rd] < org) nzcv |= FLAG_V
-#define UPDATE_C(x) if ((x)) nzcv |= FLAG_C
-
+// regs[15] holds the address of the next instruction (bit 0 = thumb) while
+// a handler runs, IBITS is the size of one instruction
 #define IBITS (2 << (~ctx.regs[15] & 1))
-#define ADDR_IP(x) u32 x;\
-	if (flags & disassembler::U_BIT)\
-		x = ctx.regs[Rn];\
-	else x = (u32)(-(signed long)ctx.regs[Rn]); \
-	if (Rn == 15) \
-		x += IBITS; \
-	x += imm
-
-#define BREAK_IF_PC(x) if (x == 15) undefined()
-
-#define TICK() ctx.regs[15] += IBITS
-
-template <typename T> void* HLCore<T>::funcs[INST::MAX_INSTRUCTIONS];
 
-template <typename T> int HLCore<T>::check_flags()
+// data processing opcodes in the order of INST::AND_I .. INST::MVN_I
+struct ALU
 {
-	return 0;
-}
+	typedef enum {
+		AND, EOR, SUB, RSB, ADD, ADC, SBC, RSC,
+		TST, TEQ, CMP, CMN, ORR, MOV, BIC, MVN
+	} CODE;
+};
 
-template <typename T> void HLCore<T>::undefined()
+// single data transfer sizes
+struct XFER
 {
-	DebugBreak_();
-	//TICK();
-}
+	typedef enum {
+		WORD, BYTE, H, SB, SH, DOUBLE
+	} CODE;
+};
 
+template <typename T> typename HLCore<T>::handler HLCore<T>::funcs[INST::MAX_INSTRUCTIONS];
 
 // returns carry after shifting imm by amount
 u32 shifter(u32 &imm, u32 amount, SHIFT::CODE op, u32 cpsr)
@@ -54,18 +43,18 @@ u32 shifter(u32 &imm, u32 amount, SHIFT::CODE op, u32 cpsr)
 	u32 carry;
 	amount &= 0xFF;
 
-	if (amount == 0)
+	if ((amount == 0) && (op != SHIFT::RRX))
 		return cpsr & FLAG_C;
 
 	switch (op)
 	{
-	case SHIFT::LSL: 
+	case SHIFT::LSL:
 		if (amount < 32)
 		{
 			carry = imm & (1 << (32 - amount));
 			imm = imm << amount;
 			return carry;
-		} 
+		}
 		if (amount == 32)
 		{
 			u32 carry = imm & 0x1;
@@ -80,7 +69,7 @@ u32 shifter(u32 &imm, u32 amount, SHIFT::CODE op, u32 cpsr)
 			carry = imm & (1 << (amount - 1));
 			imm = imm >> amount;
 			return carry;
-		} 
+		}
 		if (amount == 32)
 		{
 			carry = imm & 0x80000000;
@@ -89,13 +78,13 @@ u32 shifter(u32 &imm, u32 amount, SHIFT::CODE op, u32 cpsr)
 		}
 		imm = 0;
 		return 0;
-	case SHIFT::ASR: 
+	case SHIFT::ASR:
 		if (amount < 32)
 		{
 			carry = imm & (1 << (amount - 1));
 			imm = (u32)(((signed)imm) >> amount);
 			return carry;
-		} 
+		}
 		if (imm & 0x80000000)
 		{
 			imm = 0xFFFFFFFF;
@@ -120,392 +109,780 @@ u32 shifter(u32 &imm, u32 amount, SHIFT::CODE op, u32 cpsr)
 	return 0;
 }
 
-template <typename T> void HLCore<T>::STR_I(   /* "str%c %Rd,[%-%Rn],#0x%I"   */) { undefined(); }
-template <typename T> void HLCore<T>::LDR_I(   /* "ldr%c %Rd,[%-%Rn],#0x%I"   */) { undefined(); }
-template <typename T> void HLCore<T>::STR_IW(  /* "str%ct %Rd,[%-%Rn],#0x%I"  */) { undefined(); }
-template <typename T> void HLCore<T>::LDR_IW(  /* "ldr%ct %Rd,[%-%Rn],#0x%I"  */) { undefined(); }
-template <typename T> void HLCore<T>::STRB_I(  /* "str%cb %Rd,[%-%Rn],#0x%I"  */) { undefined(); }
-template <typename T> void HLCore<T>::LDRB_I(  /* "ldr%cb %Rd,[%-%Rn],#0x%I"  */) { undefined(); }
-template <typename T> void HLCore<T>::STRB_IW( /* "str%cbt [%Rd],%-%Rn,#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRB_IW( /* "ldr%cbt [%Rd],%-%Rn,#0x%I" */) { undefined(); }
-
-// "str%c %Rd,[%-%Rn,#0x%I]" 
-template <typename T> void HLCore<T>::STR_IP(u32 flags, u32 imm, u32 Rn, u32 Rd) 
-{ 
-	BREAK_IF_PC(Rd);
+// reads register r, R15 reads as the address of the instruction plus two
+// instructions word aligned (as the JIT does)
+template <typename T> static inline u32 read_reg(unsigned int r)
+{
 	emulation_context &ctx = processor<T>::ctx();
-	TICK();
-	ADDR_IP(addr);
-	HLE<T>::store32( addr, ctx.regs[Rd] );
+	if (r != 15)
+		return (u32)ctx.regs[r];
+	return (u32)(ctx.regs[15] + IBITS) & ~3;
 }
 
-// "ldr%c %Rd,[%-%Rn,#0x%I]" 
-template <typename T> void HLCore<T>::LDR_IP(u32 flags, u32 imm, u32 Rn, u32 Rd)
-{ 
-	BREAK_IF_PC(Rd);
-	emulation_context &ctx = processor<T>::ctx();
-	TICK();
-	ADDR_IP(addr);
-	ctx.regs[Rd] = HLE<T>::load32( addr );
+// returns a + b + cin and updates the NZCV bits of nzcv
+static u32 add_flags(u32 a, u32 b, u32 cin, u32 &nzcv)
+{
+	const unsigned long long wide = (unsigned long long)a + b + cin;
+	const u32 r = (u32)wide;
+	nzcv &= ~(FLAG_N | FLAG_Z | FLAG_C | FLAG_V);
+	nzcv |= r & FLAG_N;
+	if (r == 0)
+		nzcv |= FLAG_Z;
+	if (wide >> 32)
+		nzcv |= FLAG_C;
+	if (~(a ^ b) & (a ^ r) & 0x80000000)
+		nzcv |= FLAG_V;
+	return r;
 }
 
-// "str%c %Rd,[%-%Rn,#0x%I]!" 
-template <typename T> void HLCore<T>::STR_IPW(u32 flags, u32 imm, u32 Rn, u32 Rd) 
-{ 
-	BREAK_IF_PC(Rd);
-	emulation_context &ctx = processor<T>::ctx();
-	TICK();
-	ADDR_IP(addr);
-	HLE<T>::store32( addr, ctx.regs[Rd] );
-	ctx.regs[Rn] += imm;
+// sets N and Z of the cpsr for r, C and V stay
+static void set_nz(emulation_context &ctx, u32 r)
+{
+	u32 nzcv = (u32)ctx.cpsr & ~(FLAG_N | FLAG_Z);
+	nzcv |= r & FLAG_N;
+	if (r == 0)
+		nzcv |= FLAG_Z;
+	ctx.cpsr = nzcv;
 }
 
-// "ldr%c %Rd,[%-%Rn,#0x%I]!" 
-template <typename T> void HLCore<T>::LDR_IPW(u32 flags, u32 imm, u32 Rn, u32 Rd) 
-{ 
-	BREAK_IF_PC(Rd);
+// runs data processing op on Rn and operand b
+// carry is the shifter carry out the logical ops set C from (nonzero = set)
+template <typename T> static void alu(ALU::CODE op, const decoded_op &o, u32 b, u32 carry)
+{
 	emulation_context &ctx = processor<T>::ctx();
-	TICK();
-	ADDR_IP(addr);
-	ctx.regs[Rd] = HLE<T>::load32( addr );
-	ctx.regs[Rn] += imm;
-}
+	const u32 a = read_reg<T>(o.rn);
+	u32 nzcv = (u32)ctx.cpsr;
+	const u32 cin = (nzcv >> 29) & 1;
+	u32 r;
+	switch (op)
+	{
+	case ALU::AND:
+	case ALU::TST: r = a & b; break;
+	case ALU::EOR:
+	case ALU::TEQ: r = a ^ b; break;
+	case ALU::ORR: r = a | b; break;
+	case ALU::MOV: r = b; break;
+	case ALU::BIC: r = a & ~b; break;
+	case ALU::MVN: r = ~b; break;
+	case ALU::SUB:
+	case ALU::CMP: r = add_flags( a, ~b, 1, nzcv ); break;
+	case ALU::RSB: r = add_flags( b, ~a, 1, nzcv ); break;
+	case ALU::ADD:
+	case ALU::CMN: r = add_flags( a, b, 0, nzcv ); break;
+	case ALU::ADC: r = add_flags( a, b, cin, nzcv ); break;
+	case ALU::SBC: r = add_flags( a, ~b, cin, nzcv ); break;
+	default:       r = add_flags( b, ~a, cin, nzcv ); break; // RSC
+	}
 
-// "str%cb %Rd,[%-%Rn,#0x%I]" 
-template <typename T> void HLCore<T>::STRB_IP(u32 flags, u32 imm, u32 Rn, u32 Rd) 
-{ 
-	BREAK_IF_PC(Rd);
-	emulation_context &ctx = processor<T>::ctx();
-	TICK();
-	ADDR_IP(addr);
-	HLE<T>::store8( addr, ctx.regs[Rd] );
-}
+	switch (op)
+	{
+	case ALU::AND: case ALU::EOR: case ALU::TST: case ALU::TEQ:
+	case ALU::ORR: case ALU::MOV: case ALU::BIC: case ALU::MVN:
+		// logical ops take C from the shifter and leave V
+		nzcv &= ~(FLAG_N | FLAG_Z | FLAG_C);
+		nzcv |= r & FLAG_N;
+		if (r == 0)
+			nzcv |= FLAG_Z;
+		if (carry)
+			nzcv |= FLAG_C;
+		break;
+	default:
+		break;
+	}
 
-// "ldr%cb %Rd,[%-%Rn,#0x%I]" 
-template <typename T> void HLCore<T>::LDRB_IP(u32 flags, u32 imm, u32 Rn, u32 Rd) 
-{ 
-	BREAK_IF_PC(Rd);
-	emulation_context &ctx = processor<T>::ctx();
-	TICK();
-	ADDR_IP(addr);
-	ctx.regs[Rd] = HLE<T>::load8u( addr );
-}
-template <typename T> void HLCore<T>::STRB_IPW(/* "str%cb %Rd,[%-%Rn,#0x%I]!" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRB_IPW(/* "ldr%cb %Rd,[%-%Rn,#0x%I]!" */) { undefined(); }
-		
-template <typename T> void HLCore<T>::STR_R(   /* "str%c %Rd,[%-%Rn],%Rm %S#0x%I"   */) { undefined(); }
-template <typename T> void HLCore<T>::LDR_R(   /* "ldr%c %Rd,[%-%Rn],%Rm %S#0x%I"   */) { undefined(); }
-template <typename T> void HLCore<T>::STR_RW(  /* "str%ct %Rd,[%-%Rn],%Rm %S#0x%I"  */) { undefined(); }
-template <typename T> void HLCore<T>::LDR_RW(  /* "ldr%ct %Rd,[%-%Rn],%Rm %S#0x%I"  */) { undefined(); }
-template <typename T> void HLCore<T>::STRB_R(  /* "str%cb %Rd,[%-%Rn],%Rm %S#0x%I"  */) { undefined(); }
-template <typename T> void HLCore<T>::LDRB_R(  /* "ldr%cb %Rd,[%-%Rn],%Rm %S#0x%I"  */) { undefined(); }
-template <typename T> void HLCore<T>::STRB_RW( /* "str%cbt %Rd,[%-%Rn],%Rm %S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRB_RW( /* "ldr%cbt %Rd,[%-%Rn],%Rm %S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::STR_RP(  /* "str%c %Rd,[%-%Rn,%Rm %S#0x%I]"   */) { undefined(); }
-template <typename T> void HLCore<T>::LDR_RP(  /* "ldr%c %Rd,[%-%Rn,%Rm %S#0x%I]"   */) { undefined(); }
-template <typename T> void HLCore<T>::STR_RPW( /* "str%c %Rd,[%-%Rn,%Rm %S#0x%I]!"  */) { undefined(); }
-template <typename T> void HLCore<T>::LDR_RPW( /* "ldr%c %Rd,[%-%Rn,%Rm %S#0x%I]!"  */) { undefined(); }
-template <typename T> void HLCore<T>::STRB_RP( /* "str%cb %Rd,[%-%Rn,%Rm %S#0x%I]"  */) { undefined(); }
-template <typename T> void HLCore<T>::LDRB_RP( /* "ldr%cb %Rd,[%-%Rn,%Rm %S#0x%I]"  */) { undefined(); }
-template <typename T> void HLCore<T>::STRB_RPW(/* "str%cb %Rd,[%-%Rn,%Rm %S#0x%I]!" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRB_RPW(/* "ldr%cb %Rd,[%-%Rn,%Rm %S#0x%I]!" */) { undefined(); }
-
-template <typename T> void HLCore<T>::AND_I(/* "and%c%s %Rd,%Rn,#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::EOR_I(/* "eor%c%s %Rd,%Rn,#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::SUB_I(/* "sub%c%s %Rd,%Rn,#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::RSB_I(/* "rsb%c%s %Rd,%Rn,#0x%I" */) { undefined(); }
-
-/* "add%c%s %Rd,%Rn,#0x%I" */
-template <typename T> void HLCore<T>::ADD_I(u32 flags, u32 imm, u32 Rn, u32 Rd) 
-{ 
-	BREAK_IF_PC(Rd);
-	BREAK_IF_PC(Rn);
-	emulation_context &ctx = processor<T>::ctx();
-	if (flags & disassembler::S_BIT)
+	if ((op >= ALU::TST) && (op <= ALU::CMN))
 	{
-		UPDATE_FLAGS(FLAG_N | FLAG_Z | FLAG_C | FLAG_V);
-		ctx.regs[Rd] = ctx.regs[Rn] + imm;
-		UPDATE_Z();
-		UPDATE_NC(); // C = N
-		UPDATE_V();
+		// compares always set the flags (thumb hi register CMP has no S bit)
 		ctx.cpsr = nzcv;
-	} else
+		return;
+	}
+
+	if (o.rd != 15)
 	{
-		ctx.regs[Rd] = ctx.regs[Rn] + imm;
+		ctx.regs[o.rd] = r;
+		if (o.flags & disassembler::S_BIT)
+			ctx.cpsr = nzcv;
+		return;
 	}
-	TICK();
-}
-
-template <typename T> void HLCore<T>::ADC_I(/* "adc%c%s %Rd,%Rn,#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::SBC_I(/* "sbc%c%s %Rd,%Rn,#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::RSC_I(/* "rsc%c%s %Rd,%Rn,#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::TST_I(/* "tst%c %Rn,#0x%I"       */) { undefined(); }
-template <typename T> void HLCore<T>::TEQ_I(/* "teq%c %Rn,#0x%I"       */) { undefined(); }
-template <typename T> void HLCore<T>::CMP_I(/* "cmp%c %Rn,#0x%I"       */) { undefined(); }
-template <typename T> void HLCore<T>::CMN_I(/* "cmn%c %Rn,#0x%I"       */) { undefined(); }
-
-// "orr%c%s %Rd,%Rn,#0x%I" 
-template <typename T> void HLCore<T>::ORR_I(u32 flags, u32 imm, u32 Rn, u32 Rd) 
-{ 
-	BREAK_IF_PC(Rd);
-	BREAK_IF_PC(Rn);
-	emulation_context &ctx = processor<T>::ctx();
-	if (flags & disassembler::S_BIT)
+
+	if (o.flags & disassembler::S_BIT)
 	{
-		UPDATE_FLAGS(FLAG_N | FLAG_Z);
-		ctx.regs[Rd] = ctx.regs[Rn] | imm;
-		UPDATE_Z();
-		UPDATE_N();
-		ctx.cpsr = nzcv;
+		// return from exception, may switch mode and instruction set
+		emulation_context *n = HLE<T>::loadcpsr( ctx.spsr, ~0UL );
+		if (n->cpsr & emulation_context::THUMB_BIT)
+			n->regs[15] = r | 1;
+		else n->regs[15] = r & ~3;
 	} else
+		ctx.regs[15] = (ctx.regs[15] & 1) | r; // stays in the instruction set
+}
+
+// operand of an immediate data processing op, C is set by rotated immediates
+#define DATA_I(name, op) \
+template <typename T> void HLCore<T>::name##_I(const decoded_op &o) \
+{ \
+	u32 carry = (u32)processor<T>::ctx().cpsr & FLAG_C; \
+	if (o.flags & decoded_op::ROTATED) \
+		carry = o.imm & 0x80000000; \
+	alu<T>( op, o, o.imm, carry ); \
+}
+
+// operand Rm shifted by an immediate
+#define DATA_R(name, op) \
+template <typename T> void HLCore<T>::name##_R(const decoded_op &o) \
+{ \
+	u32 value = read_reg<T>(o.rm); \
+	u32 carry = shifter( value, o.imm, (SHIFT::CODE)o.shift, (u32)processor<T>::ctx().cpsr ); \
+	alu<T>( op, o, value, carry ); \
+}
+
+// operand Rm shifted by Rs
+#define DATA_RR(name, op) \
+template <typename T> void HLCore<T>::name##_RR(const decoded_op &o) \
+{ \
+	u32 value = read_reg<T>(o.rm); \
+	u32 carry = shifter( value, read_reg<T>(o.rs), (SHIFT::CODE)o.shift, (u32)processor<T>::ctx().cpsr ); \
+	alu<T>( op, o, value, carry ); \
+}
+
+#define DATA_OP(name) DATA_I(name, ALU::name) DATA_R(name, ALU::name) DATA_RR(name, ALU::name)
+
+DATA_OP(AND)
+DATA_OP(EOR)
+DATA_OP(SUB)
+DATA_OP(RSB)
+DATA_OP(ADD)
+DATA_OP(ADC)
+DATA_OP(SBC)
+DATA_OP(RSC)
+DATA_OP(TST)
+DATA_OP(TEQ)
+DATA_OP(CMP)
+DATA_OP(CMN)
+DATA_OP(ORR)
+DATA_I(MOV, ALU::MOV)
+DATA_RR(MOV, ALU::MOV)
+DATA_OP(BIC)
+DATA_OP(MVN)
+
+// "mov%c%s %Rd,%Rm,%S#0x%I"
+template <typename T> void HLCore<T>::MOV_R(const decoded_op &o)
+{
+	if ((o.rd == 12) && (o.rm == 12) && (o.imm == 0) &&
+		(o.shift == SHIFT::LSL) && !(o.flags & disassembler::S_BIT))
 	{
-		ctx.regs[Rd] = ctx.regs[Rn] | imm;
-	} 
-	TICK();
+		// mov r12, r12 (debug magic)
+		HLE<T>::debug_magic( processor<T>::ctx().regs[15] );
+		return;
+	}
+	u32 value = read_reg<T>(o.rm);
+	u32 carry = shifter( value, o.imm, (SHIFT::CODE)o.shift, (u32)processor<T>::ctx().cpsr );
+	alu<T>( ALU::MOV, o, value, carry );
 }
 
-// "mov%c%s %Rd,#0x%I"
-template <typename T> void HLCore<T>::MOV_I(u32 flags, u32 imm, u32 Rd)
-{ 
-	BREAK_IF_PC(Rd);
+// offset of register load/stores, Rm shifted by an immediate
+template <typename T> static u32 reg_offset(const decoded_op &o)
+{
+	u32 value = read_reg<T>(o.rm);
+	shifter( value, o.imm, (SHIFT::CODE)o.shift, (u32)processor<T>::ctx().cpsr );
+	if (o.flags & disassembler::U_BIT)
+		return value;
+	return 0 - value;
+}
+
+// offset of register extra load/stores (no shift)
+template <typename T> static u32 ext_reg_offset(const decoded_op &o)
+{
+	u32 value = read_reg<T>(o.rm);
+	if (o.flags & disassembler::U_BIT)
+		return value;
+	return 0 - value;
+}
+
+// the transfer size of an extra load/store
+static XFER::CODE extended(const decoded_op &o, bool load)
+{
+	switch (o.extend_mode)
+	{
+	case EXTEND_MODE::SB: return XFER::SB;
+	case EXTEND_MODE::SH: return load ? XFER::SH : XFER::DOUBLE; // STRD
+	default:              return XFER::H;
+	}
+}
+
+// transfers Rd from/to [Rn+offset] (pre indexed) or [Rn] (post indexed)
+// post indexing always writes Rn+offset back, R15 is never written back
+// a loaded Rd wins over the writeback, loads to R15 branch
+template <typename T> static void transfer(const decoded_op &o, bool load, XFER::CODE size,
+	bool pre, bool writeback, u32 offset)
+{
 	emulation_context &ctx = processor<T>::ctx();
-	if (flags & disassembler::S_BIT)
+	const u32 base = read_reg<T>(o.rn);
+	const u32 addr = pre ? base + offset : base;
+	u32 value = 0, value2 = 0;
+	if (load)
 	{
-		UPDATE_FLAGS(FLAG_N | FLAG_Z);
-		ctx.regs[Rd] = imm;
-		UPDATE_N();
-		UPDATE_Z();
+		switch (size)
+		{
+		case XFER::WORD:   value = (u32)HLE<T>::load32( addr ); break;
+		case XFER::BYTE:   value = (u32)HLE<T>::load8u( addr ); break;
+		case XFER::H:      value = (u32)HLE<T>::load16u( addr ); break;
+		case XFER::SB:     value = (u32)(signed char)HLE<T>::load8u( addr ); break;
+		case XFER::SH:     value = (u32)HLE<T>::load16s( addr ); break;
+		case XFER::DOUBLE:
+			value  = (u32)HLE<T>::load32( addr );
+			value2 = (u32)HLE<T>::load32( addr + 4 );
+			break;
+		}
 	} else
 	{
-		ctx.regs[Rd] = imm;
+		value = read_reg<T>(o.rd);
+		if (o.rd == 15)
+			value += IBITS; // stored R15 is 3 instructions ahead
+		switch (size)
+		{
+		case XFER::WORD:   HLE<T>::store32( addr, value ); break;
+		case XFER::BYTE:   HLE<T>::store8( addr, value ); break;
+		case XFER::DOUBLE:
+			HLE<T>::store32( addr, value );
+			HLE<T>::store32( addr + 4, read_reg<T>(o.rd + 1) );
+			break;
+		default:           HLE<T>::store16( addr, value ); break;
+		}
+	}
+
+	if ((writeback || !pre) && (o.rn != 15))
+		ctx.regs[o.rn] = base + offset;
+	if (load)
+	{
+		ctx.regs[o.rd] = value;
+		if (size == XFER::DOUBLE)
+			ctx.regs[o.rd + 1] = value2;
 	}
-	TICK();
 }
 
-template <typename T> void HLCore<T>::BIC_I(/* "bic%c%s %Rd,%Rn,#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::MVN_I(/* "mvn%c%s %Rd,#0x%I"     */) { undefined(); }
+#define IMM_OFFSET (u32)o.imm
+#define REG_OFFSET reg_offset<T>(o)
+#define EXT_REG_OFFSET ext_reg_offset<T>(o)
 
-// "msr cpsr_%F,#0x%I"
-template <typename T> void HLCore<T>::MSR_CPSR_I(u32 /*flags*/, u32 mask, u32 imm) 
-{ 
-	undefined();
-	emulation_context &ctx = processor<T>::ctx();
-	HLE<T>::loadcpsr( imm, mask );
-	TICK();
-}
-
-template <typename T> void HLCore<T>::MSR_SPSR_I(/* "msr spsr_%F,#0x%I" */) { undefined(); }
-
-template <typename T> void HLCore<T>::AND_R(/* "and%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::EOR_R(/* "eor%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::SUB_R(/* "sub%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::RSB_R(/* "rsb%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::ADD_R(/* "add%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::ADC_R(/* "adc%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::SBC_R(/* "sbc%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::RSC_R(/* "rsc%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::TST_R(/* "tst%c %Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::TEQ_R(/* "teq%c %Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::CMP_R(/* "cmp%c %Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::CMN_R(/* "cmn%c %Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::ORR_R(/* "orr%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-
-/* "mov%c%s %Rd,%Rm,%S#0x%I" */
-template <typename T> void HLCore<T>::MOV_R(u32 flags, u32 imm, SHIFT::CODE shift, u32 Rm, u32 Rd) 
-{ 
-	emulation_context &ctx = processor<T>::ctx();
-	if (flags & disassembler::S_BIT)
+#define TRANSFER(name, load, size, pre, writeback, offset) \
+template <typename T> void HLCore<T>::name(const decoded_op &o) \
+{ \
+	transfer<T>( o, load, size, pre, writeback, offset ); \
+}
+
+TRANSFER(STR_I,    false, XFER::WORD, false, false, IMM_OFFSET)
+TRANSFER(LDR_I,    true,  XFER::WORD, false, false, IMM_OFFSET)
+TRANSFER(STR_IW,   false, XFER::WORD, false, false, IMM_OFFSET)
+TRANSFER(LDR_IW,   true,  XFER::WORD, false, false, IMM_OFFSET)
+TRANSFER(STRB_I,   false, XFER::BYTE, false, false, IMM_OFFSET)
+TRANSFER(LDRB_I,   true,  XFER::BYTE, false, false, IMM_OFFSET)
+TRANSFER(STRB_IW,  false, XFER::BYTE, false, false, IMM_OFFSET)
+TRANSFER(LDRB_IW,  true,  XFER::BYTE, false, false, IMM_OFFSET)
+TRANSFER(STR_IP,   false, XFER::WORD, true,  false, IMM_OFFSET)
+TRANSFER(LDR_IP,   true,  XFER::WORD, true,  false, IMM_OFFSET)
+TRANSFER(STR_IPW,  false, XFER::WORD, true,  true,  IMM_OFFSET)
+TRANSFER(LDR_IPW,  true,  XFER::WORD, true,  true,  IMM_OFFSET)
+TRANSFER(STRB_IP,  false, XFER::BYTE, true,  false, IMM_OFFSET)
+TRANSFER(LDRB_IP,  true,  XFER::BYTE, true,  false, IMM_OFFSET)
+TRANSFER(STRB_IPW, false, XFER::BYTE, true,  true,  IMM_OFFSET)
+TRANSFER(LDRB_IPW, true,  XFER::BYTE, true,  true,  IMM_OFFSET)
+
+TRANSFER(STR_R,    false, XFER::WORD, false, false, REG_OFFSET)
+TRANSFER(LDR_R,    true,  XFER::WORD, false, false, REG_OFFSET)
+TRANSFER(STR_RW,   false, XFER::WORD, false, false, REG_OFFSET)
+TRANSFER(LDR_RW,   true,  XFER::WORD, false, false, REG_OFFSET)
+TRANSFER(STRB_R,   false, XFER::BYTE, false, false, REG_OFFSET)
+TRANSFER(LDRB_R,   true,  XFER::BYTE, false, false, REG_OFFSET)
+TRANSFER(STRB_RW,  false, XFER::BYTE, false, false, REG_OFFSET)
+TRANSFER(LDRB_RW,  true,  XFER::BYTE, false, false, REG_OFFSET)
+TRANSFER(STR_RP,   false, XFER::WORD, true,  false, REG_OFFSET)
+TRANSFER(LDR_RP,   true,  XFER::WORD, true,  false, REG_OFFSET)
+TRANSFER(STR_RPW,  false, XFER::WORD, true,  true,  REG_OFFSET)
+TRANSFER(LDR_RPW,  true,  XFER::WORD, true,  true,  REG_OFFSET)
+TRANSFER(STRB_RP,  false, XFER::BYTE, true,  false, REG_OFFSET)
+TRANSFER(LDRB_RP,  true,  XFER::BYTE, true,  false, REG_OFFSET)
+TRANSFER(STRB_RPW, false, XFER::BYTE, true,  true,  REG_OFFSET)
+TRANSFER(LDRB_RPW, true,  XFER::BYTE, true,  true,  REG_OFFSET)
+
+TRANSFER(STRX_I,   false, extended(o, false), false, false, IMM_OFFSET)
+TRANSFER(LDRX_I,   true,  extended(o, true),  false, false, IMM_OFFSET)
+TRANSFER(STRX_IW,  false, extended(o, false), false, false, IMM_OFFSET)
+TRANSFER(LDRX_IW,  true,  extended(o, true),  false, false, IMM_OFFSET)
+TRANSFER(STRX_IP,  false, extended(o, false), true,  false, IMM_OFFSET)
+TRANSFER(LDRX_IP,  true,  extended(o, true),  true,  false, IMM_OFFSET)
+TRANSFER(STRX_IPW, false, extended(o, false), true,  true,  IMM_OFFSET)
+TRANSFER(LDRX_IPW, true,  extended(o, true),  true,  true,  IMM_OFFSET)
+TRANSFER(STRX_R,   false, extended(o, false), false, false, EXT_REG_OFFSET)
+TRANSFER(LDRX_R,   true,  extended(o, true),  false, false, EXT_REG_OFFSET)
+TRANSFER(STRX_RW,  false, extended(o, false), false, false, EXT_REG_OFFSET)
+TRANSFER(LDRX_RW,  true,  extended(o, true),  false, false, EXT_REG_OFFSET)
+TRANSFER(STRX_RP,  false, extended(o, false), true,  false, EXT_REG_OFFSET)
+TRANSFER(LDRX_RP,  true,  extended(o, true),  true,  false, EXT_REG_OFFSET)
+TRANSFER(STRX_RPW, false, extended(o, false), true,  true,  EXT_REG_OFFSET)
+TRANSFER(LDRX_RPW, true,  extended(o, true),  true,  true,  EXT_REG_OFFSET)
+
+TRANSFER(LDRD_R,    true, XFER::DOUBLE, false, false, EXT_REG_OFFSET)
+TRANSFER(LDRD_RW,   true, XFER::DOUBLE, false, false, EXT_REG_OFFSET)
+TRANSFER(LDRD_RI,   true, XFER::DOUBLE, false, false, IMM_OFFSET)
+TRANSFER(LDRD_RIW,  true, XFER::DOUBLE, false, false, IMM_OFFSET)
+TRANSFER(LDRD_RP,   true, XFER::DOUBLE, true,  false, EXT_REG_OFFSET)
+TRANSFER(LDRD_RPW,  true, XFER::DOUBLE, true,  true,  EXT_REG_OFFSET)
+TRANSFER(LDRD_RIP,  true, XFER::DOUBLE, true,  false, IMM_OFFSET)
+TRANSFER(LDRD_RIPW, true, XFER::DOUBLE, true,  true,  IMM_OFFSET)
+
+// transfers the registers of the list (imm) from/to [Rn] upwards
+// with ^ the user registers are transferred unless R15 gets loaded, then
+// the spsr is restored instead. writeback as the JIT does it: if Rn is
+// loaded the writeback only wins if Rn is the lowest register of the list
+template <typename T> static void block_transfer(const decoded_op &o, bool load, bool writeback)
+{
+	emulation_context *ctx = &processor<T>::ctx();
+	const u32 list = o.imm;
+	u32 num = 0;
+	for (u32 l = list; l; l &= l - 1)
+		num++;
+
+	const u32 base = (u32)ctx->regs[o.rn];
+	u32 addr, end;
+	switch (o.addressing_mode)
 	{
-		UPDATE_FLAGS(FLAG_N | FLAG_Z | FLAG_C);
-		UPDATE_C( shifter( ctx.regs[Rm], imm, shift, ctx.cpsr ) );
-		ctx.regs[Rd] = imm;
-		UPDATE_N();
-		UPDATE_Z();
-	} else
+	case ADDRESSING_MODE::DA: addr = base - num * 4 + 4; end = base - num * 4; break;
+	case ADDRESSING_MODE::IA: addr = base;               end = base + num * 4; break;
+	case ADDRESSING_MODE::DB: addr = base - num * 4;     end = addr;           break;
+	default:                  addr = base + 4;           end = base + num * 4; break;
+	}
+	addr &= ~3;
+
+	const bool user = (o.flags & disassembler::S_BIT) && !(load && (list & 0x8000));
+	const unsigned long mode = ctx->cpsr;
+	if (user)
+		ctx = HLE<T>::loadcpsr( 0x10, 0x1F );
+
+	for (unsigned int i = 0; i < 16; i++)
+	{
+		if (!(list & (1 << i)))
+			continue;
+		if (load)
+			ctx->regs[i] = (u32)HLE<T>::load32( addr );
+		else HLE<T>::store32( addr, ctx->regs[i] ); // R15 stores the next instruction
+		addr += 4;
+	}
+
+	if (user)
+		ctx = HLE<T>::loadcpsr( mode, 0x1F );
+
+	if (writeback)
 	{
-		shifter( ctx.regs[Rm], imm, shift, ctx.cpsr );
-		ctx.regs[Rd] = imm;
+		const u32 rn = 1 << o.rn;
+		if (!load || !(list & rn) || !(list & (rn - 1)))
+			ctx->regs[o.rn] = end;
 	}
-	TICK();
-}
-
-template <typename T> void HLCore<T>::BIC_R(/* "bic%c%s %Rd,%Rn,%Rm,%S#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::MVN_R(/* "mvn%c%s %Rd,%Rm,%S#0x%I" */) { undefined(); }
-
-template <typename T> void HLCore<T>::AND_RR(/* "and%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::EOR_RR(/* "eor%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::SUB_RR(/* "sub%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::RSB_RR(/* "rsb%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::ADD_RR(/* "add%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::ADC_RR(/* "adc%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::SBC_RR(/* "sbc%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::RSC_RR(/* "rsc%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::TST_RR(/* "tst%c %Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::TEQ_RR(/* "teq%c %Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::CMP_RR(/* "cmp%c %Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::CMN_RR(/* "cmn%c %Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::ORR_RR(/* "orr%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::MOV_RR(/* "mov%c%s %Rd,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::BIC_RR(/* "%?bic%c%s %Rd,%Rn,%Rm,%S %Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::MVN_RR(/* "mvn%c%s %Rd,%Rm,%S %Rs" */) { undefined(); }
-
-/* "msr%c cpsr_%F,%Rm" */
-template <typename T> void HLCore<T>::MSR_CPSR_R(u32 /*flags*/, u32 Rm, u32 mask) 
-{ 
-	BREAK_IF_PC(Rm);
+
+	if (load && (list & 0x8000) && (o.flags & disassembler::S_BIT))
+	{
+		// return from exception
+		ctx = HLE<T>::loadcpsr( ctx->spsr, ~0UL );
+		if (ctx->cpsr & emulation_context::THUMB_BIT)
+			ctx->regs[15] |= 1;
+		else ctx->regs[15] &= ~3;
+	}
+}
+
+// "stm%c%M %Rn,{%RL}%^"
+template <typename T> void HLCore<T>::STM(const decoded_op &o)   { block_transfer<T>( o, false, false ); }
+// "ldm%c%M %Rn,{%RL}%^"
+template <typename T> void HLCore<T>::LDM(const decoded_op &o)   { block_transfer<T>( o, true, false ); }
+// "stm%c%M %Rn!,{%RL}%^"
+template <typename T> void HLCore<T>::STM_W(const decoded_op &o) { block_transfer<T>( o, false, true ); }
+// "ldm%c%M %Rn!,{%RL}%^"
+template <typename T> void HLCore<T>::LDM_W(const decoded_op &o) { block_transfer<T>( o, true, true ); }
+
+// the psr bytes the field mask of MSR (in Rn) selects
+static u32 field_mask(unsigned int fields)
+{
+	u32 mask = 0;
+	for (unsigned int i = 0; i < 4; i++)
+		if (fields & (1 << i))
+			mask |= 0xFFu << (i * 8);
+	return mask;
+}
+
+// "msr cpsr_%F,#0x%I"
+template <typename T> void HLCore<T>::MSR_CPSR_I(const decoded_op &o)
+{
+	HLE<T>::loadcpsr( o.imm, field_mask(o.rn) );
+}
+
+// "msr spsr_%F,#0x%I"
+template <typename T> void HLCore<T>::MSR_SPSR_I(const decoded_op &o)
+{
 	emulation_context &ctx = processor<T>::ctx();
-	TICK();
-	HLE<T>::loadcpsr(ctx.regs[Rm], mask); 
+	const u32 mask = field_mask(o.rn);
+	ctx.spsr = (ctx.spsr & ~mask) | (o.imm & mask);
 }
 
-template <typename T> void HLCore<T>::MSR_SPSR_R(/* "msr%c spsr_%F,%Rm" */) { undefined(); }
-template <typename T> void HLCore<T>::MRS_CPSR(/* "msr%c %Rd,cpsr" */) { undefined(); }
-template <typename T> void HLCore<T>::MRS_SPSR(/* "mrs%c %Rd,spsr" */) { undefined(); }
+// "msr%c cpsr_%F,%Rm"
+template <typename T> void HLCore<T>::MSR_CPSR_R(const decoded_op &o)
+{
+	HLE<T>::loadcpsr( read_reg<T>(o.rm), field_mask(o.rn) );
+}
 
-template <typename T> void HLCore<T>::CLZ(/* "clz%c %Rd,%Rm" */) { undefined(); }
-template <typename T> void HLCore<T>::BKPT(/* "bkpt #0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::SWI(/* "swi #0x%I" */) { undefined(); }
+// "msr%c spsr_%F,%Rm"
+template <typename T> void HLCore<T>::MSR_SPSR_R(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	const u32 mask = field_mask(o.rn);
+	ctx.spsr = (ctx.spsr & ~mask) | (read_reg<T>(o.rm) & mask);
+}
 
-template <typename T> void HLCore<T>::BX(/* "bx%c %Rm" */) { undefined(); }
-template <typename T> void HLCore<T>::BLX(/* "blx%c %Rm" */) { undefined(); }
-template <typename T> void HLCore<T>::B(/* "b%c #0x%A" */) { undefined(); }
-template <typename T> void HLCore<T>::BL(/* "bl%c #0x%A" */) { undefined(); }
+// "mrs%c %Rd,cpsr"
+template <typename T> void HLCore<T>::MRS_CPSR(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	ctx.regs[o.rd] = ctx.cpsr;
+}
 
-template <typename T> void HLCore<T>::MRC(/* "mrc%c %Cp,%C1,%Rd,%CRn,%CRm,%C2" */) { undefined(); }
+// "mrs%c %Rd,spsr"
+template <typename T> void HLCore<T>::MRS_SPSR(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	ctx.regs[o.rd] = ctx.spsr;
+}
 
-/* "mcr%c %Cp,%C1,%Rd,%CRn,%CRm,%C2" */
-template <typename T> void HLCore<T>::MCR(u32 /*flags*/, u32 C2, u32 CRm, u32 CRn, u32 Rd, u32 C1, u32 Cp)
-{ 
-	switch (Cp) 
-	{
-	case 0xF: // System control coprocessor
-		if (C1 != 0) // SBZ
-			goto default_;   // unpredictable
-		if (Rd == 0xF)   // Rd must not be R15
-			goto default_;   // unpredictable
-		switch (CRn) // select register
-		{
-			
-		case 1: // control bits (r/w)
-			// seemed bogus
-			break;
-			
-		// MMU/PU not supported yet
-		case 2:
-		case 3:
-		case 5:
-		case 6: // CRm and opcode 2 select the protected region/bank
-			break; // skip (not supported yet)
-
-		case 7: // cache and write buffers (write only)
-			break; // not yet emulated/unimportant xD
-		case 9: // cache lockdown or TCM remapping
-			switch (CRm)
-			{
-			case 0x1: // TCM remapping
-				HLE<T>::remap_tcm( Rd, C2 );
-				break;
-			default:
-				break; // lockdown not emulated
-			}
-			break;
+// "clz%c %Rd,%Rm"
+template <typename T> void HLCore<T>::CLZ(const decoded_op &o)
+{
+	u32 value = read_reg<T>(o.rm);
+	u32 n = 32;
+	for (; value; value >>= 1)
+		n--;
+	processor<T>::ctx().regs[o.rd] = n;
+}
 
-		case 0: // may not write to this register
-		default:
-			goto default_; // not supported yet
-		}
+// "swi #0x%I"
+template <typename T> void HLCore<T>::SWI(const decoded_op &o)
+{
+	// the HLE BIOS works on the flags the JIT way
+	HLE<T>::loadcpsr( processor<T>::ctx().cpsr, 0xF8000000 );
+	HLE<T>::swi( o.imm );
+	processor<T>::ctx().cpsr = HLE<T>::storecpsr();
+}
+
+// "bx%c %Rm"
+template <typename T> void HLCore<T>::BX(const decoded_op &o)
+{
+	processor<T>::ctx().regs[15] = read_reg<T>(o.rm);
+}
+
+// "blx%c %Rm"
+template <typename T> void HLCore<T>::BLX(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	const u32 dest = read_reg<T>(o.rm);
+	ctx.regs[14] = ctx.regs[15];
+	ctx.regs[15] = dest;
+}
+
+// "b%c #0x%A"
+template <typename T> void HLCore<T>::B(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	ctx.regs[15] = (u32)(ctx.regs[15] - IBITS + o.imm);
+}
+
+// "bl%c #0x%A"
+// thumb suffixes add the offset of the prefix (see BPRE)
+template <typename T> void HLCore<T>::BL(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	ctx.regs[14] = ctx.regs[15];
+	ctx.regs[15] = (u32)(ctx.regs[15] + o.imm - 4 + ctx.bpre);
+	ctx.bpre = 0;
+}
+
+// "blx%c #0x%A"
+template <typename T> void HLCore<T>::BLX_I(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	ctx.regs[14] = ctx.regs[15];
+	ctx.regs[15] = (u32)((ctx.regs[15] & ~1) + o.imm - 4 + ctx.bpre) & ~3;
+	ctx.bpre = 0;
+}
+
+// "bpre #0x%A"
+template <typename T> void HLCore<T>::BPRE(const decoded_op &o)
+{
+	processor<T>::ctx().bpre = o.imm;
+}
+
+// "mrc%c %Cp,%C1,%Rd,%CRn,%CRm,%C2"
+// only the system control registers decode allows get here
+template <typename T> void HLCore<T>::MRC(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	if (o.rn == 0)
+		ctx.regs[o.rd] = 0x41059460; // ID codes, always the main ID register
+	else ctx.regs[o.rd] = ctx.syscontrol.control_register;
+}
+
+// "mcr%c %Cp,%C1,%Rd,%CRn,%CRm,%C2"
+template <typename T> void HLCore<T>::MCR(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	switch (o.rn)
+	{
+	case 1: // control bits (r/w)
+		ctx.syscontrol.control_register = read_reg<T>(o.rd);
 		break;
+	case 9: // cache lockdown or TCM remapping
+		if (o.rm == 1)
+			HLE<T>::remap_tcm( read_reg<T>(o.rd), o.cp_op2 );
+		break; // lockdown not emulated
 	default:
-	default_:
-		undefined();
+		break; // MMU/PU, caches and write buffers not emulated
 	}
 }
 
-template <typename T> void HLCore<T>::STM(/* "stm%c%M %Rn,{%RL}%^" */) { undefined(); }
-template <typename T> void HLCore<T>::LDM(/* "ldm%c%M %Rn,{%RL}%^" */) { undefined(); }
-template <typename T> void HLCore<T>::STM_W(/* "stm%c%M %Rn!,{%RL}%^" */) { undefined(); }
-template <typename T> void HLCore<T>::LDM_W(/* "ldm%c%M %Rn!,{%RL}%^" */) { undefined(); }
+// "mul%c%s %Rd,%Rm,%Rs"
+template <typename T> void HLCore<T>::MUL_R(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	const u32 r = read_reg<T>(o.rm) * read_reg<T>(o.rs);
+	ctx.regs[o.rd] = r;
+	if (o.flags & disassembler::S_BIT)
+		set_nz( ctx, r );
+}
 
-template <typename T> void HLCore<T>::STRX_I(/* "str%c%E %Rd,[%-%Rn],#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRX_I(/* "ldr%c%E %Rd,[%-%Rn],#0x%I" */) { undefined(); }
-template <typename T> void HLCore<T>::STRX_IW(/* "str%c%E %Rd,[%-%Rn],#0x%I!" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRX_IW(/* "ldr%c%E %Rd,[%-%Rn],#0x%I!" */) { undefined(); }
+// "mla%c%s %Rd,%Rm,%Rs,%Rn"
+template <typename T> void HLCore<T>::MLA_R(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	const u32 r = read_reg<T>(o.rm) * read_reg<T>(o.rs) + read_reg<T>(o.rn);
+	ctx.regs[o.rd] = r;
+	if (o.flags & disassembler::S_BIT)
+		set_nz( ctx, r );
+}
 
-// "str%c%E %Rd,[%-%Rn,#0x%I]" 
-template <typename T> void HLCore<T>::STRX_IP(u32 flags, u32 imm, u32 Rn, u32 Rd, EXTEND_MODE::CODE mode) 
-{ 
-	BREAK_IF_PC(Rd);
+// RdHi:RdLo (= Rn:Rd) = Rm * Rs (+ RdHi:RdLo)
+template <typename T> static void multiply_long(const decoded_op &o, bool sign, bool accumulate)
+{
 	emulation_context &ctx = processor<T>::ctx();
-	TICK();
-	ADDR_IP(addr);
-	switch (mode)
+	const u32 a = read_reg<T>(o.rm), b = read_reg<T>(o.rs);
+	unsigned long long r;
+	if (sign)
+		r = (unsigned long long)((long long)(int)a * (long long)(int)b);
+	else r = (unsigned long long)a * b;
+	if (accumulate)
+		r += ((unsigned long long)(u32)ctx.regs[o.rn] << 32) | (u32)ctx.regs[o.rd];
+	ctx.regs[o.rd] = (u32)r;
+	ctx.regs[o.rn] = (u32)(r >> 32);
+	if (o.flags & disassembler::S_BIT)
 	{
-	case EXTEND_MODE::H: return HLE<T>::store16(addr, ctx.regs[Rd]);
+		u32 nzcv = (u32)ctx.cpsr & ~(FLAG_N | FLAG_Z);
+		nzcv |= (u32)(r >> 32) & FLAG_N;
+		if (r == 0)
+			nzcv |= FLAG_Z;
+		ctx.cpsr = nzcv;
 	}
-	undefined(); 
 }
 
-// "ldr%c%E %Rd,[%-%Rn,#0x%I]"
-template <typename T> void HLCore<T>::LDRX_IP(u32 flags, u32 imm, u32 Rn, u32 Rd, EXTEND_MODE::CODE mode) 
-{ 
-	BREAK_IF_PC(Rd);
+// "umull%c%s %Rd,%Rn,%Rm,%Rs"
+template <typename T> void HLCore<T>::UMULL(const decoded_op &o) { multiply_long<T>( o, false, false ); }
+// "umlal%c%s %Rd,%Rn,%Rm,%Rs"
+template <typename T> void HLCore<T>::UMLAL(const decoded_op &o) { multiply_long<T>( o, false, true ); }
+// "smull%c%s %Rd,%Rn,%Rm,%Rs"
+template <typename T> void HLCore<T>::SMULL(const decoded_op &o) { multiply_long<T>( o, true, false ); }
+// "smlal%c%s %Rd,%Rn,%Rm,%Rs"
+template <typename T> void HLCore<T>::SMLAL(const decoded_op &o) { multiply_long<T>( o, true, true ); }
+
+// "swp%c %Rd,%Rm,[%Rn]"
+template <typename T> void HLCore<T>::SWP(const decoded_op &o)
+{
 	emulation_context &ctx = processor<T>::ctx();
-	TICK();
-	ADDR_IP(addr);
-	switch (mode)
-	{
-	case EXTEND_MODE::H: ctx.regs[Rd] = HLE<T>::load16u(addr); return;
-	case EXTEND_MODE::SB: ctx.regs[Rd] = (u32)((signed long)((signed char)HLE<T>::load8u(addr))); return;
-	case EXTEND_MODE::SH: ctx.regs[Rd] = HLE<T>::load16s(addr); return;
-	}
-	undefined(); 
+	const u32 addr = read_reg<T>(o.rn);
+	const u32 value = (u32)HLE<T>::load32( addr );
+	HLE<T>::store32( addr, read_reg<T>(o.rm) );
+	ctx.regs[o.rd] = value;
 }
 
+// "swpb%c %Rd,%Rm,[%Rn]"
+template <typename T> void HLCore<T>::SWPB(const decoded_op &o)
+{
+	emulation_context &ctx = processor<T>::ctx();
+	const u32 addr = read_reg<T>(o.rn);
+	const u32 value = (u32)HLE<T>::load8u( addr );
+	HLE<T>::store8( addr, read_reg<T>(o.rm) );
+	ctx.regs[o.rd] = value;
+}
 
-template <typename T> void HLCore<T>::STRX_IPW(/* "str%c%E %Rd,[%-%Rn,#0x%I]!" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRX_IPW(/* "ldr%c%E %Rd,[%-%Rn,#0x%I]!" */) { undefined(); }
-template <typename T> void HLCore<T>::STRX_R(/* "str%c%E %Rd,[%-%Rn],%Rm" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRX_R(/* "ldr%c%E %Rd,[%-%Rn],%Rm" */) { undefined(); }
-template <typename T> void HLCore<T>::STRX_RW(/* "str%c%E %Rd,[%-%Rn],%Rm!" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRX_RW(/* "ldr%c%E %Rd,[%-%Rn],%Rm!" */) { undefined(); }
-template <typename T> void HLCore<T>::STRX_RP(/* "str%c%E %Rd,[%-%Rn,%Rm]" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRX_RP(/* "ldr%c%E %Rd,[%-%Rn,%Rm]" */) { undefined(); }
-template <typename T> void HLCore<T>::STRX_RPW(/* "str%c%E %Rd,[%-%Rn,%Rm]!" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRX_RPW(/* "ldr%c%E %Rd,[%-%Rn,%Rm]!" */) { undefined(); }
+// "pld [%Rn,#%-%I]" caches are not emulated
+template <typename T> void HLCore<T>::PLD(const decoded_op & /*o*/)
+{
+}
 
-template <typename T> void HLCore<T>::BPRE(/* "bpre #0x%A" */) { undefined(); }
 
-template <typename T> void HLCore<T>::MUL_R(/* "mul%c%s %Rd,%Rm,%Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::MLA_R(/* "mla%c%s %Rd,%Rm,%Rs,%Rn" */) { undefined(); }
+// true if cond holds for the flags of cpsr
+static bool condition_passed(unsigned int cond, u32 cpsr)
+{
+	const bool n = (cpsr & FLAG_N) != 0;
+	const bool z = (cpsr & FLAG_Z) != 0;
+	const bool c = (cpsr & FLAG_C) != 0;
+	const bool v = (cpsr & FLAG_V) != 0;
+	switch (cond)
+	{
+	case CONDITION::EQ: return z;
+	case CONDITION::NE: return !z;
+	case CONDITION::CS: return c;
+	case CONDITION::CC: return !c;
+	case CONDITION::MI: return n;
+	case CONDITION::PL: return !n;
+	case CONDITION::VS: return v;
+	case CONDITION::VC: return !v;
+	case CONDITION::HI: return c && !z;
+	case CONDITION::LS: return !c || z;
+	case CONDITION::GE: return n == v;
+	case CONDITION::LT: return n != v;
+	case CONDITION::GT: return !z && (n == v);
+	case CONDITION::LE: return z || (n != v);
+	default: return true; // AL and NV (thumb SWI, PLD)
+	}
+}
 
-template <typename T> void HLCore<T>::UMULL(/* "umull%c%s %Rd,%Rn,%Rm,%Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::UMLAL(/* "umlal%c%s %Rd,%Rn,%Rm,%R" */) { undefined(); }
-template <typename T> void HLCore<T>::SMULL(/* "smull%c%s %Rd,%Rn,%Rm,%Rs" */) { undefined(); }
-template <typename T> void HLCore<T>::SMLAL(/* "smlal%c%s %Rd,%Rn,%Rm,%Rs" */) { undefined(); }
+// precomputes the operands of c, cases the handlers do not cover become
+// INST::UD which is left to the JIT
+template <typename T> void HLCore<T>::decode(const disassembler::context &c, decoded_op &o)
+{
+	o.inst            = (unsigned char)c.instruction;
+	o.cond            = (unsigned char)c.cond;
+	o.shift           = (unsigned char)c.shift;
+	o.addressing_mode = (unsigned char)c.addressing_mode;
+	o.extend_mode     = (unsigned char)c.extend_mode;
+	o.flags           = (unsigned char)c.flags;
+	o.rd              = (unsigned char)c.rd;
+	o.rn              = (unsigned char)c.rn;
+	o.rm              = (unsigned char)c.rm;
+	o.rs              = (unsigned char)c.rs;
+	o.cp_num          = (unsigned char)c.cp_num;
+	o.cp_op1          = (unsigned char)c.cp_op1;
+	o.cp_op2          = (unsigned char)c.cp_op2;
+	o.imm             = (u32)c.imm;
+
+	// arm data immediates carry their rotation, thumb ones are never rotated
+	if ((c.instruction >= INST::AND_I) && (c.instruction <= INST::MVN_I) &&
+		(c.op > 0xFFFF) && ((c.op >> 7) & 0x1E))
+		o.flags |= decoded_op::ROTATED;
+
+	bool supported = funcs[c.instruction] != 0;
+	switch (c.instruction)
+	{
+	case INST::STM:
+	case INST::LDM:
+	case INST::STM_W:
+	case INST::LDM_W:
+		// empty lists and R15 as base are unpredictable
+		if (!(c.imm & 0xFFFF) || (c.rn == 15))
+			supported = false;
+		break;
 
-template <typename T> void HLCore<T>::SWP(/* "swp%c %Rd,%Rm,[%Rn]" */) { undefined(); }
-template <typename T> void HLCore<T>::SWPB(/* "swpb%c %Rd,%Rm,[%Rn]" */) { undefined(); }
+	case INST::MRC:
+		supported = (c.cp_num == 0xF) && (c.cp_op1 == 0) && (c.rd != 15) &&
+			((c.rn == 0) || (c.rn == 1));
+		break;
+	case INST::MCR:
+		supported = (c.cp_num == 0xF) && (c.cp_op1 == 0) && (c.rd != 15);
+		switch (c.rn)
+		{
+		case 1: case 2: case 3: case 5: case 6: case 7: case 9:
+			break;
+		default:
+			supported = false;
+		}
+		break;
 
-template <typename T> void HLCore<T>::BLX_I(/* "blx%c #0x%A" */) { undefined(); }
+	default:
+		if ((c.instruction >= INST::STRX_I) && (c.instruction <= INST::LDRX_RPW))
+		{
+			const bool load = ((c.instruction - INST::STRX_I) & 1) != 0;
+			if (c.extend_mode == EXTEND_MODE::INVALID)
+				supported = false;
+			else if (!load && (c.extend_mode != EXTEND_MODE::H)) // STRD
+				supported = !(c.rd & 1) && (c.rd != 14);
+		} else if ((c.instruction >= INST::LDRD_R) && (c.instruction <= INST::LDRD_RIPW))
+			supported = !(c.rd & 1) && (c.rd != 14);
+	}
 
-template <typename T> void HLCore<T>::LDRD_R(/* "? ldr%cd_R %Rd,[%-%Rn]" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRD_RW(/* "? ldr%cd_RW %Rd,[%-%Rn]" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRD_RI(/* "ldr%cd %Rd,[%Rn],%I" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRD_RIW(/* "? ldr%cd_RIW %Rd,[%-%Rn]" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRD_RP(/* "? ldr%cd_RP %Rd,[%-%Rn]" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRD_RPW(/* "? ldr%cd_RPW %Rd,[%-%Rn]" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRD_RIP(/* "? ldr%cd_RIP %Rd,[%-%Rn]" */) { undefined(); }
-template <typename T> void HLCore<T>::LDRD_RIPW(/* "? ldr%cd_RIPW %Rd,[%-%Rn]" */) { undefined(); }
+	if (!supported)
+		o.inst = INST::UD;
+}
 
-template <typename T> void HLCore<T>::PLD_I(/* "pld [%Rn,#%-%I]" */) { undefined(); }
-template <typename T> void HLCore<T>::PLD_R(/* "? pld [%Rn]" */) { undefined(); }
+// interprets the code at addr (bit 0 = thumb) until it leaves the page or
+// instruction set, reaches an instruction without handler, its code gets
+// written or after MAX_STEPS instructions
+// returns the address to continue at, steps gets the instructions run
+//
+// the JIT keeps the flags in x86 layout, they are moved to the cpsr for
+// the handlers and back afterwards
+template <typename T> unsigned long HLCore<T>::run(unsigned long addr, unsigned long &steps)
+{
+	memory_block *b = memory_map<T>::addr2page( addr );
+	const unsigned long page = addr & ~PAGING::ADDRESS_MASK;
+	const unsigned long thumb = addr & 1;
+	const unsigned long size = thumb ?
+		(unsigned long)IS_THUMB::INSTRUCTION_SIZE : (unsigned long)IS_ARM::INSTRUCTION_SIZE;
+	const unsigned long dirty = thumb ?
+		(unsigned long)code_dirty_flag<T, IS_THUMB>::VALUE : (unsigned long)code_dirty_flag<T, IS_ARM>::VALUE;
+	decoded_op *ops = thumb ? b->decoded<T, IS_THUMB>() : b->decoded<T, IS_ARM>();
+
+	processor<T>::ctx().cpsr = HLE<T>::storecpsr();
+	processor<T>::ctx().regs[15] = addr;
+	for (steps = 0; steps < MAX_STEPS; steps++)
+	{
+		// handlers may switch the mode
+		emulation_context &ctx = processor<T>::ctx();
+		const unsigned long pc = ctx.regs[15];
+		if (((pc & ~PAGING::ADDRESS_MASK) != page) || ((pc & 1) != thumb) || (b->flags & dirty))
+			break;
 
+		const unsigned long offset = pc & PAGING::ADDRESS_MASK & ~(size - 1);
+		decoded_op &o = ops[offset / size];
+		if (o.inst == decoded_op::UNDECODED)
+		{
+			disassembler d;
+			if (thumb)
+			{
+				d.decode<IS_THUMB>( *(unsigned short*)&b->mem[offset], 0 );
+				b->add_code<T, IS_THUMB>( offset, size );
+			} else
+			{
+				d.decode<IS_ARM>( *(unsigned int*)&b->mem[offset], 0 );
+				b->add_code<T, IS_ARM>( offset, size );
+			}
+			decode( d.get_context(), o );
+		}
 
-template <typename T> 
+		handler h = funcs[o.inst];
+		if (!h)
+			break;
+		ctx.regs[15] = (page | offset | thumb) + size;
+		if (condition_passed( o.cond, (u32)ctx.cpsr ))
+			h( o );
+	}
+
+	b->executed += steps;
+#ifdef JIT_PREFETCH
+	// the page turns hot soon, get its code compiled meanwhile
+	if ((b->executed >= memory_block::WARM_STEPS) && (b->executed - steps < memory_block::WARM_STEPS))
+		jit_prefetch::request<T>( addr );
+#endif
+	HLE<T>::loadcpsr( processor<T>::ctx().cpsr, 0xF8000000 );
+	return processor<T>::ctx().regs[15];
+}
+
+template <typename T>
 void HLCore<T>::init()
 {
 	for (int i = 0; i < INST::MAX_INSTRUCTIONS; i++)
-		funcs[i] = undefined;
+		funcs[i] = 0;
 
 	funcs[INST::STR_I] = STR_I;
 	funcs[INST::LDR_I] = LDR_I;
@@ -523,7 +900,7 @@ void HLCore<T>::init()
 	funcs[INST::LDRB_IP] = LDRB_IP;
 	funcs[INST::STRB_IPW] = STRB_IPW;
 	funcs[INST::LDRB_IPW] = LDRB_IPW;
-		
+
 	funcs[INST::STR_R] = STR_R;
 	funcs[INST::LDR_R] = LDR_R;
 	funcs[INST::STR_RW] = STR_RW;
@@ -601,7 +978,6 @@ void HLCore<T>::init()
 	funcs[INST::MRS_SPSR] = MRS_SPSR;
 
 	funcs[INST::CLZ] = CLZ;
-	funcs[INST::BKPT] = BKPT;
 	funcs[INST::SWI] = SWI;
 
 	funcs[INST::BX] = BX;
@@ -617,7 +993,6 @@ void HLCore<T>::init()
 	funcs[INST::STM_W] = STM_W;
 	funcs[INST::LDM_W] = LDM_W;
 
-
 	funcs[INST::STRX_I] = STRX_I;
 	funcs[INST::LDRX_I] = LDRX_I;
 	funcs[INST::STRX_IW] = STRX_IW;
@@ -659,293 +1034,16 @@ void HLCore<T>::init()
 	funcs[INST::LDRD_RIP] = LDRD_RIP;
 	funcs[INST::LDRD_RIPW] = LDRD_RIPW;
 
-	funcs[INST::PLD_I] = PLD_I;
-	funcs[INST::PLD_R] = PLD_R;
-};
+	funcs[INST::PLD_I] = PLD;
+	funcs[INST::PLD_R] = PLD;
+}
 
 bool InitHLCore()
 {
 	HLCore<_ARM7>::init();
 	HLCore<_ARM9>::init();
-
-	symbols::syms[(void*)HLCore<_ARM7>::undefined]  = "arm7::ud";
-	symbols::syms[(void*)HLCore<_ARM9>::undefined]  = "arm9::ud";
-	symbols::syms[(void*)HLCore<_ARM7>::check_flags]  = "arm7::checkflags";
-	symbols::syms[(void*)HLCore<_ARM9>::check_flags]  = "arm9::checkflags";
-
-
-
-	symbols::syms[(void*)HLCore<_ARM7>::STR_I] = "arm7::STR_I";
-	symbols::syms[(void*)HLCore<_ARM7>::LDR_I] = "arm7::LDR_I";
-	symbols::syms[(void*)HLCore<_ARM7>::STR_IW] = "arm7::STR_IW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDR_IW] = "arm7::LDR_IW";
-	symbols::syms[(void*)HLCore<_ARM7>::STRB_I] = "arm7::STRB_I";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRB_I] = "arm7::LDRB_I";
-	symbols::syms[(void*)HLCore<_ARM7>::STRB_IW] = "arm7::STRB_IW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRB_IW] = "arm7::LDRB_IW";
-	symbols::syms[(void*)HLCore<_ARM7>::STR_IP] = "arm7::STR_IP";
-	symbols::syms[(void*)HLCore<_ARM7>::LDR_IP] = "arm7::LDR_IP";
-	symbols::syms[(void*)HLCore<_ARM7>::STR_IPW] = "arm7::STR_IPW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDR_IPW] = "arm7::LDR_IPW";
-	symbols::syms[(void*)HLCore<_ARM7>::STRB_IP] = "arm7::STRB_IP";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRB_IP] = "arm7::LDRB_IP";
-	symbols::syms[(void*)HLCore<_ARM7>::STRB_IPW] = "arm7::STRB_IPW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRB_IPW] = "arm7::LDRB_IPW";
-	symbols::syms[(void*)HLCore<_ARM7>::STR_R] = "arm7::STR_R";
-	symbols::syms[(void*)HLCore<_ARM7>::LDR_R] = "arm7::LDR_R";
-	symbols::syms[(void*)HLCore<_ARM7>::STR_RW] = "arm7::STR_RW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDR_RW] = "arm7::LDR_RW";
-	symbols::syms[(void*)HLCore<_ARM7>::STRB_R] = "arm7::STRB_R";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRB_R] = "arm7::LDRB_R";
-	symbols::syms[(void*)HLCore<_ARM7>::STRB_RW] = "arm7::STRB_RW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRB_RW] = "arm7::LDRB_RW";
-	symbols::syms[(void*)HLCore<_ARM7>::STR_RP] = "arm7::STR_RP";
-	symbols::syms[(void*)HLCore<_ARM7>::LDR_RP] = "arm7::LDR_RP";
-	symbols::syms[(void*)HLCore<_ARM7>::STR_RPW] = "arm7::STR_RPW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDR_RPW] = "arm7::LDR_RPW";
-	symbols::syms[(void*)HLCore<_ARM7>::STRB_RP] = "arm7::STRB_RP";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRB_RP] = "arm7::LDRB_RP";
-	symbols::syms[(void*)HLCore<_ARM7>::STRB_RPW] = "arm7::STRB_RPW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRB_RPW] = "arm7::LDRB_RPW";
-	symbols::syms[(void*)HLCore<_ARM7>::AND_I] = "arm7::AND_I";
-	symbols::syms[(void*)HLCore<_ARM7>::EOR_I] = "arm7::EOR_I";
-	symbols::syms[(void*)HLCore<_ARM7>::SUB_I] = "arm7::SUB_I";
-	symbols::syms[(void*)HLCore<_ARM7>::RSB_I] = "arm7::RSB_I";
-	symbols::syms[(void*)HLCore<_ARM7>::ADD_I] = "arm7::ADD_I";
-	symbols::syms[(void*)HLCore<_ARM7>::ADC_I] = "arm7::ADC_I";
-	symbols::syms[(void*)HLCore<_ARM7>::SBC_I] = "arm7::SBC_I";
-	symbols::syms[(void*)HLCore<_ARM7>::RSC_I] = "arm7::RSC_I";
-	symbols::syms[(void*)HLCore<_ARM7>::TST_I] = "arm7::TST_I";
-	symbols::syms[(void*)HLCore<_ARM7>::TEQ_I] = "arm7::TEQ_I";
-	symbols::syms[(void*)HLCore<_ARM7>::CMP_I] = "arm7::CMP_I";
-	symbols::syms[(void*)HLCore<_ARM7>::CMN_I] = "arm7::CMN_I";
-	symbols::syms[(void*)HLCore<_ARM7>::ORR_I] = "arm7::ORR_I";
-	symbols::syms[(void*)HLCore<_ARM7>::MOV_I] = "arm7::MOV_I";
-	symbols::syms[(void*)HLCore<_ARM7>::BIC_I] = "arm7::BIC_I";
-	symbols::syms[(void*)HLCore<_ARM7>::MVN_I] = "arm7::MVN_I";
-	symbols::syms[(void*)HLCore<_ARM7>::MSR_CPSR_I] = "arm7::MSR_CPSR_I";
-	symbols::syms[(void*)HLCore<_ARM7>::MSR_SPSR_I] = "arm7::MSR_SPSR_I";
-	symbols::syms[(void*)HLCore<_ARM7>::AND_R] = "arm7::AND_R";
-	symbols::syms[(void*)HLCore<_ARM7>::EOR_R] = "arm7::EOR_R";
-	symbols::syms[(void*)HLCore<_ARM7>::SUB_R] = "arm7::SUB_R";
-	symbols::syms[(void*)HLCore<_ARM7>::RSB_R] = "arm7::RSB_R";
-	symbols::syms[(void*)HLCore<_ARM7>::ADD_R] = "arm7::ADD_R";
-	symbols::syms[(void*)HLCore<_ARM7>::ADC_R] = "arm7::ADC_R";
-	symbols::syms[(void*)HLCore<_ARM7>::SBC_R] = "arm7::SBC_R";
-	symbols::syms[(void*)HLCore<_ARM7>::RSC_R] = "arm7::RSC_R";
-	symbols::syms[(void*)HLCore<_ARM7>::TST_R] = "arm7::TST_R";
-	symbols::syms[(void*)HLCore<_ARM7>::TEQ_R] = "arm7::TEQ_R";
-	symbols::syms[(void*)HLCore<_ARM7>::CMP_R] = "arm7::CMP_R";
-	symbols::syms[(void*)HLCore<_ARM7>::CMN_R] = "arm7::CMN_R";
-	symbols::syms[(void*)HLCore<_ARM7>::ORR_R] = "arm7::ORR_R";
-	symbols::syms[(void*)HLCore<_ARM7>::MOV_R] = "arm7::MOV_R";
-	symbols::syms[(void*)HLCore<_ARM7>::BIC_R] = "arm7::BIC_R";
-	symbols::syms[(void*)HLCore<_ARM7>::MVN_R] = "arm7::MVN_R";
-	symbols::syms[(void*)HLCore<_ARM7>::AND_RR] = "arm7::AND_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::EOR_RR] = "arm7::EOR_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::SUB_RR] = "arm7::SUB_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::RSB_RR] = "arm7::RSB_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::ADD_RR] = "arm7::ADD_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::ADC_RR] = "arm7::ADC_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::SBC_RR] = "arm7::SBC_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::RSC_RR] = "arm7::RSC_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::TST_RR] = "arm7::TST_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::TEQ_RR] = "arm7::TEQ_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::CMP_RR] = "arm7::CMP_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::CMN_RR] = "arm7::CMN_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::ORR_RR] = "arm7::ORR_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::MOV_RR] = "arm7::MOV_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::BIC_RR] = "arm7::BIC_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::MVN_RR] = "arm7::MVN_RR";
-	symbols::syms[(void*)HLCore<_ARM7>::MSR_CPSR_R] = "arm7::MSR_CPSR_R";
-	symbols::syms[(void*)HLCore<_ARM7>::MSR_SPSR_R] = "arm7::MSR_SPSR_R";
-	symbols::syms[(void*)HLCore<_ARM7>::MRS_CPSR] = "arm7::MRS_CPSR";
-	symbols::syms[(void*)HLCore<_ARM7>::MRS_SPSR] = "arm7::MRS_SPSR";
-	symbols::syms[(void*)HLCore<_ARM7>::CLZ] = "arm7::CLZ";
-	symbols::syms[(void*)HLCore<_ARM7>::BKPT] = "arm7::BKPT";
-	symbols::syms[(void*)HLCore<_ARM7>::SWI] = "arm7::SWI";
-	symbols::syms[(void*)HLCore<_ARM7>::BX] = "arm7::BX";
-	symbols::syms[(void*)HLCore<_ARM7>::BLX] = "arm7::BLX";
-	symbols::syms[(void*)HLCore<_ARM7>::B] = "arm7::B";
-	symbols::syms[(void*)HLCore<_ARM7>::BL] = "arm7::BL";
-	symbols::syms[(void*)HLCore<_ARM7>::MRC] = "arm7::MRC";
-	symbols::syms[(void*)HLCore<_ARM7>::MCR] = "arm7::MCR";
-	symbols::syms[(void*)HLCore<_ARM7>::STM] = "arm7::STM";
-	symbols::syms[(void*)HLCore<_ARM7>::LDM] = "arm7::LDM";
-	symbols::syms[(void*)HLCore<_ARM7>::STM_W] = "arm7::STM_W";
-	symbols::syms[(void*)HLCore<_ARM7>::LDM_W] = "arm7::LDM_W";
-	symbols::syms[(void*)HLCore<_ARM7>::STRX_I] = "arm7::STRX_I";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRX_I] = "arm7::LDRX_I";
-	symbols::syms[(void*)HLCore<_ARM7>::STRX_IW] = "arm7::STRX_IW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRX_IW] = "arm7::LDRX_IW";
-	symbols::syms[(void*)HLCore<_ARM7>::STRX_IP] = "arm7::STRX_IP";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRX_IP] = "arm7::LDRX_IP";
-	symbols::syms[(void*)HLCore<_ARM7>::STRX_IPW] = "arm7::STRX_IPW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRX_IPW] = "arm7::LDRX_IPW";
-	symbols::syms[(void*)HLCore<_ARM7>::STRX_R] = "arm7::STRX_R";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRX_R] = "arm7::LDRX_R";
-	symbols::syms[(void*)HLCore<_ARM7>::STRX_RW] = "arm7::STRX_RW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRX_RW] = "arm7::LDRX_RW";
-	symbols::syms[(void*)HLCore<_ARM7>::STRX_RP] = "arm7::STRX_RP";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRX_RP] = "arm7::LDRX_RP";
-	symbols::syms[(void*)HLCore<_ARM7>::STRX_RPW] = "arm7::STRX_RPW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRX_RPW] = "arm7::LDRX_RPW";
-	symbols::syms[(void*)HLCore<_ARM7>::BPRE] = "arm7::BPRE";
-	symbols::syms[(void*)HLCore<_ARM7>::MUL_R] = "arm7::MUL_R";
-	symbols::syms[(void*)HLCore<_ARM7>::MLA_R] = "arm7::MLA_R";
-	symbols::syms[(void*)HLCore<_ARM7>::UMULL] = "arm7::UMULL";
-	symbols::syms[(void*)HLCore<_ARM7>::UMLAL] = "arm7::UMLAL";
-	symbols::syms[(void*)HLCore<_ARM7>::SMULL] = "arm7::SMULL";
-	symbols::syms[(void*)HLCore<_ARM7>::SMLAL] = "arm7::SMLAL";
-	symbols::syms[(void*)HLCore<_ARM7>::SWP] = "arm7::SWP";
-	symbols::syms[(void*)HLCore<_ARM7>::SWPB] = "arm7::SWPB";
-	symbols::syms[(void*)HLCore<_ARM7>::BLX_I] = "arm7::BLX_I";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRD_R] = "arm7::LDRD_R";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRD_RW] = "arm7::LDRD_RW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRD_RI] = "arm7::LDRD_RI";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRD_RIW] = "arm7::LDRD_RIW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRD_RP] = "arm7::LDRD_RP";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRD_RPW] = "arm7::LDRD_RPW";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRD_RIP] = "arm7::LDRD_RIP";
-	symbols::syms[(void*)HLCore<_ARM7>::LDRD_RIPW] = "arm7::LDRD_RIPW";
-	symbols::syms[(void*)HLCore<_ARM7>::PLD_I] = "arm7::PLD_I";
-	symbols::syms[(void*)HLCore<_ARM7>::PLD_R] = "arm7::PLD_R";
-
-	symbols::syms[(void*)HLCore<_ARM9>::STR_I] = "arm9::STR_I";
-	symbols::syms[(void*)HLCore<_ARM9>::LDR_I] = "arm9::LDR_I";
-	symbols::syms[(void*)HLCore<_ARM9>::STR_IW] = "arm9::STR_IW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDR_IW] = "arm9::LDR_IW";
-	symbols::syms[(void*)HLCore<_ARM9>::STRB_I] = "arm9::STRB_I";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRB_I] = "arm9::LDRB_I";
-	symbols::syms[(void*)HLCore<_ARM9>::STRB_IW] = "arm9::STRB_IW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRB_IW] = "arm9::LDRB_IW";
-	symbols::syms[(void*)HLCore<_ARM9>::STR_IP] = "arm9::STR_IP";
-	symbols::syms[(void*)HLCore<_ARM9>::LDR_IP] = "arm9::LDR_IP";
-	symbols::syms[(void*)HLCore<_ARM9>::STR_IPW] = "arm9::STR_IPW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDR_IPW] = "arm9::LDR_IPW";
-	symbols::syms[(void*)HLCore<_ARM9>::STRB_IP] = "arm9::STRB_IP";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRB_IP] = "arm9::LDRB_IP";
-	symbols::syms[(void*)HLCore<_ARM9>::STRB_IPW] = "arm9::STRB_IPW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRB_IPW] = "arm9::LDRB_IPW";
-	symbols::syms[(void*)HLCore<_ARM9>::STR_R] = "arm9::STR_R";
-	symbols::syms[(void*)HLCore<_ARM9>::LDR_R] = "arm9::LDR_R";
-	symbols::syms[(void*)HLCore<_ARM9>::STR_RW] = "arm9::STR_RW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDR_RW] = "arm9::LDR_RW";
-	symbols::syms[(void*)HLCore<_ARM9>::STRB_R] = "arm9::STRB_R";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRB_R] = "arm9::LDRB_R";
-	symbols::syms[(void*)HLCore<_ARM9>::STRB_RW] = "arm9::STRB_RW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRB_RW] = "arm9::LDRB_RW";
-	symbols::syms[(void*)HLCore<_ARM9>::STR_RP] = "arm9::STR_RP";
-	symbols::syms[(void*)HLCore<_ARM9>::LDR_RP] = "arm9::LDR_RP";
-	symbols::syms[(void*)HLCore<_ARM9>::STR_RPW] = "arm9::STR_RPW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDR_RPW] = "arm9::LDR_RPW";
-	symbols::syms[(void*)HLCore<_ARM9>::STRB_RP] = "arm9::STRB_RP";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRB_RP] = "arm9::LDRB_RP";
-	symbols::syms[(void*)HLCore<_ARM9>::STRB_RPW] = "arm9::STRB_RPW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRB_RPW] = "arm9::LDRB_RPW";
-	symbols::syms[(void*)HLCore<_ARM9>::AND_I] = "arm9::AND_I";
-	symbols::syms[(void*)HLCore<_ARM9>::EOR_I] = "arm9::EOR_I";
-	symbols::syms[(void*)HLCore<_ARM9>::SUB_I] = "arm9::SUB_I";
-	symbols::syms[(void*)HLCore<_ARM9>::RSB_I] = "arm9::RSB_I";
-	symbols::syms[(void*)HLCore<_ARM9>::ADD_I] = "arm9::ADD_I";
-	symbols::syms[(void*)HLCore<_ARM9>::ADC_I] = "arm9::ADC_I";
-	symbols::syms[(void*)HLCore<_ARM9>::SBC_I] = "arm9::SBC_I";
-	symbols::syms[(void*)HLCore<_ARM9>::RSC_I] = "arm9::RSC_I";
-	symbols::syms[(void*)HLCore<_ARM9>::TST_I] = "arm9::TST_I";
-	symbols::syms[(void*)HLCore<_ARM9>::TEQ_I] = "arm9::TEQ_I";
-	symbols::syms[(void*)HLCore<_ARM9>::CMP_I] = "arm9::CMP_I";
-	symbols::syms[(void*)HLCore<_ARM9>::CMN_I] = "arm9::CMN_I";
-	symbols::syms[(void*)HLCore<_ARM9>::ORR_I] = "arm9::ORR_I";
-	symbols::syms[(void*)HLCore<_ARM9>::MOV_I] = "arm9::MOV_I";
-	symbols::syms[(void*)HLCore<_ARM9>::BIC_I] = "arm9::BIC_I";
-	symbols::syms[(void*)HLCore<_ARM9>::MVN_I] = "arm9::MVN_I";
-	symbols::syms[(void*)HLCore<_ARM9>::MSR_CPSR_I] = "arm9::MSR_CPSR_I";
-	symbols::syms[(void*)HLCore<_ARM9>::MSR_SPSR_I] = "arm9::MSR_SPSR_I";
-	symbols::syms[(void*)HLCore<_ARM9>::AND_R] = "arm9::AND_R";
-	symbols::syms[(void*)HLCore<_ARM9>::EOR_R] = "arm9::EOR_R";
-	symbols::syms[(void*)HLCore<_ARM9>::SUB_R] = "arm9::SUB_R";
-	symbols::syms[(void*)HLCore<_ARM9>::RSB_R] = "arm9::RSB_R";
-	symbols::syms[(void*)HLCore<_ARM9>::ADD_R] = "arm9::ADD_R";
-	symbols::syms[(void*)HLCore<_ARM9>::ADC_R] = "arm9::ADC_R";
-	symbols::syms[(void*)HLCore<_ARM9>::SBC_R] = "arm9::SBC_R";
-	symbols::syms[(void*)HLCore<_ARM9>::RSC_R] = "arm9::RSC_R";
-	symbols::syms[(void*)HLCore<_ARM9>::TST_R] = "arm9::TST_R";
-	symbols::syms[(void*)HLCore<_ARM9>::TEQ_R] = "arm9::TEQ_R";
-	symbols::syms[(void*)HLCore<_ARM9>::CMP_R] = "arm9::CMP_R";
-	symbols::syms[(void*)HLCore<_ARM9>::CMN_R] = "arm9::CMN_R";
-	symbols::syms[(void*)HLCore<_ARM9>::ORR_R] = "arm9::ORR_R";
-	symbols::syms[(void*)HLCore<_ARM9>::MOV_R] = "arm9::MOV_R";
-	symbols::syms[(void*)HLCore<_ARM9>::BIC_R] = "arm9::BIC_R";
-	symbols::syms[(void*)HLCore<_ARM9>::MVN_R] = "arm9::MVN_R";
-	symbols::syms[(void*)HLCore<_ARM9>::AND_RR] = "arm9::AND_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::EOR_RR] = "arm9::EOR_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::SUB_RR] = "arm9::SUB_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::RSB_RR] = "arm9::RSB_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::ADD_RR] = "arm9::ADD_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::ADC_RR] = "arm9::ADC_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::SBC_RR] = "arm9::SBC_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::RSC_RR] = "arm9::RSC_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::TST_RR] = "arm9::TST_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::TEQ_RR] = "arm9::TEQ_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::CMP_RR] = "arm9::CMP_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::CMN_RR] = "arm9::CMN_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::ORR_RR] = "arm9::ORR_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::MOV_RR] = "arm9::MOV_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::BIC_RR] = "arm9::BIC_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::MVN_RR] = "arm9::MVN_RR";
-	symbols::syms[(void*)HLCore<_ARM9>::MSR_CPSR_R] = "arm9::MSR_CPSR_R";
-	symbols::syms[(void*)HLCore<_ARM9>::MSR_SPSR_R] = "arm9::MSR_SPSR_R";
-	symbols::syms[(void*)HLCore<_ARM9>::MRS_CPSR] = "arm9::MRS_CPSR";
-	symbols::syms[(void*)HLCore<_ARM9>::MRS_SPSR] = "arm9::MRS_SPSR";
-	symbols::syms[(void*)HLCore<_ARM9>::CLZ] = "arm9::CLZ";
-	symbols::syms[(void*)HLCore<_ARM9>::BKPT] = "arm9::BKPT";
-	symbols::syms[(void*)HLCore<_ARM9>::SWI] = "arm9::SWI";
-	symbols::syms[(void*)HLCore<_ARM9>::BX] = "arm9::BX";
-	symbols::syms[(void*)HLCore<_ARM9>::BLX] = "arm9::BLX";
-	symbols::syms[(void*)HLCore<_ARM9>::B] = "arm9::B";
-	symbols::syms[(void*)HLCore<_ARM9>::BL] = "arm9::BL";
-	symbols::syms[(void*)HLCore<_ARM9>::MRC] = "arm9::MRC";
-	symbols::syms[(void*)HLCore<_ARM9>::MCR] = "arm9::MCR";
-	symbols::syms[(void*)HLCore<_ARM9>::STM] = "arm9::STM";
-	symbols::syms[(void*)HLCore<_ARM9>::LDM] = "arm9::LDM";
-	symbols::syms[(void*)HLCore<_ARM9>::STM_W] = "arm9::STM_W";
-	symbols::syms[(void*)HLCore<_ARM9>::LDM_W] = "arm9::LDM_W";
-	symbols::syms[(void*)HLCore<_ARM9>::STRX_I] = "arm9::STRX_I";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRX_I] = "arm9::LDRX_I";
-	symbols::syms[(void*)HLCore<_ARM9>::STRX_IW] = "arm9::STRX_IW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRX_IW] = "arm9::LDRX_IW";
-	symbols::syms[(void*)HLCore<_ARM9>::STRX_IP] = "arm9::STRX_IP";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRX_IP] = "arm9::LDRX_IP";
-	symbols::syms[(void*)HLCore<_ARM9>::STRX_IPW] = "arm9::STRX_IPW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRX_IPW] = "arm9::LDRX_IPW";
-	symbols::syms[(void*)HLCore<_ARM9>::STRX_R] = "arm9::STRX_R";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRX_R] = "arm9::LDRX_R";
-	symbols::syms[(void*)HLCore<_ARM9>::STRX_RW] = "arm9::STRX_RW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRX_RW] = "arm9::LDRX_RW";
-	symbols::syms[(void*)HLCore<_ARM9>::STRX_RP] = "arm9::STRX_RP";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRX_RP] = "arm9::LDRX_RP";
-	symbols::syms[(void*)HLCore<_ARM9>::STRX_RPW] = "arm9::STRX_RPW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRX_RPW] = "arm9::LDRX_RPW";
-	symbols::syms[(void*)HLCore<_ARM9>::BPRE] = "arm9::BPRE";
-	symbols::syms[(void*)HLCore<_ARM9>::MUL_R] = "arm9::MUL_R";
-	symbols::syms[(void*)HLCore<_ARM9>::MLA_R] = "arm9::MLA_R";
-	symbols::syms[(void*)HLCore<_ARM9>::UMULL] = "arm9::UMULL";
-	symbols::syms[(void*)HLCore<_ARM9>::UMLAL] = "arm9::UMLAL";
-	symbols::syms[(void*)HLCore<_ARM9>::SMULL] = "arm9::SMULL";
-	symbols::syms[(void*)HLCore<_ARM9>::SMLAL] = "arm9::SMLAL";
-	symbols::syms[(void*)HLCore<_ARM9>::SWP] = "arm9::SWP";
-	symbols::syms[(void*)HLCore<_ARM9>::SWPB] = "arm9::SWPB";
-	symbols::syms[(void*)HLCore<_ARM9>::BLX_I] = "arm9::BLX_I";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRD_R] = "arm9::LDRD_R";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRD_RW] = "arm9::LDRD_RW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRD_RI] = "arm9::LDRD_RI";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRD_RIW] = "arm9::LDRD_RIW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRD_RP] = "arm9::LDRD_RP";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRD_RPW] = "arm9::LDRD_RPW";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRD_RIP] = "arm9::LDRD_RIP";
-	symbols::syms[(void*)HLCore<_ARM9>::LDRD_RIPW] = "arm9::LDRD_RIPW";
-	symbols::syms[(void*)HLCore<_ARM9>::PLD_I] = "arm9::PLD_I";
-	symbols::syms[(void*)HLCore<_ARM9>::PLD_R] = "arm9::PLD_R";
-
 	return true;
-}
\ No newline at end of file
+}
+
+template struct HLCore<_ARM7>;
+template struct HLCore<_ARM9>;
@@ -2,178 +2,199 @@
 #define _HLCORE_H_
 
 #include "Disassembler.h"
+#include "Mem.h"
+#include "ArmContext.h"
+
+// high level interpreter, the tier below the JIT
+//
+// pages get interpreted until they turn hot and while caught in a recompile
+// storm (see memory_block::interpreted). each instruction of a page gets
+// decoded once into a decoded_op which is then dispatched through funcs,
+// instructions without a handler are left to the JIT
+
+// operands of one instruction as the handlers take them
+// kept per interpreted page, see memory_block::get_ops
+struct decoded_op
+{
+	enum { UNDECODED = 0xFF }; // inst of slots not decoded yet
+	enum { ROTATED = 0x80 };   // flags: the immediate got rotated (sets C)
+
+	unsigned char inst;            // INST::CODE
+	unsigned char cond;            // CONDITION::CODE
+	unsigned char shift;           // SHIFT::CODE
+	unsigned char addressing_mode; // ADDRESSING_MODE::CODE
+	unsigned char extend_mode;     // EXTEND_MODE::CODE
+	unsigned char flags;           // disassembler::S_BIT ...
+	unsigned char rd, rn, rm, rs;
+	unsigned char cp_num, cp_op1, cp_op2;
+	u32 imm;
+};
 
-// this is a proprietary new interface
-// replacing all JIT with HLE
-
-typedef unsigned long u32;
 template <typename T> struct HLCore
 {
-	static void* funcs[INST::MAX_INSTRUCTIONS];
+	typedef void (*handler)(const decoded_op &o);
+	static handler funcs[INST::MAX_INSTRUCTIONS];
 	static void init();
 
-	// helper
-	static int check_flags();
+	// interpreter
+	enum { MAX_STEPS = 256 }; // instructions run before interrupts get polled again
+	static void decode(const disassembler::context &c, decoded_op &o);
+	static unsigned long run(unsigned long addr, unsigned long &steps);
 
 	// functions
-	static void undefined();
-
-	static void STR_I();
-	static void LDR_I();
-	static void STR_IW();
-	static void LDR_IW();
-	static void STRB_I();
-	static void LDRB_I();
-	static void STRB_IW();
-	static void LDRB_IW();
-	static void STR_IP(u32 flags, u32 imm, u32 Rn, u32 Rd);
-	static void LDR_IP(u32 flags, u32 imm, u32 Rn, u32 Rd);
-	static void STR_IPW(u32 flags, u32 imm, u32 Rn, u32 Rd);
-	static void LDR_IPW(u32 flags, u32 imm, u32 Rn, u32 Rd);
-	static void STRB_IP(u32 flags, u32 imm, u32 Rn, u32 Rd);
-	static void LDRB_IP(u32 flags, u32 imm, u32 Rn, u32 Rd);
-	static void STRB_IPW();
-	static void LDRB_IPW();
-		
-	static void STR_R();
-	static void LDR_R();
-	static void STR_RW();
-	static void LDR_RW();
-	static void STRB_R();
-	static void LDRB_R();
-	static void STRB_RW();
-	static void LDRB_RW();
-	static void STR_RP();
-	static void LDR_RP();
-	static void STR_RPW();
-	static void LDR_RPW();
-	static void STRB_RP();
-	static void LDRB_RP();
-	static void STRB_RPW();
-	static void LDRB_RPW();
-
-	static void AND_I();
-	static void EOR_I();
-	static void SUB_I();
-	static void RSB_I();
-	static void ADD_I(u32 flags, u32 imm, u32 Rn, u32 Rd);
-	static void ADC_I();
-	static void SBC_I();
-	static void RSC_I();
-	static void TST_I();
-	static void TEQ_I();
-	static void CMP_I();
-	static void CMN_I();
-	static void ORR_I(u32 flags, u32 imm, u32 Rn, u32 Rd);
-	static void MOV_I(u32 flags, u32 imm, u32 Rd);
-	static void BIC_I();
-	static void MVN_I();
-
-	static void MSR_CPSR_I(u32 flags, u32 mask, u32 imm);
-	static void MSR_SPSR_I();
-
-	static void AND_R();
-	static void EOR_R();
-	static void SUB_R();
-	static void RSB_R();
-	static void ADD_R();
-	static void ADC_R();
-	static void SBC_R();
-	static void RSC_R();
-	static void TST_R();
-	static void TEQ_R();
-	static void CMP_R();
-	static void CMN_R();
-	static void ORR_R();
-	static void MOV_R(u32 flags, u32 imm, SHIFT::CODE shift, u32 Rm, u32 Rd);
-	static void BIC_R();
-	static void MVN_R();
-
-	static void AND_RR();
-	static void EOR_RR();
-	static void SUB_RR();
-	static void RSB_RR();
-	static void ADD_RR();
-	static void ADC_RR();
-	static void SBC_RR();
-	static void RSC_RR();
-	static void TST_RR();
-	static void TEQ_RR();
-	static void CMP_RR();
-	static void CMN_RR();
-	static void ORR_RR();
-	static void MOV_RR();
-	static void BIC_RR();
-	static void MVN_RR();
-
-	static void MSR_CPSR_R(u32 flags, u32 Rm, u32 mask);
-	static void MSR_SPSR_R();
-	static void MRS_CPSR();
-	static void MRS_SPSR();
-
-	static void CLZ();
-	static void BKPT();
-	static void SWI();
-
-	static void BX();
-	static void BLX();
-	static void B();
-	static void BL();
-
-	static void MRC();
-	static void MCR(u32 flags, u32 C2, u32 CRm, u32 CRn, u32 Rd, u32 C1, u32 Cp);
-
-	static void STM();
-	static void LDM();
-	static void STM_W();
-	static void LDM_W();
-
-
-	static void STRX_I();
-	static void LDRX_I();
-	static void STRX_IW();
-	static void LDRX_IW();
-	static void STRX_IP(u32 flags, u32 imm, u32 Rn, u32 Rd, EXTEND_MODE::CODE mode);
-	static void LDRX_IP(u32 flags, u32 imm, u32 Rn, u32 Rd, EXTEND_MODE::CODE mode);
-	static void STRX_IPW();
-	static void LDRX_IPW();
-	static void STRX_R();
-	static void LDRX_R();
-	static void STRX_RW();
-	static void LDRX_RW();
-	static void STRX_RP();
-	static void LDRX_RP();
-	static void STRX_RPW();
-	static void LDRX_RPW();
-
-	static void BPRE();
-
-	static void MUL_R();
-	static void MLA_R();
-
-	static void UMULL();
-	static void UMLAL();
-	static void SMULL();
-	static void SMLAL();
-
-	static void SWP();
-	static void SWPB();
-
-	static void BLX_I();
-
-	static void LDRD_R();
-	static void LDRD_RW();
-	static void LDRD_RI();
-	static void LDRD_RIW();
-	static void LDRD_RP();
-	static void LDRD_RPW();
-	static void LDRD_RIP();
-	static void LDRD_RIPW();
-
-	static void PLD_I();
-	static void PLD_R();
+	static void STR_I(const decoded_op &o);
+	static void LDR_I(const decoded_op &o);
+	static void STR_IW(const decoded_op &o);
+	static void LDR_IW(const decoded_op &o);
+	static void STRB_I(const decoded_op &o);
+	static void LDRB_I(const decoded_op &o);
+	static void STRB_IW(const decoded_op &o);
+	static void LDRB_IW(const decoded_op &o);
+	static void STR_IP(const decoded_op &o);
+	static void LDR_IP(const decoded_op &o);
+	static void STR_IPW(const decoded_op &o);
+	static void LDR_IPW(const decoded_op &o);
+	static void STRB_IP(const decoded_op &o);
+	static void LDRB_IP(const decoded_op &o);
+	static void STRB_IPW(const decoded_op &o);
+	static void LDRB_IPW(const decoded_op &o);
+
+	static void STR_R(const decoded_op &o);
+	static void LDR_R(const decoded_op &o);
+	static void STR_RW(const decoded_op &o);
+	static void LDR_RW(const decoded_op &o);
+	static void STRB_R(const decoded_op &o);
+	static void LDRB_R(const decoded_op &o);
+	static void STRB_RW(const decoded_op &o);
+	static void LDRB_RW(const decoded_op &o);
+	static void STR_RP(const decoded_op &o);
+	static void LDR_RP(const decoded_op &o);
+	static void STR_RPW(const decoded_op &o);
+	static void LDR_RPW(const decoded_op &o);
+	static void STRB_RP(const decoded_op &o);
+	static void LDRB_RP(const decoded_op &o);
+	static void STRB_RPW(const decoded_op &o);
+	static void LDRB_RPW(const decoded_op &o);
+
+	static void AND_I(const decoded_op &o);
+	static void EOR_I(const decoded_op &o);
+	static void SUB_I(const decoded_op &o);
+	static void RSB_I(const decoded_op &o);
+	static void ADD_I(const decoded_op &o);
+	static void ADC_I(const decoded_op &o);
+	static void SBC_I(const decoded_op &o);
+	static void RSC_I(const decoded_op &o);
+	static void TST_I(const decoded_op &o);
+	static void TEQ_I(const decoded_op &o);
+	static void CMP_I(const decoded_op &o);
+	static void CMN_I(const decoded_op &o);
+	static void ORR_I(const decoded_op &o);
+	static void MOV_I(const decoded_op &o);
+	static void BIC_I(const decoded_op &o);
+	static void MVN_I(const decoded_op &o);
+
+	static void MSR_CPSR_I(const decoded_op &o);
+	static void MSR_SPSR_I(const decoded_op &o);
+
+	static void AND_R(const decoded_op &o);
+	static void EOR_R(const decoded_op &o);
+	static void SUB_R(const decoded_op &o);
+	static void RSB_R(const decoded_op &o);
+	static void ADD_R(const decoded_op &o);
+	static void ADC_R(const decoded_op &o);
+	static void SBC_R(const decoded_op &o);
+	static void RSC_R(const decoded_op &o);
+	static void TST_R(const decoded_op &o);
+	static void TEQ_R(const decoded_op &o);
+	static void CMP_R(const decoded_op &o);
+	static void CMN_R(const decoded_op &o);
+	static void ORR_R(const decoded_op &o);
+	static void MOV_R(const decoded_op &o);
+	static void BIC_R(const decoded_op &o);
+	static void MVN_R(const decoded_op &o);
+
+	static void AND_RR(const decoded_op &o);
+	static void EOR_RR(const decoded_op &o);
+	static void SUB_RR(const decoded_op &o);
+	static void RSB_RR(const decoded_op &o);
+	static void ADD_RR(const decoded_op &o);
+	static void ADC_RR(const decoded_op &o);
+	static void SBC_RR(const decoded_op &o);
+	static void RSC_RR(const decoded_op &o);
+	static void TST_RR(const decoded_op &o);
+	static void TEQ_RR(const decoded_op &o);
+	static void CMP_RR(const decoded_op &o);
+	static void CMN_RR(const decoded_op &o);
+	static void ORR_RR(const decoded_op &o);
+	static void MOV_RR(const decoded_op &o);
+	static void BIC_RR(const decoded_op &o);
+	static void MVN_RR(const decoded_op &o);
+
+	static void MSR_CPSR_R(const decoded_op &o);
+	static void MSR_SPSR_R(const decoded_op &o);
+	static void MRS_CPSR(const decoded_op &o);
+	static void MRS_SPSR(const decoded_op &o);
+
+	static void CLZ(const decoded_op &o);
+	static void SWI(const decoded_op &o);
+
+	static void BX(const decoded_op &o);
+	static void BLX(const decoded_op &o);
+	static void B(const decoded_op &o);
+	static void BL(const decoded_op &o);
+
+	static void MRC(const decoded_op &o);
+	static void MCR(const decoded_op &o);
+
+	static void STM(const decoded_op &o);
+	static void LDM(const decoded_op &o);
+	static void STM_W(const decoded_op &o);
+	static void LDM_W(const decoded_op &o);
+
+	static void STRX_I(const decoded_op &o);
+	static void LDRX_I(const decoded_op &o);
+	static void STRX_IW(const decoded_op &o);
+	static void LDRX_IW(const decoded_op &o);
+	static void STRX_IP(const decoded_op &o);
+	static void LDRX_IP(const decoded_op &o);
+	static void STRX_IPW(const decoded_op &o);
+	static void LDRX_IPW(const decoded_op &o);
+	static void STRX_R(const decoded_op &o);
+	static void LDRX_R(const decoded_op &o);
+	static void STRX_RW(const decoded_op &o);
+	static void LDRX_RW(const decoded_op &o);
+	static void STRX_RP(const decoded_op &o);
+	static void LDRX_RP(const decoded_op &o);
+	static void STRX_RPW(const decoded_op &o);
+	static void LDRX_RPW(const decoded_op &o);
+
+	static void BPRE(const decoded_op &o);
+
+	static void MUL_R(const decoded_op &o);
+	static void MLA_R(const decoded_op &o);
+
+	static void UMULL(const decoded_op &o);
+	static void UMLAL(const decoded_op &o);
+	static void SMULL(const decoded_op &o);
+	static void SMLAL(const decoded_op &o);
+
+	static void SWP(const decoded_op &o);
+	static void SWPB(const decoded_op &o);
+
+	static void BLX_I(const decoded_op &o);
+
+	static void LDRD_R(const decoded_op &o);
+	static void LDRD_RW(const decoded_op &o);
+	static void LDRD_RI(const decoded_op &o);
+	static void LDRD_RIW(const decoded_op &o);
+	static void LDRD_RP(const decoded_op &o);
+	static void LDRD_RPW(const decoded_op &o);
+	static void LDRD_RIP(const decoded_op &o);
+	static void LDRD_RIPW(const decoded_op &o);
+
+	static void PLD(const decoded_op &o);
 };
 
 bool InitHLCore();
 
-#endif
\ No newline at end of file
+#endif
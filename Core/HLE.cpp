@@ -7,11 +7,14 @@
 #include "CPUMode.h"
 #include "ArmContext.h"
 #include "CompiledBlock.h"
+#include "Compiler.h"
 #include "Processor.h"
 #include "lz77.h"
 #include "Util.h"
 #include "runner.h"
 #include "Interrupt.h"
+#include "Prefetch.h"
+#include "HLCore.h"
 
 // TODO: could give the compiler hints about the
 // b->flags & memory_block::PAGE_ACCESSHANDLER
@@ -187,7 +190,7 @@ void FASTCALL_IMPL(HLE<T>::store32(unsigned long addr, unsigned long value))
 	if (b->flags & (memory_block::PAGE_INVALID | memory_block::PAGE_WRITEPROT))
 		return invalid_write(addr);
 	*(unsigned long*)(&b->mem[addr & (PAGING::ADDRESS_MASK & (~3))]) = value;	
-	b->dirty();
+	b->written( addr & (PAGING::ADDRESS_MASK & (~3)), 4 );
 }
 
 template <typename T>
@@ -201,7 +204,7 @@ void FASTCALL_IMPL(HLE<T>::store16(unsigned long addr, unsigned long value))
 	if (b->flags & (memory_block::PAGE_INVALID | memory_block::PAGE_WRITEPROT))
 		return invalid_write(addr);
 	*(unsigned short*)(&b->mem[addr & (PAGING::ADDRESS_MASK & (~1))]) = (unsigned short)value;
-	b->dirty();
+	b->written( addr & (PAGING::ADDRESS_MASK & (~1)), 2 );
 }
 
 template <typename T>
@@ -216,7 +219,7 @@ void FASTCALL_IMPL(HLE<T>::store8(unsigned long addr, unsigned long value))
 		memory_block::PAGE_WRITEPROT8))
 		return invalid_write(addr);
 	*(unsigned char*)(&b->mem[addr & (PAGING::ADDRESS_MASK)]) = (unsigned char)value;
-	b->dirty();
+	b->written( addr & PAGING::ADDRESS_MASK, 1 );
 }
 
 template <typename T>
@@ -233,6 +236,7 @@ void HLE<T>::store32_array(unsigned long addr, int num, unsigned long *data)
 	if (b->flags & (memory_block::PAGE_INVALID | memory_block::PAGE_WRITEPROT))
 		return invalid_write(addr);
 	unsigned long subaddr = addr & (PAGING::ADDRESS_MASK & (~3));
+	unsigned long first = subaddr; // written part of the current page
 	while (data != end)
 	{
 		*(unsigned long*)(&b->mem[subaddr]) = *data; // store word
@@ -241,17 +245,19 @@ void HLE<T>::store32_array(unsigned long addr, int num, unsigned long *data)
 		if (subaddr == PAGING::SIZE) // reached end of page?
 		{
 			// dirty old page
-			b->dirty();
+			b->written( first, subaddr - first );
 			// load next page
 			addr += PAGING::SIZE;
 			b = memory_map<T>::addr2page(addr);
 			if (b->flags & (memory_block::PAGE_INVALID | memory_block::PAGE_WRITEPROT))
 				return invalid_write(addr & ~PAGING::ADDRESS_MASK);
 			subaddr = 0;
+			first = 0;
 		}
 	}
 	// dirty old page
-	b->dirty();
+	if (subaddr != first)
+		b->written( first, subaddr - first );
 }
 
 
@@ -301,14 +307,14 @@ emulation_context* FASTCALL_IMPL(HLE<T>::loadcpsr(unsigned long value, unsigned
 	// toggling mode      => remap registers
 	// toggle flags       => update x86flags
 
-	unsigned long &cpsr = processor<T>::ctx().cpsr;
+	u32 &cpsr = processor<T>::ctx().cpsr;
 	cpsr &= ~mask;
 	cpsr |= value & mask;
 
 	// sync x86 flags as needed
 	if (mask & 0xF8000000)
 	{
-		unsigned long &x86f = processor<T>::ctx().x86_flags;
+		u32 &x86f = processor<T>::ctx().x86_flags;
 		unsigned long flags = cpsr & 0xF8000000;
 		x86f = ((flags >> 16) | (flags >> 21) | (flags >> 28)) & 0x0C101;
 	}
@@ -355,55 +361,122 @@ emulation_context* FASTCALL_IMPL(HLE<T>::loadcpsr(unsigned long value, unsigned
 	return &processor<T>::ctx();
 }
 
-template <typename T> struct dirty_flag {};
-template <> struct dirty_flag<_ARM9> { enum { VALUE = memory_block::PAGE_DIRTY_J9 }; };
-template <> struct dirty_flag<_ARM7> { enum { VALUE = memory_block::PAGE_DIRTY_J7 }; };
-
-
 // execute a jump out of page boundaries
 template <typename T>
 char* FASTCALL_IMPL(HLE<T>::compile_and_link_branch_a_real(unsigned long addr))
 {
-	interrupt<T>::poll_process();
-	// resolve destination
-	memory_block *b = memory_map<T>::addr2page(addr);
-	processor<T>::last_page = b;
-
-	if (b->flags & (memory_block::PAGE_EXECPROT))
-		invalid_branch(addr);
-	// recompile if dirty
-	if (b->flags & dirty_flag<T>::VALUE)
+	memory_block *b;
+	memory_block::epoch++;
+	// interrupts invoked meanwhile resolve branches as well, so the
+	// cycles only get published once done
+	unsigned long cycles = 0;
+	for (;;)
 	{
-		b->flags &= ~dirty_flag<T>::VALUE;
-		if ( b->get_jit<T, IS_ARM>() )
-			b->recompile<T, IS_ARM>();
-		if ( b->get_jit<T, IS_THUMB>() )
-			b->recompile<T, IS_THUMB>();
+		interrupt<T>::poll_process();
+		// resolve destination
+		b = memory_map<T>::addr2page(addr);
+		processor<T>::last_page = b;
+
+		if (b->flags & (memory_block::PAGE_EXECPROT))
+			invalid_branch(addr);
+
+		// cold pages and pages in a recompile storm get interpreted, up to
+		// the first instruction the interpreter has no handler for
+		if ((addr & 1) ? !b->interpreted<T, IS_THUMB>() : !b->interpreted<T, IS_ARM>())
+			break;
+		unsigned long steps;
+		unsigned long next = HLCore<T>::run( addr, steps );
+		cycles += steps;
+		if (next == addr)
+			break;
+		addr = next;
 	}
+
+	// recompile if dirty, only the code of the instruction set entered
 	if (addr & 1)
 	{
+		b->flush<T, IS_THUMB>();
 		compiled_block<IS_THUMB>* &block = b->get_jit<T, IS_THUMB>();
-		if ( !block )                         // if not compiled yet
-			b->recompile<T, IS_THUMB>();  // compile the block
 		unsigned long inst = (addr & PAGING::ADDRESS_MASK) >> 1;
-		return block->remap[inst];
+		size_t known = block ? block->exits.size() : 0;
+		char *dest = b->entry<T, IS_THUMB>(inst); // compiles if not done yet
+		entry_reg = block->cached_reg < 0 ? 0 : block->cached_reg;
+		entry_ctx = (char*)&processor<T>::ctx();
+		interp_cycles = cycles;
+#ifdef JIT_PREFETCH
+		jit_prefetch::request_exits<T>( addr, block->exits, known );
+#endif
+		return dest;
 	} else
 	{
+		b->flush<T, IS_ARM>();
 		compiled_block<IS_ARM>* &block = b->get_jit<T, IS_ARM>();
-		if ( !block )                       // if not compiled yet
-			b->recompile<T, IS_ARM>();  // compile the block
 		unsigned long inst = (addr & PAGING::ADDRESS_MASK) >> 2;
-		return block->remap[inst];
+		size_t known = block ? block->exits.size() : 0;
+		char *dest = b->entry<T, IS_ARM>(inst); // compiles if not done yet
+		entry_reg = block->cached_reg < 0 ? 0 : block->cached_reg;
+		entry_ctx = (char*)&processor<T>::ctx();
+		interp_cycles = cycles;
+#ifdef JIT_PREFETCH
+		jit_prefetch::request_exits<T>( addr, block->exits, known );
+#endif
+		return dest;
+	}
+}
+
+// same as above but patches the calling jump site to the destination
+template <typename T>
+char* FASTCALL_IMPL(HLE<T>::compile_and_link_branch_l_real(unsigned long addr, block_link *link))
+{
+	unsigned long generation = compiled_block_links::generation;
+	char *dest = compile_and_link_branch_a_real(addr);
+	// some block got deleted meanwhile, the link might be gone
+	if (generation != compiled_block_links::generation)
+		return dest;
+	// dest is not the code for addr if some got interpreted before
+	if (interp_cycles)
+		return dest;
+	memory_block *b = processor<T>::last_page;
+	// dont link into the shared HLE pages
+	if (b->flags & memory_block::PAGE_INVALID)
+		return dest;
+	if (addr & 1)
+	{
+		compiled_block<IS_THUMB> *to = b->get_jit<T, IS_THUMB>();
+		compiler::link( link, to, to->cached_reg, addr, b, code_dirty_flag<T, IS_THUMB>::VALUE, dest );
+	} else
+	{
+		compiled_block<IS_ARM> *to = b->get_jit<T, IS_ARM>();
+		compiler::link( link, to, to->cached_reg, addr, b, code_dirty_flag<T, IS_ARM>::VALUE, dest );
 	}
+	return dest;
+}
+
+// same as above for a way of an inline cache (see compiler::jmp_indirect)
+// once linked its address check falls through to the next way
+template <typename T>
+char* FASTCALL_IMPL(HLE<T>::compile_and_link_branch_c_real(unsigned long addr, block_link *link))
+{
+	unsigned long generation = compiled_block_links::generation;
+	char *dest = compile_and_link_branch_l_real(addr, link);
+	if ((generation == compiled_block_links::generation) && link->to)
+		compiler::chain( link );
+	return dest;
 }
 
 // this stub is needed as the original calling code
 // migh get overwritten by the compile call!
 // this is compiler dependant as i dont know any way to do this
 // highlevel yet ...
-template <typename T> char HLE<T>::compile_and_link_branch_a[7+HLE<T>::SECURITY_PADDING];
-template <typename T> char HLE<T>::invoke_arm[19+HLE<T>::SECURITY_PADDING];
+template <typename T> char HLE<T>::compile_and_link_branch_a[HLE<T>::BRANCH_STUB+HLE<T>::SECURITY_PADDING];
+template <typename T> char HLE<T>::compile_and_link_branch_l[HLE<T>::BRANCH_STUB+HLE<T>::SECURITY_PADDING];
+template <typename T> char HLE<T>::compile_and_link_branch_c[HLE<T>::BRANCH_STUB+HLE<T>::SECURITY_PADDING];
+template <typename T> char HLE<T>::invoke_arm[HLE<T>::INVOKE_STUB+HLE<T>::SECURITY_PADDING];
+template <typename T> unsigned long HLE<T>::entry_reg = 0;
+template <typename T> char* HLE<T>::entry_ctx = 0;
+template <typename T> unsigned long HLE<T>::interp_cycles = 0;
 template <typename T> char HLE<T>::read_tsc[3+HLE<T>::SECURITY_PADDING];
+template <typename T> return_stack HLE<T>::returns;
 
 // if possible remove the wrapping!
 template <typename T>
@@ -422,16 +495,205 @@ static void prepare_stub(char *addr, size_t sz)
 	cacheflush( addr, (int)sz, ICACHE );
 }
 
+// loads edi with the register cached by the block about to be entered
+// (see compiler::reg_op)
+template <typename T>
+void HLE<T>::load_entry_reg(std::ostream &s)
+{
+	unsigned long *r = &entry_reg;
+#ifdef JIT_X64
+	s << "\x48\xBA"; s.write((char*)&r, sizeof(r));      // mov rdx, &entry_reg
+	s << "\x8B\x12";                                    // mov edx, [rdx]
+	s << "\x44\x8B\x64\x95" << (char)OFFSET(regs[0]);   // mov r12d, [rbp+rdx*4+R0]
+#else
+	s << "\x8B\x15"; s.write((char*)&r, sizeof(r));   // mov edx, [entry_reg]
+	s << "\x8B\x7C\x95" << (char)OFFSET(regs[0]);     // mov edi, [ebp+edx*4+R0]
+#endif
+}
+
+// loads ebp with the context of the block about to be entered
+// the interpreter might have switched the mode meanwhile
+template <typename T>
+void HLE<T>::load_entry_ctx(std::ostream &s)
+{
+	char **c = &entry_ctx;
+#ifdef JIT_X64
+	s << "\x48\xBA"; s.write((char*)&c, sizeof(c));      // mov rdx, &entry_ctx
+	s << "\x48\x8B\x2A";                                // mov rbp, [rdx]
+#else
+	s << "\x8B\x2D"; s.write((char*)&c, sizeof(c));      // mov ebp, [entry_ctx]
+#endif
+}
+
+// accounts the instructions interpreted while resolving the branch
+template <typename T>
+void HLE<T>::add_interp_cycles(std::ostream &s)
+{
+	unsigned long *c = &interp_cycles;
+#ifdef JIT_X64
+	s << "\x48\xBA"; s.write((char*)&c, sizeof(c));      // mov rdx, &interp_cycles
+	s << "\x03\x1A";                                    // add ebx, [rdx]
+#else
+	s << "\x03\x1D"; s.write((char*)&c, sizeof(c));      // add ebx, [interp_cycles]
+#endif
+}
+
+// jumps to the code resolved (in eax) with EFLAGS holding the saved flags
+// the code might be entered behind a flag setter it compiled to leave them
+// in EFLAGS (see compiler::flags_updated), the resolve clobbered those
+template <typename T>
+void HLE<T>::jmp_entry(std::ostream &s)
+{
+#ifdef JIT_X64
+	s << "\x48\x89\xC2";                             // mov rdx, rax
+#else
+	s << "\x8B\xD0";                                 // mov edx, eax
+#endif
+	s << "\x8B\x45" << (char)OFFSET(x86_flags);       // mov eax, [ebp+x86_flags]
+	s << "\xD0\xC8";                                 // ror al, 1
+	s << '\x9E';                                     // sahf
+	s << "\xFF\xE2";                                 // jmp edx
+}
+
+#ifdef JIT_X64
+// calls func with the stack aligned for the SysV ABI
+// uses r13 which the generated code does not touch otherwise
+static void aligned_call(std::ostream &s, char *func)
+{
+	s << "\x49\x89\xE5";                        // mov r13, rsp
+	s << "\x48\x83\xE4\xF0";                    // and rsp, -16
+	s << "\x48\xB8"; s.write((char*)&func, sizeof(func)); // mov rax, func
+	s << "\xFF\xD0";                            // call rax
+	s << "\x4C\x89\xEC";                        // mov rsp, r13
+}
+#endif
+
 template <typename T>
 void HLE<T>::init()
 {
+#ifdef JIT_X64
+	{
+		// input: ecx = arm addr as emitted by the JIT
+		std::ostringstream s;
+		char *data = HLE<T>::compile_and_link_branch_a;
+		char *func = (char*)&HLE<T>::compile_and_link_branch_a_real;
+		s << "\x89\xCF";                             // mov edi, ecx
+		aligned_call( s, func );
+		add_interp_cycles( s );
+		load_entry_ctx( s );
+		load_entry_reg( s );
+		jmp_entry( s );
+		std::string str = s.str();
+		memset( data, 0x90, str.size() + SECURITY_PADDING );
+		memcpy( data, str.data(), str.size() );
+		prepare_stub( data, str.size() );
+	}
+	{
+		// input: ecx = arm addr, rdx = link
+		std::ostringstream s;
+		char *data = HLE<T>::compile_and_link_branch_l;
+		char *func = (char*)&HLE<T>::compile_and_link_branch_l_real;
+		s << "\x89\xCF";                             // mov edi, ecx
+		s << "\x48\x89\xD6";                         // mov rsi, rdx
+		aligned_call( s, func );
+		add_interp_cycles( s );
+		load_entry_ctx( s );
+		load_entry_reg( s );
+		jmp_entry( s );
+		std::string str = s.str();
+		memset( data, 0x90, str.size() + SECURITY_PADDING );
+		memcpy( data, str.data(), str.size() );
+		prepare_stub( data, str.size() );
+	}
+	{
+		// input: ecx = arm addr, rdx = link
+		std::ostringstream s;
+		char *data = HLE<T>::compile_and_link_branch_c;
+		char *func = (char*)&HLE<T>::compile_and_link_branch_c_real;
+		s << "\x89\xCF";                             // mov edi, ecx
+		s << "\x48\x89\xD6";                         // mov rsi, rdx
+		aligned_call( s, func );
+		add_interp_cycles( s );
+		load_entry_ctx( s );
+		load_entry_reg( s );
+		jmp_entry( s );
+		std::string str = s.str();
+		memset( data, 0x90, str.size() + SECURITY_PADDING );
+		memcpy( data, str.data(), str.size() );
+		prepare_stub( data, str.size() );
+	}
+	{
+		std::ostringstream s;
+		char *data = HLE<T>::invoke_arm;
+		char *func = (char*)&HLE<T>::compile_and_link_branch_a_real;
+		unsigned long ret = 0xEFEF0000;
+		// input: edi = arm addr, rsi = context pointer
+		// rbx, rbp and r12-r14 are callee saved but used by the JIT
+		s << '\x53';                                      // push rbx
+		s << '\x55';                                      // push rbp
+		s << "\x41\x54";                                  // push r12
+		s << "\x41\x55";                                  // push r13
+		s << "\x41\x56";                                  // push r14
+		s << "\x48\x8B\xEE";                              // mov rbp, rsi
+		s << "\xC7\x45" << (char)OFFSET(regs[14]);        // mov dword ptr [rbp+LR]
+		s.write((char*)&ret, 4);                          //   , 0xEFEF0000
+		aligned_call( s, func );
+		load_entry_ctx( s );
+		load_entry_reg( s );
+		s << "\xFF\xD0";                                  // call rax
+		s << "\x41\x5E";                                  // pop r14
+		s << "\x41\x5D";                                  // pop r13
+		s << "\x41\x5C";                                  // pop r12
+		s << '\x5D';                                      // pop rbp
+		s << '\x5B';                                      // pop rbx
+		s << '\xC3';                                      // ret
+
+		std::string str = s.str();
+		memset( data, 0x90, str.size() + SECURITY_PADDING );
+		memcpy( data, str.data(), str.size() );
+		prepare_stub( data, str.size() );
+	}
+#else
 	{
 		std::ostringstream s;
 		char *data = HLE<T>::compile_and_link_branch_a;
 		char *func = (char*)&HLE<T>::compile_and_link_branch_a_real;
 		unsigned long d = func - data - 5;
 		s << '\xE8'; s.write((char*)&d, sizeof(d)); // call func
-		s << "\xFF\xE0";                            // jmp eax
+		add_interp_cycles( s );
+		load_entry_ctx( s );
+		load_entry_reg( s );
+		jmp_entry( s );
+		std::string str = s.str();
+		memset( data, 0x90, str.size() + SECURITY_PADDING );
+		memcpy( data, str.data(), str.size() );
+		prepare_stub( data, str.size() );
+	}
+	{
+		std::ostringstream s;
+		char *data = HLE<T>::compile_and_link_branch_l;
+		char *func = (char*)&HLE<T>::compile_and_link_branch_l_real;
+		unsigned long d = func - data - 5;
+		s << '\xE8'; s.write((char*)&d, sizeof(d)); // call func
+		add_interp_cycles( s );
+		load_entry_ctx( s );
+		load_entry_reg( s );
+		jmp_entry( s );
+		std::string str = s.str();
+		memset( data, 0x90, str.size() + SECURITY_PADDING );
+		memcpy( data, str.data(), str.size() );
+		prepare_stub( data, str.size() );
+	}
+	{
+		std::ostringstream s;
+		char *data = HLE<T>::compile_and_link_branch_c;
+		char *func = (char*)&HLE<T>::compile_and_link_branch_c_real;
+		unsigned long d = func - data - 5;
+		s << '\xE8'; s.write((char*)&d, sizeof(d)); // call func
+		add_interp_cycles( s );
+		load_entry_ctx( s );
+		load_entry_reg( s );
+		jmp_entry( s );
 		std::string str = s.str();
 		memset( data, 0x90, str.size() + SECURITY_PADDING );
 		memcpy( data, str.data(), str.size() );
@@ -452,6 +714,8 @@ void HLE<T>::init()
 		s << "\xC7\x45" << (char)OFFSET(regs[14]);        // mov [ebp+LR]
 		s.write((char*)&ret, sizeof(ret));                //   , 0xEFEF0000
 		s << '\xE8'; s.write((char*)&d, sizeof(d));       // call func
+		load_entry_ctx( s );
+		load_entry_reg( s );
 		s << "\xFF\xD0";                                  // call eax
 		s << '\x61';                                      // popad
 		//s << '\x5D';                                      // pop ebp
@@ -464,6 +728,7 @@ void HLE<T>::init()
 		prepare_stub( data, str.size() );
 	}
 
+#endif
 	{
 		std::ostringstream s;
 		char *data = HLE<T>::read_tsc;		
@@ -474,6 +739,7 @@ void HLE<T>::init()
 		memcpy( data, str.data(), str.size() );	
 		prepare_stub( data, str.size() );
 	}
+	returns.init( HLE<T>::compile_and_link_branch_a );
 }
 
 #undef OFFSET
@@ -484,6 +750,9 @@ bool InitHLE()
 	HLE<_ARM9>::init();
 	// init default mapping
 	HLE<_ARM9>::remap_tcm(0x80000A, 0);
+#ifdef JIT_PREFETCH
+	jit_prefetch::start();
+#endif
 	return true;
 }
 
@@ -769,6 +1038,43 @@ template <typename T> void HLE<T>::wait_vblank()
 	QPseudoThread::do_sleep(20); //Sleep(20);
 }
 
+static unsigned long idle_value(volatile const char *p, unsigned long size)
+{
+	switch (size)
+	{
+	case 1: return *(volatile const unsigned char*)p;
+	case 2: return *(volatile const unsigned short*)p;
+	}
+	return *(volatile const unsigned int*)p;
+}
+
+// called by the JIT for a taken backward branch of a loop that only
+// reads memory and compares (see compiler::find_idle_loop)
+// such a loop cannot leave before an interrupt gets signaled or someone
+// else changes the value it reads, so give up the host thread meanwhile.
+// addr/size describe the watched load (size = 0 for none), IO and other
+// pages with access handlers are not read as that might have side effects
+template <typename T>
+void FASTCALL_IMPL(HLE<T>::idle_loop(unsigned long addr, unsigned long size))
+{
+	enum { MAX_YIELDS = 256 }; // the loop rechecks everything after this
+	volatile const char *watch = 0;
+	memory_block *b = memory_map<T>::addr2page(addr);
+	if (size && !(b->flags & (memory_block::PAGE_INVALID | memory_block::PAGE_READPROT | 
+		memory_block::PAGE_ACCESSHANDLER)))
+		watch = &b->mem[addr & PAGING::ADDRESS_MASK & ~(size - 1)];
+
+	unsigned long value = watch ? idle_value( watch, size ) : 0;
+	for (int i = 0; i < MAX_YIELDS; i++)
+	{
+		if (interrupt<T>::signaled)
+			return;
+		QPseudoThread::yieldCurrentThread();
+		if (watch && (idle_value( watch, size ) != value))
+			return;
+	}
+}
+
 template <>
 void FASTCALL_IMPL(HLE<_ARM9>::swi(unsigned long idx))
 {
@@ -837,12 +1143,15 @@ void symbols::init()
 	syms[(void*)HLE<_ARM9>::store32_array]             = "arm9::mem::store32_array";
 	syms[(void*)HLE<_ARM9>::load32_array]              = "arm9::mem::load32_array";
 	syms[(void*)HLE<_ARM9>::compile_and_link_branch_a] = "arm9::arm::branch";
+	syms[(void*)HLE<_ARM9>::compile_and_link_branch_l] = "arm9::arm::branch_link";
+	syms[(void*)HLE<_ARM9>::compile_and_link_branch_c] = "arm9::arm::branch_cache";
 	syms[(void*)HLE<_ARM9>::is_priviledged]            = "arm9::is_priviledged";
 	syms[(void*)HLE<_ARM9>::remap_tcm]                 = "arm9::TCM";
 	syms[(void*)HLE<_ARM9>::pushcallstack]             = "arm9::dbg::callstack::push";
 	syms[(void*)HLE<_ARM9>::popcallstack]              = "arm9::dbg::callstack::pop";
 	syms[(void*)HLE<_ARM9>::swi]                       = "arm9::swi";
 	syms[(void*)HLE<_ARM9>::debug_magic]               = "arm9::debugmagic";
+	syms[(void*)HLE<_ARM9>::idle_loop]                 = "arm9::idle";
 	syms[(void*)HLE<_ARM9>::loadcpsr]                  = "arm9::cpsr::load";
 	syms[(void*)HLE<_ARM9>::storecpsr]                 = "arm9::cpsr::store";
 
@@ -856,12 +1165,15 @@ void symbols::init()
 	syms[(void*)HLE<_ARM7>::store32_array]             = "arm7::mem::store32_array";
 	syms[(void*)HLE<_ARM7>::load32_array]              = "arm7::mem::load32_array";
 	syms[(void*)HLE<_ARM7>::compile_and_link_branch_a] = "arm7::arm::branch";
+	syms[(void*)HLE<_ARM7>::compile_and_link_branch_l] = "arm7::arm::branch_link";
+	syms[(void*)HLE<_ARM7>::compile_and_link_branch_c] = "arm7::arm::branch_cache";
 	syms[(void*)HLE<_ARM7>::is_priviledged]            = "arm7::is_priviledged";
 	syms[(void*)HLE<_ARM7>::remap_tcm]                 = "arm7::TCM";
 	syms[(void*)HLE<_ARM7>::pushcallstack]             = "arm7::dbg::callstack::push";
 	syms[(void*)HLE<_ARM7>::popcallstack]              = "arm7::dbg::callstack::pop";
 	syms[(void*)HLE<_ARM7>::swi]                       = "arm7::swi";
 	syms[(void*)HLE<_ARM7>::debug_magic]               = "arm7::debugmagic";
+	syms[(void*)HLE<_ARM7>::idle_loop]                 = "arm7::idle";
 	syms[(void*)HLE<_ARM7>::loadcpsr]                  = "arm7::cpsr::load";
 	syms[(void*)HLE<_ARM7>::storecpsr]                 = "arm7::cpsr::store";
 }
@@ -2,6 +2,7 @@
 #define _HLE_H_
 
 #include <map>
+#include <iosfwd>
 #include "forward.h"
 #include "MemMap.h"
 #include "runner.h"
@@ -14,6 +15,13 @@
 #define FASTCALL_G __fastcall
 #define FASTCALL_IMPL(x) FASTCALL(x)
 #define NAKEDCALL_IMPL(x) __declspec(naked) __fastcall x
+#elif defined(__x86_64__)
+// there is only one calling convention on x86-64 (SysV)
+#define FASTCALL(x) x
+#define FASTCALL_F(x) x
+#define FASTCALL_G
+#define FASTCALL_IMPL(x) x
+#define NAKEDCALL_IMPL(x) __attribute__((naked)) x
 #else
 #define FASTCALL(x) x __attribute__((fastcall))
 #define FASTCALL_F(x) x __attribute__((fastcall))
@@ -70,12 +78,27 @@ typedef void FASTCALL_F((FASTCALL_G *invoke_fun)(unsigned long, void*));
 typedef unsigned long FASTCALL_F((FASTCALL_G *readtsc_fun)());
 
 struct emulation_context;
+struct return_stack;
 template <typename T>
 struct HLE
 {
 private:
 	enum { SECURITY_PADDING = 64 };
+#ifdef JIT_X64
+	enum { BRANCH_STUB = 80, INVOKE_STUB = 82 };
+#else
+	enum { BRANCH_STUB = 37, INVOKE_STUB = 35 };
+#endif
 	static char* FASTCALL(compile_and_link_branch_a_real(unsigned long addr));
+	static char* FASTCALL(compile_and_link_branch_l_real(unsigned long addr, block_link *link));
+	static char* FASTCALL(compile_and_link_branch_c_real(unsigned long addr, block_link *link));
+	static unsigned long entry_reg; // cached register of the last resolved block
+	static void load_entry_reg(std::ostream &s);
+	static char *entry_ctx; // context to enter the block with
+	static void load_entry_ctx(std::ostream &s);
+	static unsigned long interp_cycles; // instructions interpreted by the last resolve
+	static void add_interp_cycles(std::ostream &s);
+	static void jmp_entry(std::ostream &s);
 	
 	static void delay();          // SWI 3h
 	static void IntrWait();       // SWI 4h
@@ -108,9 +131,12 @@ public:
 	static unsigned long FASTCALL(load8u(unsigned long addr));
 	static void load32_array(unsigned long addr, int num, unsigned long *data);
 
-	static char compile_and_link_branch_a[7+SECURITY_PADDING];
-	static char invoke_arm[19+SECURITY_PADDING];
+	static char compile_and_link_branch_a[BRANCH_STUB+SECURITY_PADDING];
+	static char compile_and_link_branch_l[BRANCH_STUB+SECURITY_PADDING];
+	static char compile_and_link_branch_c[BRANCH_STUB+SECURITY_PADDING];
+	static char invoke_arm[INVOKE_STUB+SECURITY_PADDING];
 	static char read_tsc[3+SECURITY_PADDING];
+	static return_stack returns; // shadow return stack of the compiled code
 
 	static void FASTCALL(is_priviledged());
 	static void FASTCALL(remap_tcm(unsigned long value, unsigned long mode));
@@ -118,6 +144,7 @@ public:
 	static void FASTCALL(popcallstack(unsigned long addr));
 	static void FASTCALL(swi(unsigned long idx));
 	static void FASTCALL(debug_magic(unsigned long addr));
+	static void FASTCALL(idle_loop(unsigned long addr, unsigned long size));
 
 	static unsigned short crc16_direct(unsigned short crc, unsigned long addr, int len);
 
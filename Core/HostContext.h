@@ -10,6 +10,7 @@ struct host_context
 	bool addr_resolved;     /*! flags validity of addr:subaddr */
 	unsigned long addr;     /*! Last ARM address executed */
 	unsigned long subaddr;  /*! Last JIT line of addr that got executed */
+	int cached_reg;         /*! ARM register held in edi at the break (-1 = none) */
 };
 
 #endif
@@ -0,0 +1,240 @@
+#include <cstring>
+#include "IR.h"
+
+bool ir::translate(const disassembler::context &c, bool flags_dead, inst &i)
+{
+	if ((c.cond != CONDITION::AL) || (c.rd == 15))
+		return false;
+	if ((c.flags & disassembler::S_BIT) && !flags_dead)
+		return false;
+
+	bool imm = true;
+	switch (c.instruction)
+	{
+	case INST::MOV_I: i.op = MOV; break;
+	case INST::MVN_I: i.op = MVN; break;
+	case INST::ADD_I: i.op = ADD; break;
+	case INST::SUB_I: i.op = SUB; break;
+	case INST::RSB_I: i.op = RSB; break;
+	case INST::AND_I: i.op = AND; break;
+	case INST::ORR_I: i.op = ORR; break;
+	case INST::EOR_I: i.op = EOR; break;
+	case INST::BIC_I: i.op = BIC; break;
+	case INST::MOV_R: i.op = MOV; imm = false; break;
+	case INST::MVN_R: i.op = MVN; imm = false; break;
+	case INST::ADD_R: i.op = ADD; imm = false; break;
+	case INST::SUB_R: i.op = SUB; imm = false; break;
+	case INST::RSB_R: i.op = RSB; imm = false; break;
+	case INST::AND_R: i.op = AND; imm = false; break;
+	case INST::ORR_R: i.op = ORR; imm = false; break;
+	case INST::EOR_R: i.op = EOR; imm = false; break;
+	case INST::BIC_R: i.op = BIC; imm = false; break;
+	default:
+		return false;
+	}
+
+	i.rd = c.rd;
+	if (imm)
+	{
+		i.b.is_imm = true;
+		i.b.imm = c.imm;
+	} else
+	{
+		if (c.rm == 15)
+			return false;
+		switch (c.shift)
+		{
+		case SHIFT::LSL:
+			if (c.imm > 31)
+				return false;
+			// mov r12, r12 is the debug magic
+			if ((i.op == MOV) && (c.rm == c.rd) && (c.imm == 0))
+				return false;
+			break;
+		case SHIFT::LSR:
+		case SHIFT::ASR:
+		case SHIFT::ROR:
+			if ((c.imm == 0) || (c.imm > 31))
+				return false;
+			break;
+		default:
+			return false; // RRX reads the carry
+		}
+		i.b.is_imm = false;
+		i.b.imm = 0;
+		i.b.reg = c.rm;
+		i.b.shift = c.shift;
+		i.b.amount = c.imm;
+	}
+
+	if ((i.op == MOV) || (i.op == MVN))
+	{
+		i.a.is_imm = true;
+		i.a.imm = 0;
+	} else
+	{
+		if (c.rn == 15)
+			return false;
+		i.a.is_imm = false;
+		i.a.imm = 0;
+		i.a.reg = c.rn;
+		i.a.shift = SHIFT::LSL;
+		i.a.amount = 0;
+	}
+	return true;
+}
+
+unsigned long ir::shift(unsigned long v, SHIFT::CODE s, unsigned int amount)
+{
+	v &= 0xFFFFFFFF;
+	if (amount == 0)
+		return v;
+	switch (s)
+	{
+	case SHIFT::LSL: return (v << amount) & 0xFFFFFFFF;
+	case SHIFT::LSR: return v >> amount;
+	case SHIFT::ASR: return (unsigned long)(unsigned int)((int)(unsigned int)v >> amount);
+	case SHIFT::ROR: return ((v >> amount) | (v << (32 - amount))) & 0xFFFFFFFF;
+	default:
+		return v;
+	}
+}
+
+unsigned long ir::eval(opcode op, unsigned long a, unsigned long b)
+{
+	unsigned long r;
+	switch (op)
+	{
+	case MOV: r = b; break;
+	case MVN: r = ~b; break;
+	case ADD: r = a + b; break;
+	case SUB: r = a - b; break;
+	case RSB: r = b - a; break;
+	case AND: r = a & b; break;
+	case ORR: r = a | b; break;
+	case EOR: r = a ^ b; break;
+	case BIC: r = a & ~b; break;
+	default:
+		r = 0;
+	}
+	return r & 0xFFFFFFFF;
+}
+
+// registers holding a value known at compile time are replaced by it,
+// operations on constants only become moves of the result
+bool ir::fold_constants(code &c)
+{
+	bool changed = false;
+	bool known[16];
+	unsigned long value[16];
+	memset( known, 0, sizeof(known) );
+	for (size_t k = 0; k < c.size(); k++)
+	{
+		inst &i = c[k];
+		if (i.op == NOP)
+			continue;
+		operand *ops[2] = { &i.a, &i.b };
+		for (int n = 0; n < 2; n++)
+		{
+			operand &o = *ops[n];
+			if (!o.is_imm && known[o.reg])
+			{
+				o.imm = shift( value[o.reg], o.shift, o.amount );
+				o.is_imm = true;
+				changed = true;
+			}
+		}
+		if (i.a.is_imm && i.b.is_imm)
+		{
+			unsigned long r = eval( i.op, i.a.imm, i.b.imm );
+			if (i.op != MOV)
+			{
+				i.op = MOV;
+				i.a.imm = 0;
+				i.b.imm = r;
+				changed = true;
+			}
+			known[i.rd] = true;
+			value[i.rd] = r;
+		} else known[i.rd] = false;
+	}
+	return changed;
+}
+
+// reads of a register copied from another one read the original instead
+// (only registers moved without a shift)
+bool ir::propagate_copies(code &c)
+{
+	bool changed = false;
+	int copy[16];
+	for (int r = 0; r < 16; r++)
+		copy[r] = -1;
+	for (size_t k = 0; k < c.size(); k++)
+	{
+		inst &i = c[k];
+		if (i.op == NOP)
+			continue;
+		operand *ops[2] = { &i.a, &i.b };
+		for (int n = 0; n < 2; n++)
+		{
+			operand &o = *ops[n];
+			if (!o.is_imm && (copy[o.reg] >= 0))
+			{
+				o.reg = copy[o.reg];
+				changed = true;
+			}
+		}
+		// rd gets overwritten, drop the copies involving it
+		for (int r = 0; r < 16; r++)
+			if (copy[r] == i.rd)
+				copy[r] = -1;
+		copy[i.rd] = -1;
+		if ((i.op == MOV) && !i.b.is_imm && (i.b.amount == 0) && (i.b.reg != i.rd))
+			copy[i.rd] = i.b.reg;
+	}
+	return changed;
+}
+
+// drops writes overwritten within the segment before being read
+// all registers are live behind the segment
+bool ir::eliminate_dead_stores(code &c)
+{
+	bool changed = false;
+	bool live[16];
+	for (int r = 0; r < 16; r++)
+		live[r] = true;
+	for (size_t k = c.size(); k-- > 0; )
+	{
+		inst &i = c[k];
+		if (i.op == NOP)
+			continue;
+		if (!live[i.rd])
+		{
+			i.op = NOP;
+			changed = true;
+			continue;
+		}
+		live[i.rd] = false;
+		if (!i.a.is_imm)
+			live[i.a.reg] = true;
+		if (!i.b.is_imm)
+			live[i.b.reg] = true;
+	}
+	return changed;
+}
+
+bool ir::optimize(code &c)
+{
+	enum { MAX_ROUNDS = 4 };
+	bool changed = false;
+	for (int n = 0; n < MAX_ROUNDS; n++)
+	{
+		bool step = fold_constants( c );
+		step |= propagate_copies( c );
+		if (!step)
+			break;
+		changed = true;
+	}
+	changed |= eliminate_dead_stores( c );
+	return changed;
+}
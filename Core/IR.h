@@ -0,0 +1,53 @@
+#ifndef _IR_H_
+#define _IR_H_
+
+#include <vector>
+#include "Disassembler.h"
+
+// small intermediate representation of straight ARM data processing
+//
+// compiler::emit_piece translates segments of unconditional register and
+// immediate operations into it (see translate), so the values computed by
+// one instruction carry over to the following ones. The passes rewrite the
+// segment in place and compiler::lower_ir turns the result into x86.
+// Anything else (memory, flags, branches, ...) stays with
+// compiler::compile_instruction.
+struct ir
+{
+	enum opcode { NOP, MOV, MVN, ADD, SUB, RSB, AND, ORR, EOR, BIC };
+	enum { MAX_SEGMENT = 16 };
+
+	// immediate or register shifted by an immediate
+	struct operand
+	{
+		bool is_imm;
+		unsigned long imm;
+		int reg;
+		SHIFT::CODE shift;
+		unsigned int amount;
+	};
+
+	struct inst
+	{
+		opcode op;
+		int rd;
+		operand a; // Rn, unused by MOV and MVN
+		operand b; // shifter operand
+	};
+	typedef std::vector<inst> code;
+
+	// false if the instruction is nothing the IR handles
+	// flags_dead lets S forms through, their flags are overwritten unread
+	static bool translate(const disassembler::context &c, bool flags_dead, inst &i);
+
+	// passes, each returns true if it changed the code
+	static bool fold_constants(code &c);
+	static bool propagate_copies(code &c);
+	static bool eliminate_dead_stores(code &c);
+	static bool optimize(code &c);
+
+	static unsigned long shift(unsigned long v, SHIFT::CODE s, unsigned int amount);
+	static unsigned long eval(opcode op, unsigned long a, unsigned long b);
+};
+
+#endif
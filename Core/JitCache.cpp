@@ -0,0 +1,231 @@
+#include <cstring>
+#include "JitCache.h"
+#include "Namespaces.h"
+#include "Logging.h"
+
+boost::mutex jit_cache::lock;
+jit_cache::entry_map jit_cache::entries;
+FILE *jit_cache::file = 0;
+
+// identifies the build that wrote a cache file
+struct cache_header
+{
+	char magic[8];
+	unsigned int pointer_size;
+	unsigned int key_size;
+	unsigned int codegen;
+
+	void init()
+	{
+		memset( this, 0, sizeof(*this) );
+		memcpy( magic, "NDSEJIT4", 8 );
+		pointer_size = sizeof(void*);
+		key_size = sizeof(jit_cache::key);
+		codegen = jit_cache::CODEGEN_VERSION;
+	}
+};
+
+bool jit_cache::key::operator == (const key &other) const
+{
+	return (cpu == other.cpu) && (thumb == other.thumb) && (literals == other.literals) &&
+		(cached_reg == other.cached_reg) && (start == other.start) && (end == other.end) &&
+		(memcmp( mem, other.mem, sizeof(mem) ) == 0);
+}
+
+// FNV-1a
+unsigned long long jit_cache::key::hash() const
+{
+	unsigned long long h = 14695981039346656037ULL;
+	const unsigned char *p = (const unsigned char*)mem;
+	for (size_t i = 0; i < sizeof(mem); i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	h = (h ^ cpu) * 1099511628211ULL;
+	h = (h ^ thumb) * 1099511628211ULL;
+	h = (h ^ literals) * 1099511628211ULL;
+	h = (h ^ (unsigned char)cached_reg) * 1099511628211ULL;
+	h = (h ^ start) * 1099511628211ULL;
+	h = (h ^ end) * 1099511628211ULL;
+	return h;
+}
+
+// FNV-1a over the bytes, continuing from h
+static unsigned long long fnv(unsigned long long h, const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h;
+}
+
+template <typename T> static unsigned long long fnv_vector(unsigned long long h, const std::vector<T> &v)
+{
+	unsigned int n = (unsigned int)v.size();
+	h = fnv( h, &n, sizeof(n) );
+	return n ? fnv( h, &v[0], n * sizeof(T) ) : h;
+}
+
+// fails for more than max elements
+template <typename T> static bool read_vector(FILE *f, std::vector<T> &v, unsigned int max)
+{
+	unsigned int n;
+	if ((fread( &n, sizeof(n), 1, f ) != 1) || (n > max))
+		return false;
+	v.resize( n );
+	return !n || (fread( &v[0], sizeof(T), n, f ) == n);
+}
+
+template <typename T> static void write_vector(FILE *f, const std::vector<T> &v)
+{
+	unsigned int n = (unsigned int)v.size();
+	fwrite( &n, sizeof(n), 1, f );
+	if (n)
+		fwrite( &v[0], sizeof(T), n, f );
+}
+
+unsigned long long jit_cache::checksum(const entry &e)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	h = fnv( h, &e.k, sizeof(e.k) );
+	h = fnv( h, &e.used, sizeof(e.used) );
+	h = fnv_vector( h, e.code );
+	h = fnv_vector( h, e.relocs );
+	h = fnv_vector( h, e.ptrs );
+	h = fnv_vector( h, e.remap );
+	h = fnv_vector( h, e.sites );
+	h = fnv_vector( h, e.exits );
+	return h;
+}
+
+bool jit_cache::read_entry(FILE *f, entry &e)
+{
+	unsigned long long sum;
+	return (fread( &e.k, sizeof(e.k), 1, f ) == 1) && (fread( &e.used, sizeof(e.used), 1, f ) == 1) &&
+		read_vector( f, e.code, MAX_CODE ) && read_vector( f, e.relocs, MAX_RECORDS ) && 
+		read_vector( f, e.ptrs, MAX_RECORDS ) && read_vector( f, e.remap, PAGING::INST<IS_THUMB>::NUM ) && 
+		read_vector( f, e.sites, MAX_RECORDS ) && read_vector( f, e.exits, MAX_EXITS ) &&
+		(fread( &sum, sizeof(sum), 1, f ) == 1) && (sum == checksum( e ));
+}
+
+void jit_cache::write_entry(FILE *f, const entry &e)
+{
+	fwrite( &e.k, sizeof(e.k), 1, f );
+	fwrite( &e.used, sizeof(e.used), 1, f );
+	write_vector( f, e.code );
+	write_vector( f, e.relocs );
+	write_vector( f, e.ptrs );
+	write_vector( f, e.remap );
+	write_vector( f, e.sites );
+	write_vector( f, e.exits );
+	unsigned long long sum = checksum( e );
+	fwrite( &sum, sizeof(sum), 1, f );
+}
+
+bool jit_cache::open(const char *filename)
+{
+	close();
+	boost::mutex::scoped_lock g(lock);
+
+	cache_header expected, h;
+	expected.init();
+	bool valid = false;
+	bool intact = false;
+	FILE *f = fopen( filename, "rb" );
+	if (f)
+	{
+		valid = (fread( &h, sizeof(h), 1, f ) == 1) && (memcmp( &h, &expected, sizeof(h) ) == 0);
+		if (valid)
+		{
+			entry e;
+			long good = ftell( f );
+			while (read_entry( f, e ))
+			{
+				entries.insert( entry_map::value_type( e.k.hash(), e ) );
+				good = ftell( f );
+			}
+			fseek( f, 0, SEEK_END );
+			intact = ftell( f ) == good;
+		} else logging<_DEFAULT>::logf("Discarding JIT cache %s written by another build", filename);
+		fclose( f );
+	}
+
+	// a torn or corrupt tail (crash while writing) gets cut by writing the
+	// intact entries again, appending behind it would hide all later ones
+	file = fopen( filename, intact ? "ab" : "wb" );
+	if (!file)
+	{
+		logging<_DEFAULT>::logf("Failed to open JIT cache %s", filename);
+		entries.clear();
+		return false;
+	}
+	if (!intact)
+	{
+		if (valid)
+			logging<_DEFAULT>::logf("JIT cache %s is damaged, keeping the intact entries", filename);
+		fwrite( &expected, sizeof(expected), 1, file );
+		for (entry_map::const_iterator it = entries.begin(); it != entries.end(); ++it)
+			write_entry( file, it->second );
+		fflush( file );
+	}
+	logging<_DEFAULT>::logf("JIT cache %s: %d pieces", filename, (int)entries.size());
+	return true;
+}
+
+void jit_cache::close()
+{
+	boost::mutex::scoped_lock g(lock);
+	if (file)
+		fclose( file );
+	file = 0;
+	entries.clear();
+}
+
+bool jit_cache::find(const key &k, entry &e)
+{
+	boost::mutex::scoped_lock g(lock);
+	if (!file)
+		return false;
+	std::pair<entry_map::iterator, entry_map::iterator> r = entries.equal_range( k.hash() );
+	for (entry_map::iterator it = r.first; it != r.second; ++it)
+	{
+		if (it->second.k == k)
+		{
+			e = it->second;
+			return true;
+		}
+	}
+	return false;
+}
+
+void jit_cache::add(const entry &e)
+{
+	boost::mutex::scoped_lock g(lock);
+	if (!file)
+		return;
+	entries.insert( entry_map::value_type( e.k.hash(), e ) );
+	write_entry( file, e );
+	fflush( file );
+}
+
+// symbols are stored as index << 32 | offset
+bool jit_cache::to_symbol(const symbol *syms, size_t n, const void *p, long long &sym)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		const char *base = (const char*)syms[i].p;
+		if (((const char*)p >= base) && ((const char*)p < base + syms[i].size))
+		{
+			sym = ((long long)i << 32) | (long long)((const char*)p - base);
+			return true;
+		}
+	}
+	return false;
+}
+
+const void* jit_cache::from_symbol(const symbol *syms, size_t n, long long sym)
+{
+	unsigned long long i = (unsigned long long)sym >> 32;
+	unsigned long long offset = (unsigned long long)sym & 0xFFFFFFFF;
+	if ((i >= n) || (offset >= syms[i].size))
+		return 0;
+	return (const char*)syms[i].p + offset;
+}
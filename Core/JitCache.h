@@ -0,0 +1,103 @@
+#ifndef _JITCACHE_H_
+#define _JITCACHE_H_
+
+// persistent cache of compiled pieces
+// pieces are keyed by the page contents, cpu, instruction set and the
+// range compiled (plus everything else compiler::compile depends on)
+// and stored with the emitter output before relocation, so a hit just
+// has to resolve the relocations again instead of compiling
+//
+// host addresses in the code are stored as index and offset into a fixed
+// table of symbols the generated code may refer to (see
+// compiler::host_symbols), so the cache stays valid across ASLR. pieces
+// referring to anything else are not stored. the file gets discarded if
+// CODEGEN_VERSION differs
+//
+// every entry carries a checksum, the file is cut behind the last intact
+// one before appending. compiler::restore checks the offsets again before
+// loading anything into the emitter
+#define JIT_CACHE
+
+#include <cstdio>
+#include <map>
+#include <vector>
+#include <boost/thread.hpp>
+#include "Mem.h"
+
+class jit_cache
+{
+public:
+	// bump whenever the generated code changes
+	enum { CODEGEN_VERSION = 1 };
+
+	// upper bounds of the entry vectors, anything above is a corrupt file
+	enum { MAX_CODE = 64 * 1024, MAX_RECORDS = 4096, MAX_EXITS = 1024 };
+	struct key
+	{
+		unsigned char cpu;       // T::VALUE
+		unsigned char thumb;
+		unsigned char literals;  // pc relative loads got folded
+		signed char cached_reg;
+		unsigned short start;    // instructions [start, end) of the page
+		unsigned short end;
+		char mem[PAGING::SIZE];  // page contents
+
+		bool operator == (const key &other) const;
+		unsigned long long hash() const;
+	};
+
+	// a host address inside the code, see to_symbol
+	struct reloc
+	{
+		unsigned int at;         // position in the code
+		unsigned int kind;
+		long long value;
+	};
+	enum { SYM_HOST, SYM_LINK, SYM_NULL };
+
+	// host object the generated code may embed the address of
+	struct symbol
+	{
+		const void *p;
+		size_t size;
+	};
+
+	struct entry
+	{
+		key k;
+		std::vector<char> code;           // emitter output
+		std::vector<reloc> relocs;        // rel32 calls/jumps
+		std::vector<reloc> ptrs;          // absolute pointers
+		std::vector<unsigned int> remap;  // code offsets of the instructions
+		std::vector<unsigned int> sites;  // block_link sites
+		std::vector<unsigned long> exits; // see compiled_block_base::exits
+		code_map used;                    // parts of the page the piece depends on
+	};
+
+private:
+	typedef std::multimap<unsigned long long, entry> entry_map;
+	static boost::mutex lock;
+	static entry_map entries;
+	static FILE *file;  // opened for appending (0 = cache disabled)
+
+	static bool read_entry(FILE *f, entry &e);
+	static void write_entry(FILE *f, const entry &e);
+	static unsigned long long checksum(const entry &e);
+
+public:
+	// loads the entries of filename and appends new ones there
+	static bool open(const char *filename);
+	static void close();
+
+	// returns false if no entry for k exists, else copies it to e
+	static bool find(const key &k, entry &e);
+	static void add(const entry &e);
+
+	// translates a host address to a value stable between runs
+	// returns false for addresses outside the n symbols of syms
+	static bool to_symbol(const symbol *syms, size_t n, const void *p, long long &sym);
+	// returns 0 if sym does not lie within syms
+	static const void* from_symbol(const symbol *syms, size_t n, long long sym);
+};
+
+#endif
@@ -1,3 +1,4 @@
+#include <cstring>
 #include "basetypes.h"
 #include "Mem.h"
 #include "Breakpoint.h"
@@ -5,17 +6,38 @@
 #include "Compiler.h"
 #include "CompiledBlock.h"
 #include "HLE.h"
+#include "Interrupt.h"
+#include "HLCore.h"
 
 const char* IS_ARM::name = "Arm";
 const char* IS_THUMB::name = "Thumb";
 
 template <> compiled_block<IS_THUMB>* &compile_info::get<IS_THUMB>() { return thumb; };
 template <> compiled_block<IS_ARM>* &compile_info::get<IS_ARM>()   { return arm; };
+template <> code_map &compile_info::get_code<IS_THUMB>() { return thumb_code; };
+template <> code_map &compile_info::get_code<IS_ARM>()   { return arm_code; };
+template <> decoded_op* &compile_info::get_ops<IS_THUMB>() { return thumb_ops; };
+template <> decoded_op* &compile_info::get_ops<IS_ARM>()   { return arm_ops; };
+template <> std::vector<memory_block*> &compile_info::get_traces<IS_THUMB>() { return thumb_traces; };
+template <> std::vector<memory_block*> &compile_info::get_traces<IS_ARM>()   { return arm_traces; };
 template <> compiled_block<IS_ARM>* &memory_block::get_jit<_ARM9, IS_ARM>() { return arm9.get<IS_ARM>(); }
 template <> compiled_block<IS_ARM>* &memory_block::get_jit<_ARM7, IS_ARM>() { return arm7.get<IS_ARM>(); }
 template <> compiled_block<IS_THUMB>* &memory_block::get_jit<_ARM9, IS_THUMB>() { return arm9.get<IS_THUMB>(); }
 template <> compiled_block<IS_THUMB>* &memory_block::get_jit<_ARM7, IS_THUMB>() { return arm7.get<IS_THUMB>(); }
+template <> code_map &memory_block::get_code<_ARM9, IS_ARM>() { return arm9.get_code<IS_ARM>(); }
+template <> code_map &memory_block::get_code<_ARM7, IS_ARM>() { return arm7.get_code<IS_ARM>(); }
+template <> code_map &memory_block::get_code<_ARM9, IS_THUMB>() { return arm9.get_code<IS_THUMB>(); }
+template <> code_map &memory_block::get_code<_ARM7, IS_THUMB>() { return arm7.get_code<IS_THUMB>(); }
+template <> decoded_op* &memory_block::get_ops<_ARM9, IS_ARM>() { return arm9.get_ops<IS_ARM>(); }
+template <> decoded_op* &memory_block::get_ops<_ARM7, IS_ARM>() { return arm7.get_ops<IS_ARM>(); }
+template <> decoded_op* &memory_block::get_ops<_ARM9, IS_THUMB>() { return arm9.get_ops<IS_THUMB>(); }
+template <> decoded_op* &memory_block::get_ops<_ARM7, IS_THUMB>() { return arm7.get_ops<IS_THUMB>(); }
+template <> std::vector<memory_block*> &memory_block::get_traces<_ARM9, IS_ARM>() { return arm9.get_traces<IS_ARM>(); }
+template <> std::vector<memory_block*> &memory_block::get_traces<_ARM7, IS_ARM>() { return arm7.get_traces<IS_ARM>(); }
+template <> std::vector<memory_block*> &memory_block::get_traces<_ARM9, IS_THUMB>() { return arm9.get_traces<IS_THUMB>(); }
+template <> std::vector<memory_block*> &memory_block::get_traces<_ARM7, IS_THUMB>() { return arm7.get_traces<IS_THUMB>(); }
 
+unsigned long memory_block::epoch = 0;
 
 memory_block::memory_block()
 {
@@ -24,7 +46,20 @@ memory_block::memory_block()
 	arm9.thumb = 0;
 	arm7.arm = 0;
 	arm7.thumb = 0;
+	arm9.arm_code.clear();
+	arm9.thumb_code.clear();
+	arm7.arm_code.clear();
+	arm7.thumb_code.clear();
+	arm9.arm_ops = 0;
+	arm9.thumb_ops = 0;
+	arm7.arm_ops = 0;
+	arm7.thumb_ops = 0;
 	recompiles = 0;
+	last_recompile = 0;
+	interpret_left = 0;
+	storm_count = 0;
+	storms = 0;
+	executed = 0;
 }
 
 /*
@@ -47,46 +82,327 @@ struct adjust_breakpoints
 	}
 };
 
+// baseline blocks marked dirty once hot (see compiler::count_branch) get
+// compiled by the optimizing tier, which is no code change to count.
+// if their piece falling through the page end got linked, that path
+// continues into the next page (see compiler::emit_trace)
 template <typename T, typename U> void memory_block::recompile()
 {
-	recompiles++;
-	if (recompiles == 100)
-		logging<T>::logf("Performance warning: Page %p recompiled 100 times.", this);
 	compiled_block<U>* &b = get_jit<T, U>();
-	if (b)
-		delete b;
-	b = new compiled_block<U>(this);
+	bool hot = b && !b->optimized && (b->heat <= 0);
+	if (!hot)
+	{
+		recompiles++;
+		if (recompiles == 100)
+			logging<T>::logf("Performance warning: Page %p recompiled 100 times.", this);
+		if (epoch - last_recompile < STORM_GAP)
+		{
+			if ((++storm_count >= STORM_RECOMPILES) && !interpret_left)
+			{
+				if (storms < MAX_STORMS)
+					storms++;
+				interpret_left = COOLING_ENTRIES << storms;
+				logging<T>::logf("Page %p keeps getting recompiled, interpreting it for now.", this);
+			}
+		} else storm_count = 0;
+		last_recompile = epoch;
+	}
+	// the new block starts without code, cleared first so bits a prefetch
+	// worker sets meanwhile at worst cause a needless recompile
+	// traces into the page are no longer covered by the code then
+	drop_traces<T, U>();
+	get_code<T, U>().clear();
+	code_dropped();
+	drop_decoded<T, U>();
+	compiled_block<U> *cb = new compiled_block<U>(this, hot);
+	if (b && b->trace_page)
+		b->trace_page->template remove_trace<T, U>( this );
+	unsigned long addr;
+	memory_block *next;
+	if (hot && b->page_exit && compiler::linked_to( b->page_exit, addr, next ) &&
+		(next != this) && !(next->flags & (PAGE_INVALID | PAGE_EXECPROT)))
+	{
+		cb->trace_page = next;
+		cb->trace_addr = addr;
+	}
+	// exchanged as prefetch workers might publish a block concurrently
+	compiled_block<U> *old = (compiled_block<U>*)_InterlockedExchangePointer( 
+		(void**)&b, cb );
+	if (old)
+		delete old;
+#ifndef JIT_ENTRY_BLOCKS
+	// with entry blocks the code gets compiled on demand by entry()
 	compiler::compile<T,U>(*b);
 	breakpoints<T,U>::template for_region< adjust_breakpoints<T,U> >::f( mem, mem + PAGING::SIZE );
+#endif
+}
+
+// returns the code for instruction inst of the page
+// compiling the piece starting there if not done yet
+template <typename T, typename U> char* memory_block::entry(unsigned long inst)
+{
+	compiled_block<U>* &b = get_jit<T, U>();
+	if (!b)
+		recompile<T, U>();
+	if (b->breaks_pending)
+	{
+		// the breakpoints belong to this thread, see prefetch
+		b->breaks_pending = false;
+		breakpoints<T,U>::template for_region< adjust_breakpoints<T,U> >::f( mem, mem + PAGING::SIZE );
+	}
+	if (!b->compiled(inst))
+	{
+		unsigned int end = compiler::compile<T,U>(*b, inst);
+		const unsigned int size = U::INSTRUCTION_SIZE;
+		breakpoints<T,U>::template for_region< adjust_breakpoints<T,U> >::f( 
+			mem + inst * size, mem + end * size );
+	}
+	return b->target(inst);
 }
 
+// compiles the piece starting at instruction inst into a new block on a
+// background thread and publishes it if the page still has no block then.
+// the page contents are compared against a snapshot after compiling, any
+// later write to the code gets the block recompiled (see add_code)
+// returns false if the block was dropped, else exits gets the exits of
+// the piece (the block may be changed by the emulation once published)
+template <typename T, typename U> bool memory_block::prefetch(unsigned long inst, 
+	std::vector<unsigned long> &exits)
+{
+	compiled_block<U>* volatile &b = get_jit<T, U>();
+	if (b)
+		return false;
 
-void memory_block::flush()
+	char snapshot[PAGING::SIZE];
+	memcpy( snapshot, mem, PAGING::SIZE );
+	compiled_block<U> *cb = new compiled_block<U>(this);
+	compiler::compile<T,U>(*cb, inst);
+	// the emulation thread adjusts the breakpoints on first entry
+	cb->breaks_pending = true;
+	exits = cb->exits;
+
+	if ((memcmp( snapshot, mem, PAGING::SIZE ) == 0) &&
+		(_InterlockedCompareExchangePointer( (void**)&b, cb, 0 ) == 0))
+		return true;
+	delete cb;
+	return false;
+}
+
+template bool memory_block::prefetch<_ARM7, IS_ARM>(unsigned long inst, std::vector<unsigned long> &exits);
+template bool memory_block::prefetch<_ARM7, IS_THUMB>(unsigned long inst, std::vector<unsigned long> &exits);
+template bool memory_block::prefetch<_ARM9, IS_ARM>(unsigned long inst, std::vector<unsigned long> &exits);
+template bool memory_block::prefetch<_ARM9, IS_THUMB>(unsigned long inst, std::vector<unsigned long> &exits);
+
+template char* memory_block::entry<_ARM7, IS_ARM>(unsigned long inst);
+template char* memory_block::entry<_ARM7, IS_THUMB>(unsigned long inst);
+template char* memory_block::entry<_ARM9, IS_ARM>(unsigned long inst);
+template char* memory_block::entry<_ARM9, IS_THUMB>(unsigned long inst);
+
+// true if an entry into the code for T/U should be interpreted
+// cold pages are until HOT_STEPS instructions ran on them. for pages in a
+// recompile storm each entry counts down the cooling period, writing the
+// code restarts it
+template <typename T, typename U> bool memory_block::interpreted()
+{
+	if (flags & PAGE_INVALID)
+		return false; // the HLE pages are precompiled
+	if (!interpret_left)
+	{
+#ifndef HLE_CORE
+		if (executed >= HOT_STEPS)
+			return false;
+#endif
+		flush<T, U>();
+		return true;
+	}
+	if (flags & code_dirty_flag<T, U>::VALUE)
+	{
+		flush<T, U>();
+		interpret_left = COOLING_ENTRIES << storms;
+	} else if (!--interpret_left)
+	{
+		storm_count = 0;
+		logging<T>::logf("Page %p settled, compiling it again.", this);
+		return false;
+	}
+	return true;
+}
+
+template bool memory_block::interpreted<_ARM7, IS_ARM>();
+template bool memory_block::interpreted<_ARM7, IS_THUMB>();
+template bool memory_block::interpreted<_ARM9, IS_ARM>();
+template bool memory_block::interpreted<_ARM9, IS_THUMB>();
+
+// records the halfwords a piece just compiled for T/U depends on
+// done before a prefetched block gets published, see prefetch
+template <typename T, typename U> void memory_block::add_code(const code_map &used)
+{
+	get_code<T, U>().merge( used );
+	_InterlockedOr( (long*)&flags, PAGE_CODE );
+}
+
+template void memory_block::add_code<_ARM7, IS_ARM>(const code_map &used);
+template void memory_block::add_code<_ARM7, IS_THUMB>(const code_map &used);
+template void memory_block::add_code<_ARM9, IS_ARM>(const code_map &used);
+template void memory_block::add_code<_ARM9, IS_THUMB>(const code_map &used);
+
+// records a single instruction the interpreter decoded
+template <typename T, typename U> void memory_block::add_code(unsigned long offset, unsigned long size)
+{
+	code_map used;
+	used.clear();
+	used.set( offset, size );
+	add_code<T, U>( used );
+}
+
+template void memory_block::add_code<_ARM7, IS_ARM>(unsigned long offset, unsigned long size);
+template void memory_block::add_code<_ARM7, IS_THUMB>(unsigned long offset, unsigned long size);
+template void memory_block::add_code<_ARM9, IS_ARM>(unsigned long offset, unsigned long size);
+template void memory_block::add_code<_ARM9, IS_THUMB>(unsigned long offset, unsigned long size);
+
+// the instructions of the page decoded for the interpreter
+// allocated on first use, dropped whenever the code changes
+template <typename T, typename U> decoded_op* memory_block::decoded()
 {
-	if (flags & PAGE_DIRTY_J7)
+	decoded_op* &ops = get_ops<T, U>();
+	if (!ops)
 	{
-		flags &= ~PAGE_DIRTY_J7;
-		if ( get_jit<_ARM7, IS_ARM>() )
-			recompile<_ARM7, IS_ARM>();
-		if ( get_jit<_ARM7, IS_THUMB>() )
-			recompile<_ARM7, IS_THUMB>();
+		ops = new decoded_op[PAGING::INST<U>::NUM];
+		for (int i = 0; i < PAGING::INST<U>::NUM; i++)
+			ops[i].inst = decoded_op::UNDECODED;
 	}
+	return ops;
+}
+
+template decoded_op* memory_block::decoded<_ARM7, IS_ARM>();
+template decoded_op* memory_block::decoded<_ARM7, IS_THUMB>();
+template decoded_op* memory_block::decoded<_ARM9, IS_ARM>();
+template decoded_op* memory_block::decoded<_ARM9, IS_THUMB>();
+
+template <typename T, typename U> void memory_block::drop_decoded()
+{
+	decoded_op* &ops = get_ops<T, U>();
+	delete [] ops;
+	ops = 0;
+}
+
+// the code compiled for T/U of owner continues into this page
+template <typename T, typename U> void memory_block::add_trace(memory_block *owner)
+{
+	std::vector<memory_block*> &traces = get_traces<T, U>();
+	for (size_t i = 0; i < traces.size(); i++)
+		if (traces[i] == owner)
+			return;
+	traces.push_back( owner );
+}
+
+template void memory_block::add_trace<_ARM7, IS_ARM>(memory_block *owner);
+template void memory_block::add_trace<_ARM7, IS_THUMB>(memory_block *owner);
+template void memory_block::add_trace<_ARM9, IS_ARM>(memory_block *owner);
+template void memory_block::add_trace<_ARM9, IS_THUMB>(memory_block *owner);
+
+// owner got recompiled, its old trace is gone
+template <typename T, typename U> void memory_block::remove_trace(memory_block *owner)
+{
+	std::vector<memory_block*> &traces = get_traces<T, U>();
+	for (size_t i = traces.size(); i-- > 0; )
+		if (traces[i] == owner)
+			traces.erase( traces.begin() + i );
+}
+
+// marks the code of T/U continuing into this page dirty, so it gets
+// recompiled the next time it is branched to
+template <typename T, typename U> void memory_block::drop_traces()
+{
+	std::vector<memory_block*> &traces = get_traces<T, U>();
+	const unsigned long dirty = code_dirty_flag<T, U>::VALUE;
+	for (size_t i = 0; i < traces.size(); i++)
+		_InterlockedOr( (long*)&traces[i]->flags, dirty );
+	traces.clear();
+}
+
+// returns the dirty flags of the code compiled from [offset, offset+size)
+unsigned long memory_block::code_written(unsigned long offset, unsigned long size)
+{
+	unsigned long f = 0;
+	if (arm7.arm_code.test( offset, size ))
+		f |= PAGE_DIRTY_J7_ARM;
+	if (arm7.thumb_code.test( offset, size ))
+		f |= PAGE_DIRTY_J7_THUMB;
+	if (arm9.arm_code.test( offset, size ))
+		f |= PAGE_DIRTY_J9_ARM;
+	if (arm9.thumb_code.test( offset, size ))
+		f |= PAGE_DIRTY_J9_THUMB;
+	return f;
+}
+
+// clears PAGE_CODE once none of the code maps holds anything, so stores
+// to the page take the fast path again. code a prefetch worker adds
+// meanwhile shows up in the second check or sets the flag itself (see add_code)
+void memory_block::code_dropped()
+{
+	if (!arm7.arm_code.empty() || !arm7.thumb_code.empty() ||
+		!arm9.arm_code.empty() || !arm9.thumb_code.empty())
+		return;
+	_InterlockedAnd( (long*)&flags, ~PAGE_CODE );
+	if (!arm7.arm_code.empty() || !arm7.thumb_code.empty() ||
+		!arm9.arm_code.empty() || !arm9.thumb_code.empty())
+		_InterlockedOr( (long*)&flags, PAGE_CODE );
+}
+
+// drop all direct jumps into this page (e.g. as it gets unmapped)
+template <typename T> void memory_block::unlink()
+{
+	if ( get_jit<T, IS_ARM>() )
+		get_jit<T, IS_ARM>()->unlink_incoming();
+	if ( get_jit<T, IS_THUMB>() )
+		get_jit<T, IS_THUMB>()->unlink_incoming();
+	drop_traces<T, IS_ARM>();
+	drop_traces<T, IS_THUMB>();
+}
+
+template void memory_block::unlink<_ARM7>();
+template void memory_block::unlink<_ARM9>();
 
-	if (flags & PAGE_DIRTY_J9)
+// recompiles the code dirtied for T/U if there is any
+// or drops what got decoded of it if it was only interpreted so far
+template <typename T, typename U> void memory_block::flush()
+{
+	const unsigned long dirty = code_dirty_flag<T, U>::VALUE;
+	if (flags & dirty)
 	{
-		flags &= ~PAGE_DIRTY_J9;
-		if ( get_jit<_ARM9, IS_ARM>() )
-			recompile<_ARM9, IS_ARM>();
-		if ( get_jit<_ARM9, IS_THUMB>() )
-			recompile<_ARM9, IS_THUMB>();
+		// other threads set bits of flags meanwhile
+		_InterlockedAnd( (long*)&flags, ~dirty );
+		if ( get_jit<T, U>() )
+			recompile<T, U>();
+		else
+		{
+			drop_traces<T, U>();
+			drop_decoded<T, U>();
+			get_code<T, U>().clear();
+			code_dropped();
+		}
 	}
 }
 
+template void memory_block::flush<_ARM7, IS_ARM>();
+template void memory_block::flush<_ARM7, IS_THUMB>();
+template void memory_block::flush<_ARM9, IS_ARM>();
+template void memory_block::flush<_ARM9, IS_THUMB>();
+
+void memory_block::flush()
+{
+	flush<_ARM7, IS_ARM>();
+	flush<_ARM7, IS_THUMB>();
+	flush<_ARM9, IS_ARM>();
+	flush<_ARM9, IS_THUMB>();
+}
+
 bool memory_block::react()
 {
 	if (flags & PAGE_DIRTY_REACTOR)
 	{
-		flags &= ~PAGE_DIRTY_REACTOR;
+		_InterlockedAnd( (long*)&flags, ~PAGE_DIRTY_REACTOR );
 		return true;
 	}
 	return false;
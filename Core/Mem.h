@@ -2,18 +2,27 @@
 #define _MEM_H_
 
 #include <utility>
+#include <vector>
 #include "Namespaces.h"
 #include "forward.h"
 
 // used to synchronize memory updates
 #ifdef __GNUC__
 #define _InterlockedOr(p,v) __sync_fetch_and_or(p, v)
+#define _InterlockedAnd(p,v) __sync_fetch_and_and(p, v)
 #define _InterlockedExchange(p,v) __sync_lock_test_and_set(p, v)
+#define _InterlockedIncrement(p) __sync_add_and_fetch(p, 1)
+#define _InterlockedExchangePointer(p,v) __sync_lock_test_and_set(p, v)
+#define _InterlockedCompareExchangePointer(p,v,c) __sync_val_compare_and_swap(p, c, v)
 //#define _InterlockedOr(p,v) (*p |= v)
 #else
 #include <intrin.h>
 #pragma intrinsic (_InterlockedOr)
+#pragma intrinsic (_InterlockedAnd)
 #pragma intrinsic (_InterlockedExchange)
+#pragma intrinsic (_InterlockedIncrement)
+#pragma intrinsic (_InterlockedExchangePointer)
+#pragma intrinsic (_InterlockedCompareExchangePointer)
 #endif
 
 template <int n> struct verify_zero { verify_zero<n> error;  };
@@ -63,13 +72,85 @@ struct PAGING
 	};
 };
 
+struct decoded_op;
+
 // a raw memory block (physical page) of the emulated system
 
+// the halfwords of a page some compiled code was built from
+// (instructions, folded literals, scanned idle loops)
+// stores to a page only dirty the code when hitting one of those
+struct code_map
+{
+	enum { BITS = sizeof(unsigned long) * 8 };
+	enum { WORDS = PAGING::SIZE / 2 / BITS };
+	unsigned long bits[WORDS];
+
+	// bits of word w covering the halfwords [first, last]
+	static unsigned long mask(unsigned long w, unsigned long first, unsigned long last)
+	{
+		unsigned long m = ~0UL;
+		if (w == first / BITS)
+			m &= ~0UL << (first % BITS);
+		if (w == last / BITS)
+			m &= ~0UL >> (BITS - 1 - last % BITS);
+		return m;
+	}
+
+	void clear()
+	{
+		for (int i = 0; i < WORDS; i++)
+			bits[i] = 0;
+	}
+
+	bool empty() const
+	{
+		for (int i = 0; i < WORDS; i++)
+			if (bits[i])
+				return false;
+		return true;
+	}
+
+	// not interlocked, used while compiling
+	void set(unsigned long offset, unsigned long size)
+	{
+		const unsigned long first = offset >> 1, last = (offset + size - 1) >> 1;
+		for (unsigned long w = first / BITS; w <= last / BITS; w++)
+			bits[w] |= mask( w, first, last );
+	}
+
+	bool test(unsigned long offset, unsigned long size) const
+	{
+		const unsigned long first = offset >> 1, last = (offset + size - 1) >> 1;
+		for (unsigned long w = first / BITS; w <= last / BITS; w++)
+			if (bits[w] & mask( w, first, last ))
+				return true;
+		return false;
+	}
+
+	void merge(const code_map &other)
+	{
+		for (int i = 0; i < WORDS; i++)
+			if (other.bits[i])
+				_InterlockedOr( (long*)&bits[i], other.bits[i] );
+	}
+};
+
 struct compile_info
 {
 	compiled_block<IS_ARM> *arm;
 	compiled_block<IS_THUMB> *thumb;
+	code_map arm_code;   // what arm/thumb got compiled from
+	code_map thumb_code;
+	decoded_op *arm_ops; // what the interpreter decoded (see HLCore)
+	decoded_op *thumb_ops;
+	// pages whose arm/thumb code continues into this one (see compiler::emit_trace)
+	// kept per CPU as only its emulation thread compiles traces
+	std::vector<memory_block*> arm_traces;
+	std::vector<memory_block*> thumb_traces;
 	template <typename T> compiled_block<T>* &get();
+	template <typename T> code_map &get_code();
+	template <typename T> decoded_op* &get_ops();
+	template <typename T> std::vector<memory_block*> &get_traces();
 };
 /*
 template <> compiled_block<IS_THUMB>* &compile_info::get<IS_THUMB>() { return thumb; };
@@ -86,21 +167,39 @@ struct memory_block /* final, do not inherit! */
 		PAGE_NULL          = PAGE_INVALID | PAGE_EXECPROT | PAGE_WRITEPROT | PAGE_READPROT,
 
 		// custom plugins might add dirty flags here
-		PAGE_DIRTY_J7      = 0x10, // JIT uses this for optimizing recompiling
-		PAGE_DIRTY_J9      = 0x20, // code pages on ARM7 and ARM9
+		PAGE_DIRTY_J7_ARM  = 0x10, // JIT uses these for optimizing recompiling
+		PAGE_DIRTY_J9_ARM  = 0x20, // code pages on ARM7 and ARM9
 		PAGE_DIRTY_REACTOR = 0x40,
 		PAGE_DIRTY_VRAM    = 0x80,
 		PAGE_DIRTY_SRAM    = 0x100,
-		PAGE_DIRTY         = PAGE_DIRTY_J7 | PAGE_DIRTY_J9 | PAGE_DIRTY_REACTOR | PAGE_DIRTY_VRAM |
+		PAGE_DIRTY_J7_THUMB = 0x200,
+		PAGE_DIRTY_J9_THUMB = 0x400,
+		PAGE_DIRTY_J7      = PAGE_DIRTY_J7_ARM | PAGE_DIRTY_J7_THUMB,
+		PAGE_DIRTY_J9      = PAGE_DIRTY_J9_ARM | PAGE_DIRTY_J9_THUMB,
+		PAGE_DIRTY_CODE    = PAGE_DIRTY_J7 | PAGE_DIRTY_J9,
+		PAGE_DIRTY         = PAGE_DIRTY_CODE | PAGE_DIRTY_REACTOR | PAGE_DIRTY_VRAM |
 							 PAGE_DIRTY_SRAM,
 
 		PAGE_ACCESSHANDLER = 0x1000, // page needs special mem access handling
-		PAGE_WRITEPROT8    = 0x2000  // fast write protection handler for VRAM
+		PAGE_WRITEPROT8    = 0x2000, // fast write protection handler for VRAM
+		PAGE_CODE          = 0x4000  // some code got compiled from the page (see code_map)
 	};
 
 	typedef void (*mem_callback)(memory_block *block);  
 	typedef void (*read_callback)(memory_block *block, unsigned long addr);
 
+	// pages recompiled STORM_RECOMPILES times with less than STORM_GAP
+	// branch resolutions in between get interpreted until their code
+	// stayed unchanged for COOLING_ENTRIES entries, doubled per storm
+	enum { STORM_GAP = 4096, STORM_RECOMPILES = 8 };
+	enum { COOLING_ENTRIES = 256, MAX_STORMS = 6 };
+	static unsigned long epoch; // branch resolutions so far
+
+	// pages get interpreted until HOT_STEPS instructions ran on them
+	// before the JIT compiles them, from WARM_STEPS on they get prefetched
+	// so the code is ready once they turn hot (see jit_prefetch)
+	enum { HOT_STEPS = 4096, WARM_STEPS = HOT_STEPS / 2 };
+
 	unsigned long flags;
 	// todo: blocks for thumb modes
 
@@ -108,12 +207,33 @@ struct memory_block /* final, do not inherit! */
 	compile_info arm9;
 	memory_region_base *base;
 	unsigned long recompiles;
+	unsigned long last_recompile;  // epoch of the last recompile
+	unsigned long interpret_left;  // entries left to interpret (0 = JIT)
+	unsigned short storm_count;    // recompiles in short succession
+	unsigned short storms;         // times the page got interpreted
+	unsigned long executed;        // instructions interpreted on the page
 
 	template <typename T, typename U> compiled_block<U>* &get_jit();
+	template <typename T, typename U> code_map &get_code();
+	template <typename T, typename U> decoded_op* &get_ops();
+	template <typename T, typename U> std::vector<memory_block*> &get_traces();
 
 	char mem[PAGING::SIZE];
 
 	template <typename T, typename U> void recompile();
+	template <typename T, typename U> bool interpreted();
+	template <typename T, typename U> char* entry(unsigned long inst);
+	template <typename T, typename U> bool prefetch(unsigned long inst, std::vector<unsigned long> &exits);
+	template <typename T> void unlink();
+	template <typename T, typename U> void add_code(const code_map &used);
+	template <typename T, typename U> void add_code(unsigned long offset, unsigned long size);
+	template <typename T, typename U> decoded_op* decoded();
+	template <typename T, typename U> void drop_decoded();
+	template <typename T, typename U> void add_trace(memory_block *owner);
+	template <typename T, typename U> void remove_trace(memory_block *owner);
+	template <typename T, typename U> void drop_traces();
+	unsigned long code_written(unsigned long offset, unsigned long size);
+	void code_dropped();
 	bool react();
 
 	inline void dirty()
@@ -121,7 +241,18 @@ struct memory_block /* final, do not inherit! */
 		_InterlockedOr( (long*)&flags, PAGE_DIRTY );
 	}
 
+	// marks the page dirty after size bytes got stored at offset
+	// the compiled code only gets dirty if built from those bytes
+	inline void written(unsigned long offset, unsigned long size)
+	{
+		unsigned long f = PAGE_DIRTY & ~PAGE_DIRTY_CODE;
+		if (flags & PAGE_CODE)
+			f |= code_written( offset, size );
+		_InterlockedOr( (long*)&flags, f );
+	}
+
 	memory_block();
+	template <typename T, typename U> void flush();
 	void flush();
 };
 /*
@@ -131,4 +262,11 @@ template <> compiled_block<IS_THUMB>* &memory_block::get_jit<_ARM9, IS_THUMB>()
 template <> compiled_block<IS_THUMB>* &memory_block::get_jit<_ARM7, IS_THUMB>() { return arm7.get<IS_THUMB>(); }
 */
 
+// dirty flag of the code compiled for cpu T and instruction set U
+template <typename T, typename U> struct code_dirty_flag {};
+template <> struct code_dirty_flag<_ARM7, IS_ARM>   { enum { VALUE = memory_block::PAGE_DIRTY_J7_ARM }; };
+template <> struct code_dirty_flag<_ARM7, IS_THUMB> { enum { VALUE = memory_block::PAGE_DIRTY_J7_THUMB }; };
+template <> struct code_dirty_flag<_ARM9, IS_ARM>   { enum { VALUE = memory_block::PAGE_DIRTY_J9_ARM }; };
+template <> struct code_dirty_flag<_ARM9, IS_THUMB> { enum { VALUE = memory_block::PAGE_DIRTY_J9_THUMB }; };
+
 #endif
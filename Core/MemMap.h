@@ -104,6 +104,9 @@ private:
 				page * PAGING::SIZE, region_p->name, addr_p, region_q->name, addr_q );
 		}
 
+		// direct jumps into the old page are no longer valid
+		if (map[page] && (map[page] != block))
+			map[page]->template unlink<T>();
 		map[page] = block;
 	}
 	static void apply_mapping( memory_region_base *region, const _region &reg )
@@ -219,6 +222,13 @@ public:
 		return map[page];
 	}
 
+	// the page table itself, indexed by addr >> PAGING::SIZE_BITS
+	// compiled code looks up pages directly for inlined memory accesses
+	static memory_block** pages()
+	{
+		return map;
+	}
+
 
 	template <typename functor>
 	static void process_memory(unsigned long addr, int len, typename functor::context &ctx)
@@ -47,7 +47,7 @@ public:
 		compiled_block<T>::code = &retcode;
 		compiled_block<T>::code_size = 1;
 		for (int i = 0; i < compiled_block<T>::REMAPS; i++)
-			compiled_block<T>::remap[i] = compiled_block<T>::code;
+			compiled_block<T>::remap[i] = 0;
 	}
 	~hle_block()
 	{
@@ -75,7 +75,7 @@ void STDCALL Init()
 	//io_observer::init();
 
 	InitHLE();
-	//InitHLCore();
+	InitHLCore();
 }
 
 unsigned long STDCALL PageSize()
@@ -322,6 +322,17 @@ void STDCALL DEFAULT_Log(log_callback cb) { logging<_DEFAULT>::cb = cb; }
 void STDCALL ARM7_Log(log_callback cb) { logging<_ARM7>::cb = cb; }
 void STDCALL ARM9_Log(log_callback cb) { logging<_ARM9>::cb = cb; }
 
+// keeps compiled code in filename between runs (0 = stop doing so)
+bool STDCALL JIT_SetCache(const char *filename)
+{
+	if (!filename)
+	{
+		jit_cache::close();
+		return true;
+	}
+	return jit_cache::open( filename );
+}
+
 
 callstack_context* STDCALL ARM7_Callstack()
 {
@@ -72,6 +72,7 @@ IMPORT unsigned long STDCALL PageSize();
 IMPORT unsigned long STDCALL DebugMax();
 IMPORT void STDCALL TouchSet(int x, int y);
 IMPORT void STDCALL DEFAULT_Log(log_callback cb);
+IMPORT bool STDCALL JIT_SetCache(const char *filename);
 
 IMPORT const char* STDCALL DEBUGGER_GetSymbol(void *addr);
 IMPORT const wchar_t* STDCALL DEBUGGER_GetFilename(int fileno);
@@ -0,0 +1,100 @@
+#include "Prefetch.h"
+#include "Namespaces.h"
+#include "MemMap.h"
+#include "CompiledBlock.h"
+#include "Compiler.h"
+#include "Logging.h"
+
+boost::mutex jit_prefetch::lock;
+boost::condition_variable jit_prefetch::wake;
+std::deque<jit_prefetch::job> jit_prefetch::jobs;
+int jit_prefetch::workers = 0;
+
+void jit_prefetch::start()
+{
+	if (workers)
+		return;
+	int n = (int)boost::thread::hardware_concurrency() - 1;
+	if (n > MAX_WORKERS)
+		n = MAX_WORKERS;
+	if (n <= 0)
+		return; // single core, compiling ahead would only steal time
+	for (int i = 0; i < n; i++)
+		boost::thread( &jit_prefetch::worker ); // detached
+	workers = n;
+	logging<_DEFAULT>::logf("JIT prefetch running on %d threads", n);
+}
+
+template <typename T> void jit_prefetch::request(unsigned long addr, int depth)
+{
+	if (!workers || (depth >= MAX_DEPTH))
+		return;
+	memory_block *b = memory_map<T>::addr2page( addr );
+	if (b->flags & (memory_block::PAGE_INVALID | memory_block::PAGE_EXECPROT))
+		return;
+	if (b->interpret_left)
+		return; // keeps getting rewritten, see memory_block::interpreted
+#ifdef HLE_CORE
+	return; // everything gets interpreted
+#else
+	if (b->executed < memory_block::WARM_STEPS)
+		return; // cold pages get interpreted as well
+#endif
+	if ((addr & 1) ? (b->get_jit<T, IS_THUMB>() != 0) : (b->get_jit<T, IS_ARM>() != 0))
+		return;
+
+	job j;
+	j.block = b;
+	j.addr = addr;
+	j.cpu = T::VALUE;
+	j.depth = depth;
+	{
+		boost::mutex::scoped_lock g(lock);
+		for (size_t i = 0; i < jobs.size(); i++)
+			if ((jobs[i].block == b) && (jobs[i].cpu == j.cpu) && (jobs[i].addr == addr))
+				return;
+		if (jobs.size() >= MAX_QUEUED)
+			jobs.pop_front();
+		jobs.push_back( j );
+	}
+	wake.notify_one();
+}
+
+template void jit_prefetch::request<_ARM7>(unsigned long addr, int depth);
+template void jit_prefetch::request<_ARM9>(unsigned long addr, int depth);
+
+template <typename T, typename U> void jit_prefetch::run(const job &j)
+{
+	std::vector<unsigned long> exits;
+	unsigned long inst = (j.addr & PAGING::ADDRESS_MASK) >> U::INSTRUCTION_SIZE_LG2;
+	if (j.block->prefetch<T, U>( inst, exits ))
+		request_exits<T>( j.addr, exits, 0, j.depth + 1 );
+}
+
+void jit_prefetch::worker()
+{
+	for (;;)
+	{
+		job j;
+		{
+			boost::mutex::scoped_lock g(lock);
+			while (jobs.empty())
+				wake.wait( g );
+			// newest first, that is the code most likely entered next
+			j = jobs.back();
+			jobs.pop_back();
+		}
+
+		if (j.cpu == _ARM9::VALUE)
+		{
+			if (j.addr & 1)
+				run<_ARM9, IS_THUMB>( j );
+			else run<_ARM9, IS_ARM>( j );
+		} else
+		{
+			if (j.addr & 1)
+				run<_ARM7, IS_THUMB>( j );
+			else run<_ARM7, IS_ARM>( j );
+		}
+	}
+}
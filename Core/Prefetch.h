@@ -0,0 +1,62 @@
+#ifndef _PREFETCH_H_
+#define _PREFETCH_H_
+
+// compiles pages in the background before the emulated cpus enter them
+// candidates are interpreted pages turning warm (see HLCore<T>::run) and
+// the pages a freshly compiled piece leaves to, either by falling off the
+// end of its page or by a static branch (see compiled_block_base::exits)
+//
+// workers build a private compiled_block and only publish it if the page
+// still has none once done (see memory_block::prefetch), pages that got
+// a block meanwhile are left to the synchronous path
+#define JIT_PREFETCH
+
+#include <vector>
+#include <deque>
+#include <boost/thread.hpp>
+#include "forward.h"
+#include "Mem.h"
+
+class jit_prefetch
+{
+public:
+	enum { MAX_WORKERS = 4 };
+	enum { MAX_QUEUED  = 64 }; // the oldest requests get dropped beyond this
+	enum { MAX_DEPTH   = 2 };  // how far exits of prefetched pages are followed
+
+private:
+	struct job
+	{
+		memory_block *block;
+		unsigned long addr; // guest address of the entry, bit 0 = thumb
+		int cpu;            // 7 or 9
+		int depth;
+	};
+
+	static boost::mutex lock;
+	static boost::condition_variable wake;
+	static std::deque<job> jobs;
+	static int workers;
+
+	static void worker();
+	template <typename T, typename U> static void run(const job &j);
+
+public:
+	// spawns the workers, leaving a core to the emulation thread
+	static void start();
+
+	// queues the entry at addr (bit 0 = thumb) for compilation
+	template <typename T> static void request(unsigned long addr, int depth = 0);
+
+	// queues the exits of the page at addr starting with exit first
+	template <typename T>
+	static void request_exits(unsigned long addr, const std::vector<unsigned long> &exits,
+		size_t first = 0, int depth = 0)
+	{
+		const unsigned long page = addr & ~PAGING::ADDRESS_MASK;
+		for (size_t i = first; i < exits.size(); i++)
+			request<T>( (page + exits[i]) | (addr & 1), depth );
+	}
+};
+
+#endif
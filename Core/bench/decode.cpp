@@ -0,0 +1,118 @@
+// decoder microbenchmark
+// checks the decode tables against the switch trees (the Thumb table is
+// the tree's output, the ARM one mirrors its paths by hand) and compares
+// the throughput of both
+//
+// build with "make decode_bench" from Core, "make check" runs it with
+// -check which only compares the decoders
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "Disassembler.h"
+
+enum { OPS = 1 << 16, ROUNDS = 256 };
+
+static unsigned int rnd_state = 0x12345678;
+static unsigned int rnd()
+{
+	rnd_state = rnd_state * 1664525 + 1013904223;
+	return rnd_state;
+}
+
+// fields that are left over from a previous op by either decoder
+// dont matter, so both start from a cleared context
+static bool same(const disassembler::context &a, const disassembler::context &b)
+{
+	if (a.instruction != b.instruction)
+		return false;
+	if ((a.instruction == INST::UD) || (a.instruction == INST::UNKNOWN))
+		return true;
+	return (a.cond == b.cond) && (a.shift == b.shift) && (a.flags == b.flags) &&
+		(a.addressing_mode == b.addressing_mode) && (a.extend_mode == b.extend_mode) &&
+		(a.imm == b.imm) && (a.rd == b.rd) && (a.rn == b.rn) && (a.rm == b.rm) && 
+		(a.rs == b.rs) && (a.cp_num == b.cp_num) && (a.cp_op1 == b.cp_op1) && 
+		(a.cp_op2 == b.cp_op2);
+}
+
+template <typename T>
+static int check(unsigned int op, unsigned int addr)
+{
+	disassembler table = disassembler();
+	disassembler tree = disassembler();
+	table.decode<T>(op, addr);
+	tree.decode_tree<T>(op, addr);
+	if (same(table.get_context(), tree.get_context()))
+		return 0;
+	char a[256], b[256];
+	table.get_str(a);
+	tree.get_str(b);
+	printf("mismatch %08X: table \"%s\", tree \"%s\"\n", op, a, b);
+	return 1;
+}
+
+template <typename T, bool TABLE>
+static double measure(const unsigned int *ops)
+{
+	disassembler d;
+	unsigned long sum = 0;
+	clock_t start = clock();
+	for (int r = 0; r < ROUNDS; r++)
+	{
+		for (int i = 0; i < OPS; i++)
+		{
+			if (TABLE)
+				d.decode<T>(ops[i], i << 2);
+			else d.decode_tree<T>(ops[i], i << 2);
+			sum += d.get_context().instruction;
+		}
+	}
+	clock_t end = clock();
+	if (sum == 1)
+		printf("\n"); // keeps the loop
+	return (double)(end - start) * 1e9 / CLOCKS_PER_SEC / ((double)OPS * ROUNDS);
+}
+
+template <typename T>
+static void bench(const char *name, const unsigned int *ops)
+{
+	double tree = measure<T, false>(ops);
+	double table = measure<T, true>(ops);
+	printf("%-6s tree %6.2f ns/op, table %6.2f ns/op (%.2fx)\n", 
+		name, tree, table, tree / table);
+}
+
+int main(int argc, char **argv)
+{
+	bool check_only = (argc > 1) && (strcmp( argv[1], "-check" ) == 0);
+	static unsigned int ops[OPS];
+	int errors = 0;
+
+	// every thumb op, every ARM table entry with random other bits
+	for (unsigned int op = 0; op < 0x10000; op++)
+		errors += check<IS_THUMB>(op, rnd() & ~1);
+	for (unsigned int i = 0; i < (1 << 12); i++)
+	{
+		for (int n = 0; n < 256; n++)
+		{
+			unsigned int op = (rnd() & 0xF00FFF0F) | ((i & 0xFF0) << 16) | ((i & 0xF) << 4);
+			errors += check<IS_ARM>(op, rnd() & ~3);
+		}
+	}
+	printf("%i mismatches\n", errors);
+	if (check_only)
+		return errors != 0;
+
+	// mostly AL ops like in real code
+	for (int i = 0; i < OPS; i++)
+	{
+		ops[i] = rnd();
+		if (ops[i] & 0x80000000)
+			ops[i] = (ops[i] & 0x0FFFFFFF) | (CONDITION::AL << 28);
+	}
+	bench<IS_ARM>("ARM", ops);
+	for (int i = 0; i < OPS; i++)
+		ops[i] = rnd() & 0xFFFF;
+	bench<IS_THUMB>("Thumb", ops);
+	return errors != 0;
+}
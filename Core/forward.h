@@ -2,11 +2,13 @@
 #define _FORWARD_H_
 
 template <typename T, typename U> class  breakpoints;
+                                  struct block_link;
                                   struct breakpoint_defs;
 template <typename T>             class  breakpoints_base;
 template <typename T>             struct callstack_tracer;
 template <typename U>             struct compiled_block;
 template <typename T>             struct compiled_block_base;
+                                  struct compiled_block_links;
                                   struct compile_info;
                                   class  compiler;
 template <int n>                  struct CPU;
@@ -15,6 +15,7 @@
 #define CONTEXT_EDI(x) x.ctx.Edi
 #define CONTEXT_ESI(x) x.ctx.Esi
 #define CONTEXT_EFLAGS(x) x.ctx.EFlags
+#define CONTEXT_CACHED(x) CONTEXT_EDI(x)
 
 
 #else
@@ -29,7 +30,8 @@
 inline unsigned long _rotr_inline (unsigned long value, unsigned long shift) __attribute__((always_inline));
 inline unsigned long _rotr_inline (unsigned long value, unsigned long shift)
 {
-	return (((unsigned long)value >> shift)|((unsigned long)value << (32-shift)));
+	// 32 bit rotate on LP64 hosts, too
+	return (unsigned int)(((unsigned int)value >> shift)|((unsigned int)value << (32-shift)));
 }
 
 // signal2 sets a signal handler for sig but only on the calling thread
@@ -39,6 +41,19 @@ inline unsigned long _rotr_inline (unsigned long value, unsigned long shift)
 
 #define PtrToUlong(x) ((unsigned long)x)
 
+#ifdef __x86_64__
+#define CONTEXT_EBP(x) x.gregs[REG_RBP]
+#define CONTEXT_ESP(x) x.gregs[REG_RSP]
+#define CONTEXT_EIP(x) x.gregs[REG_RIP]
+#define CONTEXT_EAX(x) x.gregs[REG_RAX]
+#define CONTEXT_EBX(x) x.gregs[REG_RBX]
+#define CONTEXT_ECX(x) x.gregs[REG_RCX]
+#define CONTEXT_EDX(x) x.gregs[REG_RDX]
+#define CONTEXT_EDI(x) x.gregs[REG_RDI]
+#define CONTEXT_ESI(x) x.gregs[REG_RSI]
+#define CONTEXT_EFLAGS(x) x.gregs[REG_EFL]
+#define CONTEXT_CACHED(x) x.gregs[REG_R12] /* see emitter::CACHE */
+#else
 #define CONTEXT_EBP(x) x.gregs[REG_EBP]
 #define CONTEXT_ESP(x) x.gregs[REG_ESP]
 #define CONTEXT_EIP(x) x.gregs[REG_EIP]
@@ -49,6 +64,8 @@ inline unsigned long _rotr_inline (unsigned long value, unsigned long shift)
 #define CONTEXT_EDI(x) x.gregs[REG_EDI]
 #define CONTEXT_ESI(x) x.gregs[REG_ESI]
 #define CONTEXT_EFLAGS(x) x.gregs[REG_EFL]
+#define CONTEXT_CACHED(x) CONTEXT_EDI(x)
+#endif
 
 
 #endif
@@ -44,9 +44,9 @@ void update_breakinfo(char *eip, const compiled_block<U> *block)
 	// TODO: handle CPU mode
 	unsigned long R15 = processor<T>::ctx().regs[15];
 	// find the JIT instruction of the crash
-	int i = 0;
-	while ((eip >= block->remap[i+1]) && (i < block->REMAPS-1))
-		i++;
+	int i = block->slot_of(eip);
+	if (i < 0)
+		i = 0;
 	unsigned long arm_pc = (R15 & ~PAGING::ADDRESS_MASK) + (i << U::INSTRUCTION_SIZE_LG2);
 
 	// discover the JIT subinstruction using distorm through the breakpoint interface
@@ -69,51 +69,46 @@ char* resolve_eip_v2()
 	memory_block *fault_page = processor<T>::last_page;
 	const compiled_block<IS_ARM> *ba = fault_page->get_jit<T, IS_ARM>();
 	const compiled_block<IS_THUMB> *bt = fault_page->get_jit<T, IS_THUMB>();
-	const char* ba1;// = ba->code;
-	const char* ba2;// = ba->code + ba->code_size;
-	const char* bt1;// = bt->code;
-	const char* bt2;// = bt->code + bt->code_size;
-
-	if (ba)
-	{
-		ba1 = ba->code;
-		ba2 = ba->code + ba->code_size;;
-	} else
-	{
-		ba1 = 0;
-		ba2 = 0;
-	}
-
-	if (bt)
-	{
-		bt1 = bt->code;;
-		bt2 = bt->code + bt->code_size;
-	} else
-	{
-		bt1 = 0;
-		bt2 = 0;
-	}
-
 	exception_context<T>::context.addr_resolved = false;
+	exception_context<T>::context.cached_reg = -1;
 	char *ip = (char*)UlongToPtr(
 		CONTEXT_EIP(exception_context<T>::context.ctx.uc_mcontext));
 	char **p = (char**)UlongToPtr(
 		CONTEXT_ESP(exception_context<T>::context.ctx.uc_mcontext));
 
+	// when breaking inside the block itself edi holds the newest
+	// value of the cached register, write it back for the debugger
+	const compiled_block_base<IS_ARM> *hit_a = ba;
+	const compiled_block_base<IS_THUMB> *hit_t = bt;
 	for (;;)
 	{
-		if (ip >= ba1 && ip < ba2)
+		if (ba && ba->contains(ip))
 		{
 			// resolved!
+			if (hit_a && (hit_a->cached_reg >= 0))
+			{
+				exception_context<T>::context.cached_reg = hit_a->cached_reg;
+				processor<T>::ctx().regs[hit_a->cached_reg] =
+					CONTEXT_CACHED(exception_context<T>::context.ctx.uc_mcontext);
+			}
 			update_breakinfo<T, IS_ARM>(ip, ba);
 			return ip;
 		}
-		if (ip >= bt1 && ip < bt2)
+		if (bt && bt->contains(ip))
 		{
 			// resolved!
+			if (hit_t && (hit_t->cached_reg >= 0))
+			{
+				exception_context<T>::context.cached_reg = hit_t->cached_reg;
+				processor<T>::ctx().regs[hit_t->cached_reg] =
+					CONTEXT_CACHED(exception_context<T>::context.ctx.uc_mcontext);
+			}
 			update_breakinfo<T, IS_THUMB>(ip, bt);
 			return ip;
 		}
+		// callees preserve edi and the block spilled it before calling
+		hit_a = 0;
+		hit_t = 0;
 		// ip was wrong try stackwalk
 		if ( !check_mem_access( p, sizeof(char*)) )
 			return 0;
@@ -123,7 +118,7 @@ char* resolve_eip_v2()
 
 template <typename T> struct runner
 {
-	enum { STACK_SIZE = 4096*64 }; // 64K reserved for JIT + HLE funcs
+	enum { STACK_SIZE = 4096*64 }; // 256K reserved for JIT + HLE funcs
 	typedef void (*jit_function)();
 
 	static Fiber *fiber;
@@ -144,14 +139,14 @@ template <typename T> struct runner
 		if (b->flags & (memory_block::PAGE_INVALID | memory_block::PAGE_EXECPROT))
 			return 0;
 
-		if (!b->get_jit<T, U>())
-			b->recompile<T, U>();
-		compiled_block<U> *code = b->get_jit<T, U>();
-
 		unsigned long subaddr = addr & PAGING::ADDRESS_MASK;
-		char *start = code->remap[subaddr >> U::INSTRUCTION_SIZE_LG2];
+		unsigned long inst = subaddr >> U::INSTRUCTION_SIZE_LG2;
+		char *start = b->entry<T, U>(inst);
+		compiled_block<U> *code = b->get_jit<T, U>();
 		//FlushInstructionCache( GetCurrentProcess(), start, code->code_size - (start - code->code) );
-		cacheflush( start, (int)(code->code_size - (start - code->code)), ICACHE );
+		const char *piece_start, *piece_end;
+		code->find_piece( start, piece_start, piece_end );
+		cacheflush( start, (int)(piece_end - start), ICACHE );
 		return (jit_function)start;
 	}
 
@@ -185,13 +180,18 @@ template <typename T> struct runner
 		if (bi && bi->patched)
 		{
 			repatch = bi;
-			*bi->pos = bi->original_byte;
+			*code_arena::writable(bi->pos) = bi->original_byte;
 			CONTEXT_EFLAGS(fiber->context.uc_mcontext) |= (1 << 8); // set trap flag
 		}
 
 		CONTEXT_EIP(fiber->context.uc_mcontext) += skip_instructions;
 		skip_instructions = 0;
 
+		// the debugger might have changed the cached register
+		int r = exception_context<T>::context.cached_reg;
+		if (r >= 0)
+			CONTEXT_CACHED(fiber->context.uc_mcontext) = processor<T>::ctx().regs[r];
+
 
 		fiber->do_continue();
 		return true;
@@ -201,12 +201,22 @@ template <typename T> struct runner
 	{
 		// resolve new entrypoint
 		jit_function jit_code;
+		int cached_reg;
 		if (addr & 1)
+		{
 			jit_code = get_entry<IS_THUMB>(addr);
-		else
+			if (!jit_code)
+				return;
+			cached_reg = memory_map<T>::addr2page( addr )->template get_jit<T, IS_THUMB>()->cached_reg;
+		} else
+		{
 			jit_code = get_entry<IS_ARM>(addr);
-		if (!jit_code)
-			return;
+			if (!jit_code)
+				return;
+			cached_reg = memory_map<T>::addr2page( addr )->template get_jit<T, IS_ARM>()->cached_reg;
+		}
+		// jit_continue loads edi from this
+		exception_context<T>::context.cached_reg = cached_reg;
 
 		// set EIP and R15 according to addr
 		// TODO: handle CPU mode
@@ -222,7 +232,7 @@ template <typename T> struct runner
 		if (repatch)
 		{
 			// single step caused this
-			*repatch->pos = DEBUG_BREAK;
+			*code_arena::writable(repatch->pos) = DEBUG_BREAK;
 			repatch = 0;
 			f->do_continue();
 			return;
@@ -0,0 +1,51 @@
+// prefetch self test
+// a warm page requested for prefetching has to get compiled by a worker
+// and published as the page's block
+//
+// build and run with "make check" from Core
+
+#include <stdio.h>
+#include <boost/thread.hpp>
+#include "NDSE.h"
+#include "Mem.h"
+#include "MemMap.h"
+#include "Prefetch.h"
+#include "CompiledBlock.h"
+#include "Compiler.h"
+
+int main()
+{
+	if (boost::thread::hardware_concurrency() < 2)
+	{
+		printf("prefetch: single core, no workers to test\n");
+		return 0;
+	}
+	Init(); // starts the workers
+
+	// main memory, holding "b ." so the piece ends with its first instruction
+	const unsigned long addr = 0x02000000;
+	memory_block *b = ARM9_GetPage( addr );
+	*(unsigned int*)b->mem = 0xEAFFFFFE;
+	b->executed = memory_block::WARM_STEPS;
+
+	jit_prefetch::request<_ARM9>( addr );
+	compiled_block<IS_ARM> *cb = 0;
+	for (int i = 0; (i < 500) && !cb; i++)
+	{
+		boost::this_thread::sleep( boost::posix_time::milliseconds( 10 ) );
+		cb = b->get_jit<_ARM9, IS_ARM>();
+	}
+
+	if (!cb)
+	{
+		printf("prefetch: page was not published\n");
+		return 1;
+	}
+	if (!cb->compiled( 0 ) || !cb->breaks_pending)
+	{
+		printf("prefetch: published block misses the requested piece\n");
+		return 1;
+	}
+	printf("prefetch: page published\n");
+	return 0;
+}